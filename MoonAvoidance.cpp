@@ -1,37 +1,178 @@
 #include "MoonAvoidance.hpp"
 #include "MoonAvoidanceDialog.hpp"
+#include "MoonAvoidanceTrace.hpp"
+#include "MoonAvoidanceMetricsExporter.hpp"
+#include "MoonAvoidanceQuery.hpp"
+#include "MoonAvoidanceSharedState.hpp"
+#include "MoonAvoidanceEphemerisCache.hpp"
+#include "MoonAvoidanceFrameWorker.hpp"
+#include "MoonAvoidanceKernel.hpp"
+#include "MoonAvoidancePlanner.hpp"
+#include "MoonAvoidanceSkyIndex.hpp"
 #include "StelApp.hpp"
 #include "StelCore.hpp"
+#include "StelLocation.hpp"
 #include "StelPainter.hpp"
 #include "StelProjector.hpp"
 #include "StelUtils.hpp"
 #include "StelModuleMgr.hpp"
+#include "StelObject.hpp"
+#include "StelObjectMgr.hpp"
 #include "SolarSystem.hpp"
+#include "NebulaMgr.hpp"
+#include "Nebula.hpp"
+#include "LandscapeMgr.hpp"
 #include "Planet.hpp"
 #include "StelSkyDrawer.hpp"
 #include "VecMath.hpp"
 #include <QSettings>
+#include <QFile>
+#include <QTextStream>
 #include <QApplication>
 #include <QMetaObject>
 #include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QTimeZone>
+#include <QVector>
+#include <QVariant>
+#include <QVarLengthArray>
 #include <QDebug>
 #include <QtGlobal> // For qMax, qMin, qBound
 #include <algorithm> // For std::sort
+#include <numeric> // For std::iota
 #include <cmath>
 
+namespace
+{
+	// The night timeline takes over above this clock rate (one minute per second)...
+	const double TimelineMinTimeRate = 60.0 * StelCore::JD_SECOND;
+	// ...or when the date jumps by more than a minute between frames (scrubbing)
+	const double TimelineScrubDays = 1.0 / 1440.0;
+	
+	// Ghost rings: at most this many hourly epochs, the nearest one drawn at this opacity
+	const int MaxGhostEpochs = 12;
+	const float GhostMaxOpacity = 0.6f;
+	
+	// Cap and band modes: fill opacity, and outline width of each cap
+	const float ZoneFillOpacity = 0.18f;
+	const float ZoneOutlineWidth = 2.0f;
+	
+	// Catalog highlighting: marker radius in pixels, and at most this many markers a frame
+	const float HighlightMarkerRadius = 6.0f;
+	const int MaxHighlights = 4000;
+	
+	// evaluateTargets(): answers per call, about 100 MB of script arrays
+	const qint64 MaxScriptAnswers = 4000000;
+	
+	// [ra, dec], {ra, dec} or "name, ra, dec"; NaN coordinates when unreadable
+	MoonAvoidancePlanner::Target scriptTarget(const QVariant& value)
+	{
+		MoonAvoidancePlanner::Target target;
+		target.raDegrees = target.decDegrees = std::nan("");
+		bool raOk = false;
+		bool decOk = false;
+		if (value.metaType().id() == QMetaType::QString)
+		{
+			if (!MoonAvoidancePlanner::parseTarget(value.toString(), target))
+				target.raDegrees = target.decDegrees = std::nan("");
+			return target;
+		}
+		if (value.canConvert<QVariantMap>() && value.metaType().id() != QMetaType::QVariantList)
+		{
+			const QVariantMap map = value.toMap();
+			const double ra = map.value("ra").toDouble(&raOk);
+			const double dec = map.value("dec").toDouble(&decOk);
+			if (raOk && decOk)
+			{
+				target.raDegrees = ra;
+				target.decDegrees = dec;
+			}
+			return target;
+		}
+		const QVariantList list = value.toList();
+		if (list.size() == 2)
+		{
+			const double ra = list[0].toDouble(&raOk);
+			const double dec = list[1].toDouble(&decOk);
+			if (raOk && decOk)
+			{
+				target.raDegrees = ra;
+				target.decDegrees = dec;
+			}
+		}
+		return target;
+	}
+}
+
 MoonAvoidance::MoonAvoidance()
 	: config(nullptr)
-	, configDialog(new MoonAvoidanceDialog())
+	, configDialog(nullptr) // Created on first use, see ensureDialog()
+	, configWriteBackPending(false)
+	, previewActive(false)
+	, previewRevision(0)
 	, enabled(false)
+	, zoneRenderMode(ZoneRenderRings)
 	, lastMoonAltitude(0.0)
 	, lastMoonAgeDays(0.0)
 	, lastMoonAgeFromFullDays(0.0)
+	, lastMoonDir(0.0, 0.0, 1.0)
+	, moonValid(false)
+	, lastSampledJD(0.0)
+	, timeline(nullptr)
+	, usingTimeline(false)
+	, ghostRingsVisible(false)
+	, ghostEpochsHour(0.0)
+	, ghostEpochsPreview(0)
+	, catalogHighlight(false)
+	, highlightMaxMagnitude(10.0)
+	, highlightFirstTarget(0)
+	, horizonClipping(false)
+	, horizonAltitude(0.0)
+	, horizonLatitude(0.0)
+	, horizonLongitude(0.0)
+	, perfHudVisible(false)
+	, metricsThread(nullptr)
+	, metricsExporter(nullptr)
+	, queryThread(nullptr)
+	, queryServer(nullptr)
+	, queryContextElevation(0)
+	, sharedState(nullptr)
+	, selectionMinute(0)
+	, selectionConfigRevision(0)
+	, selectionPreviewRevision(0)
+	, scriptEngine(nullptr)
+	, scriptContextElevation(0)
+	, frameWorker(nullptr)
+	, frameSerial(0)
+	, lastCountedSerial(0)
 {
 	setObjectName("MoonAvoidance");
+	statsClock.start();
 }
 
 MoonAvoidance::~MoonAvoidance()
 {
+	stopMetricsExporter();
+	stopQueryServer();
+	delete sharedState;
+	sharedState = nullptr;
+	delete scriptEngine;
+	scriptEngine = nullptr;
+	if (frameWorker)
+	{
+		frameWorker->stop();
+		delete frameWorker;
+		frameWorker = nullptr;
+	}
+	if (timeline)
+	{
+		timeline->stop();
+		delete timeline;
+		timeline = nullptr;
+	}
+	
 	// Disconnect dialog from plugin to prevent accessing plugin during destruction
 	if (configDialog)
 	{
@@ -39,7 +180,7 @@ MoonAvoidance::~MoonAvoidance()
 		
 		// Manually delete the dialog if it hasn't been parented to something else
 		// Note: If the dialog was added to the StelGui, it might be deleted by Qt's object tree
-		// But since we created it with 'new MoonAvoidanceDialog()', it likely has no parent initially
+		// But since ensureDialog() creates it with 'new MoonAvoidanceDialog()', it likely has no parent initially
 		// or was parented to something else later.
 		// Check if it's still valid and delete if necessary
 		if (configDialog->parent() == nullptr) {
@@ -60,6 +201,18 @@ MoonAvoidance::~MoonAvoidance()
 
 void MoonAvoidance::init()
 {
+	// Only the state needed for the first frame is built here. The configuration
+	// dialog is created on first use and any config write-back runs once
+	// Stellarium is idle, so the plugin adds as little as possible to launch time.
+	QElapsedTimer totalTimer;
+	totalTimer.start();
+	QElapsedTimer phaseTimer;
+	phaseTimer.start();
+	auto logPhase = [&phaseTimer](const char* phase) {
+		qDebug() << "MoonAvoidance: init phase" << phase << "took" << phaseTimer.nsecsElapsed() / 1000 << "us";
+		phaseTimer.restart();
+	};
+	
 	// Initialize config first with defaults
 	config = new MoonAvoidanceConfig();
 	
@@ -70,6 +223,14 @@ void MoonAvoidance::init()
 		if (conf)
 		{
 			enabled = conf->value("MoonAvoidance/enabled", true).toBool();
+			ghostRingsVisible = conf->value("MoonAvoidance/ghost_rings", false).toBool();
+			catalogHighlight = conf->value("MoonAvoidance/catalog_highlight", false).toBool();
+			highlightMaxMagnitude = conf->value("MoonAvoidance/highlight_max_magnitude", 10.0).toDouble();
+			horizonClipping = conf->value("MoonAvoidance/horizon_clipping", false).toBool();
+			horizonAltitude = qBound(-10.0, conf->value("MoonAvoidance/horizon_altitude", 0.0).toDouble(), 60.0);
+			const int mode = conf->value("MoonAvoidance/zone_render_mode", ZoneRenderRings).toInt();
+			if (mode >= ZoneRenderRings && mode <= ZoneRenderBands)
+				zoneRenderMode = static_cast<ZoneRenderMode>(mode);
 		}
 	}
 	catch (...)
@@ -79,10 +240,13 @@ void MoonAvoidance::init()
 	}
 	
 	flagShow = LinearFader(1000, enabled); // duration=1000ms, initialState=enabled
+	logPhase("settings");
 	
 	// Load configuration - this should be safe as it uses defaults if loading fails
+	// Any rewrite of the config file is only flagged here and done in runDeferredInit()
 	try {
 		config->loadConfiguration();
+		configWriteBackPending = config->hasPendingWriteBack();
 		
 		// Validate that we have filters with valid values
 		QList<FilterConfig> loadedFilters = config->getFilters();
@@ -116,1118 +280,984 @@ void MoonAvoidance::init()
 		if (needsReset)
 		{
 			config->setFilters(MoonAvoidanceConfig::getDefaultFilters());
-			config->saveConfiguration();
-			qDebug() << "MoonAvoidance: Reset to defaults and saved";
+			configWriteBackPending = true;
 		}
 	}
 	catch (...)
 	{
-		// If config loading fails, use defaults and save them
+		// If config loading fails, use defaults and save them later
 		config->setFilters(MoonAvoidanceConfig::getDefaultFilters());
-		config->saveConfiguration();
-		qWarning() << "MoonAvoidance: Config load failed, using and saving defaults";
+		configWriteBackPending = true;
+		qWarning() << "MoonAvoidance: Config load failed, using defaults";
 	}
+	stats.setConfigLoaded(QDateTime::currentMSecsSinceEpoch());
+	logPhase("config");
 	
-	// Connect to dialog's visibleChanged signal to save when closed with OK
-	// Do this after config is initialized
-	if (configDialog)
-	{
-		connect(configDialog, &StelDialog::visibleChanged, this, [this](bool visible) {
-			if (!visible && config && configDialog && configDialog->wasAccepted())
-			{
-				// Dialog was closed with OK - save configuration
-				QList<FilterConfig> newFilters = configDialog->getFilters();
-				if (!newFilters.isEmpty())
-				{
-					config->setFilters(newFilters);
-					config->saveConfiguration();
-					qDebug() << "MoonAvoidance: Configuration saved";
-				}
-			}
-		});
-	}
+	// Everything that is not needed to draw the first frame runs from the event loop
+	QTimer::singleShot(0, this, &MoonAvoidance::runDeferredInit);
+	logPhase("schedule");
 
-	qDebug() << "MoonAvoidance plugin initialized";
+	qDebug() << "MoonAvoidance plugin initialized in" << totalTimer.nsecsElapsed() / 1000 << "us";
 }
 
-void MoonAvoidance::update(double deltaTime)
+void MoonAvoidance::runDeferredInit()
 {
-	flagShow.update(static_cast<int>(deltaTime * 1000));
-	
-	if (!flagShow.getInterstate())
-		return;
-	
-	if (!config)
-		return;
+	QElapsedTimer timer;
+	timer.start();
 	
-	// Update moon data
-	try {
-		StelCore* core = StelApp::getInstance().getCore();
-		if (!core)
-			return;
-		
-		SolarSystem* ssystem = GETSTELMODULE(SolarSystem);
-		if (!ssystem)
-			return;
-		
-		PlanetP moonP = ssystem->searchByEnglishName("Moon");
-		
-		if (moonP)
-		{
-			Planet* moon = moonP.data();
-			if (!moon)
-				return;
-			
-			// Calculate moon altitude
-			Vec3d altAzPos = moon->getAltAzPosAuto(core);
-			double alt, az;
-			StelUtils::rectToSphe(&az, &alt, altAzPos);
-			lastMoonAltitude = alt * 180.0 / M_PI; // Convert to degrees
-			
-			// Calculate moon age in days since last new moon (standard astronomical definition)
-			// Moon age = days since last new moon (0 = new moon, ~14.77 = full moon, ~29.53 = next new moon)
-			// For the Lorentzian formula, we need days from full moon, so we'll convert
-			
-			const double SYNODIC_PERIOD_DAYS = 29.530588853; // Moon synodic period in days
-			const double HALF_SYNODIC_PERIOD = SYNODIC_PERIOD_DAYS / 2.0; // ~14.765 days
-			
-			// Get current Julian Day from Stellarium
-			double currentJD = core->getJD();
-			
-			// Reference JD for a known new moon (from Stellarium's AstroCalcDialog.cpp)
-			// This is an approximate JD for a new moon near J2000
-			const double REFERENCE_NEW_MOON_JD = 2451550.09765;
-			
-			// Calculate how many synodic periods have passed since the reference new moon
-			double periodsSinceRef = (currentJD - REFERENCE_NEW_MOON_JD) / SYNODIC_PERIOD_DAYS;
-			
-			// Find the JD of the most recent new moon before or at current time
-			double lastNewMoonJD = REFERENCE_NEW_MOON_JD + floor(periodsSinceRef) * SYNODIC_PERIOD_DAYS;
-			
-			// Calculate moon age: days since last new moon (standard definition)
-			double moonAgeSinceNewMoon = currentJD - lastNewMoonJD;
-			
-			// Ensure age is in range [0, SYNODIC_PERIOD_DAYS)
-			while (moonAgeSinceNewMoon < 0.0)
-				moonAgeSinceNewMoon += SYNODIC_PERIOD_DAYS;
-			while (moonAgeSinceNewMoon >= SYNODIC_PERIOD_DAYS)
-				moonAgeSinceNewMoon -= SYNODIC_PERIOD_DAYS;
-			
-			// Store moon age since new moon for display
-			lastMoonAgeDays = moonAgeSinceNewMoon;
-			
-			// For the Lorentzian formula, we need days from full moon (0 = full moon)
-			// Full moon occurs at ~14.765 days (half synodic period) after new moon
-			// The formula uses AGE where 0 = full moon, and separation is highest at full moon
-			// Convert moon age (days since new moon) to days from full moon:
-			// - If age < 14.765: we're before full moon, so days from full = 14.765 - age
-			// - If age >= 14.765: we're after full moon, so days from full = age - 14.765
-			// But we want the absolute distance from full moon, so we use the minimum
-			// Actually, the formula should give highest separation at full moon (AGE=0),
-			// so we need to calculate days from the nearest full moon
-			double daysFromFullMoon;
-			if (moonAgeSinceNewMoon < HALF_SYNODIC_PERIOD)
-			{
-				// Before full moon: days from full = half period - age
-				daysFromFullMoon = HALF_SYNODIC_PERIOD - moonAgeSinceNewMoon;
-			}
-			else
-			{
-				// After full moon: days from full = age - half period
-				daysFromFullMoon = moonAgeSinceNewMoon - HALF_SYNODIC_PERIOD;
-			}
-			
-			// Store days from full moon for the formula
-			// At full moon (age = 14.765), daysFromFullMoon = 0 (highest separation)
-			// At new moon (age = 0 or 29.53), daysFromFullMoon = 14.765 (lowest separation)
-			lastMoonAgeFromFullDays = daysFromFullMoon;
-		}
-	}
-	catch (...)
+	if (config && configWriteBackPending)
 	{
-		// Silently handle errors during update
+		config->saveConfiguration();
+		configWriteBackPending = false;
+		qDebug() << "MoonAvoidance: Wrote default configuration back in" << timer.nsecsElapsed() / 1000 << "us";
 	}
+	
+	startMetricsExporter();
+	startQueryServer();
+	startSharedState();
 }
 
-void MoonAvoidance::draw(StelCore* core)
+void MoonAvoidance::startMetricsExporter()
 {
-	qDebug() << "MoonAvoidance: draw() entry - enabled:" << enabled << ", flagShow interstate:" << flagShow.getInterstate();
-	
-	if (!flagShow.getInterstate())
-	{
-		qDebug() << "MoonAvoidance: draw() skipped - flagShow not interstate";
+	if (metricsThread)
 		return;
-	}
 	
-	if (!config)
-	{
-		qDebug() << "MoonAvoidance: draw() skipped - config is null";
+	QSettings* conf = StelApp::getInstance().getSettings();
+	if (!conf)
 		return;
-	}
 	
-	// Get moon position
-	SolarSystem* ssystem = GETSTELMODULE(SolarSystem);
-	if (!ssystem)
+	const QString target = conf->value("MoonAvoidance/metrics_target", "").toString().trimmed();
+	if (target.isEmpty())
+		return; // Exporter disabled
+	const int intervalMs = conf->value("MoonAvoidance/metrics_interval_ms", 15000).toInt();
+	
+	// The exporter and its timer live on a dedicated low-priority thread
+	metricsThread = new QThread(this);
+	metricsThread->setObjectName("MoonAvoidanceMetrics");
+	metricsExporter = new MoonAvoidanceMetricsExporter(&stats, target, intervalMs);
+	metricsExporter->moveToThread(metricsThread);
+	connect(metricsThread, &QThread::started, metricsExporter, &MoonAvoidanceMetricsExporter::start);
+	metricsThread->start(QThread::LowPriority);
+}
+
+void MoonAvoidance::stopMetricsExporter()
+{
+	if (!metricsThread)
 		return;
 	
-	PlanetP moonP = ssystem->searchByEnglishName("Moon");
-	
-	if (!moonP)
+	// Timers and sockets must be torn down on the thread that owns them
+	QMetaObject::invokeMethod(metricsExporter, "stop", Qt::BlockingQueuedConnection);
+	metricsThread->quit();
+	metricsThread->wait();
+	delete metricsExporter;
+	metricsExporter = nullptr;
+	delete metricsThread;
+	metricsThread = nullptr;
+}
+
+void MoonAvoidance::startQueryServer()
+{
+	if (queryThread)
 		return;
 	
-	Planet* moon = moonP.data();
-	
-	// Calculate moon altitude for altitude-based filtering
-	Vec3d altAzPos = moon->getAltAzPosAuto(core);
-	double alt, az;
-	StelUtils::rectToSphe(&az, &alt, altAzPos);
-	double currentMoonAltitude = alt * 180.0 / M_PI; // Convert to degrees
-	
-	// Always update lastMoonAltitude from current calculation
-	lastMoonAltitude = currentMoonAltitude;
-	
-	qDebug() << "MoonAvoidance: Moon altitude calculated:" << lastMoonAltitude << "degrees";
-	
-	// Get moon position in the same frame as the projection
-	// Use the current frame to match the view
-	Vec3d moonPos = moon->getJ2000EquatorialPos(core);
-	moonPos.normalize();
-	
-	// Initialize painter with the same frame as the moon position
-	StelPainter painter(core->getProjection(StelCore::FrameJ2000));
-	
-	// Enable blending for transparency support (like GridLinesMgr does)
-	painter.setBlending(true);
+	QSettings* conf = StelApp::getInstance().getSettings();
+	if (!conf)
+		return;
 	
-	// Draw circles for each filter
-	QList<FilterConfig> filters = config->getFilters();
+	const QString socketName = conf->value("MoonAvoidance/query_socket", "").toString().trimmed();
+	if (socketName.isEmpty())
+		return; // Service disabled
+	
+	// Requests are answered on their own thread, never waiting for a frame
+	queryThread = new QThread(this);
+	queryThread->setObjectName("MoonAvoidanceQuery");
+	queryServer = new MoonAvoidanceQueryServer(socketName, MoonAvoidanceEphemerisCache::defaultDirectory());
+	queryServer->moveToThread(queryThread);
+	connect(queryThread, &QThread::started, queryServer, &MoonAvoidanceQueryServer::start);
+	queryThread->start();
+	queryContextKey = MoonAvoidanceTimelineKey(); // The server learns the site from the next update()
+}
+
+void MoonAvoidance::stopQueryServer()
+{
+	if (!queryThread)
+		return;
 	
-	qDebug() << "MoonAvoidance: draw() called - moon altitude:" << lastMoonAltitude << "degrees, filters:" << filters.size();
+	QMetaObject::invokeMethod(queryServer, "stop", Qt::BlockingQueuedConnection);
+	queryThread->quit();
+	queryThread->wait();
+	delete queryServer;
+	queryServer = nullptr;
+	delete queryThread;
+	queryThread = nullptr;
+}
+
+void MoonAvoidance::updateQueryContext(StelCore* core)
+{
+	const StelLocation& location = core->getCurrentLocation();
+	if (location.planetName != "Earth")
+		return; // The service's ephemeris is for observers on Earth
+	
+	// Configured filters, not the dialog's preview: a sequencer acts on what is saved.
+	// A new night is passed on too, so its ephemeris is loaded before it is asked for.
+	const double jd = core->getJD();
+	MoonAvoidanceTimelineKey key;
+	key.latitude = location.getLatitude();
+	key.longitude = location.getLongitude();
+	key.windowStartJD = MoonAvoidanceTimeline::windowStartFor(jd, key.longitude);
+	key.filtersRevision = config->getRevision();
+	if (key == queryContextKey && location.altitude == queryContextElevation)
+		return;
 	
-	// Track visible and offscreen circles for label positioning
-	struct VisibleFilterInfo {
-		FilterConfig filter;
-		double sepAngle;
-		double topmostLeftX;  // Leftmost point along the top of the screen
-		double topmostRightX; // Rightmost point along the top of the screen
-		Vec3d topmostLeftPoint3D;
-		Vec3d topmostRightPoint3D;
-	};
-	QList<VisibleFilterInfo> visibleFilters;
-	QList<QPair<QString, double>> offscreenFilters; // Filter name and separation angle
+	MoonAvoidanceQueryEngine::Context context;
+	context.site = { key.latitude, key.longitude, static_cast<double>(location.altitude) };
+	context.deltaTDays = core->getJDE() - jd;
+	context.filters = config->getFilters();
+	queryServer->setContext(context, jd);
+	queryContextKey = key;
+	queryContextElevation = location.altitude;
+}
+
+void MoonAvoidance::startSharedState()
+{
+	if (sharedState)
+		return;
 	
-	// Get projector for screen coordinate calculations
-	StelProjectorP projector = painter.getProjector();
-	if (!projector)
+	QSettings* conf = StelApp::getInstance().getSettings();
+	if (!conf)
 		return;
 	
+	const QString name = conf->value("MoonAvoidance/shared_state", "").toString().trimmed();
+	if (name.isEmpty())
+		return; // Publication disabled
+	
+	sharedState = new MoonAvoidanceSharedStatePublisher(name);
+	QString error;
+	if (!sharedState->create(&error))
+	{
+		qWarning() << "MoonAvoidance: Cannot publish the zone state in shared memory" << name << ":" << error;
+		delete sharedState;
+		sharedState = nullptr;
+	}
+}
+
+void MoonAvoidance::publishSharedState(double jd)
+{
+	// The zones being drawn, preview included
+	const QList<FilterConfig> filters = activeFilters();
+	QStringList names;
+	names.reserve(filters.size());
 	for (const FilterConfig& filter : filters)
+		names.append(filter.name);
+	sharedState->publishFilterNames(names);
+	sharedState->publish(jd, { lastMoonDir[0], lastMoonDir[1], lastMoonDir[2] }, lastMoonAltitude, lastMoonAgeFromFullDays,
+	                     currentRadiiDegrees(filters));
+}
+
+void MoonAvoidance::updateSelectionInfo(StelCore* core)
+{
+	StelObjectMgr* objectMgr = GETSTELMODULE(StelObjectMgr);
+	if (!objectMgr || objectMgr->getSelectedObject().isEmpty())
 	{
-		// Altitude check: If moon is within [MinAlt, MaxAlt], relaxation applies
-		// If moon is outside this range, use traditional avoidance (no relaxation)
-		// Circles always draw regardless of altitude
-		
-		qDebug() << "MoonAvoidance: Processing filter" << filter.name 
-		         << "- altitude:" << lastMoonAltitude << "degrees (relaxation range: [" << filter.minAlt << "," << filter.maxAlt << "])";
-		
-		// Calculate circle radius (use days from full moon for the formula)
-		// The calculateCircleRadius function will handle relaxation based on altitude
-		double radius = calculateCircleRadius(filter, lastMoonAltitude, lastMoonAgeFromFullDays);
-		double radiusDegrees = radius * 180.0 / M_PI;
-		
-		qDebug() << "MoonAvoidance: Drawing circle for filter" << filter.name 
-		         << "- radius:" << radiusDegrees << "degrees, moon age:" << lastMoonAgeDays << "days";
-		
-		// Only draw if radius is valid and reasonable
-		// Note: radius == 0.0 means avoidance is OFF (relaxed separation <= 0)
-		if (radius > 0.0 && radius < M_PI) // Radius should be less than 180 degrees
-		{
-			// Draw circle with arrows
-			// Find filter index for staggering arrows by comparing names
-			int filterIndex = -1;
-			for (int idx = 0; idx < filters.size(); ++idx)
-			{
-				if (filters[idx].name == filter.name)
-				{
-					filterIndex = idx;
-					break;
-				}
-			}
-			if (filterIndex < 0)
-				filterIndex = 0; // Fallback to 0 if not found
-			drawCircle(painter, moonPos, radius, filter.color, filter.name, radiusDegrees, filterIndex);
-			
-		// Check if circle is visible and find topmost left and right points
-		bool isVisible = false;
-		double topmostY = -1e9; // Largest Y (topmost in OpenGL coords where Y increases upward)
-		double topmostLeftX = 1e9; // Leftmost X among topmost points
-		double topmostRightX = -1e9; // Rightmost X among topmost points
-		Vec3d topmostLeftPoint3D;
-		Vec3d topmostRightPoint3D;
-		
-		// Get viewport bounds first
-		double vpX = projector->getViewportPosX();
-		double vpY = projector->getViewportPosY();
-		double vpW = projector->getViewportWidth();
-		double vpH = projector->getViewportHeight();
-		
-		// Sample points around circle to find topmost left and right points in screen space
-		const int sampleCount = 128; // Increased for better detection
-			for (int i = 0; i < sampleCount; ++i)
-			{
-				double angle = (2.0 * M_PI * i) / sampleCount;
-				
-				// Calculate point on circle
-				Vec3d moonPosNorm = moonPos;
-				moonPosNorm.normalize();
-				
-				Vec3d north(0, 0, 1);
-				Vec3d east(1, 0, 0);
-				Vec3d perp1 = moonPosNorm ^ north;
-				if (perp1.norm() < 0.1)
-					perp1 = moonPosNorm ^ east;
-				perp1.normalize();
-				Vec3d perp2 = moonPosNorm ^ perp1;
-				perp2.normalize();
-				
-				Vec3d point = moonPosNorm * cos(radius) + 
-				              (perp1 * cos(angle) + perp2 * sin(angle)) * sin(radius);
-				point.normalize();
-				
-				// Project to screen coordinates
-				Vec3d screenPos;
-				if (projector->project(point, screenPos))
-				{
-					// Check if point is in viewport (with some tolerance)
-					if (screenPos[0] >= vpX - 10 && screenPos[0] <= vpX + vpW + 10 &&
-					    screenPos[1] >= vpY - 10 && screenPos[1] <= vpY + vpH + 10)
-					{
-						isVisible = true;
-						// Track points that are actually in viewport
-						if (screenPos[0] >= vpX && screenPos[0] <= vpX + vpW &&
-						    screenPos[1] >= vpY && screenPos[1] <= vpY + vpH)
-						{
-							// In OpenGL coords, Y increases upward, so topmost = largest Y
-							// We want points near the top of the screen (large Y values)
-							// Focus on the top portion of the screen - use a larger threshold
-							// to catch more points near the top
-							double topThreshold = vpY + vpH - 100; // Within 100 pixels of top (increased from 50)
-							
-							if (screenPos[1] >= topThreshold)
-							{
-								// This point is near the top of the screen
-								// Track the topmost points (largest Y) and their leftmost/rightmost X
-								if (screenPos[1] > topmostY)
-								{
-									// New topmost - reset left and right
-									topmostY = screenPos[1];
-									topmostLeftX = screenPos[0];
-									topmostRightX = screenPos[0];
-									topmostLeftPoint3D = point;
-									topmostRightPoint3D = point;
-								}
-								else if (screenPos[1] == topmostY)
-								{
-									// Same Y level - track leftmost and rightmost
-									if (screenPos[0] < topmostLeftX)
-									{
-										topmostLeftX = screenPos[0];
-										topmostLeftPoint3D = point;
-									}
-									if (screenPos[0] > topmostRightX)
-									{
-										topmostRightX = screenPos[0];
-										topmostRightPoint3D = point;
-									}
-								}
-							}
-						}
-					}
-				}
-			}
-			
-			if (isVisible)
-			{
-				// If we found topmost points, use them; otherwise find any visible points
-				if (topmostY < -1e8) // No topmost points found (topmostY was never updated)
-				{
-					// Circle is visible but no points near the top
-					// Re-sample to find leftmost and rightmost visible points anywhere in viewport
-					double leftmostVisibleX = 1e9;
-					double rightmostVisibleX = -1e9;
-					
-					for (int i = 0; i < sampleCount; ++i)
-					{
-						double angle = (2.0 * M_PI * i) / sampleCount;
-						
-						Vec3d moonPosNorm = moonPos;
-						moonPosNorm.normalize();
-						
-						Vec3d north(0, 0, 1);
-						Vec3d east(1, 0, 0);
-						Vec3d perp1 = moonPosNorm ^ north;
-						if (perp1.norm() < 0.1)
-							perp1 = moonPosNorm ^ east;
-						perp1.normalize();
-						Vec3d perp2 = moonPosNorm ^ perp1;
-						perp2.normalize();
-						
-						Vec3d point = moonPosNorm * cos(radius) + 
-						              (perp1 * cos(angle) + perp2 * sin(angle)) * sin(radius);
-						point.normalize();
-						
-						Vec3d screenPos;
-						if (projector->project(point, screenPos))
-						{
-							if (screenPos[0] >= vpX && screenPos[0] <= vpX + vpW &&
-							    screenPos[1] >= vpY && screenPos[1] <= vpY + vpH)
-							{
-								if (screenPos[0] < leftmostVisibleX)
-									leftmostVisibleX = screenPos[0];
-								if (screenPos[0] > rightmostVisibleX)
-									rightmostVisibleX = screenPos[0];
-							}
-						}
-					}
-					
-					// Use the visible points, or viewport edges as final fallback
-					if (leftmostVisibleX < 1e8)
-					{
-						topmostLeftX = leftmostVisibleX;
-						topmostRightX = rightmostVisibleX;
-					}
-					else
-					{
-						// Still no points found - use viewport edges
-						topmostLeftX = vpX;
-						topmostRightX = vpX + vpW;
-					}
-				}
-				
-				// Store visible filter info for drawing after all circles
-				VisibleFilterInfo info;
-				info.filter = filter;
-				info.sepAngle = radiusDegrees;
-				info.topmostLeftX = topmostLeftX;
-				info.topmostRightX = topmostRightX;
-				info.topmostLeftPoint3D = topmostLeftPoint3D;
-				info.topmostRightPoint3D = topmostRightPoint3D;
-				visibleFilters.append(info);
-			}
-			else
-			{
-				// Circle is offscreen - add to list for stacking at left edge
-				offscreenFilters.append(QPair<QString, double>(filter.name, radiusDegrees));
-			}
-		}
-		else
-		{
-			qDebug() << "MoonAvoidance: Invalid radius" << radius << "for filter" << filter.name;
-		}
+		selectionObject.clear();
+		return;
+	}
+	const StelObjectP object = objectMgr->getSelectedObject().first();
+	
+	// The info panel asks for the text every frame; it only changes with the
+	// minute (a degree moves by a few hundredths), the object or the zones
+	const double jd = core->getJD();
+	const qint64 minute = static_cast<qint64>(std::floor(jd * 1440.0));
+	if (object != selectionObject || minute != selectionMinute || config->getRevision() != selectionConfigRevision
+	    || previewRevision != selectionPreviewRevision || timelineData != selectionTimeline)
+	{
+		selectionInfo = selectionInfoText(core, object, jd);
+		selectionObject = object;
+		selectionMinute = minute;
+		selectionConfigRevision = config->getRevision();
+		selectionPreviewRevision = previewRevision;
+		selectionTimeline = timelineData;
+	}
+	if (!selectionInfo.isEmpty())
+		object->addToExtraInfoString(StelObject::Extra, selectionInfo);
+}
+
+QString MoonAvoidance::selectionInfoText(StelCore* core, const StelObjectP& object, double jd) const
+{
+	if (object->getEnglishName() == "Moon")
+		return QString();
+	
+	Vec3d dir = object->getJ2000EquatorialPos(core);
+	dir.normalize();
+	const double separation = std::acos(qBound(-1.0, lastMoonDir.dot(dir), 1.0)) * 180.0 / M_PI;
+	const QList<FilterConfig> filters = activeFilters();
+	const QVector<double> radii = currentRadiiDegrees(filters);
+	
+	// Zone edges crossed from now until dawn (or the end of the night's
+	// timeline once past dawn), for the configured filters only
+	QVector<MoonAvoidanceZoneCrossing> crossings;
+	if (timelineData && !previewActive && timelineData->filterCount == filters.size() && timelineData->covers(jd))
+	{
+		const double until = jd < timelineData->dawnJD ? timelineData->dawnJD : timelineData->endJD();
+		crossings = timelineData->crossings({ dir[0], dir[1], dir[2] }, jd, until);
 	}
 	
-	// Draw visible filter labels at top, ensuring they don't overlap circles
-	// Use StelPainter's drawText(float x, float y, ...) for screen-space text
-	// Track drawn labels for collision detection with offscreen labels
-	struct DrawnLabel {
-		double x, y, width, height;
+	const double utcOffsetHours = core->getUTCOffset(jd);
+	const auto formatTime = [utcOffsetHours](double when) {
+		const double UnixEpochJD = 2440587.5;
+		const qint64 ms = qRound64((when - UnixEpochJD) * 86400000.0 + utcOffsetHours * 3600000.0);
+		return QDateTime::fromMSecsSinceEpoch(ms, QTimeZone::utc()).toString("HH:mm");
 	};
-	QList<DrawnLabel> drawnVisibleLabels;
+	const auto degrees = [](double value) { return QString::number(value, 'f', 1) + QChar(0x00B0); };
 	
-	for (const VisibleFilterInfo& info : visibleFilters)
+	QString text = QString("Moon avoidance: %1 from the Moon<br />").arg(degrees(separation));
+	for (int index = 0; index < filters.size(); ++index)
 	{
-		QString labelText = QString("%1 safe at %2°").arg(info.filter.name).arg(info.sepAngle, 0, 'f', 1);
-		
-		// Estimate text width (approximate: ~8 pixels per character)
-		// This is a rough estimate - StelPainter doesn't expose text metrics easily
-		// Add safety margin to account for font variations and ensure no overlap
-		double estimatedTextWidth = labelText.length() * 8.0 + 20.0; // Add 20px safety margin
-		double estimatedTextHeight = 20.0; // Approximate text height
-		
-		double vpX = projector->getViewportPosX();
-		double vpW = projector->getViewportWidth();
-		double vpY = projector->getViewportPosY();
-		double vpH = projector->getViewportHeight();
-		
-		// Always prefer left side placement unless it's impossible
-		double padding = 60.0; // Padding between text and circle
-		double minPaddingFromEdge = 40.0; // Padding from screen edge (matches offscreen labels)
-		double labelX;
-		bool canPlaceLabel = false;
-		
-		// Try left side first: place label to the left of circle's topmost left point
-		// Rightmost edge of text should be left of circle's topmost left point
-		labelX = info.topmostLeftX - padding - estimatedTextWidth;
-		
-		// Check if left side placement is possible
-		if (labelX >= vpX + minPaddingFromEdge)
-		{
-			// Left side is possible
-			canPlaceLabel = true;
-		}
+		const bool inside = radii[index] > 0.0 && separation <= radii[index];
+		QString line;
+		if (radii[index] <= 0.0)
+			line = QString("%1: no zone").arg(filters[index].name);
 		else
+			line = QString("%1: %2 the %3 zone").arg(filters[index].name, inside ? "inside" : "clear of", degrees(radii[index]));
+		for (const MoonAvoidanceZoneCrossing& crossing : crossings)
 		{
-			// Left side is impossible - try right side instead
-			// Leftmost edge of text should be right of circle's topmost right point
-			labelX = info.topmostRightX + padding;
-			
-			// Check if right side placement is possible
-			if (labelX + estimatedTextWidth <= vpX + vpW - minPaddingFromEdge)
-			{
-				// Right side is possible
-				canPlaceLabel = true;
-			}
-			// If neither side is possible, canPlaceLabel remains false
-		}
-		
-		// Only draw label if it can be placed properly
-		if (canPlaceLabel)
-		{
-			// StelPainter::drawText uses OpenGL coordinates where Y=0 is at bottom
-			// So we need to invert Y: top of viewport is at vpY + vpH
-			// For top of screen: start at bottom (vpY) and go up by height, then subtract offset
-			double paddingFromTopForVisible = 50.0; // Padding from top (matches offscreen labels)
-			double labelY = vpY + vpH - paddingFromTopForVisible; // Padding from top (in OpenGL coords, Y increases upward)
-			
-			// Set text color to filter color
-			Vec3f textColor(info.filter.color.redF(), info.filter.color.greenF(), info.filter.color.blueF());
-			painter.setColor(textColor, 1.0f);
-			
-			try {
-				// Use StelPainter's screen-space drawText method
-				painter.drawText(static_cast<float>(labelX), static_cast<float>(labelY), labelText, 0.0f);
-				
-				// Track this label for collision detection
-				DrawnLabel drawn;
-				drawn.x = labelX;
-				drawn.y = labelY - estimatedTextHeight; // Y is top in OpenGL coords, so bottom is Y - height
-				drawn.width = estimatedTextWidth;
-				drawn.height = estimatedTextHeight;
-				drawnVisibleLabels.append(drawn);
-			}
-			catch (...)
-			{
-				qWarning() << "MoonAvoidance: Error drawing visible label text";
-			}
-		}
-	}
-	
-	// Draw offscreen labels stacked at left edge
-	// Hide labels that would collide with visible labels or circles
-	if (!offscreenFilters.isEmpty())
-	{
-		double vpX = projector->getViewportPosX();
-		double vpY = projector->getViewportPosY();
-		double vpH = projector->getViewportHeight();
-		double paddingFromTop = 50.0; // Increased padding from top edge
-		double paddingFromLeft = 40.0; // Increased padding from left edge
-		double lineSpacing = 40.0; // Increased spacing between stacked labels
-		double startY = vpY + vpH - paddingFromTop; // Start from top (in OpenGL coords)
-		
-		// Check if any circles are visible near the left edge where offscreen labels are drawn
-		// We'll check if any visible circle has points near the left edge (within 100 pixels)
-		double leftEdgeCheckX = vpX + paddingFromLeft + 100.0; // Check area where offscreen labels are drawn
-		bool hasCircleNearLeftEdge = false;
-		for (const VisibleFilterInfo& info : visibleFilters)
-		{
-			// Check if circle's leftmost point is near the left edge
-			if (info.topmostLeftX < leftEdgeCheckX)
-			{
-				hasCircleNearLeftEdge = true;
-				break;
-			}
-		}
-		
-		for (int i = 0; i < offscreenFilters.size(); ++i)
-		{
-			const QPair<QString, double>& filterInfo = offscreenFilters[i];
-			QString filterName = filterInfo.first;
-			double sepAngle = filterInfo.second;
-			
-			// Find the filter config for color
-			FilterConfig filterConfig;
-			for (const FilterConfig& f : filters)
-			{
-				if (f.name == filterName)
-				{
-					filterConfig = f;
-					break;
-				}
-			}
-			
-			QString labelText = QString("%1 safe at %2°").arg(filterName).arg(sepAngle, 0, 'f', 1);
-			
-			// Calculate label position at left edge, stacked vertically
-			double labelX = vpX + paddingFromLeft; // Padding from left edge
-			double labelY = startY - (i * lineSpacing); // Stack upward from top (in OpenGL coords, Y increases upward)
-			double estimatedTextWidth = labelText.length() * 8.0 + 20.0; // Add 20px safety margin
-			double estimatedTextHeight = 20.0; // Approximate text height
-			
-			// Check for collisions with visible labels
-			bool wouldCollide = false;
-			for (const DrawnLabel& drawn : drawnVisibleLabels)
-			{
-				// Check if offscreen label would overlap with visible label
-				// Using bounding box collision detection
-				double offscreenLeft = labelX;
-				double offscreenRight = labelX + estimatedTextWidth;
-				double offscreenTop = labelY;
-				double offscreenBottom = labelY - estimatedTextHeight;
-				
-				double visibleLeft = drawn.x;
-				double visibleRight = drawn.x + drawn.width;
-				double visibleTop = drawn.y + drawn.height;
-				double visibleBottom = drawn.y;
-				
-				// Check for overlap (with some padding)
-				double collisionPadding = 5.0;
-				if (!(offscreenRight + collisionPadding < visibleLeft || 
-				      offscreenLeft - collisionPadding > visibleRight ||
-				      offscreenBottom - collisionPadding > visibleTop ||
-				      offscreenTop + collisionPadding < visibleBottom))
-				{
-					wouldCollide = true;
-					break;
-				}
-			}
-			
-			// Also check if a circle is visible near the left edge
-			if (!wouldCollide && hasCircleNearLeftEdge)
-			{
-				// Check if this offscreen label's Y position is near where visible circles are
-				// (within the top portion of the screen where labels are drawn)
-				double topThreshold = vpY + vpH - 150.0; // Check top 150 pixels
-				if (labelY >= topThreshold)
-				{
-					wouldCollide = true;
-				}
-			}
-			
-			// Only draw if no collision
-			if (!wouldCollide)
-			{
-				// Set text color to filter color
-				Vec3f textColor(filterConfig.color.redF(), filterConfig.color.greenF(), filterConfig.color.blueF());
-				painter.setColor(textColor, 1.0f);
-				
-				try {
-					// Use StelPainter's screen-space drawText method
-					painter.drawText(static_cast<float>(labelX), static_cast<float>(labelY), labelText, 0.0f);
-				}
-				catch (...)
-				{
-					qWarning() << "MoonAvoidance: Error drawing offscreen label text";
-				}
-			}
+			if (crossing.filter != index)
+				continue;
+			line += crossing.entering ? QString(", enters at %1").arg(formatTime(crossing.jd))
+			                          : QString(", clear at %1").arg(formatTime(crossing.jd));
+			break;
 		}
+		text += line + "<br />";
 	}
+	return text;
 }
 
-double MoonAvoidance::getCallOrder(StelModuleActionName actionName) const
+QVector<double> MoonAvoidance::currentRadiiDegrees(const QList<FilterConfig>& filters) const
 {
-	if (actionName == StelModule::ActionDraw)
-		return StelApp::getInstance().getModuleMgr().getModule("SolarSystem")->getCallOrder(actionName) + 1;
-	return 0;
+	if (usingTimeline && !previewActive && timelineSample.radiiDegrees.size() == filters.size())
+		return timelineSample.radiiDegrees; // Built for the configured filters
+	QVector<double> radii;
+	radii.reserve(filters.size());
+	for (const FilterConfig& filter : filters)
+		radii.append(MoonAvoidanceKernel::zoneRadiusDegrees(filter, lastMoonAltitude, lastMoonAgeFromFullDays));
+	return radii;
 }
 
-double MoonAvoidance::calculateSeparation(const FilterConfig& filter, double moonAltitude) const
+QStringList MoonAvoidance::getFilterNames() const
 {
-	// If moon altitude is within [MinAlt, MaxAlt], apply relaxation adjustment
-	// If moon altitude is outside this range, use base separation (no relaxation)
-	if (moonAltitude >= filter.minAlt && moonAltitude <= filter.maxAlt)
-	{
-		// Within relaxation range: Separation = Separation + Relaxation * (moonAltitude - MaxAlt)
-		return filter.separation + filter.relaxation * (moonAltitude - filter.maxAlt);
-	}
-	else
+	QStringList names;
+	if (config)
 	{
-		// Outside relaxation range: Use base separation (traditional avoidance)
-		return filter.separation;
+		for (const FilterConfig& filter : config->getFilters())
+			names.append(filter.name);
 	}
+	return names;
 }
 
-double MoonAvoidance::calculateWidth(const FilterConfig& filter, double moonAltitude) const
+QVariantMap MoonAvoidance::evaluateTargets(const QVariantList& jds, const QVariantList& targets)
 {
-	// If moon altitude is within [MinAlt, MaxAlt], apply width adjustment
-	// If moon altitude is outside this range, use base width (no adjustment)
-	if (moonAltitude >= filter.minAlt && moonAltitude <= filter.maxAlt)
+	QVariantMap result;
+	StelCore* core = StelApp::getInstance().getCore();
+	if (!config || !core || core->getCurrentLocation().planetName != "Earth")
 	{
-		// Within relaxation range: Width = Width * ((moonAltitude - MinAlt) / (MaxAlt - MinAlt))
-		double denominator = filter.maxAlt - filter.minAlt;
-		if (denominator == 0.0)
-			return filter.width;
-		
-		double ratio = (moonAltitude - filter.minAlt) / denominator;
-		return filter.width * ratio;
+		result["error"] = QString("Moon avoidance is only evaluated for observers on Earth");
+		return result;
 	}
-	else
+	const int filterCount = config->getFilters().size();
+	if (static_cast<qint64>(jds.size()) * targets.size() * filterCount > MaxScriptAnswers)
 	{
-		// Outside relaxation range: Use base width (traditional avoidance)
-		return filter.width;
+		result["error"] = QString("Too many answers in one call (at most %1 JDs x targets x filters)").arg(MaxScriptAnswers);
+		return result;
+	}
+	
+	// Same context rules as the query service; a new one drops the engine's nights
+	const StelLocation& location = core->getCurrentLocation();
+	MoonAvoidanceTimelineKey key;
+	key.latitude = location.getLatitude();
+	key.longitude = location.getLongitude();
+	key.filtersRevision = config->getRevision();
+	if (!scriptEngine)
+		scriptEngine = new MoonAvoidanceQueryEngine(MoonAvoidanceEphemerisCache::defaultDirectory());
+	if (!scriptEngine->hasContext() || key != scriptContextKey || location.altitude != scriptContextElevation)
+	{
+		MoonAvoidanceQueryEngine::Context context;
+		context.site = { key.latitude, key.longitude, static_cast<double>(location.altitude) };
+		context.deltaTDays = core->getJDE() - core->getJD();
+		context.filters = config->getFilters();
+		scriptEngine->setContext(context);
+		scriptContextKey = key;
+		scriptContextElevation = location.altitude;
 	}
-}
-
-double MoonAvoidance::calculateCircleRadius(const FilterConfig& filter, double moonAltitude, double moonAgeDays) const
-{
-	// Calculate adjusted separation based on altitude (in degrees)
-	double adjustedSeparation = calculateSeparation(filter, moonAltitude);
 	
-	// If the separation was relaxed into oblivion (negative or zero), avoidance is off
-	// This matches NINA's behavior: "If the separation was relaxed into oblivion, avoidance is off"
-	if (adjustedSeparation <= 0.0)
+	QVector<double> times;
+	times.reserve(jds.size());
+	for (const QVariant& jd : jds)
+	{
+		bool ok = false;
+		const double value = jd.toDouble(&ok);
+		times.append(ok ? value : std::nan(""));
+	}
+	QVector<MoonAvoidancePlanner::Target> parsed;
+	parsed.reserve(targets.size());
+	for (const QVariant& target : targets)
+		parsed.append(scriptTarget(target));
+	
+	QElapsedTimer timer;
+	timer.start();
+	QVector<MoonAvoidanceQueryProtocol::Answer> answers;
+	scriptEngine->answerGrid(times, parsed, answers);
+	
+	QVariantList separation;
+	QVariantList radius;
+	QVariantList allowed;
+	separation.reserve(answers.size());
+	radius.reserve(answers.size());
+	allowed.reserve(answers.size());
+	for (const MoonAvoidanceQueryProtocol::Answer& answer : answers)
 	{
-		// Return 0 to indicate no circle should be drawn (avoidance OFF)
-		return 0.0;
-	}
-	
-	// Calculate adjusted width based on altitude (in days)
-	double adjustedWidth = calculateWidth(filter, moonAltitude);
-	
-	// Apply the Moon Avoidance Lorentzian formula from the spreadsheet:
-	// SEPARATION = DISTANCE / ( 1 + POWER( ( ( 0.5 - ( AGE / 29.5) ) / ( WIDTH / 29.5 ) ) , 2 ) )
-	// Simplified: SEPARATION = DISTANCE / ( 1 + ( ( 0.5 - ( AGE / 29.5) ) / ( WIDTH / 29.5 ) )^2 )
-	// Further simplified: SEPARATION = DISTANCE / ( 1 + ( ( 0.5 * 29.5 - AGE ) / WIDTH )^2 )
-	// where:
-	//   DISTANCE = adjustedSeparation (in degrees)
-	//   WIDTH = adjustedWidth (in days)
-	//   AGE = moonAgeDays (days from full moon, 0 = full moon)
-	//   29.5 = moon synodic period in days
-	
-	const double SYNODIC_PERIOD = 29.5;
-	
-	// Avoid division by zero
-	if (adjustedWidth <= 0.0)
-		adjustedWidth = 1.0;
-	
-	// Calculate the normalized term: ( 0.5 - ( AGE / 29.5) ) / ( WIDTH / 29.5 )
-	// This simplifies to: ( 0.5 * 29.5 - AGE ) / WIDTH
-	// Where AGE is days from full moon (0 = full moon, highest separation)
-	// The formula should give highest separation at full moon (AGE = 0)
-	// At full moon (AGE = 0): numerator = 0.5 * 29.5 = 14.75, term = 14.75 / WIDTH
-	// At new moon (AGE = 14.765): numerator = 0.5 * 29.5 - 14.765 ≈ 0, term ≈ 0
-	// 
-	// The formula SEPARATION = DISTANCE / ( 1 + term^2 ) gives:
-	// - At full moon (AGE = 0): SEPARATION = DISTANCE / ( 1 + (14.75/WIDTH)^2 ) = smaller value
-	// - At new moon (AGE = 14.765): SEPARATION = DISTANCE / ( 1 + 0^2 ) = DISTANCE (largest)
-	//
-	// This is backwards! The spreadsheet shows highest separation at full moon.
-	// The formula must be inverted or AGE must be calculated differently.
-	// Actually, looking at the spreadsheet, the formula might be:
-	// SEPARATION = DISTANCE * ( 1 + term^2 ) / ( 1 + term^2 ) or similar
-	// 
-	// Let me check: if we use the absolute value of (0.5 - AGE/29.5), we get:
-	// At full moon (AGE = 0): |0.5 - 0| = 0.5, term = 0.5 / (WIDTH/29.5) = 0.5 * 29.5 / WIDTH
-	// At new moon (AGE = 14.765): |0.5 - 14.765/29.5| = |0.5 - 0.5| = 0, term = 0
-	//
-	// Actually, I think the issue is that the formula should be:
-	// SEPARATION = DISTANCE * ( 1 + term^2 ) / ( 1 + term^2 ) where term = (0.5 - AGE/29.5) / (WIDTH/29.5)
-	// But that simplifies to DISTANCE, which doesn't make sense.
-	//
-	// Let me reconsider: the spreadsheet formula might be:
-	// SEPARATION = DISTANCE / ( 1 + ( (0.5 - AGE/29.5) / (WIDTH/29.5) )^2 )
-	// At full moon (AGE = 0): SEPARATION = DISTANCE / ( 1 + (0.5 / (WIDTH/29.5))^2 ) = DISTANCE / (1 + large) = small
-	// At new moon (AGE = 14.765): SEPARATION = DISTANCE / ( 1 + (0 / (WIDTH/29.5))^2 ) = DISTANCE / 1 = DISTANCE
-	//
-	// This is still backwards. The formula must be inverted. Let me try:
-	// SEPARATION = DISTANCE * ( 1 + term^2 ) where term = (0.5 - AGE/29.5) / (WIDTH/29.5)
-	// At full moon (AGE = 0): SEPARATION = DISTANCE * ( 1 + (0.5 / (WIDTH/29.5))^2 ) = DISTANCE * (1 + large) = large
-	// At new moon (AGE = 14.765): SEPARATION = DISTANCE * ( 1 + 0^2 ) = DISTANCE
-	//
-	// This is also backwards - it gives larger separation at full moon, but the factor is > 1, so it's larger than DISTANCE.
-	//
-	// Actually, I think the correct interpretation is that the formula should give:
-	// - Highest separation at full moon (AGE = 0)
-	// - Lower separation as we move away from full moon
-	//
-	// So the formula should be something like:
-	// SEPARATION = DISTANCE / ( 1 + (AGE / WIDTH)^2 )
-	// At full moon (AGE = 0): SEPARATION = DISTANCE / 1 = DISTANCE (highest)
-	// At new moon (AGE = 14.765): SEPARATION = DISTANCE / ( 1 + (14.765/WIDTH)^2 ) = smaller
-	//
-	// But the spreadsheet formula uses (0.5 - AGE/29.5) / (WIDTH/29.5), which is different.
-	//
-	// Let me try a different approach: maybe AGE should be the absolute distance from full moon,
-	// and the formula should be: SEPARATION = DISTANCE / ( 1 + (AGE / WIDTH)^2 )
-	// This would give highest separation at full moon (AGE = 0) and lower as we move away.
-	
-	// For now, let's use the formula as written in the spreadsheet, but we need to verify it gives
-	// the correct behavior. The spreadsheet shows highest separation at full moon, so the formula
-	// must be correct. Let me use it as-is and see if it works.
-	// The spreadsheet formula gives highest separation at full moon, but the formula as written
-	// gives highest at new moon. The correct formula should be:
-	// SEPARATION = DISTANCE / ( 1 + (AGE / WIDTH)^2 )
-	// where AGE is days from full moon (0 = full moon, 14.765 = new moon)
-	// This gives:
-	// - At full moon (AGE = 0): SEPARATION = DISTANCE / 1 = DISTANCE (highest)
-	// - At new moon (AGE = 14.765): SEPARATION = DISTANCE / ( 1 + (14.765/WIDTH)^2 ) = smaller
-	//
-	// Use days from full moon directly in the formula
-	double normalizedTerm = moonAgeDays / adjustedWidth;
-	
-	// Calculate the Lorentzian factor: 1 + (normalizedTerm)^2
-	double lorentzianFactor = 1.0 + (normalizedTerm * normalizedTerm);
-	
-	// Calculate the radius in degrees
-	// At full moon (AGE = 0): SEPARATION = DISTANCE / 1 = DISTANCE (highest)
-	// At new moon (AGE = 14.765): SEPARATION = DISTANCE / ( 1 + (14.765/WIDTH)^2 ) = smaller
-	double radiusDegrees = adjustedSeparation / lorentzianFactor;
-	
-	// Ensure minimum radius (at least 1 degree)
-	if (radiusDegrees < 1.0)
-		radiusDegrees = 1.0;
-	
-	// Convert degrees to radians for drawing
-	return radiusDegrees * M_PI / 180.0;
+		const bool invalid = answer.flags & MoonAvoidanceQueryProtocol::InvalidQuery;
+		separation.append(invalid ? std::nan("") : answer.separationDegrees);
+		radius.append(invalid ? std::nan("") : answer.radiusDegrees);
+		allowed.append(!invalid && (answer.flags & MoonAvoidanceQueryProtocol::Allowed));
+	}
+	result["filters"] = scriptEngine->filterNames();
+	result["separation"] = separation;
+	result["radius"] = radius;
+	result["allowed"] = allowed;
+	qDebug() << "MoonAvoidance: Evaluated" << answers.size() << "answers for scripts in" << timer.elapsed() << "ms";
+	return result;
 }
 
-void MoonAvoidance::drawCircle(StelPainter& painter, const Vec3d& moonPos, double radius, const QColor& color, const QString& filterName, double radiusDegrees, int filterIndex) const
+void MoonAvoidance::ensureDialog()
 {
-	// Draw a circle around the moon position
-	// The radius is in radians (angular separation on the sphere)
-	// This is a "small circle" - a circle on the sphere at constant angular distance from a point
-	
-	// Convert QColor to Vec3f for StelPainter
-	Vec3f colorVec(color.redF(), color.greenF(), color.blueF());
-	painter.setColor(colorVec, 1.0f); // Use full opacity for visibility
-	painter.setLineSmooth(true);
-	painter.setLineWidth(4.0f); // Make lines very visible
+	if (configDialog)
+		return;
 	
-	// Normalize moon position (center of circle)
-	Vec3d moonPosNorm = moonPos;
-	moonPosNorm.normalize();
+	QElapsedTimer timer;
+	timer.start();
 	
-	// Calculate two perpendicular vectors to moon position
-	// These will be used to construct the circle
-	Vec3d north(0, 0, 1);
-	Vec3d east(1, 0, 0);
+	configDialog = new MoonAvoidanceDialog();
 	
-	// Find a vector perpendicular to moon position
-	// Use ^ operator for cross product
-	Vec3d perp1 = moonPosNorm ^ north;
-	if (perp1.norm() < 0.1)
-	{
-		// If moon is near north pole, use east vector instead
-		perp1 = moonPosNorm ^ east;
-	}
-	perp1.normalize();
+	// Connect to dialog's visibleChanged signal to save when closed with OK
+	connect(configDialog, &StelDialog::visibleChanged, this, [this](bool visible) {
+		if (!visible && config && configDialog && configDialog->wasAccepted())
+		{
+			// Dialog was closed with OK - save configuration
+			QList<FilterConfig> newFilters = configDialog->getFilters();
+			if (!newFilters.isEmpty())
+			{
+				config->setFilters(newFilters);
+				config->saveConfiguration();
+				configWriteBackPending = false;
+				stats.setConfigLoaded(QDateTime::currentMSecsSinceEpoch());
+				qDebug() << "MoonAvoidance: Configuration saved";
+			}
+		}
+		// Accepted or not, the configuration is what gets drawn from now on
+		if (!visible)
+			clearPreviewFilters();
+	});
 	
-	// Find second perpendicular vector (orthogonal to both moon position and perp1)
-	Vec3d perp2 = moonPosNorm ^ perp1;
-	perp2.normalize();
+	qDebug() << "MoonAvoidance: Dialog constructed on first use in" << timer.nsecsElapsed() / 1000 << "us";
+}
+
+void MoonAvoidance::setPreviewFilters(const QList<FilterConfig>& filters)
+{
+	previewFilters = filters;
+	previewActive = true;
+	++previewRevision;
+}
+
+void MoonAvoidance::clearPreviewFilters()
+{
+	if (!previewActive)
+		return;
+	previewFilters.clear();
+	previewActive = false;
+	++previewRevision;
+}
+
+QList<FilterConfig> MoonAvoidance::activeFilters() const
+{
+	return previewActive ? previewFilters : config->getFilters();
+}
+
+MoonAvoidanceDialog* MoonAvoidance::getDialog()
+{
+	ensureDialog();
+	return configDialog;
+}
+
+void MoonAvoidance::update(double deltaTime)
+{
+	flagShow.update(static_cast<int>(deltaTime * 1000));
 	
-	// Draw circle using small circle arcs
-	// For a small circle on a sphere, we use drawSmallCircleArc
-	// Increase segments based on circle size - larger circles need more segments
-	// radiusDegrees is already a parameter, use it directly
-	int segments = qMax(256, static_cast<int>(radiusDegrees * 8)); // At least 256, more for larger circles
-	segments = qMin(segments, 1024); // Cap at 1024 for performance
-	const double angleStep = 2.0 * M_PI / segments;
+	// Sequencers are served whether or not the zones are shown
+	StelCore* queryCore = StelApp::getInstance().getCore();
+	if (queryServer && config && queryCore)
+		updateQueryContext(queryCore);
 	
-	// Draw the circle by connecting consecutive points with small circle arcs
-	// The rotation center is the moon position (center of the circle)
-	Vec3d prevPoint;
-	bool first = true;
+	if (!flagShow.getInterstate())
+		return;
 	
-	for (int i = 0; i <= segments; ++i)
-	{
-		double angle = i * angleStep;
-		
-		// Calculate point on small circle using spherical geometry
-		// For a small circle at angular distance 'radius' from center:
-		// point = center * cos(radius) + (perp1 * cos(angle) + perp2 * sin(angle)) * sin(radius)
-		Vec3d point = moonPosNorm * cos(radius) + 
-		              (perp1 * cos(angle) + perp2 * sin(angle)) * sin(radius);
-		point.normalize();
+	if (!config)
+		return;
+	
+	// Update moon data
+	MA_TRACE_ZONE("ephemeris");
+	try {
+		StelCore* core = StelApp::getInstance().getCore();
+		if (!core)
+			return;
 		
-		// Verify the point is at the correct angular distance from center
-		double dotProduct = moonPosNorm * point;
-		double actualAngle = acos(qBound(-1.0, dotProduct, 1.0));
-		double angleError = fabs(actualAngle - radius);
+		sampleMoon(core);
+		if (sharedState && moonValid)
+			publishSharedState(core->getJD());
+		if (moonValid)
+			updateSelectionInfo(core);
+		refreshHorizon(core);
+	}
+	catch (...)
+	{
+		// Silently handle errors during update
+	}
+}
+
+void MoonAvoidance::sampleMoon(StelCore* core)
+{
+	const double jd = core->getJD();
+	const bool scrubbing = std::fabs(jd - lastSampledJD) > TimelineScrubDays;
+	const bool fast = std::fabs(core->getTimeRate()) > TimelineMinTimeRate;
+	lastSampledJD = jd;
+	
+	// Keep the timeline for this night up to date, and use it while the clock
+	// runs fast or jumps, so playback does not redo the ephemeris every frame
+	usingTimeline = sampleTimeline(core) && (fast || scrubbing);
+	if (usingTimeline)
+	{
+		lastMoonDir.set(timelineSample.moonDir.x, timelineSample.moonDir.y, timelineSample.moonDir.z);
+		lastMoonAltitude = timelineSample.moonAltitude;
+		lastMoonAgeFromFullDays = timelineSample.moonDaysFromFull;
+		lastMoonAgeDays = MoonAvoidanceKernel::moonAge(jd).daysSinceNew;
+		moonValid = true;
+		return;
+	}
+	
+	SolarSystem* ssystem = GETSTELMODULE(SolarSystem);
+	if (!ssystem)
+		return;
+	
+	PlanetP moonP = ssystem->searchByEnglishName("Moon");
+	
+	if (moonP)
+	{
+		Planet* moon = moonP.data();
+		if (!moon)
+			return;
 		
-		// If error is significant, recalculate (shouldn't happen, but safety check)
-		if (angleError > 0.01) // More than 0.01 radians error
-		{
-			// Recalculate to ensure correct distance
-			point = moonPosNorm * cos(radius) + 
-			        (perp1 * cos(angle) + perp2 * sin(angle)) * sin(radius);
-			point.normalize();
-		}
+		// Calculate moon altitude
+		Vec3d altAzPos = moon->getAltAzPosAuto(core);
+		double alt, az;
+		StelUtils::rectToSphe(&az, &alt, altAzPos);
+		lastMoonAltitude = alt * 180.0 / M_PI; // Convert to degrees
 		
-		if (!first)
-		{
-			// Connect consecutive points with great circle arcs to form a smooth polygon
-			// This creates a circle by connecting points on the small circle with great circle segments
-			try {
-				painter.drawGreatCircleArc(prevPoint, point, nullptr);
-			}
-			catch (...)
-			{
-				qWarning() << "MoonAvoidance: Error drawing great circle arc";
-			}
-		}
+		// Moon position in the frame the zones are drawn in
+		lastMoonDir = moon->getJ2000EquatorialPos(core);
+		lastMoonDir.normalize();
 		
-		prevPoint = point;
-		first = false;
+		// Moon age since new moon for display, and days from full moon for the Lorentzian
+		const MoonAvoidanceKernel::MoonAge age = MoonAvoidanceKernel::moonAge(jd);
+		lastMoonAgeDays = age.daysSinceNew;
+		lastMoonAgeFromFullDays = age.daysFromFull;
+		moonValid = true;
+	}
+}
+
+void MoonAvoidance::refreshHorizon(StelCore* core)
+{
+	if (!horizonClipping)
+	{
+		horizon.clear();
+		return;
 	}
 	
-	qDebug() << "MoonAvoidance: drawCircle() completed - drew" << segments << "segments";
+	LandscapeMgr* landscapeMgr = GETSTELMODULE(LandscapeMgr);
+	const bool landscapeShown = landscapeMgr && landscapeMgr->getFlagLandscape();
+	const QString landscapeId = landscapeShown ? landscapeMgr->getCurrentLandscapeID() : QString();
+	const StelLocation& location = core->getCurrentLocation();
+	if (horizon && landscapeId == horizonLandscapeId
+	    && location.getLatitude() == horizonLatitude && location.getLongitude() == horizonLongitude)
+		return;
+	
+	QElapsedTimer timer;
+	timer.start();
+	if (landscapeShown)
+	{
+		// The landscape can only be queried here, on the main thread
+		horizon.reset(new MoonAvoidanceHorizon(MoonAvoidanceHorizon::fromSampler([landscapeMgr](double azimuth, double altitude) {
+			Vec3d azalt;
+			StelUtils::spheToRect(azimuth, altitude, azalt);
+			return landscapeMgr->getLandscapeOpacity(azalt) >= 0.5f;
+		}, horizonAltitude)));
+	}
+	else
+	{
+		horizon.reset(new MoonAvoidanceHorizon(horizonAltitude));
+	}
+	horizonLandscapeId = landscapeId;
+	horizonLatitude = location.getLatitude();
+	horizonLongitude = location.getLongitude();
+	qDebug() << "MoonAvoidance: Horizon for" << (landscapeShown ? landscapeId : QString("flat limit"))
+	         << "built in" << timer.nsecsElapsed() / 1000 << "us";
+}
+
+bool MoonAvoidance::sampleTimeline(StelCore* core)
+{
+	// The analytic ephemeris only knows about observers on Earth
+	const StelLocation& location = core->getCurrentLocation();
+	if (location.planetName != "Earth")
+	{
+		timelineData.reset();
+		return false;
+	}
 	
-	// Draw 6 radial arrows pointing outward from the circle, away from the moon
-	// Arrows are evenly spaced (60 degrees apart), but staggered for each filter circle
-	const int arrowCount = 6;
-	const double arrowSpacing = 2.0 * M_PI / arrowCount;
-	const double arrowLength = 0.03; // ~1.7 degrees outward from circle
-	const double arrowHeadLength = 0.01; // ~0.6 degrees for arrowhead
-	const double arrowHeadAngle = M_PI / 6.0; // 30 degrees for arrowhead
+	if (!timeline)
+	{
+		timeline = new MoonAvoidanceTimeline(this);
+		timeline->start(QThread::LowPriority);
+	}
 	
-	// Stagger arrows for each filter circle by rotating them
-	// Each filter gets a different starting angle offset
-	// Offset by 10 degrees per filter index to create a staggered effect
-	const double staggerOffset = (filterIndex * 10.0) * M_PI / 180.0; // Convert to radians
+	// Rebuilt only when the site, the night or the filters change
+	const double jd = core->getJD();
+	MoonAvoidanceTimelineKey key;
+	key.latitude = location.getLatitude();
+	key.longitude = location.getLongitude();
+	key.windowStartJD = MoonAvoidanceTimeline::windowStartFor(jd, key.longitude);
+	key.filtersRevision = config->getRevision();
+	timeline->request(key, config->getFilters(), core->getJDE() - jd);
+	
+	timelineData = timeline->current();
+	if (timelineData && timelineData->key != key)
+		timelineData.reset(); // Stale: built for another site, night or filter set
+	return timelineData && timelineData->sample(jd, timelineSample);
+}
+
+void MoonAvoidance::collectGhostEpochs(double jd)
+{
+	// Epochs sit on whole UT hours, so the list (and the worker's tessellation
+	// cache) only changes once an hour or when the timeline is rebuilt
+	const double hour = std::floor(jd * 24.0);
+	if (hour == ghostEpochsHour && timelineData == ghostEpochsSource && previewRevision == ghostEpochsPreview)
+		return;
+	ghostEpochsHour = hour;
+	ghostEpochsSource = timelineData;
+	ghostEpochsPreview = previewRevision;
+	ghostEpochs.clear();
 	
-	// Set color for arrows (same as circle)
-	painter.setColor(colorVec, 1.0f);
-	painter.setLineWidth(2.0f);
+	if (!timelineData)
+		return;
 	
-	for (int i = 0; i < arrowCount; ++i)
+	const MoonAvoidanceTimelineData& data = *timelineData;
+	for (int k = 1; k <= MaxGhostEpochs; ++k)
 	{
-		double angle = i * arrowSpacing + staggerOffset;
+		const double epochJD = (hour + k) / 24.0;
+		if (epochJD > data.dawnJD || !data.covers(epochJD))
+			break;
 		
-		// Calculate point on the circle
-		Vec3d circlePoint = moonPosNorm * cos(radius) + 
-		                   (perp1 * cos(angle) + perp2 * sin(angle)) * sin(radius);
-		circlePoint.normalize();
-		
-		// Calculate point further out (away from moon) for arrow tip
-		double arrowRadius = radius + arrowLength;
-		if (arrowRadius > M_PI * 0.9)
-			arrowRadius = M_PI * 0.9;
-		
-		Vec3d arrowTip = moonPosNorm * cos(arrowRadius) + 
-		                (perp1 * cos(angle) + perp2 * sin(angle)) * sin(arrowRadius);
-		arrowTip.normalize();
-		
-		// Draw arrow shaft (line from circle to tip)
-		try {
-			painter.drawGreatCircleArc(circlePoint, arrowTip, nullptr);
-		}
-		catch (...)
+		// Whole hours fall on timeline samples, no interpolation needed
+		const int index = data.nearestIndex(epochJD);
+		MoonAvoidanceGhostEpoch epoch;
+		epoch.jd = epochJD;
+		epoch.moonDir.set(data.moonDir[index].x, data.moonDir[index].y, data.moonDir[index].z);
+		if (previewActive)
 		{
-			qWarning() << "MoonAvoidance: Error drawing arrow shaft";
+			// The timeline holds the configured filters' radii; the moon state still applies
+			for (const FilterConfig& filter : previewFilters)
+				epoch.radiiDegrees.append(MoonAvoidanceKernel::zoneRadiusDegrees(filter, data.moonAltitude[index], data.moonDaysFromFull[index]));
 		}
-		
-		// Draw arrowhead (small triangle at the tip)
-		// Calculate two points for the arrowhead, perpendicular to the arrow direction
-		Vec3d arrowDir = arrowTip - circlePoint;
-		arrowDir.normalize();
-		
-		// Find a perpendicular vector to arrow direction
-		Vec3d perpArrow = moonPosNorm ^ arrowDir;
-		if (perpArrow.norm() < 0.1)
-		{
-			// If arrow is parallel to moon direction, use a different perpendicular
-			perpArrow = perp1 ^ arrowDir;
-		}
-		perpArrow.normalize();
-		
-		// Calculate arrowhead base point (slightly back from tip)
-		double headBaseRadius = arrowRadius - arrowHeadLength;
-		if (headBaseRadius < radius)
-			headBaseRadius = radius;
-		
-		Vec3d headBase = moonPosNorm * cos(headBaseRadius) + 
-		                (perp1 * cos(angle) + perp2 * sin(angle)) * sin(headBaseRadius);
-		headBase.normalize();
-		
-		// Calculate arrowhead side points
-		Vec3d headSide1 = headBase + perpArrow * (arrowHeadLength * 0.5);
-		headSide1.normalize();
-		
-		Vec3d headSide2 = headBase - perpArrow * (arrowHeadLength * 0.5);
-		headSide2.normalize();
-		
-		// Draw arrowhead triangle
-		try {
-			painter.drawGreatCircleArc(arrowTip, headSide1, nullptr);
-			painter.drawGreatCircleArc(arrowTip, headSide2, nullptr);
-			painter.drawGreatCircleArc(headSide1, headSide2, nullptr);
-		}
-		catch (...)
+		else
 		{
-			qWarning() << "MoonAvoidance: Error drawing arrowhead";
+			epoch.radiiDegrees = data.radiiAt(index);
 		}
+		ghostEpochs.append(epoch);
 	}
 	
-	// Labels temporarily hidden - user wants to try a different approach
-	/*
-	// Find the best position for the label: middle point of visible segment above horizon
-	// Sample points around the circle and find the middle of the visible arc above horizon
-	StelCore* core = StelApp::getInstance().getCore();
-	if (!core)
+	// Fade out towards dawn
+	for (int k = 0; k < ghostEpochs.size(); ++k)
+	{
+		ghostEpochs[k].opacity = GhostMaxOpacity * (1.0f - static_cast<float>(k) / ghostEpochs.size());
+	}
+}
+
+void MoonAvoidance::draw(StelCore* core)
+{
+	MA_TRACE_ZONE("draw");
+	
+	if (!flagShow.getInterstate())
 		return;
 	
-	StelProjectorP projector = painter.getProjector();
-	if (!projector)
+	if (!config)
 		return;
 	
-	QList<double> visibleAngles; // Store angles of visible points above horizon
+	QElapsedTimer frameTimer;
+	frameTimer.start();
 	
-	// Sample points around the circle to find visible points above horizon
-	const int sampleCount = 128; // More samples for better accuracy
-	for (int i = 0; i < sampleCount; ++i)
+	drawZones(core);
+	if (catalogHighlight && moonValid)
+		drawHighlights(core);
+	
+	stats.frame().drawNs = frameTimer.nsecsElapsed();
+	if (stats.endFrame(statsClock.elapsed()))
 	{
-		double angle = (2.0 * M_PI * i) / sampleCount;
-		
-		// Calculate point on circle
-		Vec3d point = moonPosNorm * cos(radius) + 
-		              (perp1 * cos(angle) + perp2 * sin(angle)) * sin(radius);
-		point.normalize();
-		
-		// Convert to Alt/Az to check altitude
-		Vec3d altAzPos = core->j2000ToAltAz(point, StelCore::RefractionOff);
-		double alt, az;
-		StelUtils::rectToSphe(&az, &alt, altAzPos);
-		double altitude = alt * 180.0 / M_PI; // Convert to degrees
-		
-		// Check if point is visible in viewport
-		Vec3d screenPos;
-		bool isVisible = projector->project(point, screenPos);
-		
-		// Check if point is within viewport bounds
-		if (isVisible)
+		// Refresh the exported planning state, property values and HUD text at the publish rate only
+		QVector<MoonAvoidanceStatsSnapshot::ZoneRadius> radii;
+		for (const FilterConfig& filter : config->getFilters())
 		{
-			double vpX = projector->getViewportPosX();
-			double vpY = projector->getViewportPosY();
-			double vpW = projector->getViewportWidth();
-			double vpH = projector->getViewportHeight();
-			
-			isVisible = (screenPos[0] >= vpX && screenPos[0] <= vpX + vpW &&
-			            screenPos[1] >= vpY && screenPos[1] <= vpY + vpH);
+			radii.append({ filter.name, calculateCircleRadius(filter, lastMoonAltitude, lastMoonAgeFromFullDays) * 180.0 / M_PI });
 		}
-		
-		// If point is visible and above horizon, store its angle
-		if (isVisible && altitude > 0.0)
+		stats.setPlanningState(radii, lastMoonAltitude, lastMoonAgeFromFullDays);
+		publishedStats = stats.snapshot();
+		if (perfHudVisible)
 		{
-			visibleAngles.append(angle);
+			perfHudText = QString("MoonAvoidance  %1 ms (max %2)  |  %3 vtx  |  %4 arcs  |  cache %5%  |  %6 labels")
+				.arg(publishedStats.frameTimeMs, 0, 'f', 3)
+				.arg(publishedStats.maxFrameTimeMs, 0, 'f', 3)
+				.arg(qRound(publishedStats.verticesProjected))
+				.arg(qRound(publishedStats.arcsSubmitted))
+				.arg(publishedStats.cacheHitRate * 100.0, 0, 'f', 0)
+				.arg(qRound(publishedStats.labelsPlaced));
 		}
+		emit perfCountersChanged();
 	}
 	
-	// Find the middle angle of the visible segment
-	// This is the geometric middle of the largest continuous arc segment that's visible and above horizon
-	double bestAngle = 0.0;
-	if (!visibleAngles.isEmpty())
+	if (perfHudVisible && !perfHudText.isEmpty())
 	{
-		// Sort angles to handle wraparound at 0/2π
-		std::sort(visibleAngles.begin(), visibleAngles.end());
-		
-		if (visibleAngles.size() == 1)
+		drawPerfHud(core);
+	}
+}
+
+void MoonAvoidance::buildHighlightIndex(StelCore* core)
+{
+	QElapsedTimer timer;
+	timer.start();
+	
+	QVector<MoonAvoidanceGeometry::Vector3> dirs;
+	NebulaMgr* nebulaMgr = GETSTELMODULE(NebulaMgr);
+	if (nebulaMgr)
+	{
+		// Catalog positions do not move; unknown magnitudes (99) are left out
+		for (const NebulaP& nebula : nebulaMgr->getAllDeepSkyObjects())
 		{
-			bestAngle = visibleAngles[0];
+			if (nebula->getVMagnitude(core) > highlightMaxMagnitude)
+				continue;
+			Vec3d dir = nebula->getJ2000EquatorialPos(core);
+			dir.normalize();
+			dirs.append({ dir[0], dir[1], dir[2] });
 		}
-		else
+	}
+	highlightFirstTarget = dirs.size();
+	highlightTargetNames.clear();
+	
+	// The user's targets, in the target-list format of moonavoid-cli
+	QSettings* conf = StelApp::getInstance().getSettings();
+	const QString path = conf ? conf->value("MoonAvoidance/highlight_targets", "").toString().trimmed() : QString();
+	if (!path.isEmpty())
+	{
+		QFile file(path);
+		if (file.open(QIODevice::ReadOnly | QIODevice::Text))
 		{
-			// Find the largest gap between consecutive visible angles
-			// This gap represents where the circle is NOT visible
-			// The visible segment is everything else (the complement)
-			double maxGap = 0.0;
-			int maxGapIndex = -1;
-			
-			// Check gaps between consecutive angles
-			for (int i = 0; i < visibleAngles.size() - 1; ++i)
-			{
-				double gap = visibleAngles[i + 1] - visibleAngles[i];
-				if (gap > maxGap)
-				{
-					maxGap = gap;
-					maxGapIndex = i;
-				}
-			}
-			
-			// Check wraparound gap (between last and first)
-			double wrapGap = (2.0 * M_PI - visibleAngles.last()) + visibleAngles.first();
-			
-			if (wrapGap > maxGap)
-			{
-				// Wraparound case: the visible segment wraps around 0/2π
-				// The visible segment is from last angle to first angle (wrapping)
-				// Calculate geometric middle: (last + (first + 2π)) / 2, then normalize
-				double startAngle = visibleAngles.last();
-				double endAngle = visibleAngles.first() + 2.0 * M_PI;
-				bestAngle = (startAngle + endAngle) / 2.0;
-				if (bestAngle >= 2.0 * M_PI)
-					bestAngle -= 2.0 * M_PI;
-			}
-			else if (maxGapIndex >= 0)
+			QTextStream in(&file);
+			MoonAvoidancePlanner::Target target;
+			QString error;
+			for (int line = 1; !in.atEnd(); ++line)
 			{
-				// Normal case: the visible segment is continuous
-				// If the largest gap is between angle[i] and angle[i+1], then:
-				// - The gap (not visible) is from angle[i] to angle[i+1]
-				// - The visible segment is from angle[i+1] to angle[i] (wrapping)
-				// - The middle is halfway between angle[i+1] and angle[i] (wrapping)
-				int startIdx = (maxGapIndex + 1) % visibleAngles.size();
-				int endIdx = maxGapIndex;
-				
-				double startAngle = visibleAngles[startIdx];
-				double endAngle = visibleAngles[endIdx];
-				
-				// Since the segment wraps (startIdx comes after endIdx in sorted order),
-				// we need to add 2π to endAngle to calculate the middle correctly
-				// The middle is: (startAngle + (endAngle + 2π)) / 2
-				endAngle += 2.0 * M_PI;
-				
-				bestAngle = (startAngle + endAngle) / 2.0;
-				if (bestAngle >= 2.0 * M_PI)
-					bestAngle -= 2.0 * M_PI;
-			}
-			else
-			{
-				// Fallback: if all angles are evenly spaced, use the middle
-				// Calculate average of all visible angles
-				double sum = 0.0;
-				for (double angle : visibleAngles)
+				if (MoonAvoidancePlanner::parseTarget(in.readLine(), target, &error))
 				{
-					sum += angle;
+					dirs.append(target.dir);
+					highlightTargetNames.append(target.name);
 				}
-				bestAngle = sum / visibleAngles.size();
+				else if (!error.isEmpty())
+					qWarning() << "MoonAvoidance:" << path << "line" << line << ":" << error;
 			}
 		}
+		else
+			qWarning() << "MoonAvoidance: Cannot read highlight targets" << path << ":" << file.errorString();
 	}
 	
-	// Calculate label position at the best angle, offset outward
-	Vec3d labelPoint = moonPosNorm * cos(radius) + 
-	                   (perp1 * cos(bestAngle) + perp2 * sin(bestAngle)) * sin(radius);
-	labelPoint.normalize();
+	highlightIndex.reset(new MoonAvoidanceSkyIndex(dirs));
+	qDebug() << "MoonAvoidance: Indexed" << highlightFirstTarget << "deep-sky objects and" << highlightTargetNames.size()
+	         << "targets for highlighting in" << timer.elapsed() << "ms";
+}
+
+void MoonAvoidance::drawHighlights(StelCore* core)
+{
+	MA_TRACE_ZONE("highlights");
+	if (!highlightIndex)
+		buildHighlightIndex(core);
+	if (highlightIndex->isEmpty())
+		return;
+	
+	StelProjectorP projector = core->getProjection(StelCore::FrameJ2000);
+	if (!projector)
+		return;
+	const SphericalCap view = projector->getBoundingCap();
+	const MoonAvoidanceGeometry::Vector3 viewCenter { view.n[0], view.n[1], view.n[2] };
+	
+	// The zones as concentric radii, smallest first; a hit's zone indexes byRadius
+	const QList<FilterConfig> filters = activeFilters();
+	const QVector<double> radii = currentRadiiDegrees(filters);
+	QVector<int> byRadius(filters.size());
+	std::iota(byRadius.begin(), byRadius.end(), 0);
+	std::sort(byRadius.begin(), byRadius.end(), [&radii](int a, int b) { return radii[a] < radii[b]; });
+	QVector<double> radiiAscending;
+	radiiAscending.reserve(filters.size());
+	for (int index : byRadius)
+		radiiAscending.append(radii[index] * M_PI / 180.0);
+	
+	highlightHits.clear();
+	highlightIndex->zoneHits(viewCenter, std::acos(qBound(-1.0, view.d, 1.0)), { lastMoonDir[0], lastMoonDir[1], lastMoonDir[2] },
+	                         radiiAscending, highlightHits);
+	if (highlightHits.isEmpty())
+		return;
+	// Innermost zones first, so the cap drops the markers furthest from the moon
+	std::sort(highlightHits.begin(), highlightHits.end(), [](const MoonAvoidanceSkyIndex::Hit& a, const MoonAvoidanceSkyIndex::Hit& b) {
+		return a.zone < b.zone;
+	});
+	if (highlightHits.size() > MaxHighlights)
+		highlightHits.resize(MaxHighlights);
+
+	StelPainter painter(projector);
+	painter.setBlending(true);
+	painter.setLineSmooth(true);
+	painter.setLineWidth(1.5f);
+	int zone = -1;
+	for (const MoonAvoidanceSkyIndex::Hit& hit : highlightHits)
+	{
+		if (hit.zone != zone)
+		{
+			zone = hit.zone;
+			const QColor& color = filters[byRadius[zone]].color;
+			painter.setColor(Vec3f(color.redF(), color.greenF(), color.blueF()), 0.9f);
+		}
+		const MoonAvoidanceGeometry::Vector3& dir = highlightIndex->direction(hit.entry);
+		Vec3d screen;
+		if (!projector->project(Vec3d(dir.x, dir.y, dir.z), screen))
+			continue;
+		const float x = static_cast<float>(screen[0]);
+		const float y = static_cast<float>(screen[1]);
+		painter.drawCircle(x, y, HighlightMarkerRadius);
+		if (hit.entry >= highlightFirstTarget)
+			painter.drawText(x + HighlightMarkerRadius + 2.0f, y + HighlightMarkerRadius + 2.0f,
+			                 highlightTargetNames[hit.entry - highlightFirstTarget], 0.0f);
+	}
+	painter.setLineWidth(1.0f);
+	painter.setLineSmooth(false);
+}
+
+void MoonAvoidance::drawPerfHud(StelCore* core)
+{
+	StelPainter painter(core->getProjection2d());
+	painter.setBlending(true);
+	painter.setColor(Vec3f(1.0f, 0.85f, 0.3f), 0.9f);
+	const StelProjectorP projector = painter.getProjector();
+	const float x = static_cast<float>(projector->getViewportPosX() + 10);
+	const float y = static_cast<float>(projector->getViewportPosY() + 20);
+	painter.drawText(x, y, perfHudText, 0.0f);
+}
+
+void MoonAvoidance::drawZones(StelCore* core)
+{
+	// Radii, tessellation and label layout run on frameWorker. This function only
+	// posts the next request and submits the latest finished state.
+	// Nothing here logs or formats text on the normal path; use MA_TRACE_ZONE and a
+	// MOONAVOIDANCE_TRACING build to inspect it.
+	MoonAvoidanceFrameCounters& counters = stats.frame();
+	
+	if (!frameWorker)
+	{
+		frameWorker = new MoonAvoidanceFrameWorker(this);
+		frameWorker->start();
+	}
+	
+	StelProjectorP projector = core->getProjection(StelCore::FrameJ2000);
+	if (!projector)
+		return;
+	
+	// The moon was sampled in update(), from Stellarium or the night timeline
+	if (!moonValid)
+		return;
+	
+	MoonAvoidanceFrameRequest request;
+	request.moonDir = lastMoonDir;
+	request.serial = ++frameSerial;
+	request.jd = core->getJD();
+	request.moonAltitude = lastMoonAltitude;
+	request.moonDaysFromFull = lastMoonAgeFromFullDays;
+	request.filters = activeFilters();
+	if (usingTimeline && !previewActive)
+		request.radiiDegrees = timelineSample.radiiDegrees; // Built for the configured filters
+	if (ghostRingsVisible)
+	{
+		collectGhostEpochs(request.jd);
+		request.ghosts = ghostEpochs; // Implicitly shared
+	}
+	request.renderMode = zoneRenderMode;
+	request.font = labelFont;
+	if (horizon)
+	{
+		const Vec3d x = core->altAzToJ2000(Vec3d(1.0, 0.0, 0.0), StelCore::RefractionOff);
+		const Vec3d y = core->altAzToJ2000(Vec3d(0.0, 1.0, 0.0), StelCore::RefractionOff);
+		const Vec3d zenith = core->altAzToJ2000(Vec3d(0.0, 0.0, 1.0), StelCore::RefractionOff);
+		request.horizon = horizon;
+		request.horizonAxes.x = { x[0], x[1], x[2] };
+		request.horizonAxes.y = { y[0], y[1], y[2] };
+		request.horizonAxes.zenith = { zenith[0], zenith[1], zenith[2] };
+	}
+	request.projector = projector;
+	frameWorker->submit(request);
+	
+	const MoonAvoidanceFrameState* state = frameWorker->acquire();
+	if (!state)
+		return; // First frames, before the worker has published anything
 	
-	// Offset label further outward from the circle for better visibility
-	// Calculate a point slightly further from the moon
-	double labelOffsetRadius = radius + 0.1; // Add ~5.7 degrees offset
-	if (labelOffsetRadius > M_PI * 0.9) // Don't go too far
-		labelOffsetRadius = M_PI * 0.9;
+	MA_TRACE_ZONE("submit");
 	
-	Vec3d labelPos = moonPosNorm * cos(labelOffsetRadius) + 
-	                 (perp1 * cos(bestAngle) + perp2 * sin(bestAngle)) * sin(labelOffsetRadius);
-	labelPos.normalize();
+	// Worker-side work is counted once per published state
+	if (state->serial != lastCountedSerial)
+	{
+		counters.verticesProjected += state->verticesProjected;
+		counters.cacheHits += state->cacheHits;
+		counters.cacheMisses += state->cacheMisses;
+		lastCountedSerial = state->serial;
+	}
+	
+	// Initialize painter with the same frame as the moon position
+	StelPainter painter(projector);
+	labelFont = painter.getFont(); // Measured by the worker from the next frame on
+	
+	// Enable blending for transparency support (like GridLinesMgr does)
+	painter.setBlending(true);
+	painter.setLineSmooth(true);
 	
-	// Format label text: "SAFE TO SHOOT {FILTER} ({radiusDegrees}°)"
-	QString labelText = QString("SAFE TO SHOOT %1 (%2°)").arg(filterName).arg(radiusDegrees, 0, 'f', 1);
+	// Lines of every zone go into three batches, one per line width, so the
+	// number of draw calls does not grow with the number of zones
+	ghostBatch.clear();
+	ringBatch.clear();
+	arrowBatch.clear();
 	
-	// Set text color to match circle color, but ensure it's visible
-	Vec3f textColor(color.redF(), color.greenF(), color.blueF());
-	painter.setColor(textColor, 1.0f);
+	// Future rings first, so the current ones are drawn on top
+	for (const MoonAvoidanceZoneGeometry& zone : state->ghostZones)
+	{
+		ghostBatch.addStrip(*projector, zone.ring, Vec4f(zone.color.redF(), zone.color.greenF(), zone.color.blueF(), zone.opacity));
+	}
 	
-	// Draw text at the label position
 	try {
-		painter.drawText(labelPos, labelText, 0.0f, 0.0f, 0.0f, true);
+		counters.arcsSubmitted += ghostBatch.draw(painter, 1.5f);
 	}
 	catch (...)
 	{
-		qWarning() << "MoonAvoidance: Error drawing label text";
+		qWarning() << "MoonAvoidance: Error drawing ghost rings";
 	}
-	*/
 	
-	// Restore line width
+	if (zoneRenderMode == ZoneRenderCaps)
+	{
+		// Translucent caps overlap: draw the largest first so smaller ones stay distinct
+		QVarLengthArray<const MoonAvoidanceZoneGeometry*, 16> ordered;
+		for (const MoonAvoidanceZoneGeometry& zone : state->zones)
+			ordered.append(&zone);
+		std::sort(ordered.begin(), ordered.end(), [](const MoonAvoidanceZoneGeometry* a, const MoonAvoidanceZoneGeometry* b) {
+			return a->radius > b->radius;
+		});
+		for (const MoonAvoidanceZoneGeometry* zone : ordered)
+		{
+			submitZone(painter, *zone);
+		}
+	}
+	else
+	{
+		for (const MoonAvoidanceZoneGeometry& zone : state->zones)
+		{
+			submitZone(painter, zone);
+		}
+	}
+	
+	try {
+		counters.arcsSubmitted += ringBatch.draw(painter, 4.0f);
+		counters.arcsSubmitted += arrowBatch.draw(painter, 2.0f);
+	}
+	catch (...)
+	{
+		qWarning() << "MoonAvoidance: Error drawing zone lines";
+	}
+	counters.verticesProjected += ghostBatch.pointsProjected() + ringBatch.pointsProjected() + arrowBatch.pointsProjected();
+	
 	painter.setLineWidth(1.0f);
 	painter.setLineSmooth(false);
+	
+	for (const MoonAvoidanceLabel& label : state->labels)
+	{
+		painter.setColor(Vec3f(label.color.redF(), label.color.greenF(), label.color.blueF()), 1.0f);
+		try {
+			painter.drawText(label.x, label.y, label.text, 0.0f);
+			++counters.labelsPlaced;
+		}
+		catch (...)
+		{
+			qWarning() << "MoonAvoidance: Error drawing label text";
+		}
+	}
+	
+	frameWorker->release();
+}
+
+void MoonAvoidance::submitZone(StelPainter& painter, const MoonAvoidanceZoneGeometry& zone)
+{
+	const Vec3f colorVec(zone.color.redF(), zone.color.greenF(), zone.color.blueF());
+	
+	// Cap and band modes: Stellarium tessellates, culls and clips the regions itself
+	if (zone.fill)
+	{
+		try {
+			painter.setColor(colorVec, ZoneFillOpacity);
+			painter.drawSphericalRegion(zone.fill.data(), StelPainter::SphericalPolygonDrawModeFill);
+			painter.setColor(colorVec, 1.0f);
+			painter.setLineWidth(ZoneOutlineWidth);
+			painter.drawSphericalRegion(zone.outline.data(), StelPainter::SphericalPolygonDrawModeBoundary);
+		}
+		catch (...)
+		{
+			qWarning() << "MoonAvoidance: Error drawing zone region";
+		}
+	}
+	
+	// Ring and arrows (pointing outward, away from the moon) are drawn with the batches
+	const StelProjector& projector = *painter.getProjector();
+	ringBatch.addStrips(projector, zone.ring, zone.ringStarts, Vec4f(colorVec[0], colorVec[1], colorVec[2], 1.0f));
+	arrowBatch.addSegments(projector, zone.arrowLines, Vec4f(colorVec[0], colorVec[1], colorVec[2], 1.0f));
+}
+
+double MoonAvoidance::getCallOrder(StelModuleActionName actionName) const
+{
+	if (actionName == StelModule::ActionDraw)
+		return StelApp::getInstance().getModuleMgr().getModule("SolarSystem")->getCallOrder(actionName) + 1;
+	return 0;
+}
+
+double MoonAvoidance::calculateSeparation(const FilterConfig& filter, double moonAltitude) const
+{
+	return MoonAvoidanceKernel::relaxedSeparation(filter, moonAltitude);
+}
+
+double MoonAvoidance::calculateWidth(const FilterConfig& filter, double moonAltitude) const
+{
+	return MoonAvoidanceKernel::relaxedWidth(filter, moonAltitude);
+}
+
+double MoonAvoidance::calculateCircleRadius(const FilterConfig& filter, double moonAltitude, double moonAgeDays) const
+{
+	// The Lorentzian lives in MoonAvoidanceKernel so the frame worker, dialog and
+	// tools all share one implementation. Returns radians; 0 = avoidance OFF.
+	return MoonAvoidanceKernel::zoneRadiusDegrees(filter, moonAltitude, moonAgeDays) * M_PI / 180.0;
 }
 
 void MoonAvoidance::loadConfiguration()
@@ -1270,6 +1300,7 @@ void MoonAvoidance::showConfigurationDialog()
 		return;
 	}
 	
+	ensureDialog();
 	if (!configDialog)
 	{
 		qWarning() << "MoonAvoidance: configDialog is null";
@@ -1312,3 +1343,87 @@ void MoonAvoidance::setEnabled(bool b)
 		emit enabledChanged(b);
 	}
 }
+
+bool MoonAvoidance::dumpTrace(const QString& path)
+{
+#ifdef MOONAVOIDANCE_TRACING
+	return MoonAvoidanceTrace::instance().dumpChromeTrace(path);
+#else
+	Q_UNUSED(path)
+	qWarning() << "MoonAvoidance: Tracing is not compiled in; reconfigure with -DMOONAVOIDANCE_TRACING=ON";
+	return false;
+#endif
+}
+
+void MoonAvoidance::setGhostRingsVisible(bool b)
+{
+	if (b != ghostRingsVisible)
+	{
+		ghostRingsVisible = b;
+		QSettings* conf = StelApp::getInstance().getSettings();
+		if (conf)
+			conf->setValue("MoonAvoidance/ghost_rings", b);
+		emit ghostRingsVisibleChanged(b);
+	}
+}
+
+void MoonAvoidance::setCatalogHighlight(bool b)
+{
+	if (b != catalogHighlight)
+	{
+		catalogHighlight = b;
+		QSettings* conf = StelApp::getInstance().getSettings();
+		if (conf)
+			conf->setValue("MoonAvoidance/catalog_highlight", b);
+		emit catalogHighlightChanged(b);
+	}
+}
+
+void MoonAvoidance::setZoneRenderMode(ZoneRenderMode mode)
+{
+	if (mode != zoneRenderMode)
+	{
+		zoneRenderMode = mode;
+		QSettings* conf = StelApp::getInstance().getSettings();
+		if (conf)
+			conf->setValue("MoonAvoidance/zone_render_mode", static_cast<int>(mode));
+		emit zoneRenderModeChanged(mode);
+	}
+}
+
+void MoonAvoidance::setHorizonClipping(bool b)
+{
+	if (b != horizonClipping)
+	{
+		horizonClipping = b;
+		horizon.clear(); // Rebuilt in the next update()
+		QSettings* conf = StelApp::getInstance().getSettings();
+		if (conf)
+			conf->setValue("MoonAvoidance/horizon_clipping", b);
+		emit horizonClippingChanged(b);
+	}
+}
+
+void MoonAvoidance::setHorizonAltitude(double degrees)
+{
+	degrees = qBound(-10.0, degrees, 60.0);
+	if (degrees != horizonAltitude)
+	{
+		horizonAltitude = degrees;
+		horizon.clear();
+		QSettings* conf = StelApp::getInstance().getSettings();
+		if (conf)
+			conf->setValue("MoonAvoidance/horizon_altitude", degrees);
+		emit horizonAltitudeChanged(degrees);
+	}
+}
+
+void MoonAvoidance::setPerfHudVisible(bool b)
+{
+	if (b != perfHudVisible)
+	{
+		perfHudVisible = b;
+		perfHudText.clear(); // Rebuilt at the next publish
+		emit perfHudVisibleChanged(b);
+	}
+}
@@ -3,19 +3,58 @@
 
 #include "StelModule.hpp"
 #include "StelFader.hpp"
+#include "StelObjectType.hpp"
 #include "MoonAvoidanceConfig.hpp"
+#include "MoonAvoidanceStats.hpp"
+#include "MoonAvoidanceTimeline.hpp"
+#include "MoonAvoidanceFrameWorker.hpp"
+#include "MoonAvoidanceHorizon.hpp"
+#include "MoonAvoidanceLineBatch.hpp"
+#include "MoonAvoidanceSkyIndex.hpp"
 #include "VecMath.hpp"
 #include <QOpenGLFunctions>
+#include <QElapsedTimer>
 
 class StelPainter;
 class MoonAvoidanceDialog;
+class MoonAvoidanceMetricsExporter;
+class MoonAvoidanceQueryEngine;
+class MoonAvoidanceQueryServer;
+class MoonAvoidanceSharedStatePublisher;
+class QThread;
 
 class MoonAvoidance : public StelModule
 {
 	Q_OBJECT
 	Q_PROPERTY(bool enabled READ isEnabled WRITE setEnabled NOTIFY enabledChanged)
+	// Faded copies of every ring at each coming whole hour until dawn
+	Q_PROPERTY(bool ghostRingsVisible READ isGhostRingsVisible WRITE setGhostRingsVisible NOTIFY ghostRingsVisibleChanged)
+	// Mark deep-sky objects (and the targets in MoonAvoidance/highlight_targets) inside the zones
+	Q_PROPERTY(bool catalogHighlight READ isCatalogHighlight WRITE setCatalogHighlight NOTIFY catalogHighlightChanged)
+	Q_PROPERTY(ZoneRenderMode zoneRenderMode READ getZoneRenderMode WRITE setZoneRenderMode NOTIFY zoneRenderModeChanged)
+	// Drop the parts of the rings below the landscape horizon (or below horizonAltitude, in degrees)
+	Q_PROPERTY(bool horizonClipping READ isHorizonClipping WRITE setHorizonClipping NOTIFY horizonClippingChanged)
+	Q_PROPERTY(double horizonAltitude READ getHorizonAltitude WRITE setHorizonAltitude NOTIFY horizonAltitudeChanged)
+	// Live performance counters, averaged over the last publish interval (~0.5 s).
+	// Readable through StelPropertyMgr, e.g. core.getProperty("MoonAvoidance.perfFrameTimeMs")
+	Q_PROPERTY(double perfFrameTimeMs READ getPerfFrameTimeMs NOTIFY perfCountersChanged)
+	Q_PROPERTY(double perfMaxFrameTimeMs READ getPerfMaxFrameTimeMs NOTIFY perfCountersChanged)
+	Q_PROPERTY(double perfVerticesProjected READ getPerfVerticesProjected NOTIFY perfCountersChanged)
+	Q_PROPERTY(double perfArcsSubmitted READ getPerfArcsSubmitted NOTIFY perfCountersChanged)
+	Q_PROPERTY(double perfCacheHitRate READ getPerfCacheHitRate NOTIFY perfCountersChanged)
+	Q_PROPERTY(double perfLabelsPlaced READ getPerfLabelsPlaced NOTIFY perfCountersChanged)
+	Q_PROPERTY(bool perfHudVisible READ isPerfHudVisible WRITE setPerfHudVisible NOTIFY perfHudVisibleChanged)
 
 public:
+	// How avoidance zones are drawn
+	enum ZoneRenderMode
+	{
+		ZoneRenderRings = MoonAvoidanceFrameWorker::RenderRings, // Outline rings with arrows (default)
+		ZoneRenderCaps = MoonAvoidanceFrameWorker::RenderCaps,   // Translucent filled caps
+		ZoneRenderBands = MoonAvoidanceFrameWorker::RenderBands  // Filled bands between neighbouring radii
+	};
+	Q_ENUM(ZoneRenderMode)
+
 	MoonAvoidance();
 	virtual ~MoonAvoidance();
 	
@@ -30,21 +69,79 @@ public:
 	void loadConfiguration();
 	void saveConfiguration();
 	
-	// Dialog
+	// Dialog (created on first use)
 	void showConfigurationDialog();
-	MoonAvoidanceDialog* getDialog() { return configDialog; }
+	MoonAvoidanceDialog* getDialog();
 	
 	// Enable/Disable
 	bool isEnabled() const { return enabled; }
 	void setEnabled(bool b);
 	
+	// Ghost rings (needs the night timeline, i.e. an observer on Earth)
+	bool isGhostRingsVisible() const { return ghostRingsVisible; }
+	void setGhostRingsVisible(bool b);
+	
+	// Objects inside the zones, coloured by the innermost zone holding them
+	bool isCatalogHighlight() const { return catalogHighlight; }
+	void setCatalogHighlight(bool b);
+	
+	ZoneRenderMode getZoneRenderMode() const { return zoneRenderMode; }
+	void setZoneRenderMode(ZoneRenderMode mode);
+	
+	// Horizon clipping: the landscape profile when a landscape is shown, never below the altitude limit
+	bool isHorizonClipping() const { return horizonClipping; }
+	void setHorizonClipping(bool b);
+	double getHorizonAltitude() const { return horizonAltitude; }
+	void setHorizonAltitude(double degrees);
+	
+	// Live preview from the dialog: these filters are drawn instead of the configured
+	// ones until cleared. Nothing is saved; clearing shows the configuration again
+	// from the next frame on.
+	void setPreviewFilters(const QList<FilterConfig>& filters);
+	void clearPreviewFilters();
+	bool isPreviewing() const { return previewActive; }
+	
 	// Get current moon data for dialog calculations
 	double getCurrentMoonAgeDays() const { return lastMoonAgeDays; } // Days since new moon
 	double getCurrentMoonAgeFromFullDays() const { return lastMoonAgeFromFullDays; } // Days from full moon
 	double getCurrentMoonAltitude() const { return lastMoonAltitude; }
+	
+	// Performance counters (see Q_PROPERTY declarations above)
+	double getPerfFrameTimeMs() const { return publishedStats.frameTimeMs; }
+	double getPerfMaxFrameTimeMs() const { return publishedStats.maxFrameTimeMs; }
+	double getPerfVerticesProjected() const { return publishedStats.verticesProjected; }
+	double getPerfArcsSubmitted() const { return publishedStats.arcsSubmitted; }
+	double getPerfCacheHitRate() const { return publishedStats.cacheHitRate; }
+	double getPerfLabelsPlaced() const { return publishedStats.labelsPlaced; }
+	bool isPerfHudVisible() const { return perfHudVisible; }
+	void setPerfHudVisible(bool b);
+	const MoonAvoidanceStats& getStats() const { return stats; }
+
+public slots:
+	// Write the hot-path trace buffer as Chrome trace_event JSON.
+	// Only available in builds configured with MOONAVOIDANCE_TRACING=ON.
+	bool dumpTrace(const QString& path);
+	
+	// Batch evaluation for scripts, without stepping the clock: every target at
+	// every JD (UT) for the current location and the saved filters, from night
+	// ephemerides built once per night. Targets are [ra, dec] arrays or
+	// {ra, dec} objects in J2000 degrees, or "name, ra, dec" strings as in
+	// moonavoid-cli target lists. Returns { filters, separation, radius, allowed }
+	// with flat arrays indexed [(jd * targetCount + target) * filterCount + filter]
+	// (NaN and false for a JD or target that could not be read), or { error }.
+	//   var r = MoonAvoidance.evaluateTargets([2460571.4, 2460571.5], [[83.8, -5.4]]);
+	QVariantMap evaluateTargets(const QVariantList& jds, const QVariantList& targets);
+	QStringList getFilterNames() const;
 
 signals:
 	void enabledChanged(bool enabled);
+	void ghostRingsVisibleChanged(bool visible);
+	void catalogHighlightChanged(bool highlight);
+	void zoneRenderModeChanged(MoonAvoidance::ZoneRenderMode mode);
+	void horizonClippingChanged(bool clipping);
+	void horizonAltitudeChanged(double degrees);
+	void perfCountersChanged();
+	void perfHudVisibleChanged(bool visible);
 
 private:
 	// Moon avoidance calculations
@@ -52,21 +149,133 @@ private:
 	double calculateWidth(const FilterConfig& filter, double moonAltitude) const;
 	double calculateCircleRadius(const FilterConfig& filter, double moonAltitude, double moonAgeDays) const;
 	
+	// Filters to draw: the preview while there is one, else the configuration
+	QList<FilterConfig> activeFilters() const;
+	// Their radii this frame, as the frame worker will draw them
+	QVector<double> currentRadiiDegrees(const QList<FilterConfig>& filters) const;
+	QString selectionInfoText(StelCore* core, const StelObjectP& object, double jd) const;
+	
+	// Moon state for the current frame, from Stellarium or the night timeline
+	void sampleMoon(StelCore* core);
+	bool sampleTimeline(StelCore* core);
+	void collectGhostEpochs(double jd);
+	void refreshHorizon(StelCore* core);
+	
 	// Drawing
-	void drawCircle(StelPainter& painter, const Vec3d& moonPos, double radius, const QColor& color, const QString& filterName, double radiusDegrees, int filterIndex) const;
+	void drawZones(StelCore* core);
+	void drawPerfHud(StelCore* core);
+	void drawHighlights(StelCore* core);
+	void buildHighlightIndex(StelCore* core);
+	void submitZone(StelPainter& painter, const MoonAvoidanceZoneGeometry& zone);
+	
+	// Deferred startup work
+	void ensureDialog();
+	void runDeferredInit();
+	void startMetricsExporter();
+	void stopMetricsExporter();
+	void startQueryServer();
+	void stopQueryServer();
+	void updateQueryContext(StelCore* core);
+	void startSharedState();
+	void publishSharedState(double jd);
+	void updateSelectionInfo(StelCore* core);
 	
 	// Configuration
 	MoonAvoidanceConfig* config;
 	MoonAvoidanceDialog* configDialog;
+	QList<FilterConfig> previewFilters;
+	bool previewActive;
+	quint64 previewRevision; // Bumped on every preview change, for the ghost epochs
+	bool configWriteBackPending; // Config must be rewritten once Stellarium is idle
 	
 	// State
 	bool enabled;
+	ZoneRenderMode zoneRenderMode;
 	LinearFader flagShow;
 	
 	// Moon data
 	double lastMoonAltitude;
 	double lastMoonAgeDays; // Days since new moon (0 = new moon, ~14.77 = full moon)
 	double lastMoonAgeFromFullDays; // Days from full moon (0 = full moon) for formula
+	Vec3d lastMoonDir; // J2000, normalized
+	bool moonValid;
+	double lastSampledJD;
+	
+	// Precomputed night, used while the clock runs fast or is being scrubbed
+	MoonAvoidanceTimeline* timeline;
+	QSharedPointer<const MoonAvoidanceTimelineData> timelineData; // Null until built for the current key
+	MoonAvoidanceTimelineSample timelineSample;
+	bool usingTimeline; // lastMoon* and timelineSample.radiiDegrees came from the timeline
+	
+	// Ghost rings, rebuilt from timelineData when the hour or the timeline changes
+	bool ghostRingsVisible;
+	QVector<MoonAvoidanceGhostEpoch> ghostEpochs;
+	double ghostEpochsHour;
+	QSharedPointer<const MoonAvoidanceTimelineData> ghostEpochsSource;
+	quint64 ghostEpochsPreview; // previewRevision the radii were taken for
+	
+	// Catalog highlighting: deep-sky objects brighter than the limit, then the
+	// user's targets (named), indexed once when first shown
+	bool catalogHighlight;
+	double highlightMaxMagnitude;
+	QSharedPointer<const MoonAvoidanceSkyIndex> highlightIndex;
+	int highlightFirstTarget; // Entries from here on are user targets
+	QStringList highlightTargetNames;
+	QVector<MoonAvoidanceSkyIndex::Hit> highlightHits; // Reused every frame
+	
+	// Horizon lookup table, rebuilt when the landscape, the location or the limit changes
+	bool horizonClipping;
+	double horizonAltitude; // Degrees
+	QSharedPointer<const MoonAvoidanceHorizon> horizon; // Null while clipping is off
+	QString horizonLandscapeId; // Empty for a flat horizon
+	double horizonLatitude;
+	double horizonLongitude;
+	
+	// Performance counters
+	MoonAvoidanceStats stats;
+	MoonAvoidanceStatsSnapshot publishedStats;
+	QElapsedTimer statsClock;
+	bool perfHudVisible;
+	QString perfHudText;
+	
+	// Prometheus exporter (own thread, optional)
+	QThread* metricsThread;
+	MoonAvoidanceMetricsExporter* metricsExporter;
+	
+	// Local query service for sequencers (own thread, optional), and the site,
+	// night and filters it was last given
+	QThread* queryThread;
+	MoonAvoidanceQueryServer* queryServer;
+	MoonAvoidanceTimelineKey queryContextKey;
+	int queryContextElevation;
+	
+	// Verdict for the selected object, added to its info text every frame and
+	// recomputed when the object, the minute, the zones or the timeline change
+	StelObjectP selectionObject;
+	qint64 selectionMinute;
+	quint64 selectionConfigRevision;
+	quint64 selectionPreviewRevision;
+	QSharedPointer<const MoonAvoidanceTimelineData> selectionTimeline;
+	QString selectionInfo;
+	
+	// evaluateTargets(): its own engine on the script thread, and what it was given
+	MoonAvoidanceQueryEngine* scriptEngine;
+	MoonAvoidanceTimelineKey scriptContextKey;
+	int scriptContextElevation;
+	
+	// Live zone state in shared memory, published every sampled frame (optional)
+	MoonAvoidanceSharedStatePublisher* sharedState;
+	
+	// Builds frame state off the render thread (started on first draw)
+	MoonAvoidanceFrameWorker* frameWorker;
+	quint64 frameSerial;
+	quint64 lastCountedSerial;
+	QFont labelFont; // Font labels are drawn with, for the worker's layout
+	
+	// Render thread: screen-space lines of all zones, one draw call per batch
+	MoonAvoidanceLineBatch ghostBatch;
+	MoonAvoidanceLineBatch ringBatch;
+	MoonAvoidanceLineBatch arrowBatch;
 };
 
 #endif // MOONAVOIDANCE_HPP
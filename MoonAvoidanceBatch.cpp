@@ -0,0 +1,293 @@
+#include "MoonAvoidanceBatch.hpp"
+#include "MoonAvoidanceEphemerisCache.hpp"
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QDebug>
+#include <QFuture>
+#include <QIODevice>
+#include <QQueue>
+#include <QTextStream>
+#include <QThreadPool>
+#include <cmath>
+#include <cstdio>
+
+namespace
+{
+	// "2026-03-14T21:35Z"; samples fall on whole minutes
+	void appendIsoTime(QByteArray& out, double jd)
+	{
+		const qint64 minutes = qRound64((jd + 0.5) * 1440.0); // Julian Days start at noon
+		const qint64 day = minutes / 1440;
+		const int minuteOfDay = static_cast<int>(minutes - day * 1440);
+		int year = 0;
+		int month = 0;
+		int dayOfMonth = 0;
+		QDate::fromJulianDay(day).getDate(&year, &month, &dayOfMonth);
+		char buffer[32];
+		const int length = std::snprintf(buffer, sizeof(buffer), "%04d-%02d-%02dT%02d:%02dZ",
+		                                 year, month, dayOfMonth, minuteOfDay / 60, minuteOfDay % 60);
+		out.append(buffer, length);
+	}
+
+	// As csvField(), without a copy for the usual name that needs no quotes
+	QByteArray csvFieldUtf8(const char* data, qint64 size)
+	{
+		const QByteArray raw = QByteArray::fromRawData(data, size);
+		if (!raw.contains(',') && !raw.contains('"') && !raw.contains('\n') && !raw.contains('\r'))
+			return raw;
+		return MoonAvoidanceBatch::csvField(QString::fromUtf8(data, size)).toUtf8();
+	}
+
+	// Rows for count targets, given each one's CSV name field and J2000 direction
+	template <typename NameField, typename Direction>
+	QByteArray evaluateTargets(const MoonAvoidanceBatch::Plan& plan, qint64 count, NameField nameField, Direction direction)
+	{
+		using MoonAvoidanceBatch::Output;
+
+		QVector<QByteArray> filterFields;
+		for (const FilterConfig& filter : plan.filters)
+			filterFields.append(MoonAvoidanceBatch::csvField(filter.name).toUtf8());
+
+		QByteArray rows;
+		QVector<MoonAvoidancePlanner::Usage> usage;
+		for (qint64 i = 0; i < count; ++i)
+		{
+			const QByteArray name = nameField(i);
+			const MoonAvoidanceGeometry::Vector3 dir = direction(i);
+			for (int n = 0; n < plan.nights.size(); ++n)
+			{
+				MoonAvoidancePlanner::evaluate(plan.nights[n], plan.zones[n], dir, plan.minAltitude, usage);
+				for (int k = 0; k < usage.size(); ++k)
+				{
+					if (plan.output == Output::Hours)
+					{
+						rows.append(name).append(',').append(plan.nightDates[n]).append(',').append(filterFields[k]).append(',')
+						    .append(QByteArray::number(usage[k].hours, 'f', 2)).append('\n');
+						continue;
+					}
+					for (const MoonAvoidancePlanner::Window& window : usage[k].windows)
+					{
+						rows.append(name).append(',').append(plan.nightDates[n]).append(',').append(filterFields[k]).append(',');
+						appendIsoTime(rows, window.startJD);
+						rows.append(',');
+						appendIsoTime(rows, window.endJD);
+						rows.append('\n');
+					}
+				}
+			}
+		}
+		return rows;
+	}
+
+	// Writes chunk results in the order they were submitted. At most a few chunks
+	// per thread are pending, so a slow writer holds back the reader.
+	class OrderedWriter
+	{
+	public:
+		OrderedWriter(QIODevice& out, QThreadPool* pool)
+			: out(out)
+			, maxInFlight(qMax(2, 2 * pool->maxThreadCount()))
+			, ok(true)
+		{}
+
+		bool isOk() const { return ok; }
+
+		void write(const QByteArray& data)
+		{
+			if (ok && out.write(data) != data.size())
+				ok = false;
+		}
+
+		void submit(const QFuture<QByteArray>& chunk)
+		{
+			inFlight.enqueue(chunk);
+			while (inFlight.size() >= maxInFlight)
+				write(inFlight.dequeue().result());
+		}
+
+		// Every chunk refers to the plan, so all are waited for even after a write error
+		bool finish()
+		{
+			while (!inFlight.isEmpty())
+				write(inFlight.dequeue().result());
+			return ok;
+		}
+
+	private:
+		QIODevice& out;
+		const int maxInFlight;
+		bool ok;
+		QQueue<QFuture<QByteArray>> inFlight;
+	};
+}
+
+namespace MoonAvoidanceBatch
+{
+
+Plan makePlan(const QDate& firstNight, int nightCount, const MoonAvoidanceEphemeris::Site& site, double deltaTDays,
+              const QList<FilterConfig>& filters, double minAltitude, Output output, QThreadPool* pool,
+              const QString& cacheDirectory)
+{
+	Plan plan;
+	plan.filters = filters;
+	plan.minAltitude = minAltitude;
+	plan.output = output;
+
+	// Local mean noon of the first date; toJulianDay() is the JD of that date's Greenwich noon
+	const double firstWindowStart = MoonAvoidancePlanner::windowStartFor(firstNight.toJulianDay() - site.longitude / 360.0 + 0.001, site.longitude);
+	for (int i = 0; i < nightCount; ++i)
+		plan.nightDates.append(firstNight.addDays(i).toString(Qt::ISODate).toUtf8());
+
+	MoonAvoidanceEphemerisCache::Key key;
+	key.site = site;
+	key.deltaTDays = deltaTDays;
+	QVector<MoonAvoidanceEphemerisCache::NightPointer> cached(nightCount);
+	if (!cacheDirectory.isEmpty())
+		MoonAvoidanceEphemerisCache::load(cacheDirectory, key, firstWindowStart, cached);
+
+	QVector<int> missing;
+	for (int i = 0; i < nightCount; ++i)
+	{
+		if (!cached[i])
+			missing.append(i);
+	}
+	const QVector<MoonAvoidancePlanner::Night> computed = QtConcurrent::blockingMapped<QVector<MoonAvoidancePlanner::Night>>(
+		pool, missing, [site, deltaTDays, firstWindowStart](int i) {
+			return MoonAvoidancePlanner::buildNight(firstWindowStart + i, site, deltaTDays);
+		});
+	for (int k = 0; k < missing.size(); ++k)
+		cached[missing[k]] = MoonAvoidanceEphemerisCache::NightPointer::create(computed[k]);
+
+	QString error;
+	if (!cacheDirectory.isEmpty() && !missing.isEmpty()
+	    && !MoonAvoidanceEphemerisCache::save(cacheDirectory, key, firstWindowStart, cached, &error))
+		qWarning() << "MoonAvoidanceBatch: Ephemeris cache not written -" << error;
+
+	for (const MoonAvoidanceEphemerisCache::NightPointer& night : cached)
+	{
+		plan.nights.append(*night);
+		plan.zones.append(MoonAvoidancePlanner::zoneTable(*night, filters));
+	}
+	return plan;
+}
+
+QByteArray header(const Plan& plan)
+{
+	return plan.output == Output::Hours ? "target,date,filter,hours\n" : "target,date,filter,start,end\n";
+}
+
+QByteArray evaluate(const Plan& plan, const QVector<MoonAvoidancePlanner::Target>& targets)
+{
+	return evaluateTargets(plan, targets.size(),
+		[&targets](qint64 i) { return csvField(targets[i].name).toUtf8(); },
+		[&targets](qint64 i) { return targets[i].dir; });
+}
+
+QByteArray evaluate(const Plan& plan, const MoonAvoidanceCatalog& catalog, qint64 begin, qint64 end)
+{
+	return evaluateTargets(plan, end - begin,
+		[&catalog, begin](qint64 i) {
+			qint64 size = 0;
+			const char* data = catalog.nameData(begin + i, &size);
+			return csvFieldUtf8(data, size);
+		},
+		[&catalog, begin](qint64 i) { return catalog.direction(begin + i); });
+}
+
+bool run(const Plan& plan, QTextStream& in, QIODevice& out, QThreadPool* pool, int chunkSize, Stats& stats,
+         const std::function<void(qint64 line, const QString& error)>& onError)
+{
+	stats = Stats();
+	OrderedWriter writer(out, pool);
+	writer.write(header(plan));
+
+	QVector<MoonAvoidancePlanner::Target> chunk;
+	chunk.reserve(chunkSize);
+	const auto submit = [&]() {
+		if (chunk.isEmpty())
+			return;
+		writer.submit(QtConcurrent::run(pool, [&plan, targets = std::move(chunk)]() { return evaluate(plan, targets); }));
+		chunk = QVector<MoonAvoidancePlanner::Target>();
+		chunk.reserve(chunkSize);
+	};
+
+	QString line;
+	QString error;
+	MoonAvoidancePlanner::Target target;
+	while (writer.isOk() && in.readLineInto(&line))
+	{
+		++stats.lines;
+		if (MoonAvoidancePlanner::parseTarget(line, target, &error))
+		{
+			chunk.append(target);
+			++stats.targets;
+			if (chunk.size() >= chunkSize)
+				submit();
+		}
+		else if (!error.isEmpty())
+		{
+			++stats.rejected;
+			if (onError)
+				onError(stats.lines, error);
+		}
+	}
+	if (writer.isOk())
+		submit();
+	return writer.finish();
+}
+
+bool run(const Plan& plan, const MoonAvoidanceCatalog& catalog, QIODevice& out, QThreadPool* pool, int chunkSize, Stats& stats)
+{
+	stats = Stats();
+	OrderedWriter writer(out, pool);
+	writer.write(header(plan));
+
+	const qint64 count = catalog.count();
+	for (qint64 begin = 0; begin < count && writer.isOk(); begin += chunkSize)
+	{
+		const qint64 end = qMin(count, begin + chunkSize);
+		writer.submit(QtConcurrent::run(pool, [&plan, &catalog, begin, end]() { return evaluate(plan, catalog, begin, end); }));
+		stats.targets += end - begin;
+	}
+	stats.lines = stats.targets;
+	return writer.finish();
+}
+
+void convert(QIODevice& in, MoonAvoidanceCatalogWriter& writer, Stats& stats, quint64& sourceChecksum,
+             const std::function<void(qint64 line, const QString& error)>& onError)
+{
+	stats = Stats();
+	sourceChecksum = MoonAvoidanceCatalogFormat::ChecksumBasis;
+	QString error;
+	MoonAvoidancePlanner::Target target;
+	for (;;)
+	{
+		const QByteArray raw = in.readLine();
+		if (raw.isEmpty())
+			break; // A line holds at least its newline, except a last one without
+		sourceChecksum = MoonAvoidanceCatalogFormat::checksum(raw.constData(), raw.size(), sourceChecksum);
+		++stats.lines;
+		if (MoonAvoidancePlanner::parseTarget(QString::fromUtf8(raw), target, &error))
+		{
+			writer.add(target.name, target.dir);
+			++stats.targets;
+		}
+		else if (!error.isEmpty())
+		{
+			++stats.rejected;
+			if (onError)
+				onError(stats.lines, error);
+		}
+	}
+}
+
+QString csvField(const QString& value)
+{
+	if (!value.contains(',') && !value.contains('"') && !value.contains('\n') && !value.contains('\r'))
+		return value;
+	QString quoted = value;
+	quoted.replace("\"", "\"\"");
+	return "\"" + quoted + "\"";
+}
+
+}
@@ -0,0 +1,85 @@
+#ifndef MOONAVOIDANCEBATCH_HPP
+#define MOONAVOIDANCEBATCH_HPP
+
+#include "MoonAvoidanceCatalog.hpp"
+#include "MoonAvoidanceConfig.hpp"
+#include "MoonAvoidanceEphemeris.hpp"
+#include "MoonAvoidancePlanner.hpp"
+#include <QByteArray>
+#include <QDate>
+#include <QList>
+#include <QString>
+#include <QVector>
+#include <functional>
+
+class QIODevice;
+class QTextStream;
+class QThreadPool;
+
+// Planner evaluation of target lists of any length, as CSV, for moonavoid-cli.
+//
+// The nights (ephemeris and zone tables) are built once. Targets are then read
+// a chunk at a time, each chunk is evaluated and formatted on a thread pool,
+// and chunks are written in input order as they complete. At most a few
+// chunks per thread are in flight, so memory does not grow with the input.
+// A binary catalog (MoonAvoidanceCatalog) skips the parsing: chunks are index
+// ranges evaluated straight from the mapped file.
+namespace MoonAvoidanceBatch
+{
+	enum class Output
+	{
+		Hours,  // target,date,filter,hours: one row per target, night and filter
+		Windows // target,date,filter,start,end: one row per usable window (UTC, ISO 8601)
+	};
+
+	// Everything the workers read; immutable once built
+	struct Plan
+	{
+		QList<FilterConfig> filters;
+		QVector<MoonAvoidancePlanner::Night> nights;
+		QVector<MoonAvoidancePlanner::ZoneTable> zones; // One per night
+		QVector<QByteArray> nightDates;                 // Evening of each night, ISO 8601
+		double minAltitude = 30.0;
+		Output output = Output::Hours;
+	};
+
+	// Nights starting on the evening of firstNight (local mean time at the site);
+	// the ephemerides are read from cacheDirectory when set (see
+	// MoonAvoidanceEphemerisCache), the rest computed in parallel on pool and
+	// written back
+	Plan makePlan(const QDate& firstNight, int nightCount, const MoonAvoidanceEphemeris::Site& site, double deltaTDays,
+	              const QList<FilterConfig>& filters, double minAltitude, Output output, QThreadPool* pool,
+	              const QString& cacheDirectory = QString());
+
+	QByteArray header(const Plan& plan);
+
+	// Rows for the targets in input order
+	QByteArray evaluate(const Plan& plan, const QVector<MoonAvoidancePlanner::Target>& targets);
+	// Rows for catalog entries [begin, end), read in place from the mapping
+	QByteArray evaluate(const Plan& plan, const MoonAvoidanceCatalog& catalog, qint64 begin, qint64 end);
+
+	struct Stats
+	{
+		qint64 lines = 0;
+		qint64 targets = 0;
+		qint64 rejected = 0; // Malformed lines, reported through onError and skipped
+	};
+
+	// Streams targets from in ("name, ra, dec" lines, see MoonAvoidancePlanner::parseTarget)
+	// to CSV on out, header first. Returns false when out fails; stats is filled either way.
+	bool run(const Plan& plan, QTextStream& in, QIODevice& out, QThreadPool* pool, int chunkSize, Stats& stats,
+	         const std::function<void(qint64 line, const QString& error)>& onError);
+
+	// Same for every entry of an open catalog; nothing is parsed or copied up front
+	bool run(const Plan& plan, const MoonAvoidanceCatalog& catalog, QIODevice& out, QThreadPool* pool, int chunkSize, Stats& stats);
+
+	// Target lines from in into writer, one pass. sourceChecksum covers the bytes
+	// read (see MoonAvoidanceCatalog::isBuiltFrom); reading ends at the end of in.
+	void convert(QIODevice& in, MoonAvoidanceCatalogWriter& writer, Stats& stats, quint64& sourceChecksum,
+	             const std::function<void(qint64 line, const QString& error)>& onError);
+
+	// Quoted when it holds a comma, quote or line break (RFC 4180)
+	QString csvField(const QString& value);
+}
+
+#endif // MOONAVOIDANCEBATCH_HPP
@@ -0,0 +1,486 @@
+#include "MoonAvoidanceCalendarWidget.hpp"
+#include "MoonAvoidanceBatch.hpp"
+#include "MoonAvoidanceTimeline.hpp"
+#include <QtConcurrent/QtConcurrentMap>
+#include <QComboBox>
+#include <QDate>
+#include <QDoubleSpinBox>
+#include <QFileDialog>
+#include <QHBoxLayout>
+#include <QHelpEvent>
+#include <QLabel>
+#include <QLineEdit>
+#include <QLocale>
+#include <QPainter>
+#include <QProgressBar>
+#include <QPushButton>
+#include <QSaveFile>
+#include <QSpinBox>
+#include <QTextStream>
+#include <QTimer>
+#include <QToolTip>
+#include <QVBoxLayout>
+#include <QDebug>
+#include <algorithm>
+
+namespace
+{
+	const int DebounceMs = 400;
+
+	// Month-by-day grid of the selected filter's usable hours, shaded by the
+	// longest dark night of the year
+	class CalendarGrid : public QWidget
+	{
+	public:
+		CalendarGrid(const MoonAvoidanceCalendarWidget* owner, QWidget* parent)
+			: QWidget(parent)
+			, owner(owner)
+		{
+			setMinimumSize(LeftMargin + 31 * 12, TopMargin + 12 * 12);
+		}
+
+		QSize sizeHint() const override { return QSize(LeftMargin + 31 * 18, TopMargin + 12 * 18); }
+
+	protected:
+		void paintEvent(QPaintEvent* event) override;
+		bool event(QEvent* event) override;
+
+	private:
+		static const int LeftMargin = 36;
+		static const int TopMargin = 16;
+
+		QRectF cellRect(int month, int day) const;
+		int nightAt(const QPointF& position) const; // -1 outside the year's dates
+
+		const MoonAvoidanceCalendarWidget* owner;
+	};
+
+	QRectF CalendarGrid::cellRect(int month, int day) const
+	{
+		const double cellWidth = (width() - LeftMargin) / 31.0;
+		const double cellHeight = (height() - TopMargin) / 12.0;
+		return QRectF(LeftMargin + (day - 1) * cellWidth, TopMargin + (month - 1) * cellHeight, cellWidth, cellHeight);
+	}
+
+	int CalendarGrid::nightAt(const QPointF& position) const
+	{
+		const MoonAvoidanceCalendarWidget::YearData& data = owner->yearData();
+		const int day = static_cast<int>((position.x() - LeftMargin) / ((width() - LeftMargin) / 31.0)) + 1;
+		const int month = static_cast<int>((position.y() - TopMargin) / ((height() - TopMargin) / 12.0)) + 1;
+		if (data.year == 0 || position.x() < LeftMargin || position.y() < TopMargin || !QDate::isValid(data.year, month, day))
+			return -1;
+		return QDate(data.year, month, day).dayOfYear() - 1;
+	}
+
+	void CalendarGrid::paintEvent(QPaintEvent* event)
+	{
+		Q_UNUSED(event)
+
+		QPainter painter(this);
+		painter.fillRect(rect(), palette().base());
+		const QColor textColor = palette().color(QPalette::Text);
+		QColor pendingColor = textColor;
+		pendingColor.setAlphaF(0.08);
+
+		painter.setPen(textColor);
+		for (int day = 1; day <= 31; day += (day == 1 ? 4 : 5))
+		{
+			const QRectF cell = cellRect(1, day);
+			painter.drawText(QRectF(cell.left() - 10.0, 0.0, cell.width() + 20.0, TopMargin), Qt::AlignCenter, QString::number(day));
+		}
+
+		const MoonAvoidanceCalendarWidget::YearData& data = owner->yearData();
+		const int filter = owner->selectedFilter();
+		const int filterCount = data.filters.size();
+		double longestNight = 1.0;
+		for (int night = 0; night < data.done.size(); ++night)
+		{
+			if (data.done[night])
+				longestNight = qMax(longestNight, data.darkHours[night]);
+		}
+
+		for (int month = 1; month <= 12; ++month)
+		{
+			const QRectF first = cellRect(month, 1);
+			painter.setPen(textColor);
+			painter.drawText(QRectF(0.0, first.top(), LeftMargin - 4.0, first.height()), Qt::AlignRight | Qt::AlignVCenter,
+			                 QLocale::c().monthName(month, QLocale::ShortFormat));
+			if (data.year == 0)
+				continue;
+
+			const int days = QDate(data.year, month, 1).daysInMonth();
+			for (int day = 1; day <= days; ++day)
+			{
+				const QRectF cell = cellRect(month, day).adjusted(1.0, 1.0, -1.0, -1.0);
+				const int night = QDate(data.year, month, day).dayOfYear() - 1;
+				if (night >= data.done.size() || !data.done[night] || filter < 0 || filter >= filterCount)
+				{
+					painter.fillRect(cell, pendingColor);
+					continue;
+				}
+				QColor color = data.filters[filter].color;
+				color.setAlphaF(qBound(0.0, data.hours[night * filterCount + filter] / longestNight, 1.0));
+				painter.fillRect(cell, pendingColor);
+				painter.fillRect(cell, color);
+			}
+		}
+	}
+
+	bool CalendarGrid::event(QEvent* event)
+	{
+		if (event->type() != QEvent::ToolTip)
+			return QWidget::event(event);
+
+		QHelpEvent* help = static_cast<QHelpEvent*>(event);
+		const MoonAvoidanceCalendarWidget::YearData& data = owner->yearData();
+		const int night = nightAt(help->pos());
+		if (night < 0 || night >= data.done.size() || !data.done[night])
+		{
+			QToolTip::hideText();
+			event->ignore();
+			return true;
+		}
+
+		const int filterCount = data.filters.size();
+		QStringList lines;
+		lines << QString("%1: %2 h dark").arg(QDate(data.year, 1, 1).addDays(night).toString(Qt::ISODate))
+		                                  .arg(data.darkHours[night], 0, 'f', 1);
+		for (int k = 0; k < filterCount; ++k)
+			lines << QString("%1: %2 h").arg(data.filters[k].name).arg(data.hours[night * filterCount + k], 0, 'f', 1);
+		QToolTip::showText(help->globalPos(), lines.join('\n'), this);
+		return true;
+	}
+}
+
+MoonAvoidanceCalendarWidget::MoonAvoidanceCalendarWidget(QWidget* parent)
+	: QWidget(parent)
+	, targetEdit(nullptr)
+	, yearSpinBox(nullptr)
+	, minAltitudeSpinBox(nullptr)
+	, filterComboBox(nullptr)
+	, exportButton(nullptr)
+	, progressBar(nullptr)
+	, statusLabel(nullptr)
+	, grid(nullptr)
+	, debounce(nullptr)
+	, latitude(0.0)
+	, longitude(0.0)
+	, elevation(0.0)
+	, deltaTDays(0.0)
+	, hasSite(false)
+	, ephemerisYear(0)
+	, watcher(nullptr)
+	, runBuildsNights(false)
+	, stale(true)
+{
+	QVBoxLayout* layout = new QVBoxLayout(this);
+	layout->setContentsMargins(0, 0, 0, 0);
+
+	QHBoxLayout* inputLayout = new QHBoxLayout();
+	targetEdit = new QLineEdit(this);
+	targetEdit->setPlaceholderText("Target: name, RA, Dec (J2000)");
+	yearSpinBox = new QSpinBox(this);
+	yearSpinBox->setRange(1900, 2100);
+	yearSpinBox->setValue(QDate::currentDate().year());
+	minAltitudeSpinBox = new QDoubleSpinBox(this);
+	minAltitudeSpinBox->setRange(0.0, 80.0);
+	minAltitudeSpinBox->setDecimals(1);
+	minAltitudeSpinBox->setValue(30.0);
+	minAltitudeSpinBox->setSuffix("°");
+	filterComboBox = new QComboBox(this);
+	inputLayout->addWidget(targetEdit, 1);
+	inputLayout->addWidget(new QLabel("Year:", this));
+	inputLayout->addWidget(yearSpinBox);
+	inputLayout->addWidget(new QLabel("Min Altitude:", this));
+	inputLayout->addWidget(minAltitudeSpinBox);
+	inputLayout->addWidget(new QLabel("Show:", this));
+	inputLayout->addWidget(filterComboBox);
+	layout->addLayout(inputLayout);
+
+	grid = new CalendarGrid(this, this);
+	layout->addWidget(grid, 1);
+
+	QHBoxLayout* statusLayout = new QHBoxLayout();
+	progressBar = new QProgressBar(this);
+	progressBar->setVisible(false);
+	statusLabel = new QLabel(this);
+	exportButton = new QPushButton("Export CSV...", this);
+	exportButton->setEnabled(false);
+	statusLayout->addWidget(progressBar, 1);
+	statusLayout->addWidget(statusLabel, 1);
+	statusLayout->addWidget(exportButton);
+	layout->addLayout(statusLayout);
+
+	debounce = new QTimer(this);
+	debounce->setSingleShot(true);
+	debounce->setInterval(DebounceMs);
+	connect(debounce, &QTimer::timeout, this, &MoonAvoidanceCalendarWidget::start);
+
+	connect(targetEdit, &QLineEdit::textChanged, this, &MoonAvoidanceCalendarWidget::onInputsEdited);
+	connect(yearSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), this, &MoonAvoidanceCalendarWidget::onInputsEdited);
+	connect(minAltitudeSpinBox, QOverload<double>::of(&QDoubleSpinBox::valueChanged), this, &MoonAvoidanceCalendarWidget::onInputsEdited);
+	connect(filterComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged), grid, QOverload<>::of(&QWidget::update));
+	connect(exportButton, &QPushButton::clicked, this, &MoonAvoidanceCalendarWidget::exportCsv);
+}
+
+MoonAvoidanceCalendarWidget::~MoonAvoidanceCalendarWidget()
+{
+	stop();
+}
+
+void MoonAvoidanceCalendarWidget::setSite(double lat, double lon, double elev, double deltaT)
+{
+	if (hasSite && lat == latitude && lon == longitude && elev == elevation)
+		return;
+
+	hasSite = true;
+	latitude = lat;
+	longitude = lon;
+	elevation = elev;
+	deltaTDays = deltaT;
+	nights.clear();
+	start();
+}
+
+void MoonAvoidanceCalendarWidget::setFilters(const QList<FilterConfig>& newFilters)
+{
+	filters = newFilters;
+
+	const int selected = filterComboBox->currentIndex();
+	filterComboBox->blockSignals(true);
+	filterComboBox->clear();
+	for (const FilterConfig& filter : filters)
+		filterComboBox->addItem(filter.name);
+	filterComboBox->setCurrentIndex(qBound(0, selected, filters.size() - 1));
+	filterComboBox->blockSignals(false);
+
+	onInputsEdited();
+}
+
+void MoonAvoidanceCalendarWidget::setTarget(const QString& name, double raDegrees, double decDegrees)
+{
+	targetEdit->setText(QString("%1, %2, %3").arg(name).arg(raDegrees, 0, 'f', 5).arg(decDegrees, 0, 'f', 5));
+}
+
+int MoonAvoidanceCalendarWidget::selectedFilter() const
+{
+	return filterComboBox ? filterComboBox->currentIndex() : -1;
+}
+
+void MoonAvoidanceCalendarWidget::showEvent(QShowEvent* event)
+{
+	QWidget::showEvent(event);
+	if (stale)
+		start();
+}
+
+void MoonAvoidanceCalendarWidget::onInputsEdited()
+{
+	stop();
+	progressBar->setVisible(false);
+	stale = true;
+	debounce->start();
+}
+
+double MoonAvoidanceCalendarWidget::firstNightJD() const
+{
+	// Local mean noon of January 1st (the Julian Day Number is noon UT of the date)
+	const double noon = QDate(yearSpinBox->value(), 1, 1).toJulianDay() - longitude / 360.0;
+	return MoonAvoidanceTimeline::windowStartFor(noon + 0.001, longitude);
+}
+
+void MoonAvoidanceCalendarWidget::start()
+{
+	debounce->stop();
+	stop();
+	if (!isVisible() || !hasSite)
+	{
+		stale = true;
+		return;
+	}
+	stale = false;
+
+	MoonAvoidancePlanner::Target target;
+	QString error;
+	if (!MoonAvoidancePlanner::parseTarget(targetEdit->text(), target, &error) || filters.isEmpty())
+	{
+		data = YearData();
+		grid->update();
+		exportButton->setEnabled(false);
+		statusLabel->setText(!error.isEmpty() ? error : filters.isEmpty() ? QString("No filters") : QString("Enter a target"));
+		return;
+	}
+
+	const int year = yearSpinBox->value();
+	const int nightCount = QDate(year, 1, 1).daysInYear();
+	if (ephemerisYear != year || nights.size() != nightCount)
+	{
+		nights.clear();
+		nights.resize(nightCount);
+		ephemerisYear = year;
+	}
+
+	data.year = year;
+	data.targetName = target.name;
+	data.filters = filters;
+	data.done.fill(false, nightCount);
+	data.darkHours.fill(0.0, nightCount);
+	data.hours.fill(0.0, nightCount * filters.size());
+	grid->update();
+
+	const double firstNight = firstNightJD();
+	const MoonAvoidanceEphemerisCache::Key key = cacheKey();
+	MoonAvoidanceEphemerisCache::load(MoonAvoidanceEphemerisCache::defaultDirectory(), key, firstNight, nights);
+	runBuildsNights = nights.contains(QSharedPointer<const MoonAvoidancePlanner::Night>());
+
+	QVector<Task> tasks;
+	tasks.reserve(nightCount);
+	for (int night = 0; night < nightCount; ++night)
+		tasks.append({ night, firstNight + night, nights[night] });
+
+	// Copies only: the tasks never touch the widget
+	const QVector<MoonAvoidancePlanner::Target> taskTargets { target };
+	const QList<FilterConfig> taskFilters = filters;
+	const MoonAvoidanceEphemeris::Site site = key.site;
+	const double deltaT = deltaTDays;
+	const double minAltitude = minAltitudeSpinBox->value();
+
+	QFuture<TaskResult> future = QtConcurrent::mapped(tasks, [=](const Task& task) -> TaskResult {
+		TaskResult result;
+		result.night = task.night;
+		result.ephemeris = task.ephemeris;
+		if (!result.ephemeris)
+			result.ephemeris.reset(new MoonAvoidancePlanner::Night(MoonAvoidancePlanner::buildNight(task.windowStartJD, site, deltaT)));
+		result.darkHours = MoonAvoidancePlanner::darkHours(*result.ephemeris);
+		const QVector<MoonAvoidancePlanner::Usage> usage =
+			MoonAvoidancePlanner::evaluateNight(*result.ephemeris, taskTargets, taskFilters, minAltitude);
+		result.hours.reserve(usage.size());
+		for (const MoonAvoidancePlanner::Usage& filterUsage : usage)
+			result.hours.append(filterUsage.hours);
+		return result;
+	});
+
+	QFutureWatcher<TaskResult>* runWatcher = new QFutureWatcher<TaskResult>(this);
+	watcher = runWatcher;
+	connect(runWatcher, &QFutureWatcherBase::resultReadyAt, this, [this, runWatcher](int index) {
+		applyResult(runWatcher->resultAt(index));
+	});
+	connect(runWatcher, &QFutureWatcherBase::progressRangeChanged, progressBar, &QProgressBar::setRange);
+	connect(runWatcher, &QFutureWatcherBase::progressValueChanged, progressBar, &QProgressBar::setValue);
+	connect(runWatcher, &QFutureWatcherBase::finished, this, [this, runWatcher]() { finish(runWatcher); });
+	runWatcher->setFuture(future);
+
+	runClock.start();
+	progressBar->setValue(0);
+	progressBar->setVisible(true);
+	exportButton->setEnabled(false);
+	statusLabel->setText(QString("Computing %1...").arg(year));
+}
+
+void MoonAvoidanceCalendarWidget::stop()
+{
+	if (!watcher)
+		return;
+
+	watcher->disconnect(this);
+	watcher->disconnect(progressBar);
+	watcher->cancel();
+	watcher->deleteLater();
+	watcher = nullptr;
+}
+
+void MoonAvoidanceCalendarWidget::applyResult(const TaskResult& result)
+{
+	if (result.night < 0 || result.night >= data.done.size() || result.hours.size() != data.filters.size())
+		return;
+
+	if (result.night < nights.size())
+		nights[result.night] = result.ephemeris;
+	data.done[result.night] = true;
+	data.darkHours[result.night] = result.darkHours;
+	std::copy(result.hours.constBegin(), result.hours.constEnd(), data.hours.begin() + result.night * data.filters.size());
+	grid->update(); // Repaints are coalesced by Qt
+}
+
+void MoonAvoidanceCalendarWidget::finish(QFutureWatcher<TaskResult>* finished)
+{
+	if (finished != watcher)
+		return;
+
+	const qint64 elapsedMs = runClock.elapsed();
+	watcher->deleteLater();
+	watcher = nullptr;
+	progressBar->setVisible(false);
+	exportButton->setEnabled(true);
+
+	if (runBuildsNights)
+	{
+		// The year box may already show another year, waiting for the pause to end
+		const double noon = QDate(ephemerisYear, 1, 1).toJulianDay() - longitude / 360.0;
+		const double firstNight = MoonAvoidanceTimeline::windowStartFor(noon + 0.001, longitude);
+		MoonAvoidanceEphemerisCache::saveInBackground(MoonAvoidanceEphemerisCache::defaultDirectory(), cacheKey(), firstNight, nights);
+		runBuildsNights = false;
+	}
+
+	const QString status = QString("%1, %2: %3 nights × %4 filters in %5 ms")
+		.arg(data.targetName).arg(data.year).arg(data.done.size()).arg(data.filters.size()).arg(elapsedMs);
+	statusLabel->setText(status);
+	qDebug() << "MoonAvoidanceCalendarWidget:" << status;
+}
+
+MoonAvoidanceEphemerisCache::Key MoonAvoidanceCalendarWidget::cacheKey() const
+{
+	MoonAvoidanceEphemerisCache::Key key;
+	key.site = { latitude, longitude, elevation };
+	key.deltaTDays = deltaTDays;
+	return key;
+}
+
+void MoonAvoidanceCalendarWidget::writeCsv(QTextStream& out) const
+{
+	out << "date,dark_hours";
+	for (const FilterConfig& filter : data.filters)
+		out << ',' << MoonAvoidanceBatch::csvField(filter.name);
+	out << '\n';
+
+	const int filterCount = data.filters.size();
+	const QDate first(data.year, 1, 1);
+	for (int night = 0; night < data.done.size(); ++night)
+	{
+		if (!data.done[night])
+			continue;
+		out << first.addDays(night).toString(Qt::ISODate) << ',' << QString::number(data.darkHours[night], 'f', 2);
+		for (int k = 0; k < filterCount; ++k)
+			out << ',' << QString::number(data.hours[night * filterCount + k], 'f', 2);
+		out << '\n';
+	}
+}
+
+void MoonAvoidanceCalendarWidget::exportCsv()
+{
+	if (data.year == 0)
+		return;
+
+	const QString suggested = QString("%1-%2.csv").arg(data.targetName).arg(data.year).replace(' ', '_');
+	const QString path = QFileDialog::getSaveFileName(this, "Export Calendar", suggested, "CSV files (*.csv)");
+	if (path.isEmpty())
+		return;
+
+	QSaveFile file(path);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+	{
+		qWarning() << "MoonAvoidanceCalendarWidget: Cannot write" << path << "-" << file.errorString();
+		statusLabel->setText(QString("Cannot write %1").arg(path));
+		return;
+	}
+	QTextStream out(&file);
+	writeCsv(out);
+	out.flush();
+	if (!file.commit())
+	{
+		qWarning() << "MoonAvoidanceCalendarWidget: Cannot write" << path << "-" << file.errorString();
+		statusLabel->setText(QString("Cannot write %1").arg(path));
+		return;
+	}
+	statusLabel->setText(QString("Exported to %1").arg(path));
+}
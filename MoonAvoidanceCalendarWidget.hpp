@@ -0,0 +1,123 @@
+#ifndef MOONAVOIDANCECALENDARWIDGET_HPP
+#define MOONAVOIDANCECALENDARWIDGET_HPP
+
+#include "MoonAvoidanceConfig.hpp"
+#include "MoonAvoidanceEphemerisCache.hpp"
+#include "MoonAvoidancePlanner.hpp"
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QList>
+#include <QSharedPointer>
+#include <QVector>
+#include <QWidget>
+
+class QComboBox;
+class QDoubleSpinBox;
+class QLabel;
+class QLineEdit;
+class QProgressBar;
+class QPushButton;
+class QSpinBox;
+class QTextStream;
+class QTimer;
+
+// Usable hours of one target on every night of a year, per filter, shown in
+// the Calendar tab as a month-by-day grid and exported as CSV.
+//
+// Same machinery as the planner: one task per night on QtConcurrent's global
+// pool, cancelled and restarted when an input changes. The year's night
+// ephemerides are kept while the site and year stay the same, so another
+// target, altitude limit or filter set only re-evaluates the kernel, a few
+// milliseconds for the whole year.
+class MoonAvoidanceCalendarWidget : public QWidget
+{
+	Q_OBJECT
+
+public:
+	// One entry per night of the year; night i starts on the evening of day i + 1
+	struct YearData
+	{
+		int year = 0;
+		QString targetName;
+		QList<FilterConfig> filters;
+		QVector<bool> done;
+		QVector<double> darkHours;
+		QVector<double> hours; // night * filters.size() + filter
+	};
+
+	explicit MoonAvoidanceCalendarWidget(QWidget* parent = nullptr);
+	~MoonAvoidanceCalendarWidget() override;
+
+	// Observer; a new location recomputes the year's ephemerides (or reads them
+	// from MoonAvoidanceEphemerisCache)
+	void setSite(double latitude, double longitude, double elevation, double deltaTDays);
+	void setFilters(const QList<FilterConfig>& filters);
+	void setTarget(const QString& name, double raDegrees, double decDegrees);
+
+	const YearData& yearData() const { return data; }
+	int selectedFilter() const;
+
+	// Header, then one line per computed night: date, dark hours, usable hours per filter
+	void writeCsv(QTextStream& out) const;
+
+protected:
+	void showEvent(QShowEvent* event) override;
+
+private slots:
+	void onInputsEdited();
+	void start();
+	void exportCsv();
+
+private:
+	struct Task
+	{
+		int night;
+		double windowStartJD;
+		QSharedPointer<const MoonAvoidancePlanner::Night> ephemeris; // Null: compute it
+	};
+
+	struct TaskResult
+	{
+		int night = 0;
+		QSharedPointer<const MoonAvoidancePlanner::Night> ephemeris;
+		double darkHours = 0.0;
+		QVector<double> hours; // One per filter
+	};
+
+	void stop();
+	void applyResult(const TaskResult& result);
+	void finish(QFutureWatcher<TaskResult>* finished);
+	double firstNightJD() const;
+	MoonAvoidanceEphemerisCache::Key cacheKey() const;
+
+	QLineEdit* targetEdit;
+	QSpinBox* yearSpinBox;
+	QDoubleSpinBox* minAltitudeSpinBox;
+	QComboBox* filterComboBox;
+	QPushButton* exportButton;
+	QProgressBar* progressBar;
+	QLabel* statusLabel;
+	QWidget* grid;
+	QTimer* debounce;
+
+	// Inputs
+	QList<FilterConfig> filters;
+	double latitude;
+	double longitude;
+	double elevation;
+	double deltaTDays;
+	bool hasSite;
+
+	YearData data;
+
+	// Ephemerides of the year's nights, for ephemerisYear at the current site
+	QVector<QSharedPointer<const MoonAvoidancePlanner::Night>> nights;
+	int ephemerisYear;
+
+	QFutureWatcher<TaskResult>* watcher;
+	bool runBuildsNights; // Some ephemerides were not cached
+	QElapsedTimer runClock;
+	bool stale;
+};
+
+#endif // MOONAVOIDANCECALENDARWIDGET_HPP
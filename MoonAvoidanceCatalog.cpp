@@ -0,0 +1,318 @@
+#include "MoonAvoidanceCatalog.hpp"
+#include <QByteArray>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <cstddef>
+#include <cstring>
+
+namespace
+{
+	using MoonAvoidanceCatalogFormat::Header;
+
+	const qint64 CopyBlockBytes = 1 << 20;
+
+	bool fail(QString* error, const QString& message)
+	{
+		if (error)
+			*error = message;
+		return false;
+	}
+
+	// offset and size lie within a file of fileSize bytes, without overflow
+	bool fits(quint64 offset, quint64 size, quint64 fileSize)
+	{
+		return offset <= fileSize && size <= fileSize - offset;
+	}
+
+	bool aligned(quint64 offset)
+	{
+		return offset % MoonAvoidanceCatalogFormat::Alignment == 0 && offset >= sizeof(Header);
+	}
+
+	quint64 headerChecksum(const Header& header)
+	{
+		return MoonAvoidanceCatalogFormat::checksum(reinterpret_cast<const char*>(&header), offsetof(Header, headerChecksum));
+	}
+}
+
+namespace MoonAvoidanceCatalogFormat
+{
+
+quint64 checksum(const char* data, qint64 size, quint64 basis)
+{
+	quint64 hash = basis;
+	for (qint64 i = 0; i < size; ++i)
+	{
+		hash ^= static_cast<uchar>(data[i]);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+Source sourceOf(const QString& path)
+{
+	const QFileInfo info(path);
+	Source source;
+	source.size = static_cast<quint64>(info.size());
+	source.modifiedMs = info.lastModified().toMSecsSinceEpoch();
+	return source;
+}
+
+}
+
+MoonAvoidanceCatalog::MoonAvoidanceCatalog()
+	: mapping(nullptr)
+	, header(nullptr)
+	, x(nullptr)
+	, y(nullptr)
+	, z(nullptr)
+	, nameOffsets(nullptr)
+	, strings(nullptr)
+{
+}
+
+MoonAvoidanceCatalog::~MoonAvoidanceCatalog()
+{
+	close();
+}
+
+bool MoonAvoidanceCatalog::open(const QString& path, bool verifyPayload, QString* error)
+{
+	close();
+
+#if Q_BYTE_ORDER != Q_LITTLE_ENDIAN
+	Q_UNUSED(verifyPayload)
+	return fail(error, "Catalogs are little-endian; this host is not");
+#else
+	file.setFileName(path);
+	if (!file.open(QIODevice::ReadOnly))
+		return fail(error, QString("Cannot open %1: %2").arg(path, file.errorString()));
+
+	const quint64 size = static_cast<quint64>(file.size());
+	uchar* map = size >= sizeof(Header) ? file.map(0, file.size()) : nullptr;
+	if (!map)
+	{
+		file.close();
+		return fail(error, QString("%1 is not a catalog").arg(path));
+	}
+
+	// Mapped, so close() unmaps whatever goes wrong below
+	mapping = map;
+	const Header* h = reinterpret_cast<const Header*>(map);
+	const quint64 componentBytes = h->componentBytes;
+	const quint64 count = h->count;
+	QString problem;
+	if (std::memcmp(h->magic, MoonAvoidanceCatalogFormat::Magic, sizeof(h->magic)) != 0)
+		problem = "not a catalog";
+	else if (h->version != MoonAvoidanceCatalogFormat::Version)
+		problem = QString("unsupported version %1").arg(h->version);
+	else if (h->headerChecksum != headerChecksum(*h))
+		problem = "header checksum mismatch";
+	else if (h->fileSize != size)
+		problem = "truncated or extended since it was written";
+	else if ((componentBytes != 4 && componentBytes != 8) || count > size / (3 * componentBytes))
+		problem = "inconsistent header";
+	else if (!aligned(h->xOffset) || !aligned(h->yOffset) || !aligned(h->zOffset) || !aligned(h->nameOffsetsOffset)
+	         || !aligned(h->stringsOffset)
+	         || !fits(h->xOffset, count * componentBytes, size) || !fits(h->yOffset, count * componentBytes, size)
+	         || !fits(h->zOffset, count * componentBytes, size) || !fits(h->nameOffsetsOffset, (count + 1) * 8, size)
+	         || !fits(h->stringsOffset, h->stringsSize, size))
+		problem = "sections out of bounds";
+	if (problem.isEmpty())
+	{
+		const quint64* offsets = reinterpret_cast<const quint64*>(map + h->nameOffsetsOffset);
+		if (offsets[0] != 0 || offsets[count] != h->stringsSize)
+			problem = "inconsistent name table";
+		else if (verifyPayload && MoonAvoidanceCatalogFormat::checksum(reinterpret_cast<const char*>(map) + sizeof(Header),
+		                                                                size - sizeof(Header)) != h->payloadChecksum)
+			problem = "payload checksum mismatch";
+	}
+	if (!problem.isEmpty())
+	{
+		close();
+		return fail(error, QString("%1: %2").arg(path, problem));
+	}
+
+	header = h;
+	x = map + h->xOffset;
+	y = map + h->yOffset;
+	z = map + h->zOffset;
+	nameOffsets = reinterpret_cast<const quint64*>(map + h->nameOffsetsOffset);
+	strings = reinterpret_cast<const char*>(map + h->stringsOffset);
+	return true;
+#endif
+}
+
+void MoonAvoidanceCatalog::close()
+{
+	if (mapping)
+		file.unmap(const_cast<uchar*>(mapping));
+	if (file.isOpen())
+		file.close();
+	mapping = nullptr;
+	header = nullptr;
+	x = nullptr;
+	y = nullptr;
+	z = nullptr;
+	nameOffsets = nullptr;
+	strings = nullptr;
+}
+
+const char* MoonAvoidanceCatalog::nameData(qint64 index, qint64* size) const
+{
+	*size = 0;
+	if (!header || index < 0 || index >= count())
+		return nullptr;
+	const quint64 begin = nameOffsets[index];
+	const quint64 end = nameOffsets[index + 1];
+	if (begin > end || end > header->stringsSize)
+		return nullptr;
+	*size = static_cast<qint64>(end - begin);
+	return strings + begin;
+}
+
+QString MoonAvoidanceCatalog::name(qint64 index) const
+{
+	qint64 size = 0;
+	const char* data = nameData(index, &size);
+	return data ? QString::fromUtf8(data, size) : QString();
+}
+
+MoonAvoidanceCatalogFormat::Source MoonAvoidanceCatalog::source() const
+{
+	MoonAvoidanceCatalogFormat::Source result;
+	if (header)
+	{
+		result.size = header->sourceSize;
+		result.modifiedMs = header->sourceModifiedMs;
+		result.checksum = header->sourceChecksum;
+	}
+	return result;
+}
+
+bool MoonAvoidanceCatalog::isBuiltFrom(const QString& csvPath) const
+{
+	if (!header)
+		return false;
+	const MoonAvoidanceCatalogFormat::Source current = MoonAvoidanceCatalogFormat::sourceOf(csvPath);
+	if (current.size != header->sourceSize)
+		return false;
+	if (current.modifiedMs == header->sourceModifiedMs)
+		return true;
+
+	// Touched but perhaps not changed
+	QFile csv(csvPath);
+	if (!csv.open(QIODevice::ReadOnly))
+		return false;
+	quint64 hash = MoonAvoidanceCatalogFormat::ChecksumBasis;
+	QByteArray block;
+	while (!(block = csv.read(CopyBlockBytes)).isEmpty())
+		hash = MoonAvoidanceCatalogFormat::checksum(block.constData(), block.size(), hash);
+	return hash == header->sourceChecksum;
+}
+
+MoonAvoidanceCatalogWriter::MoonAvoidanceCatalogWriter(bool doublePrecision)
+	: doublePrecision(doublePrecision)
+	, written(0)
+	, stringsSize(0)
+{
+}
+
+bool MoonAvoidanceCatalogWriter::begin(QString* error)
+{
+	written = 0;
+	stringsSize = 0;
+	for (QTemporaryFile* spool : { &xSpool, &ySpool, &zSpool, &nameOffsetSpool, &stringSpool })
+	{
+		if (!spool->open() || !spool->resize(0))
+			return fail(error, QString("Cannot create a temporary file: %1").arg(spool->errorString()));
+	}
+	nameOffsetSpool.write(reinterpret_cast<const char*>(&stringsSize), sizeof(stringsSize));
+	return true;
+}
+
+void MoonAvoidanceCatalogWriter::add(const QString& name, const MoonAvoidanceGeometry::Vector3& dir)
+{
+	if (doublePrecision)
+	{
+		xSpool.write(reinterpret_cast<const char*>(&dir.x), sizeof(double));
+		ySpool.write(reinterpret_cast<const char*>(&dir.y), sizeof(double));
+		zSpool.write(reinterpret_cast<const char*>(&dir.z), sizeof(double));
+	}
+	else
+	{
+		const float fx = static_cast<float>(dir.x);
+		const float fy = static_cast<float>(dir.y);
+		const float fz = static_cast<float>(dir.z);
+		xSpool.write(reinterpret_cast<const char*>(&fx), sizeof(float));
+		ySpool.write(reinterpret_cast<const char*>(&fy), sizeof(float));
+		zSpool.write(reinterpret_cast<const char*>(&fz), sizeof(float));
+	}
+
+	const QByteArray utf8 = name.toUtf8();
+	stringSpool.write(utf8);
+	stringsSize += static_cast<quint64>(utf8.size());
+	nameOffsetSpool.write(reinterpret_cast<const char*>(&stringsSize), sizeof(stringsSize));
+	++written;
+}
+
+bool MoonAvoidanceCatalogWriter::finish(const QString& path, const MoonAvoidanceCatalogFormat::Source& source, QString* error)
+{
+	QSaveFile out(path);
+	if (!out.open(QIODevice::WriteOnly))
+		return fail(error, QString("Cannot write %1: %2").arg(path, out.errorString()));
+
+	Header header;
+	std::memset(&header, 0, sizeof(header));
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header)); // Rewritten once complete
+
+	quint64 position = sizeof(Header);
+	quint64 payloadChecksum = MoonAvoidanceCatalogFormat::ChecksumBasis;
+	const auto put = [&](const char* data, qint64 size) {
+		payloadChecksum = MoonAvoidanceCatalogFormat::checksum(data, size, payloadChecksum);
+		position += static_cast<quint64>(size);
+		return out.write(data, size) == size;
+	};
+	// Pads to the next section boundary, copies the spool and returns where it starts
+	const auto section = [&](QTemporaryFile& spool, quint64& offset) {
+		static const char zeros[MoonAvoidanceCatalogFormat::Alignment] = {};
+		const qint64 padding = (MoonAvoidanceCatalogFormat::Alignment - position % MoonAvoidanceCatalogFormat::Alignment)
+		                       % MoonAvoidanceCatalogFormat::Alignment;
+		if (padding > 0 && !put(zeros, padding))
+			return false;
+		offset = position;
+		if (!spool.flush() || !spool.seek(0))
+			return false;
+		QByteArray block;
+		while (!(block = spool.read(CopyBlockBytes)).isEmpty())
+		{
+			if (!put(block.constData(), block.size()))
+				return false;
+		}
+		return spool.error() == QFileDevice::NoError;
+	};
+
+	if (!section(xSpool, header.xOffset) || !section(ySpool, header.yOffset) || !section(zSpool, header.zOffset)
+	    || !section(nameOffsetSpool, header.nameOffsetsOffset) || !section(stringSpool, header.stringsOffset))
+	{
+		out.cancelWriting();
+		return fail(error, QString("Cannot write %1: %2").arg(path, out.errorString()));
+	}
+
+	std::memcpy(header.magic, MoonAvoidanceCatalogFormat::Magic, sizeof(header.magic));
+	header.version = MoonAvoidanceCatalogFormat::Version;
+	header.componentBytes = doublePrecision ? 8 : 4;
+	header.count = static_cast<quint64>(written);
+	header.stringsSize = stringsSize;
+	header.fileSize = position;
+	header.sourceSize = source.size;
+	header.sourceModifiedMs = source.modifiedMs;
+	header.sourceChecksum = source.checksum;
+	header.payloadChecksum = payloadChecksum;
+	header.headerChecksum = headerChecksum(header);
+
+	if (!out.seek(0) || out.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header) || !out.commit())
+		return fail(error, QString("Cannot write %1: %2").arg(path, out.errorString()));
+	return true;
+}
@@ -0,0 +1,151 @@
+#ifndef MOONAVOIDANCECATALOG_HPP
+#define MOONAVOIDANCECATALOG_HPP
+
+#include "MoonAvoidanceGeometry.hpp"
+#include <QFile>
+#include <QString>
+#include <QTemporaryFile>
+#include <QtGlobal>
+
+// Binary target catalog, memory-mapped for screening without parsing or copying.
+//
+// File layout, version 1, little-endian:
+//
+//   Header, 128 bytes (below)
+//   x[count], y[count], z[count]   J2000 unit vectors, float32 or float64
+//   nameOffsets[count + 1]         uint64 into the string table
+//   strings                        names, UTF-8, not terminated
+//
+// Every section starts on a 64-byte boundary, zero padded. The payload
+// checksum covers everything after the header, the header checksum the
+// header fields before it; both are 64-bit FNV-1a. The source fields
+// identify the CSV the catalog was built from, so a stale catalog can be
+// detected and rebuilt.
+namespace MoonAvoidanceCatalogFormat
+{
+	const char Magic[8] = { 'M', 'A', 'V', 'C', 'A', 'T', '\0', '\0' };
+	const quint32 Version = 1;
+	const qint64 Alignment = 64;
+
+	struct Header
+	{
+		char magic[8];
+		quint32 version;
+		quint32 componentBytes;   // 4 or 8
+		quint64 count;
+		quint64 xOffset;
+		quint64 yOffset;
+		quint64 zOffset;
+		quint64 nameOffsetsOffset;
+		quint64 stringsOffset;
+		quint64 stringsSize;
+		quint64 fileSize;
+		quint64 sourceSize;
+		qint64 sourceModifiedMs;  // Milliseconds since the epoch, UTC
+		quint64 sourceChecksum;
+		quint64 payloadChecksum;
+		quint64 headerChecksum;   // Of the bytes before this field
+		quint64 reserved;
+	};
+	static_assert(sizeof(Header) == 128, "The catalog header is two cache lines");
+
+	const quint64 ChecksumBasis = 14695981039346656037ULL;
+
+	// 64-bit FNV-1a; pass the previous result as basis to continue a checksum
+	quint64 checksum(const char* data, qint64 size, quint64 basis = ChecksumBasis);
+
+	// The CSV a catalog is built from
+	struct Source
+	{
+		quint64 size = 0;
+		qint64 modifiedMs = 0;
+		quint64 checksum = 0;
+	};
+
+	// Size and modification time of a file; checksum left at 0
+	Source sourceOf(const QString& path);
+}
+
+// Read-only view of a catalog file. The arrays point into the mapping and stay
+// valid until close() or destruction; the object can be shared by threads.
+class MoonAvoidanceCatalog
+{
+public:
+	MoonAvoidanceCatalog();
+	~MoonAvoidanceCatalog();
+
+	// Maps the file and checks the header; verifyPayload also checksums the
+	// arrays and names (one pass over the file)
+	bool open(const QString& path, bool verifyPayload, QString* error = nullptr);
+	void close();
+	bool isOpen() const { return header != nullptr; }
+
+	qint64 count() const { return header ? static_cast<qint64>(header->count) : 0; }
+	bool isDoublePrecision() const { return header && header->componentBytes == 8; }
+
+	MoonAvoidanceGeometry::Vector3 direction(qint64 index) const
+	{
+		if (isDoublePrecision())
+		{
+			const double* dx = reinterpret_cast<const double*>(x);
+			const double* dy = reinterpret_cast<const double*>(y);
+			const double* dz = reinterpret_cast<const double*>(z);
+			return { dx[index], dy[index], dz[index] };
+		}
+		const float* fx = reinterpret_cast<const float*>(x);
+		const float* fy = reinterpret_cast<const float*>(y);
+		const float* fz = reinterpret_cast<const float*>(z);
+		return { fx[index], fy[index], fz[index] };
+	}
+
+	QString name(qint64 index) const;
+	// UTF-8 bytes of the name, pointing into the mapping
+	const char* nameData(qint64 index, qint64* size) const;
+
+	MoonAvoidanceCatalogFormat::Source source() const;
+
+	// True when path still has the size and modification time the catalog was
+	// built from, or else the same content (checksummed, no parsing)
+	bool isBuiltFrom(const QString& csvPath) const;
+
+private:
+	QFile file;
+	const uchar* mapping;
+	const MoonAvoidanceCatalogFormat::Header* header;
+	const uchar* x;
+	const uchar* y;
+	const uchar* z;
+	const quint64* nameOffsets;
+	const char* strings;
+
+	Q_DISABLE_COPY(MoonAvoidanceCatalog)
+};
+
+// Writes a catalog from targets added one at a time. The columns are spooled
+// to temporary files, so memory stays flat however many targets are added.
+class MoonAvoidanceCatalogWriter
+{
+public:
+	explicit MoonAvoidanceCatalogWriter(bool doublePrecision);
+
+	bool begin(QString* error = nullptr);
+	void add(const QString& name, const MoonAvoidanceGeometry::Vector3& dir);
+	qint64 count() const { return written; }
+
+	// Assembles the file; it replaces path only when complete
+	bool finish(const QString& path, const MoonAvoidanceCatalogFormat::Source& source, QString* error = nullptr);
+
+private:
+	bool doublePrecision;
+	qint64 written;
+	quint64 stringsSize;
+	QTemporaryFile xSpool;
+	QTemporaryFile ySpool;
+	QTemporaryFile zSpool;
+	QTemporaryFile nameOffsetSpool;
+	QTemporaryFile stringSpool;
+
+	Q_DISABLE_COPY(MoonAvoidanceCatalogWriter)
+};
+
+#endif // MOONAVOIDANCECATALOG_HPP
@@ -0,0 +1,291 @@
+#include "MoonAvoidanceBatch.hpp"
+#include "MoonAvoidanceConfig.hpp"
+#include "MoonAvoidanceEphemerisCache.hpp"
+#include "MoonAvoidanceQuery.hpp"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QTextStream>
+#include <QThreadPool>
+#include <cstdio>
+
+// moonavoid-cli: usable hours or windows per target, night and filter, without Stellarium.
+//
+//   moonavoid-cli --lat 48.2 --lon 16.4 --date 2026-03-01 --nights 30 < targets.csv > hours.csv
+//
+// Targets are "name, RA, Dec" lines (J2000, see MoonAvoidancePlanner::parseTarget)
+// or a binary catalog (MoonAvoidanceCatalog), which --catalog builds from them once
+// and maps on later runs; filters come from a MoonAvoidance.ini.
+// With --serve it runs instead as the query service of MoonAvoidanceQuery for
+// the given site, for sequencers on machines without Stellarium.
+// Exit status: 0 success, 1 usage, 2 I/O.
+
+namespace
+{
+	bool parseDouble(const QCommandLineParser& parser, const QString& name, double min, double max, double& out)
+	{
+		bool ok = false;
+		out = parser.value(name).toDouble(&ok);
+		if (!ok || out < min || out > max)
+		{
+			QTextStream(stderr) << "moonavoid-cli: --" << name << " must be a number from " << min << " to " << max << "\n";
+			return false;
+		}
+		return true;
+	}
+
+	// Targets from a CSV file, or stdin for "-"; raw bytes, so the catalog's source checksum matches the file
+	bool openTargets(QFile& input, const QString& path)
+	{
+		if (path == "-")
+			return input.open(stdin, QIODevice::ReadOnly);
+		input.setFileName(path);
+		return input.open(QIODevice::ReadOnly);
+	}
+
+	bool convertToCatalog(const QString& targetsPath, const QString& catalogPath, bool doublePrecision, QTextStream& err)
+	{
+		QFile input;
+		if (!openTargets(input, targetsPath))
+		{
+			err << "moonavoid-cli: Cannot read targets from " << targetsPath << "\n";
+			return false;
+		}
+
+		QElapsedTimer clock;
+		clock.start();
+		MoonAvoidanceCatalogWriter writer(doublePrecision);
+		QString error;
+		if (!writer.begin(&error))
+		{
+			err << "moonavoid-cli: " << error << "\n";
+			return false;
+		}
+		MoonAvoidanceBatch::Stats stats;
+		MoonAvoidanceCatalogFormat::Source source;
+		if (targetsPath != "-")
+			source = MoonAvoidanceCatalogFormat::sourceOf(targetsPath);
+		MoonAvoidanceBatch::convert(input, writer, stats, source.checksum,
+			[&err](qint64 line, const QString& lineError) { err << "moonavoid-cli: line " << line << ": " << lineError << "\n"; });
+		if (!writer.finish(catalogPath, source, &error))
+		{
+			err << "moonavoid-cli: " << error << "\n";
+			return false;
+		}
+		err << "moonavoid-cli: " << stats.targets << " targets written to " << catalogPath << " in " << clock.elapsed() << " ms";
+		if (stats.rejected > 0)
+			err << ", " << stats.rejected << " lines skipped";
+		err << "\n";
+		return true;
+	}
+
+	bool parseInt(const QCommandLineParser& parser, const QString& name, int min, int max, int& out)
+	{
+		bool ok = false;
+		out = parser.value(name).toInt(&ok);
+		if (!ok || out < min || out > max)
+		{
+			QTextStream(stderr) << "moonavoid-cli: --" << name << " must be an integer from " << min << " to " << max << "\n";
+			return false;
+		}
+		return true;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("moonavoid-cli");
+	QCoreApplication::setApplicationVersion(MOONAVOIDANCE_VERSION);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Usable imaging hours per target, night and filter under moon avoidance.\n"
+	                                 "Reads \"name, RA, Dec\" lines (J2000) and writes CSV to stdout.");
+	parser.addHelpOption();
+	parser.addVersionOption();
+	const QList<QCommandLineOption> options {
+		{ "targets", "Target list, - for stdin (default).", "file", "-" },
+		{ "filters", "Filter definitions in MoonAvoidance.ini format (default: Stellarium's).", "file",
+		  MoonAvoidanceConfig::configFilePath() },
+		{ "lat", "Observer latitude, degrees north.", "degrees" },
+		{ "lon", "Observer longitude, degrees east.", "degrees" },
+		{ "elevation", "Observer elevation, meters (default 0).", "meters", "0" },
+		{ "date", "Evening of the first night, YYYY-MM-DD (default: today).", "date",
+		  QDate::currentDate().toString(Qt::ISODate) },
+		{ "nights", "Number of nights (default 1).", "count", "1" },
+		{ "min-alt", "Minimum target altitude, degrees (default 30).", "degrees", "30" },
+		{ "delta-t", "TT - UT in seconds (default 69).", "seconds", "69" },
+		{ "output", "hours (per night and filter) or windows (UTC start and end).", "mode", "hours" },
+		{ "threads", "Worker threads (default: one per core).", "count",
+		  QString::number(QThreadPool::globalInstance()->maxThreadCount()) },
+		{ "chunk", "Targets per work item (default 512).", "count", "512" },
+		{ "catalog", "Binary catalog: screened directly, and (re)built first from --targets when given and stale.", "file" },
+		{ "precision", "Catalog vectors: float (default) or double.", "type", "float" },
+		{ "convert-only", "Build the catalog from --targets and exit." },
+		{ "no-verify", "Skip the catalog's payload checksum." },
+		{ "ephemeris-cache", "Directory of cached night ephemerides; empty to disable.", "dir",
+		  MoonAvoidanceEphemerisCache::defaultDirectory() },
+		{ "serve", "Answer moon avoidance queries on this local socket until stopped (see MoonAvoidanceQuery.hpp).", "name" },
+	};
+	parser.addOptions(options);
+	parser.process(app);
+
+	QTextStream err(stderr);
+	const QString targetsPath = parser.value("targets");
+	const QString catalogPath = parser.value("catalog");
+	const bool useCatalog = !catalogPath.isEmpty();
+	if (parser.value("precision") != "float" && parser.value("precision") != "double")
+	{
+		err << "moonavoid-cli: --precision must be float or double\n";
+		return 1;
+	}
+
+	// A catalog is (re)built when targets are given and it is missing, damaged or older than them
+	if (useCatalog && (parser.isSet("targets") || parser.isSet("convert-only")))
+	{
+		MoonAvoidanceCatalog existing;
+		const bool current = targetsPath != "-" && existing.open(catalogPath, false) && existing.isBuiltFrom(targetsPath)
+		                     && (!parser.isSet("precision") || existing.isDoublePrecision() == (parser.value("precision") == "double"));
+		existing.close();
+		if (!current && !convertToCatalog(targetsPath, catalogPath, parser.value("precision") == "double", err))
+			return 2;
+		if (current)
+			err << "moonavoid-cli: " << catalogPath << " is up to date\n";
+	}
+	if (parser.isSet("convert-only"))
+	{
+		if (!useCatalog)
+		{
+			err << "moonavoid-cli: --convert-only needs --catalog\n";
+			return 1;
+		}
+		return 0;
+	}
+
+	if (!parser.isSet("lat") || !parser.isSet("lon"))
+	{
+		err << "moonavoid-cli: --lat and --lon are required\n";
+		return 1;
+	}
+
+	double latitude = 0.0;
+	double longitude = 0.0;
+	double elevation = 0.0;
+	double minAltitude = 0.0;
+	double deltaTSeconds = 0.0;
+	int nights = 0;
+	int threads = 0;
+	int chunkSize = 0;
+	if (!parseDouble(parser, "lat", -90.0, 90.0, latitude) || !parseDouble(parser, "lon", -180.0, 360.0, longitude)
+	    || !parseDouble(parser, "elevation", -500.0, 10000.0, elevation)
+	    || !parseDouble(parser, "min-alt", -90.0, 90.0, minAltitude) || !parseDouble(parser, "delta-t", -1.0e6, 1.0e6, deltaTSeconds)
+	    || !parseInt(parser, "nights", 1, 3660, nights) || !parseInt(parser, "threads", 1, 1024, threads)
+	    || !parseInt(parser, "chunk", 1, 1000000, chunkSize))
+		return 1;
+
+	const QDate firstNight = QDate::fromString(parser.value("date"), Qt::ISODate);
+	if (!firstNight.isValid())
+	{
+		err << "moonavoid-cli: --date must be YYYY-MM-DD\n";
+		return 1;
+	}
+
+	MoonAvoidanceBatch::Output output = MoonAvoidanceBatch::Output::Hours;
+	if (parser.value("output") == "windows")
+		output = MoonAvoidanceBatch::Output::Windows;
+	else if (parser.value("output") != "hours")
+	{
+		err << "moonavoid-cli: --output must be hours or windows\n";
+		return 1;
+	}
+
+	const QString filtersPath = parser.value("filters");
+	if (!QFileInfo::exists(filtersPath))
+	{
+		err << "moonavoid-cli: Cannot read filters from " << filtersPath << "\n";
+		return 2;
+	}
+	QSettings settings(filtersPath, QSettings::IniFormat);
+	bool hasInvalidValues = false;
+	const QList<FilterConfig> filters = MoonAvoidanceConfig::readFilters(settings, &hasInvalidValues);
+	if (settings.status() != QSettings::NoError || filters.isEmpty() || hasInvalidValues)
+	{
+		err << "moonavoid-cli: No valid filters in " << filtersPath << "\n";
+		return 2;
+	}
+
+	if (parser.isSet("serve"))
+	{
+		MoonAvoidanceQueryServer server(parser.value("serve"), parser.value("ephemeris-cache"));
+		if (!server.start())
+			return 2;
+		MoonAvoidanceQueryEngine::Context context;
+		context.site = { latitude, longitude, elevation };
+		context.deltaTDays = deltaTSeconds / 86400.0;
+		context.filters = filters;
+		const double nowJD = QDateTime::currentMSecsSinceEpoch() / 86400000.0 + 2440587.5;
+		server.setContext(context, nowJD);
+		err << "moonavoid-cli: Serving " << filters.size() << " filters on " << parser.value("serve") << "\n";
+		err.flush();
+		return app.exec();
+	}
+
+	QFile input;
+	MoonAvoidanceCatalog catalog;
+	QString catalogError;
+	if (useCatalog && !catalog.open(catalogPath, !parser.isSet("no-verify"), &catalogError))
+	{
+		err << "moonavoid-cli: " << catalogError << "\n";
+		return 2;
+	}
+	if (!useCatalog && !openTargets(input, targetsPath))
+	{
+		err << "moonavoid-cli: Cannot read targets from " << targetsPath << "\n";
+		return 2;
+	}
+	QFile outputFile;
+	if (!outputFile.open(stdout, QIODevice::WriteOnly))
+	{
+		err << "moonavoid-cli: Cannot write to stdout\n";
+		return 2;
+	}
+
+	QThreadPool pool;
+	pool.setMaxThreadCount(threads);
+
+	QElapsedTimer clock;
+	clock.start();
+	const MoonAvoidanceBatch::Plan plan = MoonAvoidanceBatch::makePlan(
+		firstNight, nights, { latitude, longitude, elevation }, deltaTSeconds / 86400.0, filters, minAltitude, output, &pool,
+		parser.value("ephemeris-cache"));
+
+	MoonAvoidanceBatch::Stats stats;
+	bool written = false;
+	if (useCatalog)
+	{
+		written = MoonAvoidanceBatch::run(plan, catalog, outputFile, &pool, chunkSize, stats);
+	}
+	else
+	{
+		QTextStream in(&input);
+		written = MoonAvoidanceBatch::run(plan, in, outputFile, &pool, chunkSize, stats,
+			[&err](qint64 line, const QString& error) { err << "moonavoid-cli: line " << line << ": " << error << "\n"; });
+	}
+	outputFile.flush();
+
+	err << "moonavoid-cli: " << stats.targets << " targets x " << nights << " nights x " << filters.size()
+	    << " filters in " << clock.elapsed() << " ms";
+	if (stats.rejected > 0)
+		err << ", " << stats.rejected << " lines skipped";
+	err << "\n";
+	if (!written)
+	{
+		err << "moonavoid-cli: Write error: " << outputFile.errorString() << "\n";
+		return 2;
+	}
+	return 0;
+}
@@ -4,6 +4,8 @@
 
 MoonAvoidanceConfig::MoonAvoidanceConfig()
 	: settings(nullptr)
+	, pendingWriteBack(false)
+	, revision(0)
 {
 	loadDefaults();
 }
@@ -19,6 +21,7 @@ MoonAvoidanceConfig::~MoonAvoidanceConfig()
 void MoonAvoidanceConfig::loadDefaults()
 {
 	filters = getDefaultFilters();
+	++revision;
 }
 
 QList<FilterConfig> MoonAvoidanceConfig::getDefaultFilters()
@@ -40,59 +43,44 @@ QList<FilterConfig> MoonAvoidanceConfig::getDefaultFilters()
 	return defaults;
 }
 
-void MoonAvoidanceConfig::loadConfiguration()
+QString MoonAvoidanceConfig::configFilePath()
 {
-	// Use Stellarium's file manager if available, otherwise fall back to QStandardPaths
-	QString pluginConfigPath;
-	try {
-		// Try to use Stellarium's file manager
-		QString configDir = QStandardPaths::writableLocation(QStandardPaths::ConfigLocation);
-		pluginConfigPath = configDir + "/stellarium/plugins/MoonAvoidance.ini";
-	}
-	catch (...)
-	{
-		// Fallback to default location
-		pluginConfigPath = QStandardPaths::writableLocation(QStandardPaths::ConfigLocation) + "/stellarium/plugins/MoonAvoidance.ini";
-	}
-	
-	if (settings)
-	{
-		delete settings;
-		settings = nullptr;
-	}
-	
-	settings = new QSettings(pluginConfigPath, QSettings::IniFormat);
-	
-	filters.clear();
+	return QStandardPaths::writableLocation(QStandardPaths::ConfigLocation) + "/stellarium/plugins/MoonAvoidance.ini";
+}
+
+QList<FilterConfig> MoonAvoidanceConfig::readFilters(QSettings& settings, bool* hasInvalidValues)
+{
+	QList<FilterConfig> result;
+	if (hasInvalidValues)
+		*hasInvalidValues = false;
 	
 	// Load filter groups
-	QStringList groups = settings->childGroups();
-	
-	bool hasInvalidValues = false;
+	const QStringList groups = settings.childGroups();
 	
 	for (const QString& group : groups)
 	{
-		settings->beginGroup(group);
+		settings.beginGroup(group);
 		
 		QString name = group;
-		double separation = settings->value("Separation", 0.0).toDouble();
-		double width = settings->value("Width", 0.0).toDouble();
-		double relaxation = settings->value("Relaxation", 0.0).toDouble();
-		double minAlt = settings->value("MinAlt", -15.0).toDouble();
-		double maxAlt = settings->value("MaxAlt", 5.0).toDouble();
+		double separation = settings.value("Separation", 0.0).toDouble();
+		double width = settings.value("Width", 0.0).toDouble();
+		double relaxation = settings.value("Relaxation", 0.0).toDouble();
+		double minAlt = settings.value("MinAlt", -15.0).toDouble();
+		double maxAlt = settings.value("MaxAlt", 5.0).toDouble();
 		
 		// Validate values - check if they're all zeros or invalid
 		if (separation == 0.0 && width == 0.0 && relaxation == 0.0)
 		{
-			hasInvalidValues = true;
+			if (hasInvalidValues)
+				*hasInvalidValues = true;
 			qWarning() << "MoonAvoidanceConfig: Filter" << name << "has all zero values, will reset to defaults";
 		}
 		
 		// Load color
 		QColor color(Qt::white);
-		if (settings->contains("Color"))
+		if (settings.contains("Color"))
 		{
-			color = settings->value("Color").value<QColor>();
+			color = settings.value("Color").value<QColor>();
 		}
 		else
 		{
@@ -103,28 +91,43 @@ void MoonAvoidanceConfig::loadConfiguration()
 			else if (name == "S") color = Qt::yellow;
 		}
 		
-		filters.append(FilterConfig(name, separation, width, relaxation, minAlt, maxAlt, color));
+		result.append(FilterConfig(name, separation, width, relaxation, minAlt, maxAlt, color));
 		
-		settings->endGroup();
+		settings.endGroup();
 	}
+	return result;
+}
+
+void MoonAvoidanceConfig::loadConfiguration()
+{
+	if (settings)
+	{
+		delete settings;
+		settings = nullptr;
+	}
+	
+	settings = new QSettings(configFilePath(), QSettings::IniFormat);
+	
+	pendingWriteBack = false;
+	bool hasInvalidValues = false;
+	filters = readFilters(*settings, &hasInvalidValues);
 	
 	// If no filters loaded or all values are invalid, use defaults
 	if (filters.isEmpty() || hasInvalidValues)
 	{
 		qWarning() << "MoonAvoidanceConfig: No valid filters found or invalid values detected, loading defaults";
 		loadDefaults();
-		// Save defaults to config file
-		saveConfiguration();
+		// Defaults are written back later, off the startup path
+		pendingWriteBack = true;
 	}
+	++revision;
 }
 
 void MoonAvoidanceConfig::saveConfiguration()
 {
 	if (!settings)
 	{
-		QString configPath = QStandardPaths::writableLocation(QStandardPaths::ConfigLocation);
-		QString pluginConfigPath = configPath + "/stellarium/plugins/MoonAvoidance.ini";
-		settings = new QSettings(pluginConfigPath, QSettings::IniFormat);
+		settings = new QSettings(configFilePath(), QSettings::IniFormat);
 	}
 	
 	settings->clear();
@@ -142,11 +145,13 @@ void MoonAvoidanceConfig::saveConfiguration()
 	}
 	
 	settings->sync();
+	pendingWriteBack = false;
 }
 
 void MoonAvoidanceConfig::addFilter(const FilterConfig& filter)
 {
 	filters.append(filter);
+	++revision;
 }
 
 void MoonAvoidanceConfig::removeFilter(int index)
@@ -154,6 +159,7 @@ void MoonAvoidanceConfig::removeFilter(int index)
 	if (index >= 0 && index < filters.size())
 	{
 		filters.removeAt(index);
+		++revision;
 	}
 }
 
@@ -162,6 +168,7 @@ void MoonAvoidanceConfig::updateFilter(int index, const FilterConfig& filter)
 	if (index >= 0 && index < filters.size())
 	{
 		filters[index] = filter;
+		++revision;
 	}
 }
 
@@ -45,18 +45,34 @@ public:
 	void loadConfiguration();
 	void saveConfiguration();
 	
+	// True when loadConfiguration() fell back to defaults that are not yet on disk.
+	// The caller decides when to write them back (see MoonAvoidance::runDeferredInit).
+	bool hasPendingWriteBack() const { return pendingWriteBack; }
+	
 	QList<FilterConfig> getFilters() const { return filters; }
-	void setFilters(const QList<FilterConfig>& f) { filters = f; }
+	void setFilters(const QList<FilterConfig>& f) { filters = f; ++revision; }
+	
+	// Incremented on every change to the filter list, so caches keyed on the
+	// filters (e.g. the night timeline) can tell when to rebuild
+	quint64 getRevision() const { return revision; }
 	
 	void addFilter(const FilterConfig& filter);
 	void removeFilter(int index);
 	void updateFilter(int index, const FilterConfig& filter);
 	
 	static QList<FilterConfig> getDefaultFilters();
+	
+	// Stellarium's plugin configuration file, MoonAvoidance.ini
+	static QString configFilePath();
+	// One filter per group of an IniFormat file; hasInvalidValues is set when a
+	// filter has all-zero parameters (callers fall back to the defaults)
+	static QList<FilterConfig> readFilters(QSettings& settings, bool* hasInvalidValues = nullptr);
 
 private:
 	QList<FilterConfig> filters;
 	QSettings* settings;
+	bool pendingWriteBack;
+	quint64 revision;
 	
 	void loadDefaults();
 };
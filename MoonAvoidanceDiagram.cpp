@@ -0,0 +1,231 @@
+#include "MoonAvoidanceDiagram.hpp"
+#include "MoonAvoidanceKernel.hpp"
+#include <QPainter>
+#include <QPaintEvent>
+#include <QResizeEvent>
+#include <cmath>
+
+namespace
+{
+	const double HalfMonth = MoonAvoidanceKernel::HalfSynodicPeriodDays;
+	const double FullMonth = MoonAvoidanceKernel::SynodicPeriodDays;
+
+	// Margins around the plot area, for the axis labels
+	const double LeftMargin = 44.0;
+	const double RightMargin = 12.0;
+	const double TopMargin = 12.0;
+	const double BottomMargin = 28.0;
+
+	// Curves are sampled until the chord error is below this fraction of a pixel
+	const double CurvePixelTolerance = 0.25;
+}
+
+MoonAvoidanceDiagram::MoonAvoidanceDiagram(QWidget* parent)
+	: QWidget(parent)
+	, selected(-1)
+	, moonDaysSinceNew(-1.0)
+	, moonAltitude(90.0)
+	, maxRadius(20.0)
+	, computed(0)
+{
+	setMinimumSize(320, 200);
+}
+
+void MoonAvoidanceDiagram::setFilters(const QList<FilterConfig>& filters)
+{
+	entries.resize(filters.size());
+	for (int i = 0; i < filters.size(); ++i)
+		entries[i].filter = filters[i];
+	if (selected >= entries.size())
+		selected = -1;
+	updateScale();
+	update();
+}
+
+void MoonAvoidanceDiagram::setFilter(int index, const FilterConfig& filter)
+{
+	if (index < 0 || index >= entries.size())
+		return;
+	entries[index].filter = filter;
+	updateScale();
+	update();
+}
+
+void MoonAvoidanceDiagram::setSelectedFilter(int index)
+{
+	if (index == selected)
+		return;
+	selected = index;
+	update();
+}
+
+void MoonAvoidanceDiagram::setMoonState(double daysSinceNew, double altitude)
+{
+	if (daysSinceNew == moonDaysSinceNew && altitude == moonAltitude)
+		return;
+	moonDaysSinceNew = daysSinceNew;
+	moonAltitude = altitude;
+	update();
+}
+
+void MoonAvoidanceDiagram::updateScale()
+{
+	// Round the largest separation up to the next 20 degrees
+	double largest = 0.0;
+	for (const Entry& entry : entries)
+		largest = qMax(largest, entry.filter.separation);
+	const double top = qMax(20.0, std::ceil(largest / 20.0) * 20.0);
+	if (top != maxRadius)
+	{
+		maxRadius = top;
+		invalidatePaths();
+	}
+}
+
+void MoonAvoidanceDiagram::invalidatePaths()
+{
+	for (Entry& entry : entries)
+	{
+		entry.relaxed.path = QPainterPath();
+		entry.classic.path = QPainterPath();
+	}
+}
+
+void MoonAvoidanceDiagram::resizeEvent(QResizeEvent* event)
+{
+	QWidget::resizeEvent(event);
+	invalidatePaths();
+}
+
+QRectF MoonAvoidanceDiagram::plotRect() const
+{
+	return QRectF(LeftMargin, TopMargin, qMax(1.0, width() - LeftMargin - RightMargin), qMax(1.0, height() - TopMargin - BottomMargin));
+}
+
+QPointF MoonAvoidanceDiagram::toWidget(double daysSinceNew, double radius) const
+{
+	const QRectF plot = plotRect();
+	return QPointF(plot.left() + plot.width() * daysSinceNew / FullMonth,
+	               plot.bottom() - plot.height() * radius / maxRadius);
+}
+
+void MoonAvoidanceDiagram::ensureCurve(Curve& curve, double separation, double width)
+{
+	// Fine enough for the current scale; a much larger plot gets a finer curve
+	const double tolerance = CurvePixelTolerance * maxRadius / plotRect().height();
+	if (curve.separation == separation && curve.width == width && tolerance >= 0.5 * curve.tolerance)
+		return;
+
+	MoonAvoidanceKernel::radiusCurve(separation, width, HalfMonth, tolerance, curve.ages, curve.radii);
+	curve.separation = separation;
+	curve.width = width;
+	curve.tolerance = tolerance;
+	curve.path = QPainterPath();
+	++computed;
+}
+
+void MoonAvoidanceDiagram::buildPath(Curve& curve) const
+{
+	// The curve is symmetric about full moon: waxing half mirrored, then waning half
+	const int n = curve.ages.size();
+	if (n == 0)
+		return;
+	QPainterPath path(toWidget(HalfMonth - curve.ages[n - 1], curve.radii[n - 1]));
+	for (int i = n - 2; i >= 0; --i)
+		path.lineTo(toWidget(HalfMonth - curve.ages[i], curve.radii[i]));
+	for (int i = 1; i < n; ++i)
+		path.lineTo(toWidget(HalfMonth + curve.ages[i], curve.radii[i]));
+	curve.path = path;
+}
+
+void MoonAvoidanceDiagram::paintEvent(QPaintEvent* event)
+{
+	Q_UNUSED(event)
+
+	QPainter painter(this);
+	painter.setRenderHint(QPainter::Antialiasing, true);
+	painter.fillRect(rect(), palette().base());
+
+	const QRectF plot = plotRect();
+	const QColor axisColor = palette().color(QPalette::Text);
+	QColor gridColor = axisColor;
+	gridColor.setAlphaF(0.2);
+
+	// Grid and labels: radius every 20 degrees, moon phases along the bottom
+	for (double r = 0.0; r <= maxRadius + 0.5; r += 20.0)
+	{
+		const QPointF p = toWidget(0.0, r);
+		painter.setPen(QPen(gridColor, 1.0));
+		painter.drawLine(QPointF(plot.left(), p.y()), QPointF(plot.right(), p.y()));
+		painter.setPen(axisColor);
+		painter.drawText(QRectF(0.0, p.y() - 8.0, LeftMargin - 6.0, 16.0), Qt::AlignRight | Qt::AlignVCenter, QString("%1°").arg(r, 0, 'f', 0));
+	}
+	const char* phases[] = { "New", "First Q", "Full", "Last Q", "New" };
+	for (int k = 0; k <= 4; ++k)
+	{
+		const QPointF p = toWidget(FullMonth * k / 4.0, 0.0);
+		painter.setPen(QPen(gridColor, 1.0));
+		painter.drawLine(QPointF(p.x(), plot.top()), QPointF(p.x(), plot.bottom()));
+		painter.setPen(axisColor);
+		painter.drawText(QRectF(p.x() - 30.0, plot.bottom() + 4.0, 60.0, BottomMargin - 6.0), Qt::AlignHCenter | Qt::AlignTop, phases[k]);
+	}
+
+	// Curves, selected filter last so it stays on top
+	QVector<int> order;
+	order.reserve(entries.size());
+	for (int i = 0; i < entries.size(); ++i)
+	{
+		if (i != selected)
+			order.append(i);
+	}
+	if (selected >= 0 && selected < entries.size())
+		order.append(selected);
+
+	painter.setClipRect(plot.adjusted(-2.0, -2.0, 2.0, 2.0));
+	for (int i : order)
+	{
+		Entry& entry = entries[i];
+		const FilterConfig& filter = entry.filter;
+		const double relaxedSeparation = MoonAvoidanceKernel::relaxedSeparation(filter, moonAltitude);
+		const double relaxedWidth = MoonAvoidanceKernel::relaxedWidth(filter, moonAltitude);
+		const bool relaxing = relaxedSeparation != filter.separation || relaxedWidth != filter.width;
+		const double lineWidth = i == selected ? 2.5 : 1.5;
+
+		ensureCurve(entry.relaxed, relaxedSeparation, relaxedWidth);
+		if (entry.relaxed.path.isEmpty())
+			buildPath(entry.relaxed);
+		if (relaxing)
+		{
+			ensureCurve(entry.classic, filter.separation, filter.width);
+			if (entry.classic.path.isEmpty())
+				buildPath(entry.classic);
+			painter.setPen(QPen(filter.color, lineWidth, Qt::DashLine));
+			painter.drawPath(entry.classic.path);
+		}
+		painter.setPen(QPen(filter.color, lineWidth));
+		painter.drawPath(entry.relaxed.path);
+	}
+
+	// Present moon: vertical marker and each filter's current radius on it
+	if (moonDaysSinceNew >= 0.0)
+	{
+		const QPointF top = toWidget(moonDaysSinceNew, maxRadius);
+		const QPointF bottom = toWidget(moonDaysSinceNew, 0.0);
+		painter.setPen(QPen(axisColor, 1.0, Qt::DotLine));
+		painter.drawLine(top, bottom);
+
+		const double daysFromFull = std::fabs(moonDaysSinceNew - HalfMonth);
+		painter.setPen(Qt::NoPen);
+		for (const Entry& entry : entries)
+		{
+			const double radius = MoonAvoidanceKernel::zoneRadiusDegrees(entry.filter, moonAltitude, daysFromFull);
+			painter.setBrush(entry.filter.color);
+			painter.drawEllipse(toWidget(moonDaysSinceNew, radius), 3.5, 3.5);
+		}
+	}
+
+	painter.setClipping(false);
+	painter.setPen(QPen(axisColor, 1.0));
+	painter.setBrush(Qt::NoBrush);
+	painter.drawRect(plot);
+}
@@ -0,0 +1,80 @@
+#ifndef MOONAVOIDANCEDIAGRAM_HPP
+#define MOONAVOIDANCEDIAGRAM_HPP
+
+#include "MoonAvoidanceConfig.hpp"
+#include <QList>
+#include <QPainterPath>
+#include <QVector>
+#include <QWidget>
+
+// Plot of avoidance radius against moon age for every filter, shown in the
+// Diagram tab of the configuration dialog.
+//
+// Each filter gets two curves: relaxed for the current moon altitude (solid)
+// and classic, without relaxation (dashed, only drawn where they differ).
+// A curve depends on nothing but its separation and width, so it is cached
+// under those two values and recomputed, lazily at the next paint, only when
+// they change. Editing one filter's spin box therefore recomputes that
+// filter's curves and nothing else, and repeated edits between two frames
+// cost a single recomputation. The screen paths are cached as well and only
+// rebuilt when the widget is resized or the axis range changes.
+class MoonAvoidanceDiagram : public QWidget
+{
+	Q_OBJECT
+
+public:
+	explicit MoonAvoidanceDiagram(QWidget* parent = nullptr);
+
+	// Replaces the filter list; curves of unchanged filters are kept
+	void setFilters(const QList<FilterConfig>& filters);
+	// One filter was edited
+	void setFilter(int index, const FilterConfig& filter);
+	// Drawn on top with a thicker line; -1 for none
+	void setSelectedFilter(int index);
+	// Present moon: marker position (days since new moon) and the altitude the relaxed curves use
+	void setMoonState(double daysSinceNew, double moonAltitude);
+
+	// Curves computed so far (each is one adaptive kernel evaluation)
+	int curvesComputed() const { return computed; }
+
+	QSize sizeHint() const override { return QSize(480, 320); }
+
+protected:
+	void paintEvent(QPaintEvent* event) override;
+	void resizeEvent(QResizeEvent* event) override;
+
+private:
+	struct Curve
+	{
+		// The whole curve follows from these two (after altitude relaxation)
+		double separation = -1.0;
+		double width = -1.0;
+		double tolerance = 0.0; // Degrees, from the plot's scale when computed
+		QVector<double> ages;   // Days from full moon, 0 .. half a synodic month
+		QVector<double> radii;  // Degrees
+		QPainterPath path;      // Widget coordinates; empty until built
+	};
+
+	struct Entry
+	{
+		FilterConfig filter;
+		Curve relaxed;
+		Curve classic;
+	};
+
+	void ensureCurve(Curve& curve, double separation, double width);
+	void buildPath(Curve& curve) const;
+	void updateScale();
+	void invalidatePaths();
+	QRectF plotRect() const;
+	QPointF toWidget(double daysSinceNew, double radius) const;
+
+	QVector<Entry> entries;
+	int selected;
+	double moonDaysSinceNew;
+	double moonAltitude;
+	double maxRadius; // Top of the radius axis, degrees
+	int computed;
+};
+
+#endif // MOONAVOIDANCEDIAGRAM_HPP
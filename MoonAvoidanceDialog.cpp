@@ -5,6 +5,15 @@
 #include "StelTranslator.hpp"
 #include "StelModuleMgr.hpp"
 #include "MoonAvoidance.hpp"
+#include "MoonAvoidanceKernel.hpp"
+#include "MoonAvoidanceCalendarWidget.hpp"
+#include "MoonAvoidanceDiagram.hpp"
+#include "MoonAvoidancePlannerWidget.hpp"
+#include "MoonAvoidanceTimeline.hpp"
+#include "StelCore.hpp"
+#include "StelLocation.hpp"
+#include "StelObjectMgr.hpp"
+#include "StelUtils.hpp"
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QFormLayout>
@@ -20,6 +29,12 @@
 #include <QDebug>
 #include <cmath>
 
+namespace
+{
+	// Live preview window: edits within it reach the sky together
+	const int PreviewIntervalMs = 60;
+}
+
 MoonAvoidanceDialog::MoonAvoidanceDialog()
 	: StelDialog("MoonAvoidance")
 	, tabWidget(nullptr)
@@ -36,15 +51,26 @@ MoonAvoidanceDialog::MoonAvoidanceDialog()
 	, moonAgeLabel(nullptr)
 	, currentSeparationLabel(nullptr)
 	, enabledCheckBox(nullptr)
+	, ghostRingsCheckBox(nullptr)
+	, catalogHighlightCheckBox(nullptr)
+	, zoneStyleComboBox(nullptr)
+	, horizonClippingCheckBox(nullptr)
+	, horizonAltitudeSpinBox(nullptr)
 	, infoTab(nullptr)
 	, aboutTab(nullptr)
 	, diagramTab(nullptr)
+	, diagram(nullptr)
+	, plannerTab(nullptr)
+	, planner(nullptr)
+	, calendarTab(nullptr)
+	, calendar(nullptr)
 	, infoTextBrowser(nullptr)
 	, aboutTextBrowser(nullptr)
 	, addButton(nullptr)
 	, removeButton(nullptr)
 	, okButton(nullptr)
 	, cancelButton(nullptr)
+	, previewTimer(nullptr)
 	, currentFilterIndex(-1)
 	, accepted(false)
 {
@@ -96,6 +122,8 @@ void MoonAvoidanceDialog::createDialogContent()
 	createInfoTab();
 	createAboutTab();
 	createDiagramTab();
+	createPlannerTab();
+	createCalendarTab();
 
 	// Add tabs to tab widget
 	if (filtersTab)
@@ -106,6 +134,10 @@ void MoonAvoidanceDialog::createDialogContent()
 		tabWidget->addTab(aboutTab, "About");
 	if (diagramTab)
 		tabWidget->addTab(diagramTab, "Diagram");
+	if (plannerTab)
+		tabWidget->addTab(plannerTab, "Planner");
+	if (calendarTab)
+		tabWidget->addTab(calendarTab, "Calendar");
 
 	mainLayout->addWidget(tabWidget);
 
@@ -126,15 +158,26 @@ void MoonAvoidanceDialog::createDialogContent()
 
 	mainLayout->addWidget(buttonWidget);
 
+	previewTimer = new QTimer(this);
+	previewTimer->setSingleShot(true);
+	previewTimer->setInterval(PreviewIntervalMs);
+	connect(previewTimer, &QTimer::timeout, this, &MoonAvoidanceDialog::pushPreview);
+
 	// Connect OK/Cancel signals
 	connect(okButton, &QPushButton::clicked, this, [this]() {
 		if (validateInput())
 		{
+			previewTimer->stop();
 			accepted = true;
 			close();
 		}
 	});
 	connect(cancelButton, &QPushButton::clicked, this, [this]() {
+		// Back to the saved filters right away, before the dialog goes
+		previewTimer->stop();
+		MoonAvoidance* plugin = qobject_cast<MoonAvoidance*>(StelApp::getInstance().getModuleMgr().getModule("MoonAvoidance"));
+		if (plugin)
+			plugin->clearPreviewFilters();
 		accepted = false;
 		close();
 	});
@@ -188,6 +231,102 @@ void MoonAvoidanceDialog::createFiltersTab()
 		}
 	}
 
+	// Ghost rings: where each zone will be at every coming hour until dawn
+	ghostRingsCheckBox = new QCheckBox("Show Rings Hourly Until Dawn", filterGroupBox);
+	if (ghostRingsCheckBox)
+	{
+		groupLayout->addWidget(ghostRingsCheckBox);
+
+		MoonAvoidance* plugin = qobject_cast<MoonAvoidance*>(StelApp::getInstance().getModuleMgr().getModule("MoonAvoidance"));
+		if (plugin)
+		{
+			ghostRingsCheckBox->setChecked(plugin->isGhostRingsVisible());
+			connect(ghostRingsCheckBox, &QCheckBox::toggled, plugin, &MoonAvoidance::setGhostRingsVisible);
+			connect(plugin, &MoonAvoidance::ghostRingsVisibleChanged, ghostRingsCheckBox, &QCheckBox::setChecked);
+		}
+	}
+
+	// Deep-sky objects and user targets inside the zones, coloured by zone
+	catalogHighlightCheckBox = new QCheckBox("Highlight Objects Inside Zones", filterGroupBox);
+	if (catalogHighlightCheckBox)
+	{
+		groupLayout->addWidget(catalogHighlightCheckBox);
+
+		MoonAvoidance* plugin = qobject_cast<MoonAvoidance*>(StelApp::getInstance().getModuleMgr().getModule("MoonAvoidance"));
+		if (plugin)
+		{
+			catalogHighlightCheckBox->setChecked(plugin->isCatalogHighlight());
+			connect(catalogHighlightCheckBox, &QCheckBox::toggled, plugin, &MoonAvoidance::setCatalogHighlight);
+			connect(plugin, &MoonAvoidance::catalogHighlightChanged, catalogHighlightCheckBox, &QCheckBox::setChecked);
+		}
+	}
+
+	// Zone style: outline rings, filled caps or filled bands
+	zoneStyleComboBox = new QComboBox(filterGroupBox);
+	if (zoneStyleComboBox)
+	{
+		zoneStyleComboBox->addItem("Rings");
+		zoneStyleComboBox->addItem("Filled Caps");
+		zoneStyleComboBox->addItem("Filled Bands");
+
+		QHBoxLayout* zoneStyleLayout = new QHBoxLayout();
+		zoneStyleLayout->addWidget(new QLabel("Zone Style:", filterGroupBox));
+		zoneStyleLayout->addWidget(zoneStyleComboBox);
+		zoneStyleLayout->addStretch();
+		groupLayout->addLayout(zoneStyleLayout);
+
+		MoonAvoidance* plugin = qobject_cast<MoonAvoidance*>(StelApp::getInstance().getModuleMgr().getModule("MoonAvoidance"));
+		if (plugin)
+		{
+			zoneStyleComboBox->setCurrentIndex(plugin->getZoneRenderMode());
+			connect(zoneStyleComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged), plugin, [plugin](int index) {
+				plugin->setZoneRenderMode(static_cast<MoonAvoidance::ZoneRenderMode>(index));
+			});
+			connect(plugin, &MoonAvoidance::zoneRenderModeChanged, zoneStyleComboBox, [this](MoonAvoidance::ZoneRenderMode mode) {
+				if (!zoneStyleComboBox)
+					return;
+				zoneStyleComboBox->blockSignals(true);
+				zoneStyleComboBox->setCurrentIndex(mode);
+				zoneStyleComboBox->blockSignals(false);
+			});
+		}
+	}
+
+	// Horizon clipping: hide the parts of the zones below the landscape or an altitude limit
+	horizonClippingCheckBox = new QCheckBox("Clip Zones at the Horizon", filterGroupBox);
+	horizonAltitudeSpinBox = new QDoubleSpinBox(filterGroupBox);
+	if (horizonClippingCheckBox && horizonAltitudeSpinBox)
+	{
+		horizonAltitudeSpinBox->setRange(-10.0, 60.0);
+		horizonAltitudeSpinBox->setDecimals(1);
+		horizonAltitudeSpinBox->setSuffix("°");
+		horizonAltitudeSpinBox->setToolTip("Lowest altitude kept; the landscape horizon is used where it is higher");
+
+		QHBoxLayout* horizonLayout = new QHBoxLayout();
+		horizonLayout->addWidget(horizonClippingCheckBox);
+		horizonLayout->addWidget(new QLabel("Lowest Altitude:", filterGroupBox));
+		horizonLayout->addWidget(horizonAltitudeSpinBox);
+		horizonLayout->addStretch();
+		groupLayout->addLayout(horizonLayout);
+
+		MoonAvoidance* plugin = qobject_cast<MoonAvoidance*>(StelApp::getInstance().getModuleMgr().getModule("MoonAvoidance"));
+		if (plugin)
+		{
+			horizonClippingCheckBox->setChecked(plugin->isHorizonClipping());
+			horizonAltitudeSpinBox->setValue(plugin->getHorizonAltitude());
+			connect(horizonClippingCheckBox, &QCheckBox::toggled, plugin, &MoonAvoidance::setHorizonClipping);
+			connect(plugin, &MoonAvoidance::horizonClippingChanged, horizonClippingCheckBox, &QCheckBox::setChecked);
+			connect(horizonAltitudeSpinBox, QOverload<double>::of(&QDoubleSpinBox::valueChanged), plugin, &MoonAvoidance::setHorizonAltitude);
+			connect(plugin, &MoonAvoidance::horizonAltitudeChanged, horizonAltitudeSpinBox, [this](double degrees) {
+				if (!horizonAltitudeSpinBox)
+					return;
+				horizonAltitudeSpinBox->blockSignals(true);
+				horizonAltitudeSpinBox->setValue(degrees);
+				horizonAltitudeSpinBox->blockSignals(false);
+			});
+		}
+	}
+
 	// Create horizontal layout for list and form
 	QHBoxLayout* listFormLayout = new QHBoxLayout();
 
@@ -400,10 +539,112 @@ void MoonAvoidanceDialog::createDiagramTab()
 	QVBoxLayout* diagramLayout = new QVBoxLayout(diagramTab);
 	diagramLayout->setContentsMargins(10, 10, 10, 10);
 
-	QLabel* placeholderLabel = new QLabel("Diagram view coming soon...", diagramTab);
-	placeholderLabel->setAlignment(Qt::AlignCenter);
+	diagram = new MoonAvoidanceDiagram(diagramTab);
+	if (diagram)
+	{
+		diagramLayout->addWidget(diagram, 1);
+		if (!currentFilters.isEmpty())
+			diagram->setFilters(currentFilters);
+	}
+
+	QLabel* legendLabel = new QLabel("Avoidance radius over one lunation. Solid: relaxed at the current moon altitude; "
+	                                 "dashed: without relaxation. The dotted line marks the current moon age.", diagramTab);
+	legendLabel->setWordWrap(true);
+	diagramLayout->addWidget(legendLabel);
 
-	diagramLayout->addWidget(placeholderLabel);
+	// The moon moves while the dialog is open; refresh when the tab is shown
+	connect(tabWidget, &QTabWidget::currentChanged, this, [this](int index) {
+		if (tabWidget && tabWidget->widget(index) == diagramTab)
+			updateDiagram();
+	});
+}
+
+void MoonAvoidanceDialog::createPlannerTab()
+{
+	plannerTab = new QWidget();
+	QVBoxLayout* plannerLayout = new QVBoxLayout(plannerTab);
+	plannerLayout->setContentsMargins(10, 10, 10, 10);
+
+	planner = new MoonAvoidancePlannerWidget(plannerTab);
+	if (planner)
+	{
+		plannerLayout->addWidget(planner, 1);
+		if (!currentFilters.isEmpty())
+			planner->setFilters(currentFilters);
+	}
+
+	// Adds the object selected in Stellarium with its J2000 coordinates
+	QPushButton* addSelectedButton = new QPushButton("Add Selected Object", plannerTab);
+	QHBoxLayout* plannerButtonLayout = new QHBoxLayout();
+	plannerButtonLayout->addWidget(addSelectedButton);
+	plannerButtonLayout->addStretch();
+	plannerLayout->addLayout(plannerButtonLayout);
+	connect(addSelectedButton, &QPushButton::clicked, this, [this]() {
+		QString name;
+		double ra = 0.0;
+		double dec = 0.0;
+		if (planner && selectedObject(name, ra, dec))
+			planner->addTarget(name, ra, dec);
+	});
+
+	// The first night follows the simulation clock; refresh when the tab is shown
+	connect(tabWidget, &QTabWidget::currentChanged, this, [this](int index) {
+		if (tabWidget && tabWidget->widget(index) == plannerTab)
+			updatePlannerSite();
+	});
+}
+
+void MoonAvoidanceDialog::createCalendarTab()
+{
+	calendarTab = new QWidget();
+	QVBoxLayout* calendarLayout = new QVBoxLayout(calendarTab);
+	calendarLayout->setContentsMargins(10, 10, 10, 10);
+
+	calendar = new MoonAvoidanceCalendarWidget(calendarTab);
+	if (calendar)
+	{
+		calendarLayout->addWidget(calendar, 1);
+		if (!currentFilters.isEmpty())
+			calendar->setFilters(currentFilters);
+	}
+
+	QPushButton* useSelectedButton = new QPushButton("Use Selected Object", calendarTab);
+	QHBoxLayout* calendarButtonLayout = new QHBoxLayout();
+	calendarButtonLayout->addWidget(useSelectedButton);
+	calendarButtonLayout->addStretch();
+	calendarLayout->addLayout(calendarButtonLayout);
+	connect(useSelectedButton, &QPushButton::clicked, this, [this]() {
+		QString name;
+		double ra = 0.0;
+		double dec = 0.0;
+		if (calendar && selectedObject(name, ra, dec))
+			calendar->setTarget(name, ra, dec);
+	});
+
+	connect(tabWidget, &QTabWidget::currentChanged, this, [this](int index) {
+		if (tabWidget && tabWidget->widget(index) == calendarTab)
+			updateCalendarSite();
+	});
+}
+
+bool MoonAvoidanceDialog::selectedObject(QString& name, double& raDegrees, double& decDegrees) const
+{
+	StelObjectMgr* objectMgr = GETSTELMODULE(StelObjectMgr);
+	if (!objectMgr || objectMgr->getSelectedObject().isEmpty())
+		return false;
+	const StelObjectP object = objectMgr->getSelectedObject().first();
+	StelCore* core = StelApp::getInstance().getCore();
+	double ra = 0.0;
+	double dec = 0.0;
+	StelUtils::rectToSphe(&ra, &dec, object->getJ2000EquatorialPos(core));
+	raDegrees = ra * 180.0 / M_PI;
+	if (raDegrees < 0.0)
+		raDegrees += 360.0;
+	decDegrees = dec * 180.0 / M_PI;
+	name = object->getEnglishName();
+	if (name.isEmpty())
+		name = object->getID();
+	return true;
 }
 
 void MoonAvoidanceDialog::setFilters(const QList<FilterConfig>& filters)
@@ -417,6 +658,12 @@ void MoonAvoidanceDialog::setFilters(const QList<FilterConfig>& filters)
 	}
 	
 	currentFilters = filters;
+	if (diagram)
+		diagram->setFilters(currentFilters);
+	if (planner)
+		planner->setFilters(currentFilters);
+	if (calendar)
+		calendar->setFilters(currentFilters);
 	
 	// Populate list widget
 	filterListWidget->blockSignals(true);
@@ -477,6 +724,7 @@ void MoonAvoidanceDialog::onFilterSelectionChanged(const QString& filterName)
 	{
 		enableFormFields(false);
 	}
+	updateDiagram();
 }
 
 void MoonAvoidanceDialog::updateFormFields()
@@ -559,6 +807,13 @@ void MoonAvoidanceDialog::addFilter()
 	newFilter.color = QColor(Qt::white);
 	
 	currentFilters.append(newFilter);
+	if (diagram)
+		diagram->setFilters(currentFilters);
+	if (planner)
+		planner->setFilters(currentFilters);
+	if (calendar)
+		calendar->setFilters(currentFilters);
+	schedulePreview();
 	
 	// Add to list widget
 	if (filterListWidget)
@@ -578,6 +833,13 @@ void MoonAvoidanceDialog::removeFilter()
 	
 	// Remove from list
 	currentFilters.removeAt(currentFilterIndex);
+	if (diagram)
+		diagram->setFilters(currentFilters);
+	if (planner)
+		planner->setFilters(currentFilters);
+	if (calendar)
+		calendar->setFilters(currentFilters);
+	schedulePreview();
 	
 	// Remove from list widget
 	if (filterListWidget)
@@ -610,6 +872,8 @@ void MoonAvoidanceDialog::updateSeparation(double value)
 	{
 		currentFilters[currentFilterIndex].separation = value;
 		updateCurrentSeparation();
+		updateDiagram();
+		schedulePreview();
 	}
 }
 
@@ -619,6 +883,8 @@ void MoonAvoidanceDialog::updateWidth(double value)
 	{
 		currentFilters[currentFilterIndex].width = value;
 		updateCurrentSeparation();
+		updateDiagram();
+		schedulePreview();
 	}
 }
 
@@ -628,6 +894,8 @@ void MoonAvoidanceDialog::updateRelaxation(double value)
 	{
 		currentFilters[currentFilterIndex].relaxation = value;
 		updateCurrentSeparation();
+		updateDiagram();
+		schedulePreview();
 	}
 }
 
@@ -637,6 +905,8 @@ void MoonAvoidanceDialog::updateMinAlt(double value)
 	{
 		currentFilters[currentFilterIndex].minAlt = value;
 		updateCurrentSeparation();
+		updateDiagram();
+		schedulePreview();
 	}
 }
 
@@ -646,6 +916,8 @@ void MoonAvoidanceDialog::updateMaxAlt(double value)
 	{
 		currentFilters[currentFilterIndex].maxAlt = value;
 		updateCurrentSeparation();
+		updateDiagram();
+		schedulePreview();
 	}
 }
 
@@ -679,43 +951,94 @@ void MoonAvoidanceDialog::updateCurrentSeparation()
 	
 	const FilterConfig& filter = currentFilters[currentFilterIndex];
 	
-	// Calculate adjusted separation based on altitude (same as in MoonAvoidance::calculateSeparation)
-	double adjustedSeparation = filter.separation + filter.relaxation * (moonAltitude - filter.maxAlt);
+	// Same Lorentzian and altitude relaxation as the sky rendering
+	double currentSeparationDegrees = MoonAvoidanceKernel::zoneRadiusDegrees(filter, moonAltitude, moonAgeFromFullMoon);
 	
-	// Calculate adjusted width based on altitude (same as in MoonAvoidance::calculateWidth)
-	double denominator = filter.maxAlt - filter.minAlt;
-	double adjustedWidth = filter.width;
-	if (denominator != 0.0)
+	if (currentSeparationDegrees <= 0.0)
 	{
-		double ratio = (moonAltitude - filter.minAlt) / denominator;
-		adjustedWidth = filter.width * ratio;
+		currentSeparationLabel->setText("Off");
+		return;
 	}
 	
-	// Apply the Moon Avoidance Lorentzian formula from the spreadsheet:
-	// SEPARATION = DISTANCE / ( 1 + POWER( ( ( 0.5 - ( AGE / 29.5) ) / ( WIDTH / 29.5 ) ) , 2 ) )
-	const double SYNODIC_PERIOD = 29.5;
-	
-	// Avoid division by zero
-	if (adjustedWidth <= 0.0)
-		adjustedWidth = 1.0;
-	
-	// Use the corrected formula: SEPARATION = DISTANCE / ( 1 + (AGE / WIDTH)^2 )
-	// where AGE is days from full moon (0 = full moon, 14.765 = new moon)
-	// This gives highest separation at full moon and lower as we move away
-	double normalizedTerm = moonAgeFromFullMoon / adjustedWidth;
-	
-	// Calculate the Lorentzian factor: 1 + (normalizedTerm)^2
-	double lorentzianFactor = 1.0 + (normalizedTerm * normalizedTerm);
+	// Display the calculated separation
+	currentSeparationLabel->setText(QString("%1°").arg(currentSeparationDegrees, 0, 'f', 1));
+}
+
+void MoonAvoidanceDialog::updateDiagram()
+{
+	if (!diagram)
+		return;
 	
-	// Calculate the current separation in degrees
-	double currentSeparationDegrees = adjustedSeparation / lorentzianFactor;
+	if (currentFilterIndex >= 0 && currentFilterIndex < currentFilters.size())
+		diagram->setFilter(currentFilterIndex, currentFilters[currentFilterIndex]);
+	diagram->setSelectedFilter(currentFilterIndex);
 	
-	// Ensure minimum separation (at least 1 degree)
-	if (currentSeparationDegrees < 1.0)
-		currentSeparationDegrees = 1.0;
+	MoonAvoidance* plugin = qobject_cast<MoonAvoidance*>(StelApp::getInstance().getModuleMgr().getModule("MoonAvoidance"));
+	if (plugin)
+		diagram->setMoonState(plugin->getCurrentMoonAgeDays(), plugin->getCurrentMoonAltitude());
+}
+
+void MoonAvoidanceDialog::updatePlanner()
+{
+	if (!planner)
+		return;
+	// Unchanged filters are skipped by the planner, so edits to several filters within one preview window all land
+	for (int i = 0; i < currentFilters.size(); ++i)
+		planner->setFilter(i, currentFilters[i]);
+}
+
+void MoonAvoidanceDialog::schedulePreview()
+{
+	if (previewTimer && !previewTimer->isActive())
+		previewTimer->start();
+}
+
+void MoonAvoidanceDialog::pushPreview()
+{
+	if (!visible())
+		return; // Closed while the timer ran; the plugin is back on the configuration
 	
-	// Display the calculated separation
-	currentSeparationLabel->setText(QString("%1°").arg(currentSeparationDegrees, 0, 'f', 1));
+	// The worker caches geometry per filter and radius, so only edited filters are rebuilt
+	MoonAvoidance* plugin = qobject_cast<MoonAvoidance*>(StelApp::getInstance().getModuleMgr().getModule("MoonAvoidance"));
+	if (plugin)
+		plugin->setPreviewFilters(currentFilters);
+	updatePlanner();
+	if (calendar)
+		calendar->setFilters(currentFilters);
+}
+
+void MoonAvoidanceDialog::updatePlannerSite()
+{
+	if (!planner)
+		return;
+
+	StelCore* core = StelApp::getInstance().getCore();
+	if (!core)
+		return;
+	const StelLocation& location = core->getCurrentLocation();
+	if (location.planetName != "Earth")
+		return; // The planner's ephemeris is for observers on Earth
+
+	const double jd = core->getJD();
+	const double longitude = location.getLongitude();
+	planner->setSite(location.getLatitude(), longitude, location.altitude, core->getJDE() - jd,
+	                 MoonAvoidanceTimeline::windowStartFor(jd, longitude), core->getUTCOffset(jd));
+}
+
+void MoonAvoidanceDialog::updateCalendarSite()
+{
+	if (!calendar)
+		return;
+
+	StelCore* core = StelApp::getInstance().getCore();
+	if (!core)
+		return;
+	const StelLocation& location = core->getCurrentLocation();
+	if (location.planetName != "Earth")
+		return;
+
+	const double jd = core->getJD();
+	calendar->setSite(location.getLatitude(), location.getLongitude(), location.altitude, core->getJDE() - jd);
 }
 
 void MoonAvoidanceDialog::updateColor()
@@ -731,6 +1054,8 @@ void MoonAvoidanceDialog::updateColor()
 	if (newColor.isValid())
 	{
 		currentFilters[currentFilterIndex].color = newColor;
+		updateDiagram();
+		schedulePreview();
 		if (colorLabel)
 		{
 			QString style = QString("background-color: %1;").arg(newColor.name());
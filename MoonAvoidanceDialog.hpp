@@ -9,12 +9,17 @@
 #include <QColorDialog>
 #include <QLabel>
 #include <QCheckBox>
+#include <QComboBox>
 #include <QTabWidget>
 #include <QTextBrowser>
+#include <QTimer>
 #include "MoonAvoidanceConfig.hpp"
 
 class TitleBar;
 class MoonAvoidance;
+class MoonAvoidanceDiagram;
+class MoonAvoidancePlannerWidget;
+class MoonAvoidanceCalendarWidget;
 
 class MoonAvoidanceDialog : public StelDialog
 {
@@ -51,10 +56,19 @@ private:
 	void updateFormFields();
 	void enableFormFields(bool enabled);
 	void updateCurrentSeparation(); // Calculate and display current separation
+	void updateDiagram(); // Edited filter, selection and moon state to the diagram
+	void updatePlanner(); // Edited filters to the planner, which recomputes their columns
+	void schedulePreview(); // Coalesces edits; see previewTimer
+	void pushPreview(); // Edited filters to the sky and the planner
+	void updatePlannerSite(); // Observer, first night and UTC offset from Stellarium
+	void updateCalendarSite(); // Observer from Stellarium
+	bool selectedObject(QString& name, double& raDegrees, double& decDegrees) const; // J2000; false if none
 	void createFiltersTab();
 	void createInfoTab();
 	void createAboutTab();
 	void createDiagramTab();
+	void createPlannerTab();
+	void createCalendarTab();
 
 	// Tab widget
 	QTabWidget* tabWidget;
@@ -75,13 +89,23 @@ private:
 	QLabel* moonAgeLabel; // Read-only display of moon age (days since new moon)
 	QLabel* currentSeparationLabel; // Read-only display of calculated current separation
 
-	// Visibility checkbox
+	// Visibility checkboxes
 	QCheckBox* enabledCheckBox;
+	QCheckBox* ghostRingsCheckBox;
+	QCheckBox* catalogHighlightCheckBox;
+	QComboBox* zoneStyleComboBox; // Index == MoonAvoidance::ZoneRenderMode
+	QCheckBox* horizonClippingCheckBox;
+	QDoubleSpinBox* horizonAltitudeSpinBox;
 
 	// Other tabs
 	QWidget* infoTab;
 	QWidget* aboutTab;
 	QWidget* diagramTab;
+	MoonAvoidanceDiagram* diagram;
+	QWidget* plannerTab;
+	MoonAvoidancePlannerWidget* planner;
+	QWidget* calendarTab;
+	MoonAvoidanceCalendarWidget* calendar;
 	QTextBrowser* infoTextBrowser;
 	QTextBrowser* aboutTextBrowser;
 
@@ -91,6 +115,11 @@ private:
 	QPushButton* okButton;
 	QPushButton* cancelButton;
 	
+	// Live preview: the first edit starts the timer and later ones within the
+	// window ride along, so dragging a spin box updates the sky a few times a
+	// second rather than on every step
+	QTimer* previewTimer;
+	
 	QList<FilterConfig> currentFilters;
 	QList<FilterConfig> pendingFilters; // Filters to set after dialog is created
 	QString currentFilterName;
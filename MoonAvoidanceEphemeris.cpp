@@ -0,0 +1,217 @@
+#include "MoonAvoidanceEphemeris.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	using MoonAvoidanceGeometry::Vector3;
+
+	constexpr double DegToRad = M_PI / 180.0;
+	constexpr double J2000 = 2451545.0;
+	constexpr double EarthRadiusKm = 6378.14;
+	constexpr double ObliquityJ2000 = 23.4392911;            // Degrees
+	constexpr double PrecessionInLongitude = 5029.0966 / 3600.0; // Degrees per Julian century
+
+	// Multiples of D, M, M', F and the coefficient (1e-6 deg, or 1e-3 km for distance)
+	struct PeriodicTerm
+	{
+		signed char d, m, mp, f;
+		int coefficient;
+	};
+
+	// Meeus table 47.A, longitude terms above 2000e-6 deg
+	const PeriodicTerm LongitudeTerms[] = {
+		{ 0, 0, 1, 0, 6288774 }, { 2, 0, -1, 0, 1274027 }, { 2, 0, 0, 0, 658314 },
+		{ 0, 0, 2, 0, 213618 }, { 0, 1, 0, 0, -185116 }, { 0, 0, 0, 2, -114332 },
+		{ 2, 0, -2, 0, 58793 }, { 2, -1, -1, 0, 57066 }, { 2, 0, 1, 0, 53322 },
+		{ 2, -1, 0, 0, 45758 }, { 0, 1, -1, 0, -40923 }, { 1, 0, 0, 0, -34720 },
+		{ 0, 1, 1, 0, -30383 }, { 2, 0, 0, -2, 15327 }, { 0, 0, 1, 2, -12528 },
+		{ 0, 0, 1, -2, 10980 }, { 4, 0, -1, 0, 10675 }, { 0, 0, 3, 0, 10034 },
+		{ 4, 0, -2, 0, 8548 }, { 2, 1, -1, 0, -7888 }, { 2, 1, 0, 0, -6766 },
+		{ 1, 0, -1, 0, -5163 }, { 1, 1, 0, 0, 4987 }, { 2, -1, 1, 0, 4036 },
+		{ 2, 0, 2, 0, 3994 }, { 4, 0, 0, 0, 3861 }, { 2, 0, -3, 0, 3665 },
+		{ 0, 1, -2, 0, -2689 }, { 2, 0, -1, 2, -2602 }, { 2, -1, -2, 0, 2390 },
+		{ 1, 0, 1, 0, -2348 }, { 2, -2, 0, 0, 2236 },
+	};
+
+	// Meeus table 47.A, distance terms above 7000e-3 km
+	const PeriodicTerm DistanceTerms[] = {
+		{ 0, 0, 1, 0, -20905355 }, { 2, 0, -1, 0, -3699111 }, { 2, 0, 0, 0, -2955968 },
+		{ 0, 0, 2, 0, -569925 }, { 0, 1, 0, 0, 48888 }, { 2, 0, -2, 0, 246158 },
+		{ 2, -1, -1, 0, -152138 }, { 2, 0, 1, 0, -170733 }, { 2, -1, 0, 0, -204586 },
+		{ 0, 1, -1, 0, -129620 }, { 1, 0, 0, 0, 108743 }, { 0, 1, 1, 0, 104755 },
+		{ 2, 0, 0, -2, 10321 }, { 0, 0, 1, -2, 79661 }, { 4, 0, -1, 0, -34782 },
+		{ 0, 0, 3, 0, -23210 }, { 4, 0, -2, 0, -21636 }, { 2, 1, -1, 0, 24208 },
+		{ 2, 1, 0, 0, 30824 }, { 1, 0, -1, 0, -8379 }, { 1, 1, 0, 0, -16675 },
+		{ 2, -1, 1, 0, -12831 }, { 2, 0, 2, 0, -10445 }, { 4, 0, 0, 0, -11650 },
+		{ 2, 0, -3, 0, 14403 }, { 0, 1, -2, 0, -7003 }, { 2, -1, -2, 0, 10056 },
+		{ 2, -2, 0, 0, -9884 },
+	};
+
+	// Meeus table 47.B, latitude terms above 2000e-6 deg
+	const PeriodicTerm LatitudeTerms[] = {
+		{ 0, 0, 0, 1, 5128122 }, { 0, 0, 1, 1, 280602 }, { 0, 0, 1, -1, 277693 },
+		{ 2, 0, 0, -1, 173237 }, { 2, 0, -1, 1, 55413 }, { 2, 0, -1, -1, 46271 },
+		{ 2, 0, 0, 1, 32573 }, { 0, 0, 2, 1, 17198 }, { 2, 0, 1, -1, 9266 },
+		{ 0, 0, 2, -1, 8822 }, { 2, -1, 0, -1, 8216 }, { 2, 0, -2, -1, 4324 },
+		{ 2, 0, 1, 1, 4200 }, { 2, 1, 0, -1, -3359 }, { 2, -1, -1, 1, 2463 },
+	};
+
+	struct Arguments
+	{
+		double d, m, mp, f; // Radians
+		double e;           // Eccentricity factor for terms in M
+	};
+
+	// Sum of coefficient * E^|m| * fn(argument) over a table
+	template <size_t N, typename Fn>
+	double sumTerms(const PeriodicTerm (&terms)[N], const Arguments& a, Fn fn)
+	{
+		double sum = 0.0;
+		for (const PeriodicTerm& t : terms)
+		{
+			double value = t.coefficient * fn(t.d * a.d + t.m * a.m + t.mp * a.mp + t.f * a.f);
+			if (t.m == 1 || t.m == -1)
+				value *= a.e;
+			else if (t.m == 2 || t.m == -2)
+				value *= a.e * a.e;
+			sum += value;
+		}
+		return sum;
+	}
+
+	// Ecliptic (longitude, latitude in radians, distance) to equatorial for an obliquity in radians
+	Vector3 eclipticToEquatorial(double lambda, double beta, double distance, double obliquity)
+	{
+		const double x = distance * std::cos(beta) * std::cos(lambda);
+		const double y = distance * std::cos(beta) * std::sin(lambda);
+		const double z = distance * std::sin(beta);
+		const double ce = std::cos(obliquity);
+		const double se = std::sin(obliquity);
+		return { x, y * ce - z * se, y * se + z * ce };
+	}
+
+	Vector3 equatorialToEcliptic(const Vector3& v, double obliquity)
+	{
+		const double ce = std::cos(obliquity);
+		const double se = std::sin(obliquity);
+		return { v.x, v.y * ce + v.z * se, -v.y * se + v.z * ce };
+	}
+
+	// Equatorial of date to J2000: undo precession in ecliptic longitude, then use the J2000 obliquity
+	Vector3 ofDateToJ2000(const Vector3& v, double obliquity, double t)
+	{
+		const Vector3 ecliptic = equatorialToEcliptic(v, obliquity);
+		const double eclLon = std::atan2(ecliptic.y, ecliptic.x) - PrecessionInLongitude * t * DegToRad;
+		const double eclLat = std::asin(std::max(-1.0, std::min(1.0, ecliptic.z)));
+		return MoonAvoidanceGeometry::normalized(eclipticToEquatorial(eclLon, eclLat, 1.0, ObliquityJ2000 * DegToRad));
+	}
+}
+
+namespace MoonAvoidanceEphemeris
+{
+
+double greenwichMeanSiderealTime(double jdUT)
+{
+	// Meeus (12.4)
+	const double t = (jdUT - J2000) / 36525.0;
+	const double theta = 280.46061837 + 360.98564736629 * (jdUT - J2000) + 0.000387933 * t * t - t * t * t / 38710000.0;
+	const double wrapped = std::fmod(theta, 360.0);
+	return wrapped < 0.0 ? wrapped + 360.0 : wrapped;
+}
+
+MoonPosition moonPosition(double jdUT, double deltaTDays, const Site& site)
+{
+	const double t = (jdUT + deltaTDays - J2000) / 36525.0;
+	const double t2 = t * t;
+
+	// Mean elements, degrees (Meeus 47.1 - 47.5)
+	const double lp = 218.3164477 + 481267.88123421 * t - 0.0015786 * t2;
+	Arguments a;
+	a.d = (297.8501921 + 445267.1114034 * t - 0.0018819 * t2) * DegToRad;
+	a.m = (357.5291092 + 35999.0502909 * t - 0.0001536 * t2) * DegToRad;
+	a.mp = (134.9633964 + 477198.8675055 * t + 0.0087414 * t2) * DegToRad;
+	a.f = (93.2720950 + 483202.0175233 * t - 0.0036539 * t2) * DegToRad;
+	a.e = 1.0 - 0.002516 * t - 0.0000074 * t2;
+
+	const double a1 = (119.75 + 131.849 * t) * DegToRad;
+	const double a2 = (53.09 + 479264.290 * t) * DegToRad;
+	const double a3 = (313.45 + 481266.484 * t) * DegToRad;
+	const double lpRad = lp * DegToRad;
+
+	auto sine = [](double x) { return std::sin(x); };
+	auto cosine = [](double x) { return std::cos(x); };
+
+	double sumL = sumTerms(LongitudeTerms, a, sine);
+	double sumB = sumTerms(LatitudeTerms, a, sine);
+	const double sumR = sumTerms(DistanceTerms, a, cosine);
+
+	// Venus, Jupiter and Earth flattening corrections
+	sumL += 3958.0 * std::sin(a1) + 1962.0 * std::sin(lpRad - a.f) + 318.0 * std::sin(a2);
+	sumB += -2235.0 * std::sin(lpRad) + 382.0 * std::sin(a3) + 175.0 * std::sin(a1 - a.f)
+	        + 175.0 * std::sin(a1 + a.f) + 127.0 * std::sin(lpRad - a.mp) - 115.0 * std::sin(lpRad + a.mp);
+
+	const double lambda = (lp + sumL / 1e6) * DegToRad;
+	const double beta = (sumB / 1e6) * DegToRad;
+	const double distance = 385000.56 + sumR / 1000.0;
+
+	// Geocentric equatorial of date
+	const double obliquity = (ObliquityJ2000 - 0.0130042 * t) * DegToRad;
+	const Vector3 geocentric = eclipticToEquatorial(lambda, beta, distance, obliquity);
+
+	// Observer on a spherical Earth, equatorial of date
+	const double lat = site.latitude * DegToRad;
+	const double lst = (greenwichMeanSiderealTime(jdUT) + site.longitude) * DegToRad;
+	const double radius = EarthRadiusKm + site.elevation / 1000.0;
+	const Vector3 observer { radius * std::cos(lat) * std::cos(lst),
+	                         radius * std::cos(lat) * std::sin(lst),
+	                         radius * std::sin(lat) };
+	const Vector3 topocentric = MoonAvoidanceGeometry::normalized(geocentric - observer);
+
+	// Altitude from the hour angle
+	const double ra = std::atan2(topocentric.y, topocentric.x);
+	const double dec = std::asin(topocentric.z);
+	const double hourAngle = lst - ra;
+	const double sinAlt = std::sin(lat) * std::sin(dec) + std::cos(lat) * std::cos(dec) * std::cos(hourAngle);
+	const double altitude = std::asin(std::max(-1.0, std::min(1.0, sinAlt)));
+
+	MoonPosition position;
+	position.j2000Dir = ofDateToJ2000(topocentric, obliquity, t);
+	position.altitude = altitude / DegToRad;
+	position.distanceKm = distance;
+	return position;
+}
+
+double sunAltitude(double jdUT, double deltaTDays, const Site& site)
+{
+	const double t = (jdUT + deltaTDays - J2000) / 36525.0;
+
+	// Meeus (25.2) - (25.4) and the equation of center
+	const double l0 = 280.46646 + 36000.76983 * t + 0.0003032 * t * t;
+	const double m = (357.52911 + 35999.05029 * t - 0.0001537 * t * t) * DegToRad;
+	const double c = (1.914602 - 0.004817 * t - 0.000014 * t * t) * std::sin(m)
+	                 + (0.019993 - 0.000101 * t) * std::sin(2.0 * m) + 0.000289 * std::sin(3.0 * m);
+	const double lambda = (l0 + c) * DegToRad;
+
+	const double obliquity = (ObliquityJ2000 - 0.0130042 * t) * DegToRad;
+	const Vector3 sun = eclipticToEquatorial(lambda, 0.0, 1.0, obliquity);
+
+	const double lat = site.latitude * DegToRad;
+	const double lst = (greenwichMeanSiderealTime(jdUT) + site.longitude) * DegToRad;
+	const double ra = std::atan2(sun.y, sun.x);
+	const double dec = std::asin(sun.z);
+	const double sinAlt = std::sin(lat) * std::sin(dec) + std::cos(lat) * std::cos(dec) * std::cos(lst - ra);
+	return std::asin(std::max(-1.0, std::min(1.0, sinAlt))) / DegToRad;
+}
+
+Vector3 zenithJ2000(double jdUT, double deltaTDays, const Site& site)
+{
+	const double t = (jdUT + deltaTDays - J2000) / 36525.0;
+	const double obliquity = (ObliquityJ2000 - 0.0130042 * t) * DegToRad;
+	const double lat = site.latitude * DegToRad;
+	const double lst = (greenwichMeanSiderealTime(jdUT) + site.longitude) * DegToRad;
+	const Vector3 zenith { std::cos(lat) * std::cos(lst), std::cos(lat) * std::sin(lst), std::sin(lat) };
+	return ofDateToJ2000(zenith, obliquity, t);
+}
+
+}
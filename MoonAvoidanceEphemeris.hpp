@@ -0,0 +1,48 @@
+#ifndef MOONAVOIDANCEEPHEMERIS_HPP
+#define MOONAVOIDANCEEPHEMERIS_HPP
+
+#include "MoonAvoidanceGeometry.hpp"
+
+// Low-precision analytic moon ephemeris (Meeus, Astronomical Algorithms,
+// ch. 47, main terms only) with topocentric correction, plus the Sun's
+// altitude for twilight.
+//
+// Stellarium's SolarSystem can only be asked about the current simulation
+// time on the main thread. This is used where the plugin needs the moon at
+// many other times off the render thread (the night timeline). Accuracy is
+// a few arcminutes, which is far below the size of any avoidance zone.
+// No refraction and no nutation are applied.
+namespace MoonAvoidanceEphemeris
+{
+	// Observer on Earth, degrees, east longitude positive
+	struct Site
+	{
+		double latitude;
+		double longitude;
+		double elevation = 0.0; // Meters above sea level; only changes the moon's parallax
+	};
+
+	struct MoonPosition
+	{
+		MoonAvoidanceGeometry::Vector3 j2000Dir;  // Topocentric, J2000 equatorial, normalized
+		double altitude;                          // Topocentric geometric altitude, degrees
+		double distanceKm;                        // Geocentric distance
+	};
+
+	// Greenwich mean sidereal time at a UT Julian Day, degrees in [0, 360)
+	double greenwichMeanSiderealTime(double jdUT);
+
+	// Moon seen from the site. jdUT drives the Earth's rotation; the moon's
+	// orbit is evaluated at jdUT + deltaTDays (Stellarium: getJDE() - getJD()).
+	MoonPosition moonPosition(double jdUT, double deltaTDays, const Site& site);
+
+	// Geometric altitude of the Sun's center in degrees (Meeus ch. 25, low
+	// accuracy, ~0.01 degree). Used to find twilight, e.g. dawn at -18.
+	double sunAltitude(double jdUT, double deltaTDays, const Site& site);
+
+	// The site's zenith as a J2000 equatorial unit vector, so the altitude of a
+	// J2000 direction p is asin(p . zenith). Same precession as moonPosition().
+	MoonAvoidanceGeometry::Vector3 zenithJ2000(double jdUT, double deltaTDays, const Site& site);
+}
+
+#endif // MOONAVOIDANCEEPHEMERIS_HPP
@@ -0,0 +1,325 @@
+#include "MoonAvoidanceEphemerisCache.hpp"
+#include "MoonAvoidanceCatalog.hpp"
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QDebug>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+namespace
+{
+	using MoonAvoidanceGeometry::Vector3;
+	using MoonAvoidanceEphemerisCache::Key;
+	using MoonAvoidanceEphemerisCache::NightPointer;
+	static_assert(sizeof(Vector3) == 3 * sizeof(double), "Vector3 arrays are stored as they are in memory");
+
+	const char Magic[8] = { 'M', 'A', 'V', 'E', 'P', 'H', '\0', '\0' };
+	const quint32 Version = 1;
+	const qint64 MinutesPerDay = 1440;
+
+	struct Header
+	{
+		char magic[8];
+		quint32 version;
+		quint32 samplesPerNight;
+		double latitude;
+		double longitude;
+		double elevation;
+		double stepDays;
+		double deltaTSeconds;      // Rounded
+		double firstWindowStartJD;
+		quint64 nightCount;
+		quint64 fileSize;
+		quint64 payloadChecksum;
+		quint64 headerHash;        // Of the bytes before this field
+		quint64 reserved[4];
+	};
+	static_assert(sizeof(Header) == 128, "The ephemeris cache header is two cache lines");
+
+	double deltaTSeconds(const Key& key)
+	{
+		return std::round(key.deltaTDays * 86400.0);
+	}
+
+	qint64 nightBytes(int samples)
+	{
+		return static_cast<qint64>(samples) * static_cast<qint64>(2 * sizeof(Vector3) + 3 * sizeof(double));
+	}
+
+	// Window starts are whole minutes (see MoonAvoidancePlanner::windowStartFor)
+	qint64 minuteOf(double windowStartJD)
+	{
+		return qRound64(windowStartJD * MinutesPerDay);
+	}
+
+	QString sitePrefix(const Key& key)
+	{
+		const double fields[] = { key.site.latitude, key.site.longitude, key.site.elevation, key.stepDays, deltaTSeconds(key),
+		                          static_cast<double>(key.samplesPerNight) };
+		const quint64 hash = MoonAvoidanceCatalogFormat::checksum(reinterpret_cast<const char*>(fields), sizeof(fields));
+		return QString("ephemeris-%1-").arg(hash, 16, 16, QChar('0'));
+	}
+
+	// "<prefix><first minute>-<count>.bin"
+	bool parseName(const QString& name, const QString& prefix, qint64& firstMinute, qint64& count)
+	{
+		if (!name.startsWith(prefix) || !name.endsWith(".bin"))
+			return false;
+		const QStringList parts = name.mid(prefix.size(), name.size() - prefix.size() - 4).split('-');
+		bool firstOk = false;
+		bool countOk = false;
+		if (parts.size() == 2)
+		{
+			firstMinute = parts[0].toLongLong(&firstOk);
+			count = parts[1].toLongLong(&countOk);
+		}
+		return firstOk && countOk && count > 0;
+	}
+
+	// A validated, mapped cache file
+	class MappedFile
+	{
+	public:
+		MappedFile() : mapping(nullptr) {}
+		~MappedFile()
+		{
+			if (mapping)
+				file.unmap(mapping);
+		}
+
+		bool open(const QString& path, const Key& key, qint64 count, QString& problem)
+		{
+#if Q_BYTE_ORDER != Q_LITTLE_ENDIAN
+			Q_UNUSED(path)
+			Q_UNUSED(key)
+			Q_UNUSED(count)
+			problem = "big-endian host";
+			return false;
+#else
+			file.setFileName(path);
+			if (!file.open(QIODevice::ReadOnly))
+			{
+				problem = file.errorString();
+				return false;
+			}
+			const qint64 expectedSize = static_cast<qint64>(sizeof(Header)) + count * nightBytes(key.samplesPerNight);
+			if (file.size() != expectedSize)
+			{
+				problem = "unexpected size";
+				return false;
+			}
+			mapping = file.map(0, file.size());
+			if (!mapping)
+			{
+				problem = file.errorString();
+				return false;
+			}
+
+			const Header* h = reinterpret_cast<const Header*>(mapping);
+			if (std::memcmp(h->magic, Magic, sizeof(Magic)) != 0 || h->version != Version)
+				problem = "not an ephemeris cache of this version";
+			else if (h->headerHash != MoonAvoidanceCatalogFormat::checksum(reinterpret_cast<const char*>(h), offsetof(Header, headerHash)))
+				problem = "header hash mismatch";
+			else if (h->latitude != key.site.latitude || h->longitude != key.site.longitude || h->elevation != key.site.elevation
+			         || h->stepDays != key.stepDays || h->deltaTSeconds != deltaTSeconds(key)
+			         || h->samplesPerNight != static_cast<quint32>(key.samplesPerNight)
+			         || h->nightCount != static_cast<quint64>(count) || h->fileSize != static_cast<quint64>(expectedSize))
+				problem = "different site or range";
+			else if (h->payloadChecksum != MoonAvoidanceCatalogFormat::checksum(reinterpret_cast<const char*>(mapping) + sizeof(Header),
+			                                                                     expectedSize - static_cast<qint64>(sizeof(Header))))
+				problem = "payload checksum mismatch";
+			samples = key.samplesPerNight;
+			stepDays = key.stepDays;
+			return problem.isEmpty();
+#endif
+		}
+
+		NightPointer night(qint64 index, double windowStartJD) const
+		{
+			const uchar* block = mapping + sizeof(Header) + index * nightBytes(samples);
+			MoonAvoidancePlanner::Night* night = new MoonAvoidancePlanner::Night();
+			night->windowStartJD = windowStartJD;
+			night->stepDays = stepDays;
+			night->sampleCount = samples;
+			night->moonDir.resize(samples);
+			night->zenith.resize(samples);
+			night->moonAltitude.resize(samples);
+			night->moonDaysFromFull.resize(samples);
+			night->sunAltitude.resize(samples);
+
+			const size_t vectorBytes = samples * sizeof(Vector3);
+			const size_t scalarBytes = samples * sizeof(double);
+			std::memcpy(night->moonDir.data(), block, vectorBytes);
+			block += vectorBytes;
+			std::memcpy(night->zenith.data(), block, vectorBytes);
+			block += vectorBytes;
+			std::memcpy(night->moonAltitude.data(), block, scalarBytes);
+			block += scalarBytes;
+			std::memcpy(night->moonDaysFromFull.data(), block, scalarBytes);
+			block += scalarBytes;
+			std::memcpy(night->sunAltitude.data(), block, scalarBytes);
+			return NightPointer(night);
+		}
+
+	private:
+		QFile file;
+		uchar* mapping;
+		int samples = 0;
+		double stepDays = 0.0;
+	};
+}
+
+namespace MoonAvoidanceEphemerisCache
+{
+
+QString defaultDirectory()
+{
+	return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/MoonAvoidance";
+}
+
+int load(const QString& directory, const Key& key, double firstWindowStartJD, QVector<NightPointer>& nights)
+{
+	if (!nights.contains(NightPointer()))
+		return 0;
+
+	const QDir dir(directory);
+	const QString prefix = sitePrefix(key);
+	const qint64 firstMinute = minuteOf(firstWindowStartJD);
+	int filled = 0;
+	for (const QString& name : dir.entryList({ prefix + "*.bin" }, QDir::Files, QDir::Name))
+	{
+		qint64 fileFirstMinute = 0;
+		qint64 count = 0;
+		if (!parseName(name, prefix, fileFirstMinute, count) || (firstMinute - fileFirstMinute) % MinutesPerDay != 0)
+			continue;
+
+		// nights[j] is night j + offset of the file
+		const qint64 offset = (firstMinute - fileFirstMinute) / MinutesPerDay;
+		const qint64 begin = qMax<qint64>(0, -offset);
+		const qint64 end = qMin<qint64>(nights.size(), count - offset);
+		bool needed = false;
+		for (qint64 j = begin; j < end && !needed; ++j)
+			needed = !nights[j];
+		if (!needed)
+			continue;
+
+		MappedFile file;
+		QString problem;
+		if (!file.open(dir.filePath(name), key, count, problem))
+		{
+			qWarning() << "MoonAvoidanceEphemerisCache: Ignoring" << dir.filePath(name) << "-" << problem;
+			continue;
+		}
+		for (qint64 j = begin; j < end; ++j)
+		{
+			if (!nights[j])
+			{
+				nights[j] = file.night(j + offset, firstWindowStartJD + j);
+				++filled;
+			}
+		}
+	}
+	return filled;
+}
+
+bool save(const QString& directory, const Key& key, double firstWindowStartJD, const QVector<NightPointer>& nights, QString* error)
+{
+	const auto fail = [error](const QString& message) {
+		if (error)
+			*error = message;
+		return false;
+	};
+
+	for (const NightPointer& night : nights)
+	{
+		if (!night || night->sampleCount != key.samplesPerNight || night->stepDays != key.stepDays)
+			return fail("Nights missing or sampled differently");
+	}
+	if (nights.isEmpty())
+		return true;
+
+	QDir dir(directory);
+	if (!dir.mkpath("."))
+		return fail(QString("Cannot create %1").arg(directory));
+
+	const QString prefix = sitePrefix(key);
+	const qint64 firstMinute = minuteOf(firstWindowStartJD);
+	for (const QString& name : dir.entryList({ prefix + "*.bin" }, QDir::Files))
+	{
+		qint64 fileFirstMinute = 0;
+		qint64 count = 0;
+		if (!parseName(name, prefix, fileFirstMinute, count) || (firstMinute - fileFirstMinute) % MinutesPerDay != 0)
+			continue;
+		const qint64 offset = (firstMinute - fileFirstMinute) / MinutesPerDay;
+		if (offset >= 0 && offset + nights.size() <= count)
+			return true; // Already cached
+	}
+
+	const QString path = dir.filePath(QString("%1%2-%3.bin").arg(prefix).arg(firstMinute).arg(nights.size()));
+	QSaveFile out(path);
+	if (!out.open(QIODevice::WriteOnly))
+		return fail(QString("Cannot write %1: %2").arg(path, out.errorString()));
+
+	Header header;
+	std::memset(&header, 0, sizeof(header));
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header)); // Rewritten once complete
+
+	quint64 payloadChecksum = MoonAvoidanceCatalogFormat::ChecksumBasis;
+	bool written = true;
+	const auto put = [&](const void* data, qint64 size) {
+		const char* bytes = static_cast<const char*>(data);
+		payloadChecksum = MoonAvoidanceCatalogFormat::checksum(bytes, size, payloadChecksum);
+		written = written && out.write(bytes, size) == size;
+	};
+	const qint64 vectorBytes = key.samplesPerNight * static_cast<qint64>(sizeof(Vector3));
+	const qint64 scalarBytes = key.samplesPerNight * static_cast<qint64>(sizeof(double));
+	for (const NightPointer& night : nights)
+	{
+		put(night->moonDir.constData(), vectorBytes);
+		put(night->zenith.constData(), vectorBytes);
+		put(night->moonAltitude.constData(), scalarBytes);
+		put(night->moonDaysFromFull.constData(), scalarBytes);
+		put(night->sunAltitude.constData(), scalarBytes);
+	}
+
+	std::memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.samplesPerNight = static_cast<quint32>(key.samplesPerNight);
+	header.latitude = key.site.latitude;
+	header.longitude = key.site.longitude;
+	header.elevation = key.site.elevation;
+	header.stepDays = key.stepDays;
+	header.deltaTSeconds = deltaTSeconds(key);
+	header.firstWindowStartJD = firstWindowStartJD;
+	header.nightCount = static_cast<quint64>(nights.size());
+	header.fileSize = sizeof(Header) + nights.size() * nightBytes(key.samplesPerNight);
+	header.payloadChecksum = payloadChecksum;
+	header.headerHash = MoonAvoidanceCatalogFormat::checksum(reinterpret_cast<const char*>(&header), offsetof(Header, headerHash));
+
+	if (!written || !out.seek(0) || out.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header)
+	    || !out.commit())
+		return fail(QString("Cannot write %1: %2").arg(path, out.errorString()));
+
+	// Newest first; the rest of the site's files beyond the limit go
+	const QStringList files = dir.entryList({ prefix + "*.bin" }, QDir::Files, QDir::Time);
+	for (int i = MaxFilesPerSite; i < files.size(); ++i)
+		dir.remove(files[i]);
+	return true;
+}
+
+void saveInBackground(const QString& directory, const Key& key, double firstWindowStartJD, const QVector<NightPointer>& nights)
+{
+	// The nights are shared and immutable, so the copies cost nothing. Nobody
+	// waits for the write, so it is started rather than run for a QFuture.
+	QThreadPool::globalInstance()->start([directory, key, firstWindowStartJD, nights]() {
+		QString error;
+		if (!save(directory, key, firstWindowStartJD, nights, &error))
+			qWarning() << "MoonAvoidanceEphemerisCache:" << error;
+	});
+}
+
+}
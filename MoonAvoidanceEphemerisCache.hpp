@@ -0,0 +1,55 @@
+#ifndef MOONAVOIDANCEEPHEMERISCACHE_HPP
+#define MOONAVOIDANCEEPHEMERISCACHE_HPP
+
+#include "MoonAvoidanceEphemeris.hpp"
+#include "MoonAvoidancePlanner.hpp"
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+// Planner night ephemerides kept on disk between runs, shared by the Planner
+// and Calendar tabs and moonavoid-cli.
+//
+// One file per site and range of consecutive nights, named
+// ephemeris-<site hash>-<first night>-<count>.bin, where the site hash covers
+// the coordinates, elevation, Delta T (to the second), time step and samples
+// per night. A file is a 128-byte header followed by one block per night:
+// moonDir and zenith (Vector3 each), then moonAltitude, moonDaysFromFull and
+// sunAltitude, all float64, little-endian. The header repeats the key and is
+// validated by its own hash; the nights by a payload checksum (64-bit FNV-1a,
+// as in MoonAvoidanceCatalogFormat). Files are mapped for reading; a
+// damaged or mismatched file is ignored and rewritten by the next save.
+namespace MoonAvoidanceEphemerisCache
+{
+	using NightPointer = QSharedPointer<const MoonAvoidancePlanner::Night>;
+
+	// What a night's ephemeris depends on besides its window start
+	struct Key
+	{
+		MoonAvoidanceEphemeris::Site site;
+		double deltaTDays = 0.0;
+		double stepDays = MoonAvoidancePlanner::StepDays;
+		int samplesPerNight = MoonAvoidancePlanner::SamplesPerNight;
+	};
+
+	// Files kept per site; the least recently written go first
+	const int MaxFilesPerSite = 8;
+
+	// <generic cache location>/MoonAvoidance
+	QString defaultDirectory();
+
+	// Fills null entries of nights, consecutive from firstWindowStartJD (local mean
+	// noon, see MoonAvoidancePlanner::windowStartFor), from any file of the site
+	// that covers them. Returns how many were filled.
+	int load(const QString& directory, const Key& key, double firstWindowStartJD, QVector<NightPointer>& nights);
+
+	// Writes the nights (none null) unless one file already covers them all, then
+	// drops the oldest files of the site beyond MaxFilesPerSite
+	bool save(const QString& directory, const Key& key, double firstWindowStartJD, const QVector<NightPointer>& nights,
+	          QString* error = nullptr);
+
+	// save() on the global thread pool, for the GUI; failures are only logged
+	void saveInBackground(const QString& directory, const Key& key, double firstWindowStartJD, const QVector<NightPointer>& nights);
+}
+
+#endif // MOONAVOIDANCEEPHEMERISCACHE_HPP
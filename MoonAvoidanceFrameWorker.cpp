@@ -0,0 +1,507 @@
+#include "MoonAvoidanceFrameWorker.hpp"
+#include "MoonAvoidanceKernel.hpp"
+#include "MoonAvoidanceTrace.hpp"
+#include <QMutexLocker>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	using MoonAvoidanceGeometry::Vector3;
+
+	inline Vector3 toVector3(const Vec3d& v)
+	{
+		return { v[0], v[1], v[2] };
+	}
+
+	inline Vec3d toVec3d(const Vector3& v)
+	{
+		return Vec3d(v.x, v.y, v.z);
+	}
+
+	inline bool sameDirection(const Vector3& a, const Vector3& b)
+	{
+		return a.x == b.x && a.y == b.y && a.z == b.z;
+	}
+
+	inline bool sameAxes(const MoonAvoidanceHorizon::Axes& a, const MoonAvoidanceHorizon::Axes& b)
+	{
+		return sameDirection(a.x, b.x) && sameDirection(a.y, b.y) && sameDirection(a.zenith, b.zenith);
+	}
+
+	// Arrows come in groups of eight points starting on the ring; keep those whose base is above the horizon
+	void dropArrowsBelowHorizon(const MoonAvoidanceHorizon& horizon, const MoonAvoidanceHorizon::Axes& axes, QVector<Vector3>& lineVertices)
+	{
+		int kept = 0;
+		for (int i = 0; i + 8 <= lineVertices.size(); i += 8)
+		{
+			if (horizon.margin(axes, lineVertices[i]) < 0.0)
+				continue;
+			for (int k = 0; k < 8; ++k)
+				lineVertices[kept + k] = lineVertices[i + k];
+			kept += 8;
+		}
+		lineVertices.resize(kept);
+	}
+
+	void convert(const QVector<Vector3>& in, QVector<Vec3d>& out)
+	{
+		out.resize(in.size());
+		for (int i = 0; i < in.size(); ++i)
+		{
+			out[i] = toVec3d(in[i]);
+		}
+	}
+}
+
+MoonAvoidanceFrameWorker::MoonAvoidanceFrameWorker(QObject* parent)
+	: QThread(parent)
+	, hasPending(false)
+	, stopping(false)
+	, front(-1)
+	, inUse { false, false }
+	, acquiredIndex(-1)
+{
+	setObjectName("MoonAvoidanceFrameWorker");
+}
+
+MoonAvoidanceFrameWorker::~MoonAvoidanceFrameWorker()
+{
+	stop();
+}
+
+void MoonAvoidanceFrameWorker::submit(const MoonAvoidanceFrameRequest& request)
+{
+	QMutexLocker locker(&mutex);
+	pending = request;
+	hasPending = true;
+	requestReady.wakeOne();
+}
+
+const MoonAvoidanceFrameState* MoonAvoidanceFrameWorker::acquire()
+{
+	QMutexLocker locker(&mutex);
+	if (front < 0)
+		return nullptr;
+	inUse[front] = true;
+	acquiredIndex = front;
+	return &buffers[front];
+}
+
+void MoonAvoidanceFrameWorker::release()
+{
+	QMutexLocker locker(&mutex);
+	if (acquiredIndex >= 0)
+	{
+		inUse[acquiredIndex] = false;
+		acquiredIndex = -1;
+		bufferReleased.wakeOne();
+	}
+}
+
+void MoonAvoidanceFrameWorker::stop()
+{
+	{
+		QMutexLocker locker(&mutex);
+		stopping = true;
+		requestReady.wakeAll();
+		bufferReleased.wakeAll();
+	}
+	wait();
+}
+
+void MoonAvoidanceFrameWorker::run()
+{
+	for (;;)
+	{
+		MoonAvoidanceFrameRequest request;
+		int target;
+		{
+			QMutexLocker locker(&mutex);
+			while (!hasPending && !stopping)
+				requestReady.wait(&mutex);
+			if (stopping)
+				return;
+			request = pending;
+			pending.projector.clear(); // Do not keep the view alive longer than needed
+			hasPending = false;
+
+			// Write into the buffer the render thread is not reading
+			target = front < 0 ? 0 : 1 - front;
+			while (inUse[target] && !stopping)
+				bufferReleased.wait(&mutex);
+			if (stopping)
+				return;
+		}
+
+		compute(request, buffers[target]);
+
+		QMutexLocker locker(&mutex);
+		front = target;
+	}
+}
+
+void MoonAvoidanceFrameWorker::compute(const MoonAvoidanceFrameRequest& request, MoonAvoidanceFrameState& state)
+{
+	MA_TRACE_ZONE("worker");
+
+	state.serial = request.serial;
+	state.jd = request.jd;
+	state.zones.clear();
+	state.ghostZones.clear();
+	state.labels.clear();
+	state.verticesProjected = 0;
+	state.cacheHits = 0;
+	state.cacheMisses = 0;
+
+	const Vector3 center = toVector3(request.moonDir);
+	const MoonAvoidanceGeometry::LocalFrame frame = MoonAvoidanceGeometry::makeLocalFrame(center);
+	const double pixelsPerRad = request.projector ? request.projector->getPixelPerRadAtCenter() : 0.0;
+	state.zones.reserve(request.filters.size());
+
+	for (int index = 0; index < request.filters.size(); ++index)
+	{
+		const FilterConfig& filter = request.filters[index];
+
+		double radiusDegrees;
+		{
+			MA_TRACE_ZONE("radius");
+			if (request.radiiDegrees.size() == request.filters.size())
+				radiusDegrees = request.radiiDegrees[index];
+			else
+				radiusDegrees = MoonAvoidanceKernel::zoneRadiusDegrees(filter, request.moonAltitude, request.moonDaysFromFull);
+		}
+		const double radius = radiusDegrees * M_PI / 180.0;
+
+		// radius == 0 means avoidance is OFF (relaxed separation <= 0)
+		if (!(radius > 0.0 && radius < M_PI))
+			continue;
+
+		CachedRing& cached = ringCache[filter.name];
+		if (sameDirection(cached.center, center) && cached.radius == radius && cached.filterIndex == index
+		    && cached.renderMode == request.renderMode && cached.horizon == request.horizon
+		    && (!request.horizon || sameAxes(cached.horizonAxes, request.horizonAxes)))
+		{
+			++state.cacheHits;
+		}
+		else
+		{
+			MA_TRACE_ZONE("tessellation");
+			++state.cacheMisses;
+			// Cap and band modes draw the outline from the region; only rings need the strip
+			cached.ringStarts.clear();
+			if (request.renderMode == RenderRings)
+			{
+				const int segments = MoonAvoidanceGeometry::ringSegments(radiusDegrees);
+				if (request.horizon)
+					request.horizon->clipRing(frame, radius, segments, request.horizonAxes, scratch, cached.ringStarts);
+				else
+					MoonAvoidanceGeometry::tessellateRing(frame, radius, segments, scratch);
+				convert(scratch, cached.ring);
+				scratch.clear();
+			}
+			else
+			{
+				cached.ring.clear();
+			}
+			cached.center = center;
+			cached.radius = radius;
+			cached.filterIndex = index;
+			cached.renderMode = request.renderMode;
+			cached.horizon = request.horizon;
+			cached.horizonAxes = request.horizonAxes;
+			cached.arrowCount = -1;
+		}
+
+		// Arrow count follows the ring's size on screen: none when it is too small to read
+		const double circumferencePixels = 2.0 * M_PI * std::sin(qMin(radius, M_PI_2)) * pixelsPerRad;
+		const int arrowCount = MoonAvoidanceGeometry::arrowCountForCircumference(circumferencePixels);
+		if (cached.arrowCount != arrowCount)
+		{
+			MoonAvoidanceGeometry::appendArrows(frame, radius, index, arrowCount, scratch);
+			if (request.horizon)
+				dropArrowsBelowHorizon(*request.horizon, request.horizonAxes, scratch);
+			convert(scratch, cached.arrowLines);
+			scratch.clear();
+			cached.arrowCount = arrowCount;
+		}
+
+		MoonAvoidanceZoneGeometry zone;
+		zone.name = filter.name;
+		zone.color = filter.color;
+		zone.radius = radius;
+		zone.radiusDegrees = radiusDegrees;
+		zone.ring = cached.ring;             // Implicitly shared, no copy
+		zone.ringStarts = cached.ringStarts;
+		zone.arrowLines = cached.arrowLines;
+		state.zones.append(zone);
+	}
+
+	if (request.renderMode != RenderRings)
+		computeRegions(request, state);
+	else
+		regionCache.clear();
+
+	computeGhosts(request, state);
+
+	if (request.projector)
+		placeLabels(request, state);
+}
+
+void MoonAvoidanceFrameWorker::computeRegions(const MoonAvoidanceFrameRequest& request, MoonAvoidanceFrameState& state)
+{
+	MA_TRACE_ZONE("regions");
+
+	// Reuse a cached polygon while the moon has moved less than ~1 arcsecond
+	// and the radii changed by less than that; the difference is not visible
+	const double tolerance = 5e-6; // Radians
+	const double cosTolerance = std::cos(tolerance);
+	const Vector3 center = toVector3(request.moonDir);
+
+	// Bands run from the next smaller radius out to this one (ties: the earlier filter is inside).
+	// Sorting once keeps this O(n log n) for hundreds of zones.
+	innerRadii.fill(0.0, state.zones.size());
+	if (request.renderMode == RenderBands)
+	{
+		order.resize(state.zones.size());
+		for (int i = 0; i < order.size(); ++i)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [&state](int a, int b) {
+			const double ra = state.zones[a].radius;
+			const double rb = state.zones[b].radius;
+			return ra < rb || (ra == rb && a < b);
+		});
+		for (int k = 1; k < order.size(); ++k)
+			innerRadii[order[k]] = state.zones[order[k - 1]].radius;
+	}
+
+	for (int i = 0; i < state.zones.size(); ++i)
+	{
+		MoonAvoidanceZoneGeometry& zone = state.zones[i];
+		const double innerRadius = innerRadii[i];
+
+		CachedRegion& cached = regionCache[zone.name];
+		if (cached.outline && MoonAvoidanceGeometry::dot(cached.center, center) > cosTolerance
+		    && std::fabs(cached.radius - zone.radius) < tolerance
+		    && std::fabs(cached.innerRadius - innerRadius) < tolerance)
+		{
+			++state.cacheHits;
+		}
+		else
+		{
+			MA_TRACE_ZONE("tessellation");
+			++state.cacheMisses;
+
+			// Converting the cap to a polygon once keeps Stellarium from
+			// re-tessellating its outline every time it is drawn
+			const SphericalCap cap(request.moonDir, std::cos(zone.radius));
+			cached.outline = SphericalRegionP(new SphericalPolygon(cap.getOctahedronPolygon()));
+			if (innerRadius > 0.0)
+			{
+				const SphericalCap inner(request.moonDir, std::cos(innerRadius));
+				cached.fill = cached.outline->getSubtraction(&inner);
+			}
+			else
+			{
+				cached.fill = cached.outline;
+			}
+			cached.center = center;
+			cached.radius = zone.radius;
+			cached.innerRadius = innerRadius;
+		}
+
+		zone.outline = cached.outline;
+		zone.fill = cached.fill;
+	}
+}
+
+void MoonAvoidanceFrameWorker::computeGhosts(const MoonAvoidanceFrameRequest& request, MoonAvoidanceFrameState& state)
+{
+	if (request.ghosts.isEmpty())
+	{
+		ghostCache.clear();
+		return;
+	}
+
+	MA_TRACE_ZONE("ghosts");
+
+	// Entries for epochs that are no longer requested are dropped
+	QHash<QPair<qint64, int>, CachedGhost> nextCache;
+	nextCache.reserve(request.ghosts.size() * request.filters.size());
+
+	for (const MoonAvoidanceGhostEpoch& epoch : request.ghosts)
+	{
+		const Vector3 center = toVector3(epoch.moonDir);
+		const MoonAvoidanceGeometry::LocalFrame frame = MoonAvoidanceGeometry::makeLocalFrame(center);
+		const qint64 epochMinute = qRound64(epoch.jd * 1440.0);
+
+		for (int index = 0; index < request.filters.size() && index < epoch.radiiDegrees.size(); ++index)
+		{
+			const double radiusDegrees = epoch.radiiDegrees[index];
+			const double radius = radiusDegrees * M_PI / 180.0;
+			if (!(radius > 0.0 && radius < M_PI))
+				continue;
+
+			const QPair<qint64, int> key(epochMinute, index);
+			CachedGhost cached = ghostCache.take(key);
+			if (sameDirection(cached.center, center) && cached.radius == radius)
+			{
+				++state.cacheHits;
+			}
+			else
+			{
+				MA_TRACE_ZONE("tessellation");
+				++state.cacheMisses;
+				// Ghosts are thin and faint; a quarter of the live ring's segments is plenty
+				const int segments = qMax(64, MoonAvoidanceGeometry::ringSegments(radiusDegrees) / 4);
+				MoonAvoidanceGeometry::tessellateRing(frame, radius, segments, scratch);
+				convert(scratch, cached.ring);
+				scratch.clear();
+				cached.center = center;
+				cached.radius = radius;
+			}
+
+			MoonAvoidanceZoneGeometry zone;
+			zone.name = request.filters[index].name;
+			zone.color = request.filters[index].color;
+			zone.radius = radius;
+			zone.radiusDegrees = radiusDegrees;
+			zone.ring = cached.ring;
+			zone.opacity = epoch.opacity;
+			state.ghostZones.append(zone);
+			nextCache.insert(key, cached);
+		}
+	}
+
+	ghostCache.swap(nextCache);
+}
+
+void MoonAvoidanceFrameWorker::placeLabels(const MoonAvoidanceFrameRequest& request, MoonAvoidanceFrameState& state)
+{
+	const StelProjectorP& projector = request.projector;
+	const MoonAvoidanceGeometry::LocalFrame frame = MoonAvoidanceGeometry::makeLocalFrame(toVector3(request.moonDir));
+
+	const double vpX = projector->getViewportPosX();
+	const double vpY = projector->getViewportPosY();
+	const double vpW = projector->getViewportWidth();
+	const double vpH = projector->getViewportHeight();
+
+	// One layout request per zone: where its circle meets the top of the screen, if visible
+	QVector<MoonAvoidanceLabelLayout::Request> requests;
+	requests.reserve(state.zones.size());
+	bool circleNearLeftEdge = false;
+	const double leftEdgeCheckX = vpX + 40.0 + 100.0; // Where off-screen labels are stacked
+
+	{
+		MA_TRACE_ZONE("projection");
+		const int sampleCount = 128;
+		for (const MoonAvoidanceZoneGeometry& zone : state.zones)
+		{
+			bool isVisible = false;
+			double topmostY = -1e9;     // Largest Y (topmost in OpenGL coords where Y increases upward)
+			double topmostLeftX = 1e9;
+			double topmostRightX = -1e9;
+			double leftmostVisibleX = 1e9;
+			double rightmostVisibleX = -1e9;
+			const double topThreshold = vpY + vpH - 100; // Within 100 pixels of top
+
+			// Only the part above the horizon is probed; a zone entirely below gets an off-screen label
+			double startAngle = 0.0;
+			double endAngle = 2.0 * M_PI * (sampleCount - 1) / sampleCount;
+			bool checkProfile = false;
+			if (request.horizon)
+			{
+				double start, end;
+				const MoonAvoidanceGeometry::ArcCoverage coverage = MoonAvoidanceGeometry::arcAboveAltitude(
+					frame, zone.radius, request.horizonAxes.zenith, std::sin(request.horizon->minimumAltitude()), start, end);
+				if (coverage == MoonAvoidanceGeometry::ArcNone)
+				{
+					requests.append({ zone.name, zone.color, zone.radiusDegrees, false, 0.0, 0.0 });
+					continue;
+				}
+				if (coverage == MoonAvoidanceGeometry::ArcPartial)
+				{
+					startAngle = start;
+					endAngle = end;
+				}
+				checkProfile = !request.horizon->isFlat();
+			}
+
+			MoonAvoidanceGeometry::smallCircle(frame, zone.radius, startAngle, endAngle, sampleCount, probes);
+			for (int i = 0; i < sampleCount; ++i)
+			{
+				if (checkProfile && request.horizon->margin(request.horizonAxes, { probes.x[i], probes.y[i], probes.z[i] }) < 0.0)
+					continue;
+
+				const Vec3d point(probes.x[i], probes.y[i], probes.z[i]);
+
+				Vec3d screenPos;
+				++state.verticesProjected;
+				if (!projector->project(point, screenPos))
+					continue;
+
+				// Visible with some tolerance
+				if (screenPos[0] >= vpX - 10 && screenPos[0] <= vpX + vpW + 10 &&
+				    screenPos[1] >= vpY - 10 && screenPos[1] <= vpY + vpH + 10)
+				{
+					isVisible = true;
+				}
+
+				// Track points that are actually in the viewport
+				if (!(screenPos[0] >= vpX && screenPos[0] <= vpX + vpW &&
+				      screenPos[1] >= vpY && screenPos[1] <= vpY + vpH))
+					continue;
+
+				leftmostVisibleX = qMin(leftmostVisibleX, screenPos[0]);
+				rightmostVisibleX = qMax(rightmostVisibleX, screenPos[0]);
+
+				if (screenPos[1] >= topThreshold)
+				{
+					if (screenPos[1] > topmostY)
+					{
+						// New topmost - reset left and right
+						topmostY = screenPos[1];
+						topmostLeftX = screenPos[0];
+						topmostRightX = screenPos[0];
+					}
+					else if (screenPos[1] == topmostY)
+					{
+						topmostLeftX = qMin(topmostLeftX, screenPos[0]);
+						topmostRightX = qMax(topmostRightX, screenPos[0]);
+					}
+				}
+			}
+
+			MoonAvoidanceLabelLayout::Request labelRequest { zone.name, zone.color, zone.radiusDegrees, isVisible, 0.0, 0.0 };
+			if (!isVisible)
+			{
+				requests.append(labelRequest);
+				continue;
+			}
+
+			if (topmostY < -1e8)
+			{
+				// Visible but no points near the top: use the visible extent, or the viewport edges
+				if (leftmostVisibleX < 1e8)
+				{
+					topmostLeftX = leftmostVisibleX;
+					topmostRightX = rightmostVisibleX;
+				}
+				else
+				{
+					topmostLeftX = vpX;
+					topmostRightX = vpX + vpW;
+				}
+			}
+			labelRequest.leftX = topmostLeftX;
+			labelRequest.rightX = topmostRightX;
+			requests.append(labelRequest);
+			if (topmostLeftX < leftEdgeCheckX)
+				circleNearLeftEdge = true;
+		}
+	}
+
+	MA_TRACE_ZONE("label");
+	labelLayout.setFont(request.font);
+	labelLayout.layout(QRectF(vpX, vpY, vpW, vpH), requests, circleNearLeftEdge, state.labels);
+}
@@ -0,0 +1,186 @@
+#ifndef MOONAVOIDANCEFRAMEWORKER_HPP
+#define MOONAVOIDANCEFRAMEWORKER_HPP
+
+#include "MoonAvoidanceConfig.hpp"
+#include "MoonAvoidanceGeometry.hpp"
+#include "MoonAvoidanceHorizon.hpp"
+#include "MoonAvoidanceLabelLayout.hpp"
+#include "StelProjector.hpp"
+#include "StelSphereGeometry.hpp"
+#include "VecMath.hpp"
+#include <QColor>
+#include <QFont>
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QSharedPointer>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+// Moon and radii at a future time, for the ghost rings (see MoonAvoidance::collectGhostEpochs)
+struct MoonAvoidanceGhostEpoch
+{
+	double jd = 0.0;
+	Vec3d moonDir;                  // J2000, normalized
+	QVector<double> radiiDegrees;   // One per filter, 0 = avoidance off
+	float opacity = 1.0f;
+};
+
+// Everything the worker needs to build one frame, captured on the render thread
+struct MoonAvoidanceFrameRequest
+{
+	quint64 serial = 0;
+	double jd = 0.0;
+	Vec3d moonDir;                  // J2000, normalized
+	double moonAltitude = 0.0;      // Degrees
+	double moonDaysFromFull = 0.0;  // Lorentzian AGE
+	QList<FilterConfig> filters;
+	QVector<double> radiiDegrees;   // Optional, one per filter (from the night timeline)
+	QVector<MoonAvoidanceGhostEpoch> ghosts;
+	int renderMode = 0;             // MoonAvoidance::ZoneRenderMode
+	QFont font;                     // Font the labels will be drawn with
+	QSharedPointer<const MoonAvoidanceHorizon> horizon; // Null = no horizon clipping
+	MoonAvoidanceHorizon::Axes horizonAxes;             // Alt-az axes in J2000 at jd
+	StelProjectorP projector;       // J2000 projector of the frame that posted the request
+};
+
+// Ready-to-submit geometry for one filter
+struct MoonAvoidanceZoneGeometry
+{
+	QString name;
+	QColor color;
+	double radius = 0.0;          // Radians
+	double radiusDegrees = 0.0;
+	QVector<Vec3d> ring;          // Closed strip, first == last (ring mode only)
+	QVector<int> ringStarts;      // Clipped at the horizon: first point of each piece; empty = one strip
+	QVector<Vec3d> arrowLines;    // Pairs of points, one great-circle arc each
+	float opacity = 1.0f;
+
+	// Cap and band modes: outline of the whole cap, and the area to fill
+	// (the cap itself, or the band between this radius and the next smaller one)
+	SphericalRegionP outline;
+	SphericalRegionP fill;
+};
+
+// Result of one worker pass. The render thread only reads it.
+struct MoonAvoidanceFrameState
+{
+	quint64 serial = 0;
+	double jd = 0.0;
+	QVector<MoonAvoidanceZoneGeometry> zones;
+	QVector<MoonAvoidanceZoneGeometry> ghostZones; // Future rings, no arrows, faded
+	QVector<MoonAvoidanceLabel> labels;
+
+	// Work done by the worker for this state, folded into the frame counters
+	int verticesProjected = 0;
+	int cacheHits = 0;
+	int cacheMisses = 0;
+};
+
+// Computes the avoidance state (radii, tessellated rings, arrows, label
+// anchors) for the latest request on a dedicated thread and publishes it
+// through a double buffer.
+//
+// The render thread calls submit() with the current JD and view, then
+// acquire()/release() around submitting the most recent published state.
+// Requests coalesce: if several arrive while a pass is running only the
+// newest is computed. The render thread never waits for a computation; it
+// draws the latest finished state, at most one frame behind.
+class MoonAvoidanceFrameWorker : public QThread
+{
+	Q_OBJECT
+
+public:
+	// How zones are drawn (MoonAvoidance::ZoneRenderMode uses the same values)
+	enum RenderMode
+	{
+		RenderRings = 0,  // Outline ring with arrows
+		RenderCaps = 1,   // Translucent filled cap per filter
+		RenderBands = 2   // Filled band between neighbouring filter radii
+	};
+
+	MoonAvoidanceFrameWorker(QObject* parent = nullptr);
+	~MoonAvoidanceFrameWorker() override;
+
+	// Render thread
+	void submit(const MoonAvoidanceFrameRequest& request);
+	const MoonAvoidanceFrameState* acquire();
+	void release();
+
+	// Any thread; blocks until the worker has exited
+	void stop();
+
+	// One pass on the calling thread, as run() does for each request. Outside
+	// run() only on a worker that was never started (benchmarks).
+	void compute(const MoonAvoidanceFrameRequest& request, MoonAvoidanceFrameState& state);
+
+protected:
+	void run() override;
+
+private:
+	void computeGhosts(const MoonAvoidanceFrameRequest& request, MoonAvoidanceFrameState& state);
+	void computeRegions(const MoonAvoidanceFrameRequest& request, MoonAvoidanceFrameState& state);
+	void placeLabels(const MoonAvoidanceFrameRequest& request, MoonAvoidanceFrameState& state);
+
+	QMutex mutex;
+	QWaitCondition requestReady;
+	QWaitCondition bufferReleased;
+	MoonAvoidanceFrameRequest pending;
+	bool hasPending;
+	bool stopping;
+
+	// Double buffer: the render thread reads buffers[front] while the worker
+	// fills the other one; front flips when a pass completes
+	MoonAvoidanceFrameState buffers[2];
+	int front;            // -1 until the first state is published
+	bool inUse[2];
+	int acquiredIndex;
+
+	// Worker-thread only: tessellated ring per filter, reused while center and radius are unchanged
+	struct CachedRing
+	{
+		MoonAvoidanceGeometry::Vector3 center { 0.0, 0.0, 0.0 };
+		double radius = -1.0;
+		int filterIndex = -1;
+		int renderMode = -1;
+		int arrowCount = -1;  // Arrows follow the on-screen size and are rebuilt on their own
+		QSharedPointer<const MoonAvoidanceHorizon> horizon;
+		MoonAvoidanceHorizon::Axes horizonAxes;
+		QVector<Vec3d> ring;
+		QVector<int> ringStarts;
+		QVector<Vec3d> arrowLines;
+	};
+	QHash<QString, CachedRing> ringCache;
+
+	// Worker-thread only: cap and band polygons per filter. Polygon clipping is
+	// costly, so entries are reused while the moon and radii stay within a small
+	// tolerance instead of requiring an exact match.
+	struct CachedRegion
+	{
+		MoonAvoidanceGeometry::Vector3 center { 0.0, 0.0, 0.0 };
+		double radius = -1.0;
+		double innerRadius = -1.0;
+		SphericalRegionP outline;
+		SphericalRegionP fill;
+	};
+	QHash<QString, CachedRegion> regionCache;
+
+	// Worker-thread only: ghost rings per (epoch minute, filter index). Epochs sit
+	// on whole hours, so each ring is tessellated once and reused until it expires.
+	struct CachedGhost
+	{
+		MoonAvoidanceGeometry::Vector3 center { 0.0, 0.0, 0.0 };
+		double radius = -1.0;
+		QVector<Vec3d> ring;
+	};
+	QHash<QPair<qint64, int>, CachedGhost> ghostCache;
+	QVector<MoonAvoidanceGeometry::Vector3> scratch;
+	QVector<int> order;          // Zone indices by radius (bands)
+	QVector<double> innerRadii;  // Per zone, 0 = filled to the center
+	MoonAvoidanceGeometry::SmallCirclePoints probes; // Label probe points, reused
+	MoonAvoidanceLabelLayout labelLayout;
+};
+
+#endif // MOONAVOIDANCEFRAMEWORKER_HPP
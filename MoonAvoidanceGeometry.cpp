@@ -0,0 +1,218 @@
+#include "MoonAvoidanceGeometry.hpp"
+#include <QVarLengthArray>
+#include <algorithm>
+
+namespace MoonAvoidanceGeometry
+{
+
+LocalFrame makeLocalFrame(const Vector3& center)
+{
+	LocalFrame frame;
+	frame.center = normalized(center);
+
+	// Find a vector perpendicular to the center; near the pole use east instead of north
+	const Vector3 north { 0.0, 0.0, 1.0 };
+	const Vector3 east { 1.0, 0.0, 0.0 };
+	Vector3 u = cross(frame.center, north);
+	if (norm(u) < 0.1)
+		u = cross(frame.center, east);
+	frame.u = normalized(u);
+	frame.v = normalized(cross(frame.center, frame.u));
+	return frame;
+}
+
+Vector3 pointOnSmallCircle(const LocalFrame& frame, double radius, double angle)
+{
+	return normalized(frame.center * std::cos(radius) +
+	                  (frame.u * std::cos(angle) + frame.v * std::sin(angle)) * std::sin(radius));
+}
+
+int ringSegments(double radiusDegrees)
+{
+	// At least 256, more for larger circles, capped at 1024
+	return std::min(std::max(256, static_cast<int>(radiusDegrees * 8)), 1024);
+}
+
+void unitCircle(double startAngle, double step, int count, double* cosOut, double* sinOut)
+{
+	const double cosStep = std::cos(step);
+	const double sinStep = std::sin(step);
+	double c = 0.0;
+	double s = 0.0;
+	for (int i = 0; i < count; ++i)
+	{
+		if ((i & 31) == 0)
+		{
+			c = std::cos(startAngle + i * step);
+			s = std::sin(startAngle + i * step);
+		}
+		cosOut[i] = c;
+		sinOut[i] = s;
+		const double nextC = c * cosStep - s * sinStep;
+		s = s * cosStep + c * sinStep;
+		c = nextC;
+	}
+}
+
+void smallCircle(const LocalFrame& frame, double radius, double startAngle, double endAngle, int count, SmallCirclePoints& out)
+{
+	out.x.resize(count);
+	out.y.resize(count);
+	out.z.resize(count);
+	if (count <= 0)
+		return;
+
+	// The table goes into the output arrays first, then is expanded in place
+	const double step = count > 1 ? (endAngle - startAngle) / (count - 1) : 0.0;
+	double* x = out.x.data();
+	double* y = out.y.data();
+	double* z = out.z.data();
+	unitCircle(startAngle, step, count, x, y);
+
+	// p = center*cos(r) + (u*cos(a) + v*sin(a))*sin(r); the frame is orthonormal,
+	// so the result is a unit vector without renormalizing
+	const double cr = std::cos(radius);
+	const double sr = std::sin(radius);
+	const Vector3 c = frame.center * cr;
+	const Vector3 u = frame.u * sr;
+	const Vector3 v = frame.v * sr;
+	for (int i = 0; i < count; ++i)
+	{
+		const double ca = x[i];
+		const double sa = y[i];
+		x[i] = c.x + u.x * ca + v.x * sa;
+		y[i] = c.y + u.y * ca + v.y * sa;
+		z[i] = c.z + u.z * ca + v.z * sa;
+	}
+}
+
+void tessellateRing(const LocalFrame& frame, double radius, int segments, QVector<Vector3>& out)
+{
+	out.resize(segments + 1);
+	QVarLengthArray<double, 1025> cosTable(segments);
+	QVarLengthArray<double, 1025> sinTable(segments);
+	unitCircle(0.0, 2.0 * M_PI / segments, segments, cosTable.data(), sinTable.data());
+
+	const double cr = std::cos(radius);
+	const double sr = std::sin(radius);
+	const Vector3 c = frame.center * cr;
+	const Vector3 u = frame.u * sr;
+	const Vector3 v = frame.v * sr;
+	Vector3* points = out.data();
+	for (int i = 0; i < segments; ++i)
+	{
+		points[i] = c + u * cosTable[i] + v * sinTable[i];
+	}
+	points[segments] = points[0]; // Exactly closed
+}
+
+void tessellateArc(const LocalFrame& frame, double radius, double startAngle, double endAngle, int segments, QVector<Vector3>& out)
+{
+	out.resize(segments + 1);
+	QVarLengthArray<double, 1025> cosTable(segments + 1);
+	QVarLengthArray<double, 1025> sinTable(segments + 1);
+	unitCircle(startAngle, (endAngle - startAngle) / segments, segments + 1, cosTable.data(), sinTable.data());
+
+	const double cr = std::cos(radius);
+	const double sr = std::sin(radius);
+	const Vector3 c = frame.center * cr;
+	const Vector3 u = frame.u * sr;
+	const Vector3 v = frame.v * sr;
+	Vector3* points = out.data();
+	for (int i = 0; i <= segments; ++i)
+	{
+		points[i] = c + u * cosTable[i] + v * sinTable[i];
+	}
+}
+
+ArcCoverage arcAboveAltitude(const LocalFrame& frame, double radius, const Vector3& zenith, double sinAltitude, double& start, double& end)
+{
+	const double sr = std::sin(radius);
+	const double a = std::cos(radius) * dot(frame.center, zenith);
+	const double bu = sr * dot(frame.u, zenith);
+	const double bv = sr * dot(frame.v, zenith);
+	const double r = std::sqrt(bu * bu + bv * bv);
+
+	// Ring parallel to the horizon (center at the zenith or nadir): all or nothing
+	if (r < 1e-12)
+		return a >= sinAltitude ? ArcFull : ArcNone;
+
+	const double k = (sinAltitude - a) / r;
+	if (k <= -1.0)
+		return ArcFull;
+	if (k >= 1.0)
+		return ArcNone;
+
+	const double a0 = std::atan2(bv, bu); // Highest point of the circle
+	const double halfWidth = std::acos(k);
+	start = a0 - halfWidth;
+	end = a0 + halfWidth;
+	return ArcPartial;
+}
+
+ArrowGlyph makeArrowGlyph(double radius)
+{
+	const double arrowLength = 0.03;     // ~1.7 degrees outward from circle
+	const double arrowHeadLength = 0.01; // ~0.6 degrees for arrowhead
+
+	const double arrowRadius = std::min(radius + arrowLength, M_PI * 0.9);
+	const double headBaseRadius = std::max(arrowRadius - arrowHeadLength, radius);
+
+	// At angle 0 the ring runs through (cos r, sin r, 0) and the shaft is
+	// tangent to the x-y plane, so the head sides are offset along z
+	const Vector3 circlePoint { std::cos(radius), std::sin(radius), 0.0 };
+	const Vector3 arrowTip { std::cos(arrowRadius), std::sin(arrowRadius), 0.0 };
+	const Vector3 headBase { std::cos(headBaseRadius), std::sin(headBaseRadius), 0.0 };
+	const Vector3 side { 0.0, 0.0, arrowHeadLength * 0.5 };
+	const Vector3 headSide1 = normalized(headBase + side);
+	const Vector3 headSide2 = normalized(headBase - side);
+
+	// Shaft, two head sides, head base
+	return { { circlePoint, arrowTip,
+	           arrowTip, headSide1,
+	           arrowTip, headSide2,
+	           headSide1, headSide2 } };
+}
+
+int arrowCountForCircumference(double circumferencePixels)
+{
+	if (circumferencePixels < 250.0)
+		return 0;
+	return std::min(std::max(3, static_cast<int>(circumferencePixels / 250.0)), 24);
+}
+
+void placeArrows(const LocalFrame& frame, const ArrowGlyph& glyph, int count, double startAngle, QVector<Vector3>& lineVertices)
+{
+	if (count <= 0)
+		return;
+
+	const double step = 2.0 * M_PI / count;
+	const double cosStep = std::cos(step);
+	const double sinStep = std::sin(step);
+	double c = std::cos(startAngle);
+	double s = std::sin(startAngle);
+
+	lineVertices.reserve(lineVertices.size() + count * 8);
+	for (int i = 0; i < count; ++i)
+	{
+		// Rotate the glyph by the current angle about the center axis
+		const Vector3 du = frame.u * c + frame.v * s;
+		const Vector3 dv = frame.v * c - frame.u * s;
+		for (const Vector3& p : glyph.points)
+		{
+			lineVertices.append(frame.center * p.x + du * p.y + dv * p.z);
+		}
+
+		const double nextC = c * cosStep - s * sinStep;
+		s = s * cosStep + c * sinStep;
+		c = nextC;
+	}
+}
+
+void appendArrows(const LocalFrame& frame, double radius, int filterIndex, int count, QVector<Vector3>& lineVertices)
+{
+	const double staggerOffset = (filterIndex * 10.0) * M_PI / 180.0;
+	placeArrows(frame, makeArrowGlyph(radius), count, staggerOffset, lineVertices);
+}
+
+}
@@ -0,0 +1,108 @@
+#ifndef MOONAVOIDANCEGEOMETRY_HPP
+#define MOONAVOIDANCEGEOMETRY_HPP
+
+#include <QVector>
+#include <cmath>
+
+// Spherical geometry for avoidance rings, independent of Stellarium so it can
+// run on worker threads and in the command-line tools.
+namespace MoonAvoidanceGeometry
+{
+	struct Vector3
+	{
+		double x, y, z;
+	};
+
+	inline Vector3 operator+(const Vector3& a, const Vector3& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+	inline Vector3 operator-(const Vector3& a, const Vector3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+	inline Vector3 operator*(const Vector3& a, double s) { return { a.x * s, a.y * s, a.z * s }; }
+	inline double dot(const Vector3& a, const Vector3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	inline Vector3 cross(const Vector3& a, const Vector3& b)
+	{
+		return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+	}
+	inline double norm(const Vector3& a) { return std::sqrt(dot(a, a)); }
+	inline Vector3 normalized(const Vector3& a)
+	{
+		const double n = norm(a);
+		return n > 0.0 ? a * (1.0 / n) : a;
+	}
+
+	// Orthonormal frame around a ring center: points on the small circle of
+	// angular radius r are center*cos(r) + (u*cos(a) + v*sin(a))*sin(r)
+	struct LocalFrame
+	{
+		Vector3 center;
+		Vector3 u;
+		Vector3 v;
+	};
+
+	// Builds the frame with the same reference directions the plugin has always
+	// used (celestial north, or east near the poles), so arrow placement is stable
+	LocalFrame makeLocalFrame(const Vector3& center);
+
+	Vector3 pointOnSmallCircle(const LocalFrame& frame, double radius, double angle);
+
+	// Segment count used for on-sky rings: more for larger rings, capped for performance
+	int ringSegments(double radiusDegrees);
+
+	// cosOut[i] = cos(startAngle + i * step), sinOut[i] = sin(...) for i < count.
+	// Uses a rotation recurrence, re-seeded with exact values every 32 points so
+	// rounding cannot accumulate: one sin/cos pair per 32 points instead of per point.
+	void unitCircle(double startAngle, double step, int count, double* cosOut, double* sinOut);
+
+	// Points of a small circle as structure of arrays, so consumers (projection,
+	// screening) can run plain loops over x, y and z that the compiler vectorizes
+	struct SmallCirclePoints
+	{
+		QVector<double> x, y, z;
+		int size() const { return x.size(); }
+	};
+
+	// count points from startAngle to endAngle inclusive, on the small circle of
+	// the given angular radius around frame.center. Reuses out's storage.
+	void smallCircle(const LocalFrame& frame, double radius, double startAngle, double endAngle, int count, SmallCirclePoints& out);
+
+	// Closed ring: segments + 1 points, first == last
+	void tessellateRing(const LocalFrame& frame, double radius, int segments, QVector<Vector3>& out);
+
+	// Open arc from startAngle to endAngle: segments + 1 points, both ends included
+	void tessellateArc(const LocalFrame& frame, double radius, double startAngle, double endAngle, int segments, QVector<Vector3>& out);
+
+	// How much of a small circle lies at or above an altitude
+	enum ArcCoverage
+	{
+		ArcNone,     // Entirely below
+		ArcPartial,  // Only [start, end]
+		ArcFull      // Entirely above
+	};
+
+	// Solved in closed form: along the circle, p(a) . zenith = A + R cos(a - a0).
+	// zenith is the unit vector to the zenith in the frame's coordinates and
+	// sinAltitude the sine of the limiting altitude. On ArcPartial, start < end
+	// are angles as in pointOnSmallCircle() (end - start < 2 pi).
+	ArcCoverage arcAboveAltitude(const LocalFrame& frame, double radius, const Vector3& zenith, double sinAltitude, double& start, double& end);
+
+	// One outward arrow at angle 0 of a ring, in frame coordinates
+	// (x along center, y along u, z along v): shaft, two head sides, head base.
+	// Depends only on the ring radius; placeArrows() rotates it around the center.
+	struct ArrowGlyph
+	{
+		Vector3 points[8];
+	};
+	ArrowGlyph makeArrowGlyph(double radius);
+
+	// Number of arrows for a ring with this circumference on screen: none for
+	// rings too small to read, then one per ~250 pixels, between 3 and 24
+	int arrowCountForCircumference(double circumferencePixels);
+
+	// Appends count copies of the glyph evenly around the ring starting at
+	// startAngle, as pairs of points (one great-circle arc each). Only one
+	// sin/cos pair per call; successive arrows are placed by a rotation recurrence.
+	void placeArrows(const LocalFrame& frame, const ArrowGlyph& glyph, int count, double startAngle, QVector<Vector3>& lineVertices);
+
+	// Outward arrows for a ring, staggered by 10 degrees per filter index
+	void appendArrows(const LocalFrame& frame, double radius, int filterIndex, int count, QVector<Vector3>& lineVertices);
+}
+
+#endif // MOONAVOIDANCEGEOMETRY_HPP
@@ -0,0 +1,172 @@
+#include "MoonAvoidanceHorizon.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	using MoonAvoidanceGeometry::Vector3;
+
+	const double DegToRad = M_PI / 180.0;
+
+	// Landscape scan: from this altitude down in 1 degree steps, then bisected to ~1 arcminute
+	const int ScanTopDegrees = 80;
+	const int ScanBottomDegrees = -20;
+	const int BisectionSteps = 6;
+
+	inline double wrapBin(double azimuth)
+	{
+		double position = azimuth / (2.0 * M_PI) * MoonAvoidanceHorizon::Bins;
+		position = std::fmod(position, static_cast<double>(MoonAvoidanceHorizon::Bins));
+		return position < 0.0 ? position + MoonAvoidanceHorizon::Bins : position;
+	}
+
+	// Where the segment a-b meets the horizon, from the margins at both ends
+	inline Vector3 crossing(const Vector3& a, const Vector3& b, double marginA, double marginB)
+	{
+		const double f = marginA / (marginA - marginB);
+		return MoonAvoidanceGeometry::normalized(a + (b - a) * f);
+	}
+}
+
+MoonAvoidanceHorizon::MoonAvoidanceHorizon(double altitudeDegrees)
+	: altitudes(Bins, altitudeDegrees * DegToRad)
+	, minAltitude(0.0)
+	, maxAltitude(0.0)
+{
+	updateRange();
+}
+
+MoonAvoidanceHorizon MoonAvoidanceHorizon::fromSampler(const std::function<bool(double, double)>& obstructed, double minimumAltitudeDegrees)
+{
+	MoonAvoidanceHorizon horizon(minimumAltitudeDegrees);
+	const double minimum = minimumAltitudeDegrees * DegToRad;
+
+	for (int bin = 0; bin < Bins; ++bin)
+	{
+		const double azimuth = 2.0 * M_PI * bin / Bins;
+		double altitude = -M_PI_2; // Nothing in the way
+		for (int degrees = ScanTopDegrees; degrees >= ScanBottomDegrees; --degrees)
+		{
+			if (!obstructed(azimuth, degrees * DegToRad))
+				continue;
+
+			// Obstructed here, clear one degree higher
+			double low = degrees * DegToRad;
+			double high = (degrees + 1) * DegToRad;
+			for (int i = 0; i < BisectionSteps; ++i)
+			{
+				const double middle = 0.5 * (low + high);
+				if (obstructed(azimuth, middle))
+					low = middle;
+				else
+					high = middle;
+			}
+			altitude = high;
+			break;
+		}
+		horizon.altitudes[bin] = std::max(altitude, minimum);
+	}
+
+	horizon.updateRange();
+	return horizon;
+}
+
+void MoonAvoidanceHorizon::updateRange()
+{
+	sinAltitudes.resize(Bins);
+	minAltitude = altitudes[0];
+	maxAltitude = altitudes[0];
+	for (int bin = 0; bin < Bins; ++bin)
+	{
+		sinAltitudes[bin] = std::sin(altitudes[bin]);
+		minAltitude = std::min(minAltitude, altitudes[bin]);
+		maxAltitude = std::max(maxAltitude, altitudes[bin]);
+	}
+}
+
+double MoonAvoidanceHorizon::altitudeAt(double azimuth) const
+{
+	const double position = wrapBin(azimuth);
+	const int i0 = std::min(static_cast<int>(position), Bins - 1);
+	const int i1 = (i0 + 1) % Bins;
+	const double f = position - i0;
+	return altitudes[i0] * (1.0 - f) + altitudes[i1] * f;
+}
+
+double MoonAvoidanceHorizon::sinAltitudeAt(double azimuth) const
+{
+	const double position = wrapBin(azimuth);
+	const int i0 = std::min(static_cast<int>(position), Bins - 1);
+	const int i1 = (i0 + 1) % Bins;
+	const double f = position - i0;
+	return sinAltitudes[i0] * (1.0 - f) + sinAltitudes[i1] * f;
+}
+
+double MoonAvoidanceHorizon::margin(const Axes& axes, const Vector3& p) const
+{
+	const double sinAltitude = MoonAvoidanceGeometry::dot(p, axes.zenith);
+	if (isFlat())
+		return sinAltitude - sinAltitudes[0];
+	const double azimuth = std::atan2(MoonAvoidanceGeometry::dot(p, axes.y), MoonAvoidanceGeometry::dot(p, axes.x));
+	return sinAltitude - sinAltitudeAt(azimuth);
+}
+
+void MoonAvoidanceHorizon::clipRing(const MoonAvoidanceGeometry::LocalFrame& frame, double radius, int segments, const Axes& axes,
+                                    QVector<Vector3>& points, QVector<int>& pieceStarts) const
+{
+	points.resize(0);
+	pieceStarts.resize(0);
+
+	// Nothing below the lowest point of the horizon can be visible
+	double start = 0.0;
+	double end = 0.0;
+	const MoonAvoidanceGeometry::ArcCoverage coverage =
+		MoonAvoidanceGeometry::arcAboveAltitude(frame, radius, axes.zenith, std::sin(minAltitude), start, end);
+	if (coverage == MoonAvoidanceGeometry::ArcNone)
+		return;
+
+	if (coverage == MoonAvoidanceGeometry::ArcFull)
+	{
+		MoonAvoidanceGeometry::tessellateRing(frame, radius, segments, points);
+	}
+	else
+	{
+		// Same point spacing as the full ring
+		const int arcSegments = std::max(8, static_cast<int>(std::ceil(segments * (end - start) / (2.0 * M_PI))));
+		MoonAvoidanceGeometry::tessellateArc(frame, radius, start, end, arcSegments, points);
+	}
+
+	if (isFlat())
+	{
+		pieceStarts.append(0); // The closed-form arc is exact
+		return;
+	}
+
+	// Split against the profile
+	QVector<Vector3> raw;
+	raw.swap(points);
+	points.reserve(raw.size() + 8);
+	bool above = false;
+	double previousMargin = 0.0;
+	for (int i = 0; i < raw.size(); ++i)
+	{
+		const double m = margin(axes, raw[i]);
+		if (m >= 0.0)
+		{
+			if (!above)
+			{
+				pieceStarts.append(points.size());
+				if (i > 0)
+					points.append(crossing(raw[i - 1], raw[i], previousMargin, m));
+				above = true;
+			}
+			points.append(raw[i]);
+		}
+		else if (above)
+		{
+			points.append(crossing(raw[i - 1], raw[i], previousMargin, m));
+			above = false;
+		}
+		previousMargin = m;
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef MOONAVOIDANCEHORIZON_HPP
+#define MOONAVOIDANCEHORIZON_HPP
+
+#include "MoonAvoidanceGeometry.hpp"
+#include <QVector>
+#include <functional>
+
+// Horizon altitude as a lookup table over azimuth, from the landscape or a
+// flat limit, used to drop the parts of the zones that are below it.
+//
+// Built once on the main thread (the landscape can only be queried there)
+// whenever the landscape, the location or the limit changes, then shared
+// read-only with the frame worker.
+class MoonAvoidanceHorizon
+{
+public:
+	static constexpr int Bins = 360; // One per degree of azimuth
+
+	// The alt-az axes in the coordinates of the geometry being clipped (J2000).
+	// Azimuth here is atan2(p . y, p . x), in whatever direction the caller's
+	// alt-az frame runs; only the sampler has to agree with it.
+	struct Axes
+	{
+		MoonAvoidanceGeometry::Vector3 x { 1.0, 0.0, 0.0 };
+		MoonAvoidanceGeometry::Vector3 y { 0.0, 1.0, 0.0 };
+		MoonAvoidanceGeometry::Vector3 zenith { 0.0, 0.0, 1.0 };
+	};
+
+	// Flat horizon at an altitude in degrees
+	explicit MoonAvoidanceHorizon(double altitudeDegrees = 0.0);
+
+	// Profile from a landscape. obstructed(azimuth, altitude), both in radians,
+	// tells whether the landscape hides the sky there. Each bin is scanned
+	// downward and keeps the highest obstruction, so gaps under the top of a
+	// tree do not count. The result never goes below minimumAltitudeDegrees.
+	static MoonAvoidanceHorizon fromSampler(const std::function<bool(double, double)>& obstructed, double minimumAltitudeDegrees);
+
+	// Radians, interpolated between bins
+	double altitudeAt(double azimuth) const;
+	double minimumAltitude() const { return minAltitude; }
+	double maximumAltitude() const { return maxAltitude; }
+	bool isFlat() const { return maxAltitude - minAltitude < 1e-9; }
+
+	// Positive above the horizon, negative below (difference of the sines of the altitudes)
+	double margin(const Axes& axes, const MoonAvoidanceGeometry::Vector3& p) const;
+
+	// Tessellates the parts of a small circle that are above the horizon. The
+	// arc below the lowest horizon altitude is dropped in closed form before
+	// tessellating; with a landscape profile the rest is split where it dips
+	// under the profile, ending each piece on the horizon. points receives all
+	// pieces back to back and pieceStarts the first index of each; both are
+	// empty when the circle is entirely below.
+	void clipRing(const MoonAvoidanceGeometry::LocalFrame& frame, double radius, int segments, const Axes& axes,
+	              QVector<MoonAvoidanceGeometry::Vector3>& points, QVector<int>& pieceStarts) const;
+
+private:
+	void updateRange();
+	double sinAltitudeAt(double azimuth) const;
+
+	QVector<double> altitudes;    // Radians, one per bin
+	QVector<double> sinAltitudes;
+	double minAltitude;
+	double maxAltitude;
+};
+
+#endif // MOONAVOIDANCEHORIZON_HPP
@@ -0,0 +1,153 @@
+#include "MoonAvoidanceKernel.hpp"
+#include <cmath>
+
+namespace
+{
+	// Separation / (1 + (AGE / Width)^2) with the plugin's guards: 0 = off, at least 1 degree
+	inline double lorentzian(double separation, double width, double daysFromFull)
+	{
+		// "If the separation was relaxed into oblivion, avoidance is off" (NINA)
+		if (separation <= 0.0)
+			return 0.0;
+
+		if (width <= 0.0)
+			width = 1.0; // Avoid division by zero
+
+		// Highest separation at full moon (AGE = 0), decaying as the moon wanes or waxes
+		const double term = daysFromFull / width;
+		const double radius = separation / (1.0 + term * term);
+
+		// Ensure minimum radius (at least 1 degree)
+		return radius < 1.0 ? 1.0 : radius;
+	}
+
+	// Curve refinement: starting intervals and the number of halvings after that
+	const int CurveInitialIntervals = 8;
+	const int CurveMaxLevels = 8;
+}
+
+namespace MoonAvoidanceKernel
+{
+
+MoonAge moonAge(double jd)
+{
+	// Find the most recent new moon before or at jd
+	const double periodsSinceRef = (jd - ReferenceNewMoonJD) / SynodicPeriodDays;
+	const double lastNewMoonJD = ReferenceNewMoonJD + std::floor(periodsSinceRef) * SynodicPeriodDays;
+
+	// Days since last new moon, kept in [0, SynodicPeriodDays)
+	double sinceNew = jd - lastNewMoonJD;
+	while (sinceNew < 0.0)
+		sinceNew += SynodicPeriodDays;
+	while (sinceNew >= SynodicPeriodDays)
+		sinceNew -= SynodicPeriodDays;
+
+	// Full moon is half a synodic period after new moon; the Lorentzian needs
+	// the absolute distance to it (0 = full moon, highest separation)
+	MoonAge age;
+	age.daysSinceNew = sinceNew;
+	age.daysFromFull = std::fabs(sinceNew - HalfSynodicPeriodDays);
+	return age;
+}
+
+double relaxedSeparation(const FilterConfig& filter, double moonAltitude)
+{
+	if (moonAltitude >= filter.minAlt && moonAltitude <= filter.maxAlt)
+	{
+		// Within relaxation range: Separation + Relaxation * (moonAltitude - MaxAlt)
+		return filter.separation + filter.relaxation * (moonAltitude - filter.maxAlt);
+	}
+	// Outside relaxation range: traditional avoidance
+	return filter.separation;
+}
+
+double relaxedWidth(const FilterConfig& filter, double moonAltitude)
+{
+	if (moonAltitude >= filter.minAlt && moonAltitude <= filter.maxAlt)
+	{
+		// Within relaxation range: Width * ((moonAltitude - MinAlt) / (MaxAlt - MinAlt))
+		const double denominator = filter.maxAlt - filter.minAlt;
+		if (denominator == 0.0)
+			return filter.width;
+		return filter.width * ((moonAltitude - filter.minAlt) / denominator);
+	}
+	return filter.width;
+}
+
+double zoneRadiusDegrees(const FilterConfig& filter, double moonAltitude, double daysFromFull)
+{
+	return lorentzian(relaxedSeparation(filter, moonAltitude), relaxedWidth(filter, moonAltitude), daysFromFull);
+}
+
+void lorentzianRadiiDegrees(double separation, double width, const double* daysFromFull, int count, double* out)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		out[i] = lorentzian(separation, width, daysFromFull[i]);
+	}
+}
+
+void radiusCurve(double separation, double width, double maxDaysFromFull, double tolerance,
+                 QVector<double>& ages, QVector<double>& radii)
+{
+	ages.resize(CurveInitialIntervals + 1);
+	for (int i = 0; i <= CurveInitialIntervals; ++i)
+		ages[i] = maxDaysFromFull * i / CurveInitialIntervals;
+	radii.resize(ages.size());
+	lorentzianRadiiDegrees(separation, width, ages.constData(), ages.size(), radii.data());
+
+	// refine[i]: interval [i, i + 1] still needs halving
+	QVector<char> refine(CurveInitialIntervals, 1);
+	QVector<double> midAges;
+	QVector<double> midRadii;
+	QVector<double> nextAges;
+	QVector<double> nextRadii;
+	QVector<char> nextRefine;
+
+	for (int level = 0; level < CurveMaxLevels; ++level)
+	{
+		midAges.resize(0);
+		for (int i = 0; i < refine.size(); ++i)
+		{
+			if (refine[i])
+				midAges.append(0.5 * (ages[i] + ages[i + 1]));
+		}
+		if (midAges.isEmpty())
+			break;
+
+		midRadii.resize(midAges.size());
+		lorentzianRadiiDegrees(separation, width, midAges.constData(), midAges.size(), midRadii.data());
+
+		// Splice the midpoints in; a halved interval is refined again only if the
+		// chord missed its midpoint by more than the tolerance
+		nextAges.resize(0);
+		nextRadii.resize(0);
+		nextRefine.resize(0);
+		int m = 0;
+		for (int i = 0; i < refine.size(); ++i)
+		{
+			nextAges.append(ages[i]);
+			nextRadii.append(radii[i]);
+			if (!refine[i])
+			{
+				nextRefine.append(0);
+				continue;
+			}
+			const double error = std::fabs(midRadii[m] - 0.5 * (radii[i] + radii[i + 1]));
+			const char again = error > tolerance ? 1 : 0;
+			nextAges.append(midAges[m]);
+			nextRadii.append(midRadii[m]);
+			nextRefine.append(again);
+			nextRefine.append(again);
+			++m;
+		}
+		nextAges.append(ages.last());
+		nextRadii.append(radii.last());
+
+		ages.swap(nextAges);
+		radii.swap(nextRadii);
+		refine.swap(nextRefine);
+	}
+}
+
+}
@@ -0,0 +1,52 @@
+#ifndef MOONAVOIDANCEKERNEL_HPP
+#define MOONAVOIDANCEKERNEL_HPP
+
+#include "MoonAvoidanceConfig.hpp"
+#include <QVector>
+
+// Avoidance math shared by the plugin, its worker threads and the tools.
+//
+// Everything in here is a pure function of its arguments: no Stellarium
+// objects, no globals, safe to call from any thread.
+namespace MoonAvoidanceKernel
+{
+	// Moon synodic period and a reference new moon near J2000
+	// (from Stellarium's AstroCalcDialog.cpp)
+	constexpr double SynodicPeriodDays = 29.530588853;
+	constexpr double HalfSynodicPeriodDays = SynodicPeriodDays / 2.0;
+	constexpr double ReferenceNewMoonJD = 2451550.09765;
+
+	struct MoonAge
+	{
+		double daysSinceNew;  // 0 = new moon, ~14.77 = full moon
+		double daysFromFull;  // 0 = full moon, ~14.77 = new moon (Lorentzian AGE)
+	};
+
+	// Mean moon age at a Julian Day
+	MoonAge moonAge(double jd);
+
+	// Separation after altitude relaxation, in degrees.
+	// Relaxation only applies while minAlt <= moonAltitude <= maxAlt.
+	double relaxedSeparation(const FilterConfig& filter, double moonAltitude);
+
+	// Lorentzian width after altitude relaxation, in days
+	double relaxedWidth(const FilterConfig& filter, double moonAltitude);
+
+	// Avoidance radius in degrees: Separation / (1 + (AgeFromFull / Width)^2),
+	// never below 1 degree. Returns 0 when the separation was relaxed into
+	// oblivion, i.e. avoidance is off for this filter.
+	double zoneRadiusDegrees(const FilterConfig& filter, double moonAltitude, double daysFromFull);
+
+	// Batch form for a given (already relaxed) separation and width: out[i] is
+	// the radius at daysFromFull[i], same rules as zoneRadiusDegrees()
+	void lorentzianRadiiDegrees(double separation, double width, const double* daysFromFull, int count, double* out);
+
+	// The radius curve from full moon (0) to maxDaysFromFull, sampled adaptively:
+	// intervals are halved, one batch evaluation per level, until linear
+	// interpolation is within tolerance degrees everywhere. Dense around the
+	// peak, sparse in the tails. ages is sorted and includes both ends.
+	void radiusCurve(double separation, double width, double maxDaysFromFull, double tolerance,
+	                 QVector<double>& ages, QVector<double>& radii);
+}
+
+#endif // MOONAVOIDANCEKERNEL_HPP
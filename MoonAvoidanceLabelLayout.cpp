@@ -0,0 +1,198 @@
+#include "MoonAvoidanceLabelLayout.hpp"
+#include <cmath>
+
+namespace
+{
+	const double MinPaddingFromEdge = 40.0; // Labels stay this far inside the viewport
+	const double CirclePadding = 60.0;      // Between a label and its circle
+	const double RowSpacing = 40.0;         // Between label rows and stacked labels
+	const double TopOffset = 50.0;          // First row below the top of the viewport
+	const double CollisionMargin = 5.0;     // Extra space kept around every label
+	const int VisibleRows = 3;              // Rows tried for labels of on-screen circles
+	const double StackClearance = 150.0;    // Stack keeps this much of the top free when a circle is near
+}
+
+MoonAvoidanceLabelLayout::MoonAvoidanceLabelLayout()
+	: metrics(font)
+	, formatted(0)
+	, columns(0)
+	, rows(0)
+{
+}
+
+void MoonAvoidanceLabelLayout::setFont(const QFont& f)
+{
+	if (f == font)
+		return;
+	font = f;
+	metrics = QFontMetricsF(font);
+	texts.clear();
+}
+
+const MoonAvoidanceLabelLayout::CachedText& MoonAvoidanceLabelLayout::textFor(const Request& request)
+{
+	CachedText& cached = texts[request.name];
+	const int tenths = qRound(request.radiusDegrees * 10.0);
+	if (cached.tenths != tenths)
+	{
+		cached.tenths = tenths;
+		cached.text = QString("%1 safe at %2°").arg(request.name).arg(tenths / 10.0, 0, 'f', 1);
+		cached.width = metrics.horizontalAdvance(cached.text);
+		++formatted;
+	}
+	return cached;
+}
+
+void MoonAvoidanceLabelLayout::cellRange(const QRectF& rect, int& x0, int& y0, int& x1, int& y1) const
+{
+	x0 = qBound(0, static_cast<int>(std::floor((rect.left() - area.left()) / CellSize)), columns - 1);
+	x1 = qBound(0, static_cast<int>(std::floor((rect.right() - area.left()) / CellSize)), columns - 1);
+	y0 = qBound(0, static_cast<int>(std::floor((rect.top() - area.top()) / CellSize)), rows - 1);
+	y1 = qBound(0, static_cast<int>(std::floor((rect.bottom() - area.top()) / CellSize)), rows - 1);
+}
+
+bool MoonAvoidanceLabelLayout::collides(const QRectF& rect) const
+{
+	const QRectF padded = rect.adjusted(-CollisionMargin, -CollisionMargin, CollisionMargin, CollisionMargin);
+	int x0, y0, x1, y1;
+	cellRange(padded, x0, y0, x1, y1);
+	for (int cy = y0; cy <= y1; ++cy)
+	{
+		for (int cx = x0; cx <= x1; ++cx)
+		{
+			for (int index : cells[cy * columns + cx])
+			{
+				if (placedRects[index].intersects(padded))
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
+void MoonAvoidanceLabelLayout::insert(const QRectF& rect)
+{
+	const int index = placedRects.size();
+	placedRects.append(rect);
+	int x0, y0, x1, y1;
+	cellRange(rect, x0, y0, x1, y1);
+	for (int cy = y0; cy <= y1; ++cy)
+	{
+		for (int cx = x0; cx <= x1; ++cx)
+		{
+			const int cell = cy * columns + cx;
+			if (cells[cell].isEmpty())
+				usedCells.append(cell);
+			cells[cell].append(index);
+		}
+	}
+}
+
+void MoonAvoidanceLabelLayout::layout(const QRectF& viewport, const QVector<Request>& requests, bool circleNearLeftEdge, QVector<MoonAvoidanceLabel>& out)
+{
+	out.clear();
+	formatted = 0;
+
+	// Reset the grid: only the cells touched last frame need clearing
+	if (viewport != area)
+	{
+		area = viewport;
+		columns = qMax(1, static_cast<int>(std::ceil(area.width() / CellSize)));
+		rows = qMax(1, static_cast<int>(std::ceil(area.height() / CellSize)));
+		cells.clear();
+		cells.resize(columns * rows);
+	}
+	else
+	{
+		for (int cell : usedCells)
+			cells[cell].clear();
+	}
+	usedCells.clear();
+	placedRects.clear();
+
+	// Y grows upward: area.top() is the bottom edge of the viewport
+	const double left = area.left();
+	const double right = area.left() + area.width();
+	const double bottom = area.top();
+	const double top = area.top() + area.height();
+	const double firstRowY = top - TopOffset;
+	const double height = metrics.height();
+
+	QHash<QString, Placement> next;
+	next.reserve(requests.size());
+
+	// Labels of visible circles: beside the circle's top, left preferred
+	for (const Request& request : requests)
+	{
+		if (!request.visible)
+			continue;
+
+		const CachedText& text = textFor(request);
+		const double width = text.width;
+
+		// Last frame's position first, then left/right on each row
+		QVarLengthArray<Placement, 2 * VisibleRows + 1> candidates;
+		const Placement previous = placements.value(request.name);
+		if (previous.side == 0 || previous.side == 1)
+			candidates.append(previous);
+		for (int row = 0; row < VisibleRows; ++row)
+		{
+			candidates.append({ 0, row });
+			candidates.append({ 1, row });
+		}
+
+		for (const Placement& candidate : candidates)
+		{
+			const double x = candidate.side == 0 ? request.leftX - CirclePadding - width : request.rightX + CirclePadding;
+			if (x < left + MinPaddingFromEdge || x + width > right - MinPaddingFromEdge)
+				continue;
+			const double y = firstRowY - candidate.slot * RowSpacing;
+			const QRectF rect(x, y - height, width, height);
+			if (collides(rect))
+				continue;
+
+			insert(rect);
+			out.append({ static_cast<float>(x), static_cast<float>(y), text.text, request.color });
+			next.insert(request.name, candidate);
+			break;
+		}
+	}
+
+	// Off-screen circles: stacked at the left edge, skipping occupied slots
+	const double stackX = left + MinPaddingFromEdge;
+	int firstFreeSlot = 0;
+	for (const Request& request : requests)
+	{
+		if (request.visible)
+			continue;
+
+		const CachedText& text = textFor(request);
+		auto tryPlace = [&](int slot) {
+			const double y = firstRowY - slot * RowSpacing;
+			if (circleNearLeftEdge && y >= top - StackClearance)
+				return false;
+			const QRectF rect(stackX, y - height, text.width, height);
+			if (collides(rect))
+				return false;
+			insert(rect);
+			out.append({ static_cast<float>(stackX), static_cast<float>(y), text.text, request.color });
+			next.insert(request.name, { 2, slot });
+			if (slot == firstFreeSlot)
+				++firstFreeSlot;
+			return true;
+		};
+
+		// Last frame's slot first, then the first free one downwards until out of room
+		const Placement previous = placements.value(request.name);
+		const int lastSlot = static_cast<int>((firstRowY - height - bottom) / RowSpacing);
+		if (previous.side == 2 && previous.slot <= lastSlot && tryPlace(previous.slot))
+			continue;
+		for (int slot = firstFreeSlot; slot <= lastSlot; ++slot)
+		{
+			if (tryPlace(slot))
+				break;
+		}
+	}
+
+	placements.swap(next);
+}
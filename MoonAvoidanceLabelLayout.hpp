@@ -0,0 +1,94 @@
+#ifndef MOONAVOIDANCELABELLAYOUT_HPP
+#define MOONAVOIDANCELABELLAYOUT_HPP
+
+#include <QColor>
+#include <QFont>
+#include <QFontMetricsF>
+#include <QHash>
+#include <QRectF>
+#include <QString>
+#include <QVarLengthArray>
+#include <QVector>
+
+// Screen-space label, already positioned and formatted
+struct MoonAvoidanceLabel
+{
+	float x = 0.0f;
+	float y = 0.0f;
+	QString text;
+	QColor color;
+};
+
+// Places the "<filter> safe at <radius>°" labels for one frame.
+//
+// - Widths come from the font the labels are drawn with, not a per-character guess.
+// - Collisions are looked up in a uniform screen grid, so each query only
+//   touches the labels in the cells it covers instead of every placed label.
+// - Each zone's text is formatted only when its displayed value (0.1°) changes.
+// - A label keeps last frame's side, row or stack slot while that is still
+//   free, so labels do not jump between positions as circles move.
+//
+// Screen coordinates follow Stellarium's convention: Y grows upward and a
+// label occupies [y - height, y] vertically.
+class MoonAvoidanceLabelLayout
+{
+public:
+	// One zone that wants a label
+	struct Request
+	{
+		QString name;
+		QColor color;
+		double radiusDegrees;
+		bool visible;      // The circle is on screen
+		double leftX;      // Leftmost / rightmost point of the circle near the top of the screen
+		double rightX;
+	};
+
+	MoonAvoidanceLabelLayout();
+
+	// Must be called when the font changes; clears the text cache
+	void setFont(const QFont& font);
+
+	// circleNearLeftEdge: a visible circle reaches the area where off-screen labels stack
+	void layout(const QRectF& viewport, const QVector<Request>& requests, bool circleNearLeftEdge, QVector<MoonAvoidanceLabel>& out);
+
+	// Texts formatted during the last layout() (0 when every value was unchanged)
+	int formattedLastLayout() const { return formatted; }
+
+private:
+	struct CachedText
+	{
+		int tenths = -1; // Displayed value in 0.1 degree units
+		QString text;
+		double width = 0.0;
+	};
+
+	// Where a label went last frame
+	struct Placement
+	{
+		int side = -1; // 0 = left of circle, 1 = right, 2 = off-screen stack
+		int slot = -1; // Row (visible) or stack position (off-screen)
+	};
+
+	const CachedText& textFor(const Request& request);
+	bool collides(const QRectF& rect) const;
+	void insert(const QRectF& rect);
+	void cellRange(const QRectF& rect, int& x0, int& y0, int& x1, int& y1) const;
+
+	QFont font;
+	QFontMetricsF metrics;
+	QHash<QString, CachedText> texts;
+	QHash<QString, Placement> placements;
+	int formatted;
+
+	// Uniform grid over the viewport; each cell lists indices into placedRects
+	static constexpr double CellSize = 64.0;
+	QRectF area;
+	int columns;
+	int rows;
+	QVector<QVarLengthArray<int, 4>> cells;
+	QVector<int> usedCells;
+	QVector<QRectF> placedRects;
+};
+
+#endif // MOONAVOIDANCELABELLAYOUT_HPP
@@ -0,0 +1,90 @@
+#include "MoonAvoidanceLineBatch.hpp"
+#include "StelPainter.hpp"
+
+void MoonAvoidanceLineBatch::clear()
+{
+	// Keeps the capacity, so steady frames do not allocate
+	vertices.resize(0);
+	colors.resize(0);
+	projectedCount = 0;
+}
+
+void MoonAvoidanceLineBatch::appendSegment(const Vec3d& a, const Vec3d& b, const Vec4f& color)
+{
+	vertices.append(Vec3f(static_cast<float>(a[0]), static_cast<float>(a[1]), 0.0f));
+	vertices.append(Vec3f(static_cast<float>(b[0]), static_cast<float>(b[1]), 0.0f));
+	colors.append(color);
+	colors.append(color);
+}
+
+void MoonAvoidanceLineBatch::addStrip(const StelProjector& projector, const QVector<Vec3d>& points, const Vec4f& color)
+{
+	addRange(projector, points.constData(), points.size(), color);
+}
+
+void MoonAvoidanceLineBatch::addStrips(const StelProjector& projector, const QVector<Vec3d>& points, const QVector<int>& starts, const Vec4f& color)
+{
+	if (starts.isEmpty())
+	{
+		addRange(projector, points.constData(), points.size(), color);
+		return;
+	}
+	for (int k = 0; k < starts.size(); ++k)
+	{
+		const int end = k + 1 < starts.size() ? starts[k + 1] : points.size();
+		addRange(projector, points.constData() + starts[k], end - starts[k], color);
+	}
+}
+
+void MoonAvoidanceLineBatch::addRange(const StelProjector& projector, const Vec3d* points, int n, const Vec4f& color)
+{
+	if (n < 2)
+		return;
+
+	screen.resize(n);
+	valid.resize(n);
+	for (int i = 0; i < n; ++i)
+	{
+		valid[i] = projector.project(points[i], screen[i]);
+	}
+	projectedCount += n;
+
+	const bool discontinuous = projector.hasDiscontinuity();
+	for (int i = 1; i < n; ++i)
+	{
+		if (!valid[i - 1] || !valid[i])
+			continue;
+		if (discontinuous && projector.intersectViewportDiscontinuity(points[i - 1], points[i]))
+			continue;
+		appendSegment(screen[i - 1], screen[i], color);
+	}
+}
+
+void MoonAvoidanceLineBatch::addSegments(const StelProjector& projector, const QVector<Vec3d>& points, const Vec4f& color)
+{
+	const bool discontinuous = projector.hasDiscontinuity();
+	Vec3d a, b;
+	for (int i = 1; i < points.size(); i += 2)
+	{
+		if (!projector.project(points[i - 1], a) || !projector.project(points[i], b))
+			continue;
+		if (discontinuous && projector.intersectViewportDiscontinuity(points[i - 1], points[i]))
+			continue;
+		appendSegment(a, b, color);
+	}
+	projectedCount += points.size();
+}
+
+int MoonAvoidanceLineBatch::draw(StelPainter& painter, float lineWidth)
+{
+	if (vertices.isEmpty())
+		return 0;
+
+	painter.setLineWidth(lineWidth);
+	painter.enableClientStates(true, false, true);
+	painter.setVertexPointer(3, GL_FLOAT, vertices.constData());
+	painter.setColorPointer(4, GL_FLOAT, colors.constData());
+	painter.drawFromArray(StelPainter::Lines, vertices.size(), 0, false);
+	painter.enableClientStates(false);
+	return segmentCount();
+}
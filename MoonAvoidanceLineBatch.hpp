@@ -0,0 +1,50 @@
+#ifndef MOONAVOIDANCELINEBATCH_HPP
+#define MOONAVOIDANCELINEBATCH_HPP
+
+#include "StelProjector.hpp"
+#include "VecMath.hpp"
+#include <QVector>
+
+class StelPainter;
+
+// Collects the line segments of many zones in screen coordinates and draws
+// them with a single call.
+//
+// Each point is projected once. Segments with an endpoint that does not
+// project, or that cross a projection discontinuity, are dropped, as
+// drawGreatCircleArc() would do. Rings are tessellated finely enough
+// (ringSegments()) that straight screen segments look the same as arcs.
+// All segments in a batch share one line width; colors are per segment.
+class MoonAvoidanceLineBatch
+{
+public:
+	void clear();
+
+	// Consecutive points joined; closed rings repeat the first point at the end
+	void addStrip(const StelProjector& projector, const QVector<Vec3d>& points, const Vec4f& color);
+
+	// Several strips back to back; starts holds the first index of each (empty = one strip)
+	void addStrips(const StelProjector& projector, const QVector<Vec3d>& points, const QVector<int>& starts, const Vec4f& color);
+
+	// Independent segments: points[0]-points[1], points[2]-points[3], ...
+	void addSegments(const StelProjector& projector, const QVector<Vec3d>& points, const Vec4f& color);
+
+	// Draws everything added since clear(). The painter must use the projector
+	// the points were projected with. Returns the number of segments drawn.
+	int draw(StelPainter& painter, float lineWidth);
+
+	int segmentCount() const { return vertices.size() / 2; }
+	int pointsProjected() const { return projectedCount; }
+
+private:
+	void appendSegment(const Vec3d& a, const Vec3d& b, const Vec4f& color);
+	void addRange(const StelProjector& projector, const Vec3d* points, int n, const Vec4f& color);
+
+	QVector<Vec3f> vertices; // Screen coordinates, two per segment
+	QVector<Vec4f> colors;   // One per vertex
+	QVector<Vec3d> screen;   // Projection scratch for addStrip()
+	QVector<bool> valid;
+	int projectedCount = 0;
+};
+
+#endif // MOONAVOIDANCELINEBATCH_HPP
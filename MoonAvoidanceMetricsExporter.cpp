@@ -0,0 +1,185 @@
+#include "MoonAvoidanceMetricsExporter.hpp"
+#include "MoonAvoidanceStats.hpp"
+#include <QDateTime>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QTimer>
+#include <QDebug>
+
+namespace
+{
+	// Label values must escape backslash, double quote and newline
+	QString escapeLabel(const QString& value)
+	{
+		QString escaped = value;
+		escaped.replace("\\", "\\\\").replace("\"", "\\\"").replace("\n", "\\n");
+		return escaped;
+	}
+
+	void writeHeader(QTextStream& out, const char* name, const char* type, const char* help)
+	{
+		out << "# HELP " << name << ' ' << help << '\n';
+		out << "# TYPE " << name << ' ' << type << '\n';
+	}
+}
+
+MoonAvoidanceMetricsExporter::MoonAvoidanceMetricsExporter(const MoonAvoidanceStats* stats, const QString& target, int intervalMs)
+	: stats(stats)
+	, target(target)
+	, intervalMs(qMax(intervalMs, MinimumIntervalMs))
+	, timer(nullptr)
+	, server(nullptr)
+{
+	if (target.startsWith("socket:"))
+		socketName = target.mid(7);
+	else if (target.startsWith("file:"))
+		filePath = target.mid(5);
+	else
+		filePath = target;
+}
+
+MoonAvoidanceMetricsExporter::~MoonAvoidanceMetricsExporter()
+{
+	stop();
+}
+
+void MoonAvoidanceMetricsExporter::start()
+{
+	if (timer)
+		return;
+
+	if (!socketName.isEmpty())
+	{
+		server = new QLocalServer(this);
+		QLocalServer::removeServer(socketName); // Stale socket from a crashed session
+		if (!server->listen(socketName))
+		{
+			qWarning() << "MoonAvoidanceMetricsExporter: Cannot listen on" << socketName << "-" << server->errorString();
+			delete server;
+			server = nullptr;
+			return;
+		}
+		connect(server, &QLocalServer::newConnection, this, &MoonAvoidanceMetricsExporter::serveClient);
+	}
+
+	timer = new QTimer(this);
+	timer->setTimerType(Qt::CoarseTimer);
+	connect(timer, &QTimer::timeout, this, &MoonAvoidanceMetricsExporter::exportNow);
+	timer->start(intervalMs);
+	exportNow();
+
+	qDebug() << "MoonAvoidanceMetricsExporter: Exporting to" << target << "every" << intervalMs << "ms";
+}
+
+void MoonAvoidanceMetricsExporter::stop()
+{
+	if (timer)
+	{
+		timer->stop();
+		delete timer;
+		timer = nullptr;
+	}
+	if (server)
+	{
+		server->close();
+		delete server;
+		server = nullptr;
+	}
+}
+
+void MoonAvoidanceMetricsExporter::exportNow()
+{
+	if (!stats)
+		return;
+
+	const QString text = formatMetrics(stats->snapshot(), QDateTime::currentMSecsSinceEpoch());
+	latest = text.toUtf8();
+
+	if (!filePath.isEmpty())
+		writeFile(text);
+}
+
+bool MoonAvoidanceMetricsExporter::writeFile(const QString& text)
+{
+	// QSaveFile writes to a temporary and renames, so the collector never sees a partial file
+	QSaveFile file(filePath);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+	{
+		qWarning() << "MoonAvoidanceMetricsExporter: Cannot write" << filePath << "-" << file.errorString();
+		return false;
+	}
+	file.write(text.toUtf8());
+	return file.commit();
+}
+
+void MoonAvoidanceMetricsExporter::serveClient()
+{
+	while (server && server->hasPendingConnections())
+	{
+		QLocalSocket* socket = server->nextPendingConnection();
+		connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+		socket->write(latest);
+		socket->disconnectFromServer();
+	}
+}
+
+QString MoonAvoidanceMetricsExporter::formatMetrics(const MoonAvoidanceStatsSnapshot& snapshot, qint64 nowMsSinceEpoch)
+{
+	QString text;
+	QTextStream out(&text);
+
+	writeHeader(out, "moonavoidance_frames_total", "counter", "Frames drawn by the MoonAvoidance plugin.");
+	out << "moonavoidance_frames_total " << snapshot.frames << '\n';
+
+	// Quantiles over the most recent frames, sum and count over all of them
+	writeHeader(out, "moonavoidance_frame_time_ms", "summary", "Time spent in MoonAvoidance::draw per frame.");
+	const double quantiles[] = { 0.5, 0.9, 0.99, 1.0 };
+	for (double q : quantiles)
+	{
+		out << "moonavoidance_frame_time_ms{quantile=\"" << q << "\"} " << snapshot.frameTimePercentileMs(q) << '\n';
+	}
+	out << "moonavoidance_frame_time_ms_sum " << snapshot.totalFrameTimeMs << '\n';
+	out << "moonavoidance_frame_time_ms_count " << snapshot.frames << '\n';
+
+	writeHeader(out, "moonavoidance_frame_time_mean_ms", "gauge", "Mean draw time over the last publish interval.");
+	out << "moonavoidance_frame_time_mean_ms " << snapshot.frameTimeMs << '\n';
+
+	writeHeader(out, "moonavoidance_vertices_projected", "gauge", "Vertices projected per frame.");
+	out << "moonavoidance_vertices_projected " << snapshot.verticesProjected << '\n';
+
+	writeHeader(out, "moonavoidance_arcs_submitted", "gauge", "Great-circle arcs submitted per frame.");
+	out << "moonavoidance_arcs_submitted " << snapshot.arcsSubmitted << '\n';
+
+	writeHeader(out, "moonavoidance_labels_placed", "gauge", "Labels drawn per frame.");
+	out << "moonavoidance_labels_placed " << snapshot.labelsPlaced << '\n';
+
+	writeHeader(out, "moonavoidance_cache_lookups_total", "counter", "Ring tessellation cache lookups.");
+	out << "moonavoidance_cache_lookups_total{result=\"hit\"} " << snapshot.totalCacheHits << '\n';
+	out << "moonavoidance_cache_lookups_total{result=\"miss\"} " << snapshot.totalCacheMisses << '\n';
+
+	writeHeader(out, "moonavoidance_cache_hit_ratio", "gauge", "Ring tessellation cache hit ratio over the last publish interval.");
+	out << "moonavoidance_cache_hit_ratio " << snapshot.cacheHitRate << '\n';
+
+	if (snapshot.configLoadedMsSinceEpoch > 0)
+	{
+		writeHeader(out, "moonavoidance_config_age_seconds", "gauge", "Seconds since the filter configuration was last loaded or saved.");
+		out << "moonavoidance_config_age_seconds " << (nowMsSinceEpoch - snapshot.configLoadedMsSinceEpoch) / 1000.0 << '\n';
+	}
+
+	writeHeader(out, "moonavoidance_moon_altitude_degrees", "gauge", "Moon altitude used for the current zones.");
+	out << "moonavoidance_moon_altitude_degrees " << snapshot.moonAltitude << '\n';
+
+	writeHeader(out, "moonavoidance_moon_days_from_full", "gauge", "Days from full moon used in the Lorentzian.");
+	out << "moonavoidance_moon_days_from_full " << snapshot.moonDaysFromFull << '\n';
+
+	writeHeader(out, "moonavoidance_zone_radius_degrees", "gauge", "Current avoidance radius per filter (0 = avoidance off).");
+	for (const MoonAvoidanceStatsSnapshot::ZoneRadius& zone : snapshot.zoneRadii)
+	{
+		out << "moonavoidance_zone_radius_degrees{filter=\"" << escapeLabel(zone.filter) << "\"} " << zone.radiusDegrees << '\n';
+	}
+
+	out.flush();
+	return text;
+}
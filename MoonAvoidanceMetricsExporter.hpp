@@ -0,0 +1,60 @@
+#ifndef MOONAVOIDANCEMETRICSEXPORTER_HPP
+#define MOONAVOIDANCEMETRICSEXPORTER_HPP
+
+#include <QObject>
+#include <QString>
+
+class QTimer;
+class QLocalServer;
+class MoonAvoidanceStats;
+struct MoonAvoidanceStatsSnapshot;
+
+// Periodically renders the plugin's counters and planning state in the
+// Prometheus text exposition format.
+//
+// The exporter lives on its own QThread (see MoonAvoidance::startMetricsExporter);
+// it only reads MoonAvoidanceStats::snapshot(), so the render thread never
+// formats or writes anything for it.
+//
+// Target syntax (MoonAvoidance/metrics_target in config.ini):
+//   file:/var/lib/node_exporter/textfile/moonavoidance.prom
+//       written atomically for node_exporter's textfile collector
+//   socket:moonavoidance-metrics
+//       local socket; every client that connects receives the latest text
+// A bare path is treated as a file target.
+class MoonAvoidanceMetricsExporter : public QObject
+{
+	Q_OBJECT
+
+public:
+	static const int MinimumIntervalMs = 1000;
+
+	MoonAvoidanceMetricsExporter(const MoonAvoidanceStats* stats, const QString& target, int intervalMs);
+	~MoonAvoidanceMetricsExporter() override;
+
+	// Render a snapshot in Prometheus text format
+	static QString formatMetrics(const MoonAvoidanceStatsSnapshot& snapshot, qint64 nowMsSinceEpoch);
+
+public slots:
+	// Must run on the exporter thread
+	void start();
+	void stop();
+
+private slots:
+	void exportNow();
+	void serveClient();
+
+private:
+	bool writeFile(const QString& text);
+
+	const MoonAvoidanceStats* stats;
+	QString target;
+	QString filePath;
+	QString socketName;
+	int intervalMs;
+	QTimer* timer;
+	QLocalServer* server;
+	QByteArray latest;
+};
+
+#endif // MOONAVOIDANCEMETRICSEXPORTER_HPP
@@ -0,0 +1,240 @@
+#include "MoonAvoidancePlanner.hpp"
+#include "MoonAvoidanceKernel.hpp"
+#include <QRegularExpression>
+#include <QStringList>
+#include <cmath>
+
+namespace
+{
+	using MoonAvoidanceGeometry::Vector3;
+
+	const double DegToRad = M_PI / 180.0;
+
+	// Marks samples where the target cannot be imaged: above any stored cosRadius (<= 2)
+	const double Unusable = 3.0;
+}
+
+namespace MoonAvoidancePlanner
+{
+
+Vector3 directionFromRaDec(double raDegrees, double decDegrees)
+{
+	const double ra = raDegrees * DegToRad;
+	const double dec = decDegrees * DegToRad;
+	return { std::cos(dec) * std::cos(ra), std::cos(dec) * std::sin(ra), std::sin(dec) };
+}
+
+double parseAngle(const QString& text, bool hours, bool* ok)
+{
+	QString value = text.trimmed();
+	bool negative = false;
+	if (value.startsWith('-') || value.startsWith('+'))
+	{
+		negative = value.startsWith('-');
+		value = value.mid(1).trimmed();
+	}
+
+	static const QRegularExpression separators("[:hdmsHDMS°'\"\\s]+");
+	const bool sexagesimal = value.contains(separators);
+	const QStringList parts = value.split(separators, Qt::SkipEmptyParts);
+	if (parts.isEmpty() || parts.size() > 3 || (!sexagesimal && parts.size() != 1))
+	{
+		if (ok)
+			*ok = false;
+		return 0.0;
+	}
+
+	double result = 0.0;
+	double scale = 1.0;
+	for (const QString& part : parts)
+	{
+		bool partOk = false;
+		const double number = part.toDouble(&partOk);
+		if (!partOk || !std::isfinite(number) || number < 0.0)
+		{
+			if (ok)
+				*ok = false;
+			return 0.0;
+		}
+		result += number * scale;
+		scale /= 60.0;
+	}
+
+	if (sexagesimal && hours)
+		result *= 15.0;
+	if (ok)
+		*ok = true;
+	return negative ? -result : result;
+}
+
+bool parseTarget(const QString& line, Target& out, QString* error)
+{
+	if (error)
+		error->clear();
+	const QString trimmed = line.trimmed();
+	if (trimmed.isEmpty() || trimmed.startsWith('#'))
+		return false;
+
+	QString name, ra, dec;
+	static const QRegularExpression fieldSeparators("[,;\\t]");
+	if (trimmed.contains(fieldSeparators))
+	{
+		const QStringList fields = trimmed.split(fieldSeparators);
+		if (fields.size() >= 3)
+		{
+			name = fields[0].trimmed();
+			ra = fields[1];
+			dec = fields[2];
+		}
+	}
+	else
+	{
+		QStringList fields = trimmed.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+		if (fields.size() >= 3)
+		{
+			dec = fields.takeLast();
+			ra = fields.takeLast();
+			name = fields.join(' ');
+		}
+	}
+	if (name.isEmpty())
+	{
+		if (error)
+			*error = QString("Expected name, RA and Dec: \"%1\"").arg(trimmed);
+		return false;
+	}
+
+	bool raOk = false;
+	bool decOk = false;
+	const double raDegrees = parseAngle(ra, true, &raOk);
+	const double decDegrees = parseAngle(dec, false, &decOk);
+	if (!raOk || !decOk || raDegrees < 0.0 || raDegrees >= 360.0 || std::fabs(decDegrees) > 90.0)
+	{
+		if (error)
+			*error = QString("Invalid coordinates for \"%1\"").arg(name);
+		return false;
+	}
+
+	out.name = name;
+	out.raDegrees = raDegrees;
+	out.decDegrees = decDegrees;
+	out.dir = directionFromRaDec(raDegrees, decDegrees);
+	return true;
+}
+
+double windowStartFor(double jd, double longitude)
+{
+	// Julian Days start at Greenwich noon; shift by the longitude to get local mean noon,
+	// rounded to the minute so whole UT hours fall exactly on samples
+	const double offset = longitude / 360.0;
+	return std::round((std::floor(jd + offset) - offset) * 1440.0) / 1440.0;
+}
+
+Night buildNight(double windowStartJD, const MoonAvoidanceEphemeris::Site& site, double deltaTDays)
+{
+	Night night;
+	night.windowStartJD = windowStartJD;
+	night.stepDays = StepDays;
+	night.sampleCount = SamplesPerNight;
+	night.moonDir.resize(SamplesPerNight);
+	night.moonAltitude.resize(SamplesPerNight);
+	night.moonDaysFromFull.resize(SamplesPerNight);
+	night.zenith.resize(SamplesPerNight);
+	night.sunAltitude.resize(SamplesPerNight);
+
+	for (int i = 0; i < SamplesPerNight; ++i)
+	{
+		const double jd = night.jdAt(i);
+		const MoonAvoidanceEphemeris::MoonPosition moon = MoonAvoidanceEphemeris::moonPosition(jd, deltaTDays, site);
+		night.moonDir[i] = moon.j2000Dir;
+		night.moonAltitude[i] = moon.altitude;
+		night.moonDaysFromFull[i] = MoonAvoidanceKernel::moonAge(jd).daysFromFull;
+		night.zenith[i] = MoonAvoidanceEphemeris::zenithJ2000(jd, deltaTDays, site);
+		night.sunAltitude[i] = MoonAvoidanceEphemeris::sunAltitude(jd, deltaTDays, site);
+	}
+	return night;
+}
+
+double darkHours(const Night& night)
+{
+	int dark = 0;
+	for (int i = 0; i < night.sampleCount; ++i)
+	{
+		if (night.isDark(i))
+			++dark;
+	}
+	return dark * night.stepDays * 24.0;
+}
+
+ZoneTable zoneTable(const Night& night, const QList<FilterConfig>& filters)
+{
+	ZoneTable zones;
+	zones.filterCount = filters.size();
+	zones.cosRadius.resize(filters.size() * night.sampleCount);
+	double* out = zones.cosRadius.data();
+	for (const FilterConfig& filter : filters)
+	{
+		for (int i = 0; i < night.sampleCount; ++i)
+		{
+			const double radius = MoonAvoidanceKernel::zoneRadiusDegrees(filter, night.moonAltitude[i], night.moonDaysFromFull[i]);
+			*out++ = radius > 0.0 ? std::cos(radius * DegToRad) : 2.0;
+		}
+	}
+	return zones;
+}
+
+void evaluate(const Night& night, const ZoneTable& zones, const Vector3& target, double minAltitudeDegrees, QVector<Usage>& out)
+{
+	const int n = night.sampleCount;
+	const double sinMinAltitude = std::sin(minAltitudeDegrees * DegToRad);
+
+	// Cosine of the moon separation where the target is imageable, Unusable elsewhere;
+	// then a filter allows a sample when that is below the cosine of its radius
+	QVector<double> cosSeparation(n);
+	for (int i = 0; i < n; ++i)
+	{
+		const bool visible = night.isDark(i) && MoonAvoidanceGeometry::dot(target, night.zenith[i]) >= sinMinAltitude;
+		cosSeparation[i] = visible ? MoonAvoidanceGeometry::dot(target, night.moonDir[i]) : Unusable;
+	}
+
+	out.resize(zones.filterCount);
+	for (int k = 0; k < zones.filterCount; ++k)
+	{
+		Usage& usage = out[k];
+		usage.windows.resize(0);
+		const double* cosRadius = zones.cosRadius.constData() + k * n;
+		int runStart = -1;
+		int usable = 0;
+		for (int i = 0; i <= n; ++i)
+		{
+			if (i < n && cosSeparation[i] < cosRadius[i])
+			{
+				if (runStart < 0)
+					runStart = i;
+				++usable;
+			}
+			else if (runStart >= 0)
+			{
+				usage.windows.append({ night.jdAt(runStart), night.jdAt(i) });
+				runStart = -1;
+			}
+		}
+		usage.hours = usable * night.stepDays * 24.0;
+	}
+}
+
+QVector<Usage> evaluateNight(const Night& night, const QVector<Target>& targets, const QList<FilterConfig>& filters, double minAltitudeDegrees)
+{
+	const ZoneTable zones = zoneTable(night, filters);
+	QVector<Usage> result;
+	result.reserve(targets.size() * filters.size());
+	QVector<Usage> usage;
+	for (const Target& target : targets)
+	{
+		evaluate(night, zones, target.dir, minAltitudeDegrees, usage);
+		result += usage;
+	}
+	return result;
+}
+
+}
@@ -0,0 +1,101 @@
+#ifndef MOONAVOIDANCEPLANNER_HPP
+#define MOONAVOIDANCEPLANNER_HPP
+
+#include "MoonAvoidanceConfig.hpp"
+#include "MoonAvoidanceEphemeris.hpp"
+#include "MoonAvoidanceGeometry.hpp"
+#include <QList>
+#include <QString>
+#include <QVector>
+
+// Usable imaging time per target, night and filter: the sky is dark, the
+// target is high enough and it lies outside the filter's moon zone.
+//
+// Pure functions on value types, like the kernel, so they run on any thread:
+// the Planner tab maps them over nights on QtConcurrent's pool. A night's
+// ephemeris does not depend on targets or filters and is computed once and
+// shared by every target and filter evaluated for that night.
+namespace MoonAvoidancePlanner
+{
+	constexpr double StepDays = 5.0 / 1440.0; // Five minutes
+	constexpr int SamplesPerNight = 289;       // Noon to noon, both ends included
+	constexpr double DarkSunAltitude = -18.0;  // Astronomical twilight, degrees
+
+	struct Target
+	{
+		QString name;
+		double raDegrees = 0.0;  // J2000
+		double decDegrees = 0.0; // J2000
+		MoonAvoidanceGeometry::Vector3 dir { 1.0, 0.0, 0.0 };
+	};
+
+	MoonAvoidanceGeometry::Vector3 directionFromRaDec(double raDegrees, double decDegrees);
+
+	// Decimal degrees, or sexagesimal "12:30:45.5" / "12h30m45.5s" / "-5d30m" (hours when
+	// hours is true, so decimal RA is in degrees but sexagesimal RA in hours)
+	double parseAngle(const QString& text, bool hours, bool* ok);
+
+	// "name, ra, dec" (commas, semicolons or tabs), or "name ra dec" separated by spaces
+	// where the last two fields are the coordinates. Returns false for blank lines and
+	// '#' comments with error left empty, and for malformed lines with error set.
+	bool parseTarget(const QString& line, Target& out, QString* error = nullptr);
+
+	// Moon, zenith and sun along one night, sampled every StepDays from local noon
+	struct Night
+	{
+		double windowStartJD = 0.0;
+		double stepDays = StepDays;
+		int sampleCount = 0;
+		QVector<MoonAvoidanceGeometry::Vector3> moonDir; // J2000, normalized
+		QVector<double> moonAltitude;                    // Degrees
+		QVector<double> moonDaysFromFull;
+		QVector<MoonAvoidanceGeometry::Vector3> zenith;  // J2000, normalized
+		QVector<double> sunAltitude;                     // Degrees
+
+		double jdAt(int i) const { return windowStartJD + i * stepDays; }
+		bool isDark(int i) const { return sunAltitude[i] < DarkSunAltitude; }
+	};
+
+	// Local mean noon at or before jd (to the minute) for an east longitude in degrees;
+	// nights, the timeline and every cache of them are keyed on it
+	double windowStartFor(double jd, double longitude);
+
+	// windowStartJD is local mean noon, see windowStartFor()
+	Night buildNight(double windowStartJD, const MoonAvoidanceEphemeris::Site& site, double deltaTDays);
+
+	// Hours of astronomical darkness in the night
+	double darkHours(const Night& night);
+
+	// Each filter's zone along a night as the cosine of its radius, filter-major
+	// (filter * sampleCount + sample). Avoidance off is stored as 2, which the
+	// cosine of every separation is below, so it needs no special case.
+	struct ZoneTable
+	{
+		int filterCount = 0;
+		QVector<double> cosRadius;
+	};
+	ZoneTable zoneTable(const Night& night, const QList<FilterConfig>& filters);
+
+	struct Window
+	{
+		double startJD;
+		double endJD;
+	};
+
+	// Usable time, to the sample step: every usable sample counts for one step
+	struct Usage
+	{
+		double hours = 0.0;
+		QVector<Window> windows;
+	};
+
+	// One target for every filter of the table; out has zones.filterCount entries
+	void evaluate(const Night& night, const ZoneTable& zones, const MoonAvoidanceGeometry::Vector3& target,
+	              double minAltitudeDegrees, QVector<Usage>& out);
+
+	// All targets for every filter, target-major: result[target * filters.size() + filter]
+	QVector<Usage> evaluateNight(const Night& night, const QVector<Target>& targets, const QList<FilterConfig>& filters,
+	                             double minAltitudeDegrees);
+}
+
+#endif // MOONAVOIDANCEPLANNER_HPP
@@ -0,0 +1,439 @@
+#include "MoonAvoidancePlannerWidget.hpp"
+#include <QtConcurrent/QtConcurrentMap>
+#include <QDateTime>
+#include <QDoubleSpinBox>
+#include <QFormLayout>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QLabel>
+#include <QPlainTextEdit>
+#include <QProgressBar>
+#include <QPushButton>
+#include <QSpinBox>
+#include <QTableWidget>
+#include <QTextCursor>
+#include <QTimeZone>
+#include <QTimer>
+#include <QVBoxLayout>
+#include <QDebug>
+
+namespace
+{
+	// Target, night and dark hours come before the filter columns
+	const int FirstFilterColumn = 3;
+
+	// Pause after the last keystroke before recomputing
+	const int DebounceMs = 400;
+
+	const double UnixEpochJD = 2440587.5;
+
+	bool sameParameters(const FilterConfig& a, const FilterConfig& b)
+	{
+		return a.separation == b.separation && a.width == b.width && a.relaxation == b.relaxation
+		    && a.minAlt == b.minAlt && a.maxAlt == b.maxAlt;
+	}
+}
+
+MoonAvoidancePlannerWidget::MoonAvoidancePlannerWidget(QWidget* parent)
+	: QWidget(parent)
+	, targetsEdit(nullptr)
+	, nightsSpinBox(nullptr)
+	, minAltitudeSpinBox(nullptr)
+	, computeButton(nullptr)
+	, cancelButton(nullptr)
+	, progressBar(nullptr)
+	, statusLabel(nullptr)
+	, table(nullptr)
+	, debounce(nullptr)
+	, latitude(0.0)
+	, longitude(0.0)
+	, elevation(0.0)
+	, deltaTDays(0.0)
+	, firstNightJD(0.0)
+	, utcOffsetHours(0.0)
+	, hasSite(false)
+	, watcher(nullptr)
+	, runBuildsNights(false)
+	, stale(true)
+{
+	QVBoxLayout* layout = new QVBoxLayout(this);
+	layout->setContentsMargins(0, 0, 0, 0);
+
+	QHBoxLayout* inputLayout = new QHBoxLayout();
+	targetsEdit = new QPlainTextEdit(this);
+	targetsEdit->setPlaceholderText("One target per line: name, RA, Dec (J2000)\n"
+	                                "e.g. M31, 00:42:44.3, +41:16:09 or M31 10.68 41.27");
+	targetsEdit->setMaximumHeight(90);
+	inputLayout->addWidget(targetsEdit, 1);
+
+	QFormLayout* optionsLayout = new QFormLayout();
+	nightsSpinBox = new QSpinBox(this);
+	nightsSpinBox->setRange(1, 60);
+	nightsSpinBox->setValue(7);
+	optionsLayout->addRow("Nights:", nightsSpinBox);
+	minAltitudeSpinBox = new QDoubleSpinBox(this);
+	minAltitudeSpinBox->setRange(0.0, 80.0);
+	minAltitudeSpinBox->setDecimals(1);
+	minAltitudeSpinBox->setValue(30.0);
+	minAltitudeSpinBox->setSuffix("°");
+	optionsLayout->addRow("Min Target Altitude:", minAltitudeSpinBox);
+	inputLayout->addLayout(optionsLayout);
+	layout->addLayout(inputLayout);
+
+	QHBoxLayout* progressLayout = new QHBoxLayout();
+	computeButton = new QPushButton("Compute", this);
+	cancelButton = new QPushButton("Cancel", this);
+	cancelButton->setEnabled(false);
+	progressBar = new QProgressBar(this);
+	progressBar->setVisible(false);
+	statusLabel = new QLabel(this);
+	progressLayout->addWidget(computeButton);
+	progressLayout->addWidget(cancelButton);
+	progressLayout->addWidget(progressBar, 1);
+	progressLayout->addWidget(statusLabel, 1);
+	layout->addLayout(progressLayout);
+
+	table = new QTableWidget(this);
+	table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+	table->verticalHeader()->setVisible(false);
+	layout->addWidget(table, 1);
+
+	QLabel* legendLabel = new QLabel("Hours with the sky astronomically dark, the target above the minimum altitude "
+	                                 "and outside the filter's moon zone. Hover a cell for the windows.", this);
+	legendLabel->setWordWrap(true);
+	layout->addWidget(legendLabel);
+
+	debounce = new QTimer(this);
+	debounce->setSingleShot(true);
+	debounce->setInterval(DebounceMs);
+	connect(debounce, &QTimer::timeout, this, &MoonAvoidancePlannerWidget::startFull);
+
+	connect(targetsEdit, &QPlainTextEdit::textChanged, this, &MoonAvoidancePlannerWidget::onInputsEdited);
+	connect(nightsSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), this, &MoonAvoidancePlannerWidget::onInputsEdited);
+	connect(minAltitudeSpinBox, QOverload<double>::of(&QDoubleSpinBox::valueChanged), this, &MoonAvoidancePlannerWidget::onInputsEdited);
+	connect(computeButton, &QPushButton::clicked, this, &MoonAvoidancePlannerWidget::startFull);
+	connect(cancelButton, &QPushButton::clicked, this, &MoonAvoidancePlannerWidget::cancel);
+}
+
+MoonAvoidancePlannerWidget::~MoonAvoidancePlannerWidget()
+{
+	// Tasks only hold copies of their inputs, so they can finish (or skip) on their own
+	stop();
+}
+
+void MoonAvoidancePlannerWidget::setSite(double lat, double lon, double elev, double deltaT, double firstNight, double utcOffset)
+{
+	if (hasSite && lat == latitude && lon == longitude && elev == elevation && firstNight == firstNightJD
+	    && utcOffset == utcOffsetHours)
+		return;
+
+	// Delta T drifts by milliseconds per day; only a new location or night invalidates the ephemerides
+	hasSite = true;
+	latitude = lat;
+	longitude = lon;
+	elevation = elev;
+	deltaTDays = deltaT;
+	firstNightJD = firstNight;
+	utcOffsetHours = utcOffset;
+	nights.clear();
+	startFull();
+}
+
+void MoonAvoidancePlannerWidget::setFilters(const QList<FilterConfig>& newFilters)
+{
+	filters = newFilters;
+	startFull();
+}
+
+void MoonAvoidancePlannerWidget::setFilter(int index, const FilterConfig& filter)
+{
+	if (index < 0 || index >= filters.size())
+		return;
+
+	const bool recompute = !sameParameters(filters[index], filter);
+	filters[index] = filter;
+	updateHeader();
+	if (!recompute)
+		return;
+
+	if (!isVisible() || table->rowCount() == 0)
+	{
+		stale = true;
+		return;
+	}
+
+	// A running computation restarts with this column added; a full one stays full
+	QVector<int> columns { index };
+	if (watcher)
+	{
+		for (int column : runningColumns)
+		{
+			if (column != index)
+				columns.append(column);
+		}
+	}
+	start(columns);
+}
+
+void MoonAvoidancePlannerWidget::addTarget(const QString& name, double raDegrees, double decDegrees)
+{
+	QString line = QString("%1, %2, %3").arg(name).arg(raDegrees, 0, 'f', 5).arg(decDegrees, 0, 'f', 5);
+	if (!targetsEdit->toPlainText().isEmpty() && !targetsEdit->toPlainText().endsWith('\n'))
+		line.prepend('\n');
+	targetsEdit->moveCursor(QTextCursor::End);
+	targetsEdit->insertPlainText(line);
+}
+
+void MoonAvoidancePlannerWidget::showEvent(QShowEvent* event)
+{
+	QWidget::showEvent(event);
+	if (stale)
+		startFull();
+}
+
+void MoonAvoidancePlannerWidget::onInputsEdited()
+{
+	// Stop wasting the pool on inputs that are already outdated, then wait for typing to settle
+	stop();
+	progressBar->setVisible(false);
+	statusLabel->setText("Waiting for input...");
+	debounce->start();
+}
+
+void MoonAvoidancePlannerWidget::startFull()
+{
+	debounce->stop();
+	if (!isVisible() || !hasSite)
+	{
+		stop();
+		stale = true;
+		return;
+	}
+
+	parseTargets();
+	resetTable();
+
+	QVector<int> columns;
+	for (int i = 0; i < filters.size(); ++i)
+		columns.append(i);
+	start(columns);
+}
+
+void MoonAvoidancePlannerWidget::cancel()
+{
+	stop();
+	progressBar->setVisible(false);
+	statusLabel->setText("Cancelled");
+	stale = true;
+}
+
+void MoonAvoidancePlannerWidget::start(const QVector<int>& columns)
+{
+	stop();
+	stale = false;
+
+	if (targets.isEmpty() || columns.isEmpty())
+	{
+		statusLabel->setText(targetErrors.isEmpty() ? QString("Add targets to plan") : targetErrors);
+		return;
+	}
+
+	// Cells being recomputed show as pending
+	for (int row = 0; row < table->rowCount(); ++row)
+	{
+		for (int column : columns)
+		{
+			QTableWidgetItem* item = new QTableWidgetItem("...");
+			item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+			table->setItem(row, FirstFilterColumn + column, item);
+		}
+	}
+
+	const MoonAvoidanceEphemerisCache::Key key = cacheKey();
+	MoonAvoidanceEphemerisCache::load(MoonAvoidanceEphemerisCache::defaultDirectory(), key, firstNightJD, nights);
+	runBuildsNights = nights.contains(QSharedPointer<const MoonAvoidancePlanner::Night>());
+
+	QVector<Task> tasks;
+	tasks.reserve(nights.size());
+	for (int night = 0; night < nights.size(); ++night)
+		tasks.append({ night, firstNightJD + night, nights[night] });
+
+	// Everything the tasks need is copied in: they never touch the widget
+	QList<FilterConfig> columnFilters;
+	for (int column : columns)
+		columnFilters.append(filters[column]);
+	const QVector<MoonAvoidancePlanner::Target> taskTargets = targets;
+	const MoonAvoidanceEphemeris::Site site = key.site;
+	const double deltaT = deltaTDays;
+	const double minAltitude = minAltitudeSpinBox->value();
+
+	QFuture<TaskResult> future = QtConcurrent::mapped(tasks, [=](const Task& task) -> TaskResult {
+		TaskResult result;
+		result.night = task.night;
+		result.ephemeris = task.ephemeris;
+		if (!result.ephemeris)
+			result.ephemeris.reset(new MoonAvoidancePlanner::Night(MoonAvoidancePlanner::buildNight(task.windowStartJD, site, deltaT)));
+		result.usage = MoonAvoidancePlanner::evaluateNight(*result.ephemeris, taskTargets, columnFilters, minAltitude);
+		return result;
+	});
+
+	// A fresh watcher per run: signals of a replaced run can never reach the table
+	QFutureWatcher<TaskResult>* runWatcher = new QFutureWatcher<TaskResult>(this);
+	watcher = runWatcher;
+	runningColumns = columns;
+	connect(runWatcher, &QFutureWatcherBase::resultReadyAt, this, [this, runWatcher, columns](int index) {
+		applyResult(runWatcher->resultAt(index), columns);
+	});
+	connect(runWatcher, &QFutureWatcherBase::progressRangeChanged, progressBar, &QProgressBar::setRange);
+	connect(runWatcher, &QFutureWatcherBase::progressValueChanged, progressBar, &QProgressBar::setValue);
+	connect(runWatcher, &QFutureWatcherBase::finished, this, [this, runWatcher]() { finish(runWatcher); });
+	runWatcher->setFuture(future);
+
+	runClock.start();
+	progressBar->setValue(0);
+	progressBar->setVisible(true);
+	cancelButton->setEnabled(true);
+	statusLabel->setText(QString("%1 targets × %2 nights").arg(targets.size()).arg(nights.size()));
+}
+
+void MoonAvoidancePlannerWidget::stop()
+{
+	if (!watcher)
+		return;
+
+	// Pending tasks are skipped; running ones finish in the pool and are discarded
+	watcher->disconnect(this);
+	watcher->disconnect(progressBar);
+	watcher->cancel();
+	watcher->deleteLater();
+	watcher = nullptr;
+	runningColumns.clear();
+	cancelButton->setEnabled(false);
+}
+
+void MoonAvoidancePlannerWidget::applyResult(const TaskResult& result, const QVector<int>& columns)
+{
+	if (result.night < 0 || result.night >= nights.size())
+		return;
+	nights[result.night] = result.ephemeris;
+
+	const int nightCount = nights.size();
+	for (int t = 0; t < targets.size(); ++t)
+	{
+		const int row = t * nightCount + result.night;
+		QTableWidgetItem* darkItem = new QTableWidgetItem(QString("%1 h").arg(MoonAvoidancePlanner::darkHours(*result.ephemeris), 0, 'f', 1));
+		darkItem->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+		table->setItem(row, 2, darkItem);
+
+		for (int c = 0; c < columns.size(); ++c)
+		{
+			const MoonAvoidancePlanner::Usage& usage = result.usage[t * columns.size() + c];
+			QStringList windows;
+			for (const MoonAvoidancePlanner::Window& window : usage.windows)
+				windows << QString("%1 - %2").arg(formatTime(window.startJD, "HH:mm"), formatTime(window.endJD, "HH:mm"));
+
+			QTableWidgetItem* item = new QTableWidgetItem(QString("%1 h").arg(usage.hours, 0, 'f', 1));
+			item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+			item->setToolTip(windows.isEmpty() ? QString("Not usable") : windows.join('\n'));
+			table->setItem(row, FirstFilterColumn + columns[c], item);
+		}
+	}
+}
+
+void MoonAvoidancePlannerWidget::finish(QFutureWatcher<TaskResult>* finished)
+{
+	if (finished != watcher)
+		return;
+
+	const qint64 elapsedMs = runClock.elapsed();
+	const int columnCount = runningColumns.size();
+	watcher->deleteLater();
+	watcher = nullptr;
+	runningColumns.clear();
+	cancelButton->setEnabled(false);
+	progressBar->setVisible(false);
+	// Once per run: resizing to contents on every cell update is quadratic in the rows
+	table->resizeColumnsToContents();
+
+	if (runBuildsNights)
+	{
+		MoonAvoidanceEphemerisCache::saveInBackground(MoonAvoidanceEphemerisCache::defaultDirectory(), cacheKey(), firstNightJD, nights);
+		runBuildsNights = false;
+	}
+
+	QString status = QString("%1 targets × %2 nights × %3 filters in %4 ms")
+		.arg(targets.size()).arg(nights.size()).arg(columnCount).arg(elapsedMs);
+	if (!targetErrors.isEmpty())
+		status += " - " + targetErrors;
+	statusLabel->setText(status);
+	qDebug() << "MoonAvoidancePlannerWidget:" << status;
+}
+
+MoonAvoidanceEphemerisCache::Key MoonAvoidancePlannerWidget::cacheKey() const
+{
+	MoonAvoidanceEphemerisCache::Key key;
+	key.site = { latitude, longitude, elevation };
+	key.deltaTDays = deltaTDays;
+	return key;
+}
+
+void MoonAvoidancePlannerWidget::parseTargets()
+{
+	targets.clear();
+	QStringList errors;
+	const QStringList lines = targetsEdit->toPlainText().split('\n');
+	for (int i = 0; i < lines.size(); ++i)
+	{
+		MoonAvoidancePlanner::Target target;
+		QString error;
+		if (MoonAvoidancePlanner::parseTarget(lines[i], target, &error))
+			targets.append(target);
+		else if (!error.isEmpty())
+			errors << QString("line %1: %2").arg(i + 1).arg(error);
+	}
+	targetErrors = errors.join("; ");
+
+	// Keep the ephemerides of nights that are still shown
+	nights.resize(nightsSpinBox->value());
+}
+
+void MoonAvoidancePlannerWidget::resetTable()
+{
+	const int nightCount = nights.size();
+	table->clear();
+	table->setRowCount(targets.size() * nightCount);
+	table->setColumnCount(FirstFilterColumn + filters.size());
+	updateHeader();
+
+	for (int t = 0; t < targets.size(); ++t)
+	{
+		for (int night = 0; night < nightCount; ++night)
+		{
+			const int row = t * nightCount + night;
+			table->setItem(row, 0, new QTableWidgetItem(targets[t].name));
+			table->setItem(row, 1, new QTableWidgetItem(formatTime(firstNightJD + night, "ddd yyyy-MM-dd")));
+		}
+	}
+}
+
+void MoonAvoidancePlannerWidget::updateHeader()
+{
+	if (table->columnCount() != FirstFilterColumn + filters.size())
+		return; // Rebuilt by the next full run
+
+	QStringList labels { "Target", "Night", "Dark" };
+	for (const FilterConfig& filter : filters)
+		labels << filter.name;
+	table->setHorizontalHeaderLabels(labels);
+	for (int i = 0; i < filters.size(); ++i)
+	{
+		if (QTableWidgetItem* header = table->horizontalHeaderItem(FirstFilterColumn + i))
+			header->setForeground(filters[i].color);
+	}
+}
+
+QString MoonAvoidancePlannerWidget::formatTime(double jd, const char* format) const
+{
+	const qint64 ms = qRound64((jd - UnixEpochJD) * 86400000.0 + utcOffsetHours * 3600000.0);
+	return QDateTime::fromMSecsSinceEpoch(ms, QTimeZone::utc()).toString(format);
+}
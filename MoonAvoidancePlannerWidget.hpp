@@ -0,0 +1,122 @@
+#ifndef MOONAVOIDANCEPLANNERWIDGET_HPP
+#define MOONAVOIDANCEPLANNERWIDGET_HPP
+
+#include "MoonAvoidanceConfig.hpp"
+#include "MoonAvoidanceEphemerisCache.hpp"
+#include "MoonAvoidancePlanner.hpp"
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QList>
+#include <QSharedPointer>
+#include <QVector>
+#include <QWidget>
+
+class QDoubleSpinBox;
+class QLabel;
+class QPlainTextEdit;
+class QProgressBar;
+class QPushButton;
+class QSpinBox;
+class QTableWidget;
+class QTimer;
+
+// Usable hours and windows per target, night and filter, shown in the Planner
+// tab of the configuration dialog.
+//
+// The work is one task per night, mapped over QtConcurrent's global pool, and
+// rows fill in as nights finish. Any change of input cancels the running
+// computation without waiting for it and starts again (after a short pause
+// while typing), so a stale result is never shown and the dialog never blocks.
+// Night ephemerides are kept between runs: new targets or a new altitude limit
+// only re-evaluate, and editing one filter recomputes that filter's column.
+// They are also read from and written to MoonAvoidanceEphemerisCache, so
+// reopening the tab at a known site computes no ephemeris at all.
+// Nothing is computed while the tab is hidden.
+class MoonAvoidancePlannerWidget : public QWidget
+{
+	Q_OBJECT
+
+public:
+	explicit MoonAvoidancePlannerWidget(QWidget* parent = nullptr);
+	~MoonAvoidancePlannerWidget() override;
+
+	// Observer and the first night (local mean noon); a change recomputes everything.
+	// Times are shown at a fixed UTC offset, so a DST change within the range is ignored.
+	void setSite(double latitude, double longitude, double elevation, double deltaTDays, double firstNightJD,
+	             double utcOffsetHours);
+	void setFilters(const QList<FilterConfig>& filters);
+	// One filter was edited: recomputes its column only, and only if its parameters changed
+	void setFilter(int index, const FilterConfig& filter);
+	// Appends a line to the target list
+	void addTarget(const QString& name, double raDegrees, double decDegrees);
+
+	bool isComputing() const { return watcher != nullptr; }
+
+protected:
+	void showEvent(QShowEvent* event) override;
+
+private slots:
+	void onInputsEdited();
+	void startFull();
+	void cancel();
+
+private:
+	struct Task
+	{
+		int night;
+		double windowStartJD;
+		QSharedPointer<const MoonAvoidancePlanner::Night> ephemeris; // Null: compute it
+	};
+
+	struct TaskResult
+	{
+		int night = 0;
+		QSharedPointer<const MoonAvoidancePlanner::Night> ephemeris;
+		QVector<MoonAvoidancePlanner::Usage> usage; // target * columns + column
+	};
+
+	// Columns are filter indices
+	void start(const QVector<int>& columns);
+	void stop();
+	void applyResult(const TaskResult& result, const QVector<int>& columns);
+	void finish(QFutureWatcher<TaskResult>* finished);
+	MoonAvoidanceEphemerisCache::Key cacheKey() const;
+	void parseTargets();
+	void resetTable();
+	void updateHeader();
+	QString formatTime(double jd, const char* format) const;
+
+	QPlainTextEdit* targetsEdit;
+	QSpinBox* nightsSpinBox;
+	QDoubleSpinBox* minAltitudeSpinBox;
+	QPushButton* computeButton;
+	QPushButton* cancelButton;
+	QProgressBar* progressBar;
+	QLabel* statusLabel;
+	QTableWidget* table;
+	QTimer* debounce;
+
+	// Inputs
+	QList<FilterConfig> filters;
+	QVector<MoonAvoidancePlanner::Target> targets;
+	QString targetErrors;
+	double latitude;
+	double longitude;
+	double elevation;
+	double deltaTDays;
+	double firstNightJD;
+	double utcOffsetHours;
+	bool hasSite;
+
+	// Ephemerides of the nights shown, null until computed; cleared when the site changes
+	QVector<QSharedPointer<const MoonAvoidancePlanner::Night>> nights;
+
+	// Running computation (null when idle) and the filter columns it covers
+	QFutureWatcher<TaskResult>* watcher;
+	QVector<int> runningColumns;
+	bool runBuildsNights; // Some ephemerides were not cached
+	QElapsedTimer runClock;
+	bool stale; // Inputs changed while hidden
+};
+
+#endif // MOONAVOIDANCEPLANNERWIDGET_HPP
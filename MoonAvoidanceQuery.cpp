@@ -0,0 +1,456 @@
+#include "MoonAvoidanceQuery.hpp"
+#include "MoonAvoidanceEphemerisCache.hpp"
+#include "MoonAvoidanceKernel.hpp"
+#include <QDeadlineTimer>
+#include <QLocalServer>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <cstring>
+
+namespace
+{
+	using namespace MoonAvoidanceQueryProtocol;
+
+	const double RadToDeg = 180.0 / M_PI;
+
+	static_assert(sizeof(RequestHeader) == 16 && sizeof(ReplyHeader) == 16, "Headers are sent as they are in memory");
+	static_assert(sizeof(Query) == 32 && sizeof(Answer) == 24, "Records are sent as they are in memory");
+
+	const quint32 MaxRequestBytes = sizeof(RequestHeader) + MaxQueriesPerRequest * sizeof(Query);
+
+	// Length prefix, header, body
+	QByteArray replyFrame(quint16 kind, quint32 status, quint32 count, const char* body, qint64 bodySize)
+	{
+		ReplyHeader header;
+		header.magic = ReplyMagic;
+		header.version = Version;
+		header.kind = kind;
+		header.count = count;
+		header.status = status;
+		const quint32 length = static_cast<quint32>(sizeof(header) + bodySize);
+
+		QByteArray frame;
+		frame.reserve(sizeof(length) + length);
+		frame.append(reinterpret_cast<const char*>(&length), sizeof(length));
+		frame.append(reinterpret_cast<const char*>(&header), sizeof(header));
+		frame.append(body, bodySize);
+		return frame;
+	}
+
+	bool isLittleEndianHost()
+	{
+		return Q_BYTE_ORDER == Q_LITTLE_ENDIAN;
+	}
+}
+
+MoonAvoidanceQueryEngine::MoonAvoidanceQueryEngine(const QString& cacheDirectory)
+	: cacheDirectory(cacheDirectory)
+{
+}
+
+void MoonAvoidanceQueryEngine::setContext(const Context& context)
+{
+	QSharedPointer<const Context> replacement(new Context(context));
+	QMutexLocker locker(&mutex);
+	current = replacement;
+}
+
+bool MoonAvoidanceQueryEngine::hasContext() const
+{
+	return !context().isNull();
+}
+
+QStringList MoonAvoidanceQueryEngine::filterNames() const
+{
+	QStringList names;
+	if (const QSharedPointer<const Context> ctx = context())
+	{
+		for (const FilterConfig& filter : ctx->filters)
+			names.append(filter.name);
+	}
+	return names;
+}
+
+QSharedPointer<const MoonAvoidanceQueryEngine::Context> MoonAvoidanceQueryEngine::context() const
+{
+	QMutexLocker locker(&mutex);
+	return current;
+}
+
+void MoonAvoidanceQueryEngine::warm(double jd)
+{
+	if (const QSharedPointer<const Context> ctx = context())
+	{
+		if (ctx != nightsContext)
+		{
+			nights.clear();
+			nightsContext = ctx;
+		}
+		night(*ctx, jd);
+	}
+}
+
+const MoonAvoidancePlanner::Night& MoonAvoidanceQueryEngine::night(const Context& ctx, double jd)
+{
+	const double windowStart = MoonAvoidancePlanner::windowStartFor(jd, ctx.site.longitude);
+	const qint64 minute = qRound64(windowStart * 1440.0);
+	auto found = nights.constFind(minute);
+	if (found != nights.constEnd())
+		return **found;
+
+	if (nights.size() >= MaxCachedNights)
+		nights.clear(); // Queries far apart in time; tonight is loaded again on demand
+
+	QVector<QSharedPointer<const MoonAvoidancePlanner::Night>> loaded(1);
+	MoonAvoidanceEphemerisCache::Key key;
+	key.site = ctx.site;
+	key.deltaTDays = ctx.deltaTDays;
+	if (cacheDirectory.isEmpty() || MoonAvoidanceEphemerisCache::load(cacheDirectory, key, windowStart, loaded) == 0)
+		loaded[0].reset(new MoonAvoidancePlanner::Night(MoonAvoidancePlanner::buildNight(windowStart, ctx.site, ctx.deltaTDays)));
+	return **nights.insert(minute, loaded[0]);
+}
+
+bool MoonAvoidanceQueryEngine::answer(const Query* queries, int count, QVector<Answer>& out)
+{
+	const QSharedPointer<const Context> ctx = context();
+	if (!ctx)
+		return false;
+	if (ctx != nightsContext)
+	{
+		nights.clear();
+		nightsContext = ctx;
+	}
+
+	const int filterCount = ctx->filters.size();
+	for (int i = 0; i < count; ++i)
+	{
+		const Query& query = queries[i];
+		if (query.filter < -1 || query.filter >= filterCount || !std::isfinite(query.jd)
+		    || !std::isfinite(query.raDegrees) || !std::isfinite(query.decDegrees))
+		{
+			out.append({ 0.0, 0.0, InvalidQuery, query.filter });
+			continue;
+		}
+
+		// Linear between the night's samples, as MoonAvoidanceTimelineData::sample()
+		const MoonAvoidancePlanner::Night& n = night(*ctx, query.jd);
+		const double position = qBound(0.0, (query.jd - n.windowStartJD) / n.stepDays, n.sampleCount - 1.0);
+		const int i0 = qMin(static_cast<int>(position), n.sampleCount - 2);
+		const double f = position - i0;
+		const MoonAvoidanceGeometry::Vector3 moonDir =
+			MoonAvoidanceGeometry::normalized(n.moonDir[i0] * (1.0 - f) + n.moonDir[i0 + 1] * f);
+		const double moonAltitude = n.moonAltitude[i0] * (1.0 - f) + n.moonAltitude[i0 + 1] * f;
+		const double daysFromFull = MoonAvoidanceKernel::moonAge(query.jd).daysFromFull;
+
+		const MoonAvoidanceGeometry::Vector3 target = MoonAvoidancePlanner::directionFromRaDec(query.raDegrees, query.decDegrees);
+		const double separation = std::acos(qBound(-1.0, MoonAvoidanceGeometry::dot(moonDir, target), 1.0)) * RadToDeg;
+
+		const int first = query.filter < 0 ? 0 : query.filter;
+		const int last = query.filter < 0 ? filterCount : query.filter + 1;
+		for (int filter = first; filter < last; ++filter)
+		{
+			const double radius = MoonAvoidanceKernel::zoneRadiusDegrees(ctx->filters[filter], moonAltitude, daysFromFull);
+			quint32 flags = 0;
+			if (radius <= 0.0)
+				flags = Allowed | AvoidanceOff;
+			else if (separation > radius)
+				flags = Allowed;
+			out.append({ separation, radius, flags, filter });
+		}
+	}
+	return true;
+}
+
+bool MoonAvoidanceQueryEngine::answerGrid(const QVector<double>& jds, const QVector<MoonAvoidancePlanner::Target>& targets,
+                                          QVector<Answer>& out)
+{
+	const QSharedPointer<const Context> ctx = context();
+	if (!ctx)
+		return false;
+
+	const int filterCount = ctx->filters.size();
+	const qsizetype perTime = static_cast<qsizetype>(targets.size()) * filterCount;
+	out.resize(jds.size() * perTime);
+	if (perTime == 0)
+		return true;
+
+	QVector<Query> queries(targets.size());
+	for (int t = 0; t < targets.size(); ++t)
+	{
+		queries[t].raDegrees = targets[t].raDegrees;
+		queries[t].decDegrees = targets[t].decDegrees;
+		queries[t].filter = -1;
+		queries[t].reserved = 0;
+	}
+
+	QVector<int> order(jds.size());
+	std::iota(order.begin(), order.end(), 0);
+	// NaN compares false both ways, which breaks the strict weak ordering; put those times last
+	std::stable_sort(order.begin(), order.end(), [&jds](int a, int b) {
+		return std::isnan(jds[b]) ? !std::isnan(jds[a]) : jds[a] < jds[b];
+	});
+
+	QVector<Answer> answers;
+	answers.reserve(perTime);
+	for (int time : order)
+	{
+		answers.clear();
+		for (Query& query : queries)
+			query.jd = jds[time];
+		answer(queries.constData(), queries.size(), answers);
+
+		// An invalid query has a single answer; spread it over the filters
+		Answer* row = out.data() + time * perTime;
+		int a = 0;
+		for (int t = 0; t < targets.size(); ++t)
+		{
+			if (answers[a].flags & InvalidQuery)
+			{
+				for (int filter = 0; filter < filterCount; ++filter)
+					row[t * filterCount + filter] = { 0.0, 0.0, InvalidQuery, filter };
+				++a;
+				continue;
+			}
+			std::copy(answers.constBegin() + a, answers.constBegin() + a + filterCount, row + t * filterCount);
+			a += filterCount;
+		}
+	}
+	return true;
+}
+
+MoonAvoidanceQueryServer::MoonAvoidanceQueryServer(const QString& socketName, const QString& cacheDirectory)
+	: socketName(socketName)
+	, engine(cacheDirectory)
+	, server(nullptr)
+{
+}
+
+MoonAvoidanceQueryServer::~MoonAvoidanceQueryServer()
+{
+	stop();
+}
+
+void MoonAvoidanceQueryServer::setContext(const MoonAvoidanceQueryEngine::Context& context, double nowJD)
+{
+	engine.setContext(context);
+	QMetaObject::invokeMethod(this, [this, nowJD]() { engine.warm(nowJD); }, Qt::QueuedConnection);
+}
+
+bool MoonAvoidanceQueryServer::start()
+{
+	if (server)
+		return true;
+	if (!isLittleEndianHost())
+	{
+		qWarning() << "MoonAvoidanceQueryServer: The protocol is little-endian; this host is not";
+		return false;
+	}
+
+	server = new QLocalServer(this);
+	server->setSocketOptions(QLocalServer::UserAccessOption);
+	QLocalServer::removeServer(socketName); // Stale socket from a crashed session
+	if (!server->listen(socketName))
+	{
+		qWarning() << "MoonAvoidanceQueryServer: Cannot listen on" << socketName << "-" << server->errorString();
+		delete server;
+		server = nullptr;
+		return false;
+	}
+	connect(server, &QLocalServer::newConnection, this, &MoonAvoidanceQueryServer::acceptClients);
+	qDebug() << "MoonAvoidanceQueryServer: Listening on" << server->fullServerName();
+	return true;
+}
+
+void MoonAvoidanceQueryServer::stop()
+{
+	if (!server)
+		return;
+	server->close();
+	delete server; // Takes the client sockets with it
+	server = nullptr;
+}
+
+void MoonAvoidanceQueryServer::acceptClients()
+{
+	while (server && server->hasPendingConnections())
+	{
+		QLocalSocket* socket = server->nextPendingConnection();
+		connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+		connect(socket, &QLocalSocket::readyRead, this, [this, socket]() { serve(socket); });
+		serve(socket); // Requests sent along with the connection
+	}
+}
+
+void MoonAvoidanceQueryServer::serve(QLocalSocket* socket)
+{
+	// Every complete frame in the buffer, so a pipelining client is answered in one go
+	for (;;)
+	{
+		quint32 length = 0;
+		if (socket->peek(reinterpret_cast<char*>(&length), sizeof(length)) < static_cast<qint64>(sizeof(length)))
+			return;
+		if (length < sizeof(RequestHeader) || length > MaxRequestBytes)
+		{
+			socket->write(replyFrame(0, Malformed, 0, nullptr, 0));
+			socket->disconnectFromServer();
+			return;
+		}
+		if (socket->bytesAvailable() < static_cast<qint64>(sizeof(length) + length))
+			return;
+
+		socket->skip(sizeof(length));
+		bool keepOpen = true;
+		socket->write(handle(socket->read(length), keepOpen));
+		if (!keepOpen)
+		{
+			socket->disconnectFromServer();
+			return;
+		}
+	}
+}
+
+QByteArray MoonAvoidanceQueryServer::handle(const QByteArray& request, bool& keepOpen)
+{
+	RequestHeader header;
+	std::memcpy(&header, request.constData(), sizeof(header));
+	const qint64 expectedSize = sizeof(header) + (header.kind == QueryRequest ? header.count * static_cast<qint64>(sizeof(Query)) : 0);
+	if (header.magic != RequestMagic || header.version != Version || (header.kind != QueryRequest && header.kind != FilterListRequest)
+	    || header.count > MaxQueriesPerRequest || request.size() != expectedSize)
+	{
+		keepOpen = false;
+		return replyFrame(header.kind, Malformed, 0, nullptr, 0);
+	}
+
+	if (!engine.hasContext())
+		return replyFrame(header.kind, NoSite, 0, nullptr, 0);
+
+	if (header.kind == FilterListRequest)
+	{
+		const QStringList names = engine.filterNames();
+		QByteArray body;
+		for (const QString& name : names)
+			body.append(name.toUtf8()).append('\n');
+		return replyFrame(FilterListRequest, Ok, static_cast<quint32>(names.size()), body.constData(), body.size());
+	}
+
+	// Copied out: the request's bytes carry no alignment guarantee
+	QVector<MoonAvoidanceQueryProtocol::Query> queries(static_cast<int>(header.count));
+	std::memcpy(queries.data(), request.constData() + sizeof(header), header.count * sizeof(MoonAvoidanceQueryProtocol::Query));
+	answers.clear();
+	if (!engine.answer(queries.constData(), queries.size(), answers))
+		return replyFrame(QueryRequest, NoSite, 0, nullptr, 0);
+	return replyFrame(QueryRequest, Ok, static_cast<quint32>(answers.size()), reinterpret_cast<const char*>(answers.constData()),
+	                  answers.size() * static_cast<qint64>(sizeof(Answer)));
+}
+
+bool MoonAvoidanceQueryClient::connectToServer(const QString& socketName, int timeoutMs)
+{
+	if (!isLittleEndianHost())
+	{
+		error = "The protocol is little-endian; this host is not";
+		return false;
+	}
+	socket.connectToServer(socketName);
+	if (!socket.waitForConnected(timeoutMs))
+	{
+		error = QString("Cannot connect to %1: %2").arg(socketName, socket.errorString());
+		return false;
+	}
+	return true;
+}
+
+void MoonAvoidanceQueryClient::disconnectFromServer()
+{
+	socket.disconnectFromServer();
+}
+
+bool MoonAvoidanceQueryClient::filterNames(QStringList& names, int timeoutMs)
+{
+	ReplyHeader header;
+	QByteArray body;
+	if (!exchange(FilterListRequest, QByteArray(), 0, header, body, timeoutMs))
+		return false;
+	names = QString::fromUtf8(body).split('\n', Qt::SkipEmptyParts);
+	return true;
+}
+
+bool MoonAvoidanceQueryClient::query(const QVector<MoonAvoidanceQueryProtocol::Query>& queries, QVector<Answer>& answers, int timeoutMs)
+{
+	const QByteArray payload = QByteArray::fromRawData(reinterpret_cast<const char*>(queries.constData()),
+	                                                   queries.size() * static_cast<qint64>(sizeof(MoonAvoidanceQueryProtocol::Query)));
+	ReplyHeader header;
+	QByteArray body;
+	if (!exchange(QueryRequest, payload, static_cast<quint32>(queries.size()), header, body, timeoutMs))
+		return false;
+	if (body.size() != header.count * static_cast<qint64>(sizeof(Answer)))
+	{
+		error = "Reply of the wrong size";
+		return false;
+	}
+	answers.resize(static_cast<int>(header.count));
+	std::memcpy(answers.data(), body.constData(), body.size());
+	return true;
+}
+
+bool MoonAvoidanceQueryClient::exchange(Kind kind, const QByteArray& payload, quint32 count, ReplyHeader& header, QByteArray& body,
+                                        int timeoutMs)
+{
+	if (socket.state() != QLocalSocket::ConnectedState)
+	{
+		error = "Not connected";
+		return false;
+	}
+
+	RequestHeader request;
+	request.magic = RequestMagic;
+	request.version = Version;
+	request.kind = kind;
+	request.count = count;
+	request.reserved = 0;
+	const quint32 length = static_cast<quint32>(sizeof(request) + payload.size());
+	socket.write(reinterpret_cast<const char*>(&length), sizeof(length));
+	socket.write(reinterpret_cast<const char*>(&request), sizeof(request));
+	socket.write(payload);
+	socket.flush();
+
+	quint32 replyLength = 0;
+	if (!readExactly(reinterpret_cast<char*>(&replyLength), sizeof(replyLength), timeoutMs))
+		return false;
+	if (replyLength < sizeof(ReplyHeader))
+	{
+		error = "Malformed reply";
+		return false;
+	}
+	body.resize(replyLength - sizeof(ReplyHeader));
+	if (!readExactly(reinterpret_cast<char*>(&header), sizeof(header), timeoutMs) || !readExactly(body.data(), body.size(), timeoutMs))
+		return false;
+	if (header.magic != ReplyMagic || header.kind != kind)
+	{
+		error = "Malformed reply";
+		return false;
+	}
+	if (header.status != Ok)
+	{
+		error = header.status == NoSite ? QString("The server does not know the observer yet") : QString("Request rejected");
+		return false;
+	}
+	return true;
+}
+
+bool MoonAvoidanceQueryClient::readExactly(char* data, qint64 size, int timeoutMs)
+{
+	const QDeadlineTimer deadline(timeoutMs);
+	while (socket.bytesAvailable() < size)
+	{
+		if (!socket.waitForReadyRead(static_cast<int>(deadline.remainingTime())))
+		{
+			error = socket.state() == QLocalSocket::ConnectedState ? QString("Timed out") : socket.errorString();
+			return false;
+		}
+	}
+	return socket.read(data, size) == size;
+}
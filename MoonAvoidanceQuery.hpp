@@ -0,0 +1,199 @@
+#ifndef MOONAVOIDANCEQUERY_HPP
+#define MOONAVOIDANCEQUERY_HPP
+
+#include "MoonAvoidanceConfig.hpp"
+#include "MoonAvoidanceEphemeris.hpp"
+#include "MoonAvoidancePlanner.hpp"
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QLocalSocket>
+#include <QMutex>
+#include <QObject>
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class QLocalServer;
+
+// "Is this target allowed?" for imaging sequencers, over a local socket
+// (a Unix domain socket, or a named pipe on Windows).
+//
+// A client sends frames: a little-endian quint32 with the length of the rest,
+// then a RequestHeader and, for a query, count Query records. Each request
+// gets one reply frame in order: a ReplyHeader, then count Answer records, or
+// for a filter list the filter names, each followed by '\n'. Connections stay
+// open for as many requests as the client likes.
+//
+// Answers come from night ephemerides kept in memory (and read from
+// MoonAvoidanceEphemerisCache when there), interpolated between their
+// five-minute samples, so a batch costs microseconds per query once the night
+// is loaded. The night around the current time is loaded as soon as the site
+// is known.
+namespace MoonAvoidanceQueryProtocol
+{
+	const quint32 RequestMagic = 0x5156414d; // "MAVQ"
+	const quint32 ReplyMagic = 0x5256414d;   // "MAVR"
+	const quint16 Version = 1;
+	const quint32 MaxQueriesPerRequest = 65536;
+
+	enum Kind : quint16
+	{
+		QueryRequest = 1,     // count Query records
+		FilterListRequest = 2 // No records
+	};
+
+	enum Status : quint32
+	{
+		Ok = 0,
+		Malformed = 1, // Bad magic, version, kind or length; the connection is closed
+		NoSite = 2     // The server does not know the observer yet
+	};
+
+	// Answer::flags
+	enum Flag : quint32
+	{
+		Allowed = 1,        // Separation above the radius (always set with AvoidanceOff)
+		AvoidanceOff = 2,   // The filter's separation is relaxed to nothing at this moon altitude
+		InvalidQuery = 4    // No such filter index, or a time or coordinate that is not a number; nothing else is set
+	};
+
+	struct RequestHeader
+	{
+		quint32 magic;
+		quint16 version;
+		quint16 kind;
+		quint32 count; // Query records that follow
+		quint32 reserved;
+	};
+
+	struct Query
+	{
+		double jd;         // UT
+		double raDegrees;  // J2000
+		double decDegrees; // J2000
+		qint32 filter;     // Index into the filter list, or -1 for one answer per filter
+		quint32 reserved;
+	};
+
+	struct ReplyHeader
+	{
+		quint32 magic;
+		quint16 version;
+		quint16 kind;
+		quint32 count; // Answers, or filter names
+		quint32 status;
+	};
+
+	struct Answer
+	{
+		double separationDegrees; // Moon to target, topocentric
+		double radiusDegrees;     // Zone radius at that time, 0 = avoidance off
+		quint32 flags;
+		qint32 filter;
+	};
+}
+
+// Answers queries for one observer and filter set. setContext() may be called
+// from any thread; answer() and warm() only from the thread serving requests.
+class MoonAvoidanceQueryEngine
+{
+public:
+	struct Context
+	{
+		MoonAvoidanceEphemeris::Site site;
+		double deltaTDays = 0.0;
+		QList<FilterConfig> filters;
+	};
+
+	static const int MaxCachedNights = 16;
+
+	explicit MoonAvoidanceQueryEngine(const QString& cacheDirectory = QString());
+
+	void setContext(const Context& context);
+	bool hasContext() const;
+	QStringList filterNames() const;
+
+	// Loads the night around jd ahead of the first query
+	void warm(double jd);
+
+	// Appends one answer per query (one per filter for filter -1); false without a context
+	bool answer(const MoonAvoidanceQueryProtocol::Query* queries, int count, QVector<MoonAvoidanceQueryProtocol::Answer>& out);
+
+	// Every target at every time, one answer per filter, replacing out; out is indexed
+	// [(time * targetCount + target) * filterCount + filter]. Times are visited in
+	// order whatever their order in jds, so each night is loaded once. A time or
+	// target that is not a number gives InvalidQuery answers. False without a context.
+	bool answerGrid(const QVector<double>& jds, const QVector<MoonAvoidancePlanner::Target>& targets,
+	                QVector<MoonAvoidanceQueryProtocol::Answer>& out);
+
+private:
+	QSharedPointer<const Context> context() const;
+	const MoonAvoidancePlanner::Night& night(const Context& context, double jd);
+
+	const QString cacheDirectory;
+	mutable QMutex mutex;
+	QSharedPointer<const Context> current;
+
+	// Serving thread only
+	QSharedPointer<const Context> nightsContext; // What nights were built for
+	QHash<qint64, QSharedPointer<const MoonAvoidancePlanner::Night>> nights; // By first minute
+};
+
+// QLocalServer front end of a MoonAvoidanceQueryEngine. Lives on its own
+// thread in the plugin (see MoonAvoidance::startQueryServer) and on the main
+// thread of moonavoid-cli --serve.
+class MoonAvoidanceQueryServer : public QObject
+{
+	Q_OBJECT
+
+public:
+	MoonAvoidanceQueryServer(const QString& socketName, const QString& cacheDirectory);
+	~MoonAvoidanceQueryServer() override;
+
+	// Any thread; the night around nowJD is loaded on the server's thread
+	void setContext(const MoonAvoidanceQueryEngine::Context& context, double nowJD);
+
+public slots:
+	// Must run on the server thread
+	bool start();
+	void stop();
+
+private slots:
+	void acceptClients();
+
+private:
+	void serve(QLocalSocket* socket);
+	QByteArray handle(const QByteArray& request, bool& keepOpen);
+
+	const QString socketName;
+	MoonAvoidanceQueryEngine engine;
+	QLocalServer* server;
+	QVector<MoonAvoidanceQueryProtocol::Answer> answers; // Reused between requests
+};
+
+// Blocking client, for sequencers written against Qt and for the tests. Not
+// for the thread the server runs on.
+class MoonAvoidanceQueryClient
+{
+public:
+	bool connectToServer(const QString& socketName, int timeoutMs = 1000);
+	void disconnectFromServer();
+
+	bool filterNames(QStringList& names, int timeoutMs = 1000);
+	bool query(const QVector<MoonAvoidanceQueryProtocol::Query>& queries, QVector<MoonAvoidanceQueryProtocol::Answer>& answers,
+	           int timeoutMs = 1000);
+
+	QString errorString() const { return error; }
+
+private:
+	bool exchange(MoonAvoidanceQueryProtocol::Kind kind, const QByteArray& payload, quint32 count,
+	              MoonAvoidanceQueryProtocol::ReplyHeader& header, QByteArray& body, int timeoutMs);
+	bool readExactly(char* data, qint64 size, int timeoutMs);
+
+	QLocalSocket socket;
+	QString error;
+};
+
+#endif // MOONAVOIDANCEQUERY_HPP
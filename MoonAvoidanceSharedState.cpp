@@ -0,0 +1,273 @@
+#include "MoonAvoidanceSharedState.hpp"
+#include <QDateTime>
+#include <QDir>
+#include <QNativeIpcKey>
+#include <QThread>
+#include <cstring>
+#include <new>
+
+using namespace MoonAvoidanceSharedStateFormat;
+
+namespace
+{
+	QNativeIpcKey nativeKey(const QString& name)
+	{
+#ifdef Q_OS_WIN
+		return QNativeIpcKey(name, QNativeIpcKey::Type::Windows);
+#else
+		return QNativeIpcKey(QLatin1Char('/') + name, QNativeIpcKey::Type::PosixRealtime);
+#endif
+	}
+
+	// Single writer: the plain load of the sequence cannot race another store.
+	// A sequence left odd by a writer that died mid-write stays odd until this
+	// write completes, and every even value is new, so readers never accept a
+	// block they may have seen half of.
+	void writeBlock(std::atomic<quint64>& sequence, std::atomic<quint64>* words, const void* block, size_t size)
+	{
+		const quint64 writing = sequence.load(std::memory_order_relaxed) | 1;
+		sequence.store(writing, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		const unsigned char* bytes = static_cast<const unsigned char*>(block);
+		for (size_t i = 0; i < size / 8; ++i)
+		{
+			quint64 word;
+			std::memcpy(&word, bytes + i * 8, 8);
+			words[i].store(word, std::memory_order_relaxed);
+		}
+		sequence.store(writing + 1, std::memory_order_release);
+	}
+
+	bool readBlock(const std::atomic<quint64>& sequence, const std::atomic<quint64>* words, void* block, size_t size,
+	               int maxAttempts, quint64& retries)
+	{
+		unsigned char* bytes = static_cast<unsigned char*>(block);
+		for (int attempt = 0; attempt < maxAttempts; ++attempt)
+		{
+			const quint64 before = sequence.load(std::memory_order_acquire);
+			if ((before & 1) == 0)
+			{
+				for (size_t i = 0; i < size / 8; ++i)
+				{
+					const quint64 word = words[i].load(std::memory_order_relaxed);
+					std::memcpy(bytes + i * 8, &word, 8);
+				}
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (sequence.load(std::memory_order_relaxed) == before)
+					return true;
+			}
+			++retries;
+			// The writer holds a block for well under a microsecond, unless it was
+			// preempted mid-write
+			if (attempt % 64 == 63)
+				QThread::yieldCurrentThread();
+		}
+		return false;
+	}
+}
+
+MoonAvoidanceSharedStatePublisher::MoonAvoidanceSharedStatePublisher(const QString& name)
+	: memory(nativeKey(name))
+	, ownerLock(QDir(QDir::tempPath()).filePath(name + ".lock"))
+	, layout(nullptr)
+	, frame(0)
+	, namesRevision(0)
+{
+}
+
+MoonAvoidanceSharedStatePublisher::~MoonAvoidanceSharedStatePublisher()
+{
+	close();
+}
+
+bool MoonAvoidanceSharedStatePublisher::create(QString* error)
+{
+	close();
+
+	// Only dead owners count as stale, however long a session runs
+	ownerLock.setStaleLockTime(0);
+	if (!ownerLock.tryLock(0))
+	{
+		if (error)
+		{
+			qint64 pid = 0;
+			QString hostName;
+			QString appName;
+			if (ownerLock.error() == QLockFile::LockFailedError && ownerLock.getLockInfo(&pid, &hostName, &appName))
+				*error = QString("already published by %1 (process %2)").arg(appName).arg(pid);
+			else
+				*error = QString("cannot lock %1").arg(QDir::toNativeSeparators(ownerLock.fileName()));
+		}
+		return false;
+	}
+
+	bool reused = false;
+	if (!memory.create(sizeof(Layout)))
+	{
+		// A segment left by a session that did not close it (POSIX shared memory
+		// outlives the process); no live owner holds the lock, so it is ours to
+		// reuse if it is big enough
+		if (memory.error() != QSharedMemory::AlreadyExists || !memory.attach() || memory.size() < static_cast<qsizetype>(sizeof(Layout)))
+		{
+			if (error)
+				*error = memory.errorString();
+			close();
+			return false;
+		}
+		reused = true;
+	}
+
+	Layout* existing = static_cast<Layout*>(memory.data());
+	if (reused && existing->magic == Magic && existing->version == Version && existing->layoutBytes == sizeof(Layout)
+	    && existing->maxFilters == static_cast<quint32>(MaxFilters))
+	{
+		// Readers may still be attached: keep the header and carry the sequences
+		// on from where the old writer left them
+		layout = existing;
+	}
+	else
+	{
+		// New, or not a segment readers accept: nothing reads it until the magic
+		// is there, so the header can be written plainly
+		layout = new (memory.data()) Layout;
+		layout->magic = 0;
+		layout->version = Version;
+		layout->layoutBytes = sizeof(Layout);
+		layout->maxFilters = MaxFilters;
+		layout->sequence.store(0, std::memory_order_relaxed);
+		layout->namesSequence.store(0, std::memory_order_relaxed);
+	}
+
+	Snapshot snapshot;
+	std::memset(&snapshot, 0, sizeof(snapshot));
+	Names names;
+	std::memset(&names, 0, sizeof(names));
+	writeBlock(layout->sequence, layout->snapshot, &snapshot, sizeof(snapshot));
+	writeBlock(layout->namesSequence, layout->names, &names, sizeof(names));
+	if (layout->magic != Magic)
+	{
+		std::atomic_thread_fence(std::memory_order_release);
+		layout->magic = Magic;
+	}
+
+	frame = 0;
+	namesRevision = 0;
+	publishedNames.clear();
+	return true;
+}
+
+void MoonAvoidanceSharedStatePublisher::close()
+{
+	if (memory.isAttached())
+		memory.detach();
+	layout = nullptr;
+	if (ownerLock.isLocked())
+		ownerLock.unlock();
+}
+
+void MoonAvoidanceSharedStatePublisher::publish(double jd, const MoonAvoidanceGeometry::Vector3& moonDir, double moonAltitude,
+                                                double moonDaysFromFull, const QVector<double>& radiiDegrees)
+{
+	if (layout == nullptr)
+		return;
+
+	Snapshot snapshot;
+	snapshot.frame = ++frame;
+	snapshot.publishedMs = QDateTime::currentMSecsSinceEpoch();
+	snapshot.jd = jd;
+	snapshot.moonDir[0] = moonDir.x;
+	snapshot.moonDir[1] = moonDir.y;
+	snapshot.moonDir[2] = moonDir.z;
+	snapshot.moonAltitude = moonAltitude;
+	snapshot.moonDaysFromFull = moonDaysFromFull;
+	snapshot.filterCount = static_cast<quint32>(qMin(radiiDegrees.size(), static_cast<qsizetype>(MaxFilters)));
+	snapshot.namesRevision = namesRevision;
+	for (int i = 0; i < MaxFilters; ++i)
+		snapshot.radiiDegrees[i] = i < static_cast<int>(snapshot.filterCount) ? radiiDegrees[i] : 0.0;
+	writeBlock(layout->sequence, layout->snapshot, &snapshot, sizeof(snapshot));
+}
+
+void MoonAvoidanceSharedStatePublisher::publishFilterNames(const QStringList& names)
+{
+	if (layout == nullptr || (names == publishedNames && namesRevision != 0))
+		return;
+
+	Names block;
+	std::memset(&block, 0, sizeof(block));
+	block.count = static_cast<quint32>(qMin(names.size(), static_cast<qsizetype>(MaxFilters)));
+	block.revision = ++namesRevision;
+	for (quint32 i = 0; i < block.count; ++i)
+	{
+		QByteArray utf8 = names[static_cast<int>(i)].toUtf8();
+		// Truncate on a character boundary, leaving room for the NUL
+		qsizetype length = qMin(utf8.size(), static_cast<qsizetype>(NameBytes - 1));
+		while (length > 0 && length < utf8.size() && (static_cast<unsigned char>(utf8[length]) & 0xc0) == 0x80)
+			--length;
+		std::memcpy(block.names[i], utf8.constData(), static_cast<size_t>(length));
+	}
+	writeBlock(layout->namesSequence, layout->names, &block, sizeof(block));
+	publishedNames = names;
+}
+
+MoonAvoidanceSharedStateReader::MoonAvoidanceSharedStateReader()
+	: layout(nullptr)
+	, retryCount(0)
+{
+}
+
+MoonAvoidanceSharedStateReader::~MoonAvoidanceSharedStateReader()
+{
+	detach();
+}
+
+bool MoonAvoidanceSharedStateReader::attach(const QString& name, QString* error)
+{
+	detach();
+	memory.setNativeKey(nativeKey(name));
+	if (!memory.attach(QSharedMemory::ReadOnly))
+	{
+		if (error)
+			*error = memory.errorString();
+		return false;
+	}
+	const Layout* candidate = static_cast<const Layout*>(memory.constData());
+	if (memory.size() < static_cast<qsizetype>(sizeof(Layout)) || candidate->magic != Magic || candidate->version != Version
+	    || candidate->layoutBytes != sizeof(Layout) || candidate->maxFilters != static_cast<quint32>(MaxFilters))
+	{
+		if (error)
+			*error = QString("%1 is not a version %2 moon avoidance state segment").arg(name).arg(Version);
+		memory.detach();
+		return false;
+	}
+	layout = candidate;
+	return true;
+}
+
+void MoonAvoidanceSharedStateReader::detach()
+{
+	if (memory.isAttached())
+		memory.detach();
+	layout = nullptr;
+}
+
+bool MoonAvoidanceSharedStateReader::read(Snapshot& out, int maxAttempts) const
+{
+	if (layout == nullptr)
+		return false;
+	return readBlock(layout->sequence, layout->snapshot, &out, sizeof(out), maxAttempts, retryCount);
+}
+
+bool MoonAvoidanceSharedStateReader::readFilterNames(QStringList& names, quint32* revision, int maxAttempts) const
+{
+	if (layout == nullptr)
+		return false;
+	Names block;
+	if (!readBlock(layout->namesSequence, layout->names, &block, sizeof(block), maxAttempts, retryCount))
+		return false;
+	names.clear();
+	for (quint32 i = 0; i < qMin(block.count, static_cast<quint32>(MaxFilters)); ++i)
+		names.append(QString::fromUtf8(block.names[i], static_cast<qsizetype>(qstrnlen(block.names[i], NameBytes))));
+	if (revision)
+		*revision = block.revision;
+	return true;
+}
@@ -0,0 +1,129 @@
+#ifndef MOONAVOIDANCESHAREDSTATE_HPP
+#define MOONAVOIDANCESHAREDSTATE_HPP
+
+#include "MoonAvoidanceGeometry.hpp"
+#include <QLockFile>
+#include <QSharedMemory>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <atomic>
+
+// The plugin's live avoidance state in a named shared-memory segment, for
+// local processes (guiding, sequencer, dome) that want it every frame.
+//
+// The segment is a Layout: a fixed header, then two seqlocked blocks, the
+// Snapshot (written every frame) and the filter Names (written when they
+// change). The writer makes a block's sequence odd, stores the block's words,
+// then makes it even again; a reader copies the words between two loads of
+// the sequence and retries if they differ or are odd. Readers never block the
+// writer and make no system calls once attached; a torn copy is never
+// returned.
+//
+// A seqlock allows one writer only. The publisher holds a lock file named
+// after the segment in the temporary directory for as long as it is open, so
+// a second live session configured with the same name is refused. A segment
+// left by a crashed session is reused with its sequences carried on, so a
+// reader still attached to it cannot mistake the new writes for old ones.
+//
+// On Unix the segment is POSIX shared memory named "/<name>", so readers
+// without Qt can shm_open() it and use the same layout (native byte order,
+// 64-bit lock-free atomics).
+namespace MoonAvoidanceSharedStateFormat
+{
+	const quint32 Magic = 0x5356414d; // "MAVS"
+	const quint32 Version = 1;
+	const int MaxFilters = 32;        // Radii and names beyond are not published
+	const int NameBytes = 32;         // UTF-8, NUL-padded, truncated
+
+	struct Snapshot
+	{
+		quint64 frame;            // Publications so far, 0 = none yet
+		qint64 publishedMs;       // Wall clock of the publication, ms since the Unix epoch
+		double jd;                // UT
+		double moonDir[3];        // J2000, normalized
+		double moonAltitude;      // Degrees
+		double moonDaysFromFull;  // Lorentzian AGE
+		quint32 filterCount;
+		quint32 namesRevision;    // Names::revision the radii are ordered by
+		double radiiDegrees[MaxFilters]; // 0 = avoidance off
+	};
+
+	struct Names
+	{
+		quint32 count;
+		quint32 revision;
+		char names[MaxFilters][NameBytes];
+	};
+
+	static_assert(sizeof(Snapshot) % 8 == 0 && sizeof(Names) % 8 == 0, "Blocks are copied as 64-bit words");
+	static_assert(std::atomic<quint64>::is_always_lock_free, "The seqlock words are shared between processes");
+
+	struct Layout
+	{
+		quint32 magic;
+		quint32 version;
+		quint32 layoutBytes;
+		quint32 maxFilters;
+		alignas(64) std::atomic<quint64> sequence; // Odd while the snapshot is written
+		std::atomic<quint64> snapshot[sizeof(Snapshot) / 8];
+		alignas(64) std::atomic<quint64> namesSequence;
+		std::atomic<quint64> names[sizeof(Names) / 8];
+	};
+}
+
+// Creates the segment and writes into it; one writer per segment, on one thread
+class MoonAvoidanceSharedStatePublisher
+{
+public:
+	explicit MoonAvoidanceSharedStatePublisher(const QString& name);
+	~MoonAvoidanceSharedStatePublisher();
+
+	// Creates the segment, or takes over one left behind by a crashed session.
+	// Fails while another live process publishes under the same name.
+	bool create(QString* error = nullptr);
+	void close();
+	bool isOpen() const { return layout != nullptr; }
+
+	// radiiDegrees beyond MaxFilters are dropped
+	void publish(double jd, const MoonAvoidanceGeometry::Vector3& moonDir, double moonAltitude, double moonDaysFromFull,
+	             const QVector<double>& radiiDegrees);
+	// Only writes when the names differ from the last ones published
+	void publishFilterNames(const QStringList& names);
+
+private:
+	QSharedMemory memory;
+	QLockFile ownerLock;
+	MoonAvoidanceSharedStateFormat::Layout* layout;
+	quint64 frame;
+	quint32 namesRevision;
+	QStringList publishedNames;
+};
+
+// Attaches to a published segment read-only; reads are lock-free and copy
+// only the block asked for
+class MoonAvoidanceSharedStateReader
+{
+public:
+	MoonAvoidanceSharedStateReader();
+	~MoonAvoidanceSharedStateReader();
+
+	bool attach(const QString& name, QString* error = nullptr);
+	void detach();
+	bool isAttached() const { return layout != nullptr; }
+
+	// A consistent copy of the latest snapshot; false if the writer was mid-write
+	// on every one of maxAttempts tries
+	bool read(MoonAvoidanceSharedStateFormat::Snapshot& out, int maxAttempts = 1000) const;
+	bool readFilterNames(QStringList& names, quint32* revision = nullptr, int maxAttempts = 1000) const;
+
+	// Retries so far that found the writer mid-write, or a changed sequence
+	quint64 retries() const { return retryCount; }
+
+private:
+	QSharedMemory memory;
+	const MoonAvoidanceSharedStateFormat::Layout* layout;
+	mutable quint64 retryCount;
+};
+
+#endif // MOONAVOIDANCESHAREDSTATE_HPP
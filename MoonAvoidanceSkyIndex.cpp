@@ -0,0 +1,155 @@
+#include "MoonAvoidanceSkyIndex.hpp"
+#include <QPair>
+#include <algorithm>
+#include <cmath>
+
+using MoonAvoidanceGeometry::Vector3;
+
+namespace
+{
+	double angleBetween(const Vector3& a, const Vector3& b)
+	{
+		return std::acos(qBound(-1.0, MoonAvoidanceGeometry::dot(a, b), 1.0));
+	}
+
+	double declination(const Vector3& dir)
+	{
+		return std::asin(qBound(-1.0, dir.z, 1.0));
+	}
+}
+
+MoonAvoidanceSkyIndex::MoonAvoidanceSkyIndex(const QVector<Vector3>& dirs, double cellDegrees)
+	: directions(dirs)
+{
+	const double cell = qBound(0.1, cellDegrees, 90.0) * M_PI / 180.0;
+	const int bandCount = static_cast<int>(std::ceil(M_PI / cell));
+	const double bandHeight = M_PI / bandCount;
+
+	// (band, cell in band) of every entry, as one sortable key
+	QVector<QPair<qint64, int>> keyed;
+	keyed.reserve(directions.size());
+	for (int i = 0; i < directions.size(); ++i)
+	{
+		const Vector3& dir = directions[i];
+		const int band = qBound(0, static_cast<int>((declination(dir) + M_PI / 2.0) / bandHeight), bandCount - 1);
+		const double middle = -M_PI / 2.0 + (band + 0.5) * bandHeight;
+		const int cellsInBand = qMax(1, static_cast<int>(std::lround(2.0 * M_PI * std::cos(middle) / cell)));
+		double ra = std::atan2(dir.y, dir.x);
+		if (ra < 0.0)
+			ra += 2.0 * M_PI;
+		const int column = qBound(0, static_cast<int>(ra / (2.0 * M_PI) * cellsInBand), cellsInBand - 1);
+		keyed.append({ static_cast<qint64>(band) << 32 | column, i });
+	}
+	std::sort(keyed.begin(), keyed.end());
+
+	order.reserve(keyed.size());
+	ordered.reserve(keyed.size());
+	for (const QPair<qint64, int>& entry : keyed)
+	{
+		order.append(entry.second);
+		ordered.append(directions[entry.second]);
+	}
+
+	for (int begin = 0; begin < keyed.size();)
+	{
+		int end = begin + 1;
+		while (end < keyed.size() && keyed[end].first == keyed[begin].first)
+			++end;
+
+		// Bounding cap around the mean direction
+		Vector3 sum { 0.0, 0.0, 0.0 };
+		for (int i = begin; i < end; ++i)
+			sum = sum + ordered[i];
+		Cell c;
+		c.center = MoonAvoidanceGeometry::norm(sum) > 0.0 ? MoonAvoidanceGeometry::normalized(sum) : ordered[begin];
+		c.radius = 0.0;
+		double minDec = M_PI;
+		double maxDec = -M_PI;
+		for (int i = begin; i < end; ++i)
+		{
+			c.radius = qMax(c.radius, angleBetween(c.center, ordered[i]));
+			minDec = qMin(minDec, declination(ordered[i]));
+			maxDec = qMax(maxDec, declination(ordered[i]));
+		}
+		c.radius += 1e-9; // acos rounding
+		c.begin = begin;
+		c.end = end;
+
+		const qint64 band = keyed[begin].first >> 32;
+		if (bands.isEmpty() || (keyed[cells.last().begin].first >> 32) != band)
+			bands.append({ minDec, maxDec, cells.size(), cells.size() + 1 });
+		else
+		{
+			Band& current = bands.last();
+			current.minDec = qMin(current.minDec, minDec);
+			current.maxDec = qMax(current.maxDec, maxDec);
+			current.end = cells.size() + 1;
+		}
+		cells.append(c);
+		begin = end;
+	}
+}
+
+void MoonAvoidanceSkyIndex::zoneHits(const Vector3& viewCenter, double viewRadius, const Vector3& moon,
+                                     const QVector<double>& radiiAscending, QVector<Hit>& out, Counters* counters) const
+{
+	Counters local;
+	Counters& count = counters ? *counters : local;
+	count = Counters();
+
+	// Zones that are off never hold anything; skip past them once
+	const double* radii = radiiAscending.constData();
+	const double* radiiEnd = radii + radiiAscending.size();
+	const double* firstOn = std::upper_bound(radii, radiiEnd, 0.0);
+	if (firstOn == radiiEnd)
+		return;
+	const double largest = radiiEnd[-1];
+	const auto zoneOf = [&](double separation) {
+		return static_cast<int>(std::lower_bound(firstOn, radiiEnd, separation) - radii);
+	};
+	const int outside = radiiAscending.size();
+
+	const double viewDec = declination(viewCenter);
+	const double cosView = std::cos(qMin(viewRadius, M_PI));
+	for (const Band& band : bands)
+	{
+		// Declinations differ by no more than the angle between two points
+		if (band.maxDec < viewDec - viewRadius || band.minDec > viewDec + viewRadius)
+			continue;
+
+		for (int c = band.begin; c < band.end; ++c)
+		{
+			const Cell& cell = cells[c];
+			const double toView = angleBetween(viewCenter, cell.center);
+			if (toView - cell.radius > viewRadius)
+				continue;
+			const double toMoon = angleBetween(moon, cell.center);
+			if (toMoon - cell.radius > largest)
+				continue;
+			++count.cellsVisited;
+
+			const bool inView = toView + cell.radius <= viewRadius;
+			const int nearZone = zoneOf(qMax(0.0, toMoon - cell.radius));
+			const int farZone = zoneOf(toMoon + cell.radius);
+			if (inView && nearZone == farZone)
+			{
+				// Whole cell in view and between the same two rings
+				for (int i = cell.begin; i < cell.end; ++i)
+					out.append({ order[i], nearZone });
+				count.entriesAccepted += cell.end - cell.begin;
+				continue;
+			}
+
+			for (int i = cell.begin; i < cell.end; ++i)
+			{
+				const Vector3& dir = ordered[i];
+				++count.entriesTested;
+				if (!inView && MoonAvoidanceGeometry::dot(viewCenter, dir) < cosView)
+					continue;
+				const int zone = nearZone == farZone ? nearZone : zoneOf(angleBetween(moon, dir));
+				if (zone < outside)
+					out.append({ order[i], zone });
+			}
+		}
+	}
+}
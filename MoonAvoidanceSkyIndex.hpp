@@ -0,0 +1,78 @@
+#ifndef MOONAVOIDANCESKYINDEX_HPP
+#define MOONAVOIDANCESKYINDEX_HPP
+
+#include "MoonAvoidanceGeometry.hpp"
+#include <QVector>
+
+// Fixed sky positions (deep-sky objects, a user's targets) bucketed into cells
+// of roughly equal area, for finding the ones in the view that lie inside the
+// avoidance zones without testing the whole catalog every frame.
+//
+// Cells are declination bands split in right ascension. Each keeps its
+// entries contiguous with a bounding cap (center, angular radius), so a cell
+// is placed against the view and the zones as a whole: the moon distance of
+// anything in it lies within center distance +/- radius. The zones are
+// concentric around the moon, so a cell whose distance range falls between
+// two neighbouring radii has every entry in the same zone and none is tested;
+// only cells straddling a ring or the edge of the view are tested per entry.
+//
+// Built once, then read-only and safe to query from any thread.
+class MoonAvoidanceSkyIndex
+{
+public:
+	static constexpr double DefaultCellDegrees = 3.0;
+
+	// Entry, and the innermost zone holding it as an index into the ascending radii
+	struct Hit
+	{
+		int entry;
+		int zone;
+	};
+
+	// Work done by the last query, for the tests and the performance counters
+	struct Counters
+	{
+		int cellsVisited = 0;   // Cells touching the view
+		int entriesTested = 0;  // Entries whose own distance was computed
+		int entriesAccepted = 0; // Entries taken with their cell
+	};
+
+	MoonAvoidanceSkyIndex() = default;
+	// dirs are J2000 unit vectors; entry i of a Hit is dirs[i]
+	explicit MoonAvoidanceSkyIndex(const QVector<MoonAvoidanceGeometry::Vector3>& dirs,
+	                               double cellDegrees = DefaultCellDegrees);
+
+	int size() const { return directions.size(); }
+	bool isEmpty() const { return directions.isEmpty(); }
+	const MoonAvoidanceGeometry::Vector3& direction(int entry) const { return directions[entry]; }
+
+	// Entries within viewRadius of viewCenter and within the largest of
+	// radiiAscending (radians, ascending, 0 = zone off) of moon, appended to out
+	void zoneHits(const MoonAvoidanceGeometry::Vector3& viewCenter, double viewRadius, const MoonAvoidanceGeometry::Vector3& moon,
+	              const QVector<double>& radiiAscending, QVector<Hit>& out, Counters* counters = nullptr) const;
+
+private:
+	struct Cell
+	{
+		MoonAvoidanceGeometry::Vector3 center;
+		double radius; // Radians, covers every entry of the cell
+		int begin;     // Into order
+		int end;
+	};
+
+	struct Band
+	{
+		double minDec; // Radians, of the entries in the band
+		double maxDec;
+		int begin;     // Into cells
+		int end;
+	};
+
+	QVector<MoonAvoidanceGeometry::Vector3> directions; // As given
+	QVector<int> order;                                  // Entries grouped by cell
+	QVector<MoonAvoidanceGeometry::Vector3> ordered;     // directions in that order
+	QVector<Cell> cells;                                 // Non-empty cells only
+	QVector<Band> bands;                                 // Non-empty bands only
+};
+
+#endif // MOONAVOIDANCESKYINDEX_HPP
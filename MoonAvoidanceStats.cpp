@@ -0,0 +1,114 @@
+#include "MoonAvoidanceStats.hpp"
+#include <QMutexLocker>
+#include <algorithm>
+#include <cmath>
+
+MoonAvoidanceStats::MoonAvoidanceStats()
+	: intervalFrames(0)
+	, intervalDrawNs(0)
+	, intervalMaxDrawNs(0)
+	, intervalVertices(0)
+	, intervalArcs(0)
+	, intervalLabels(0)
+	, intervalHits(0)
+	, intervalMisses(0)
+	, lastPublishMs(-1)
+	, history(HistorySize, 0.0)
+	, historyHead(0)
+	, historyCount(0)
+	, configLoadedMs(0)
+{
+}
+
+bool MoonAvoidanceStats::endFrame(qint64 nowMs, qint64 publishIntervalMs)
+{
+	++intervalFrames;
+	intervalDrawNs += current.drawNs;
+	intervalMaxDrawNs = qMax(intervalMaxDrawNs, current.drawNs);
+	intervalVertices += current.verticesProjected;
+	intervalArcs += current.arcsSubmitted;
+	intervalLabels += current.labelsPlaced;
+	intervalHits += current.cacheHits;
+	intervalMisses += current.cacheMisses;
+
+	history[historyHead] = current.drawNs / 1.0e6;
+	historyHead = (historyHead + 1) % HistorySize;
+	historyCount = qMin(historyCount + 1, static_cast<int>(HistorySize));
+
+	current = MoonAvoidanceFrameCounters();
+
+	if (lastPublishMs < 0)
+		lastPublishMs = nowMs;
+	if (nowMs - lastPublishMs < publishIntervalMs)
+		return false;
+
+	publish(nowMs);
+	return true;
+}
+
+void MoonAvoidanceStats::publish(qint64 nowMs)
+{
+	const double frames = qMax<quint64>(intervalFrames, 1);
+	const qint64 lookups = intervalHits + intervalMisses;
+
+	QVector<double> recent;
+	recent.reserve(historyCount);
+	const int start = (historyHead - historyCount + HistorySize) % HistorySize;
+	for (int i = 0; i < historyCount; ++i)
+	{
+		recent.append(history[(start + i) % HistorySize]);
+	}
+
+	{
+		QMutexLocker locker(&mutex);
+		published.frames += intervalFrames;
+		published.totalFrameTimeMs += intervalDrawNs / 1.0e6;
+		published.frameTimeMs = intervalDrawNs / frames / 1.0e6;
+		published.maxFrameTimeMs = intervalMaxDrawNs / 1.0e6;
+		published.verticesProjected = intervalVertices / frames;
+		published.arcsSubmitted = intervalArcs / frames;
+		published.labelsPlaced = intervalLabels / frames;
+		published.cacheHitRate = lookups > 0 ? static_cast<double>(intervalHits) / lookups : 0.0;
+		published.totalCacheHits += intervalHits;
+		published.totalCacheMisses += intervalMisses;
+		published.recentFrameTimesMs = recent;
+	}
+
+	intervalFrames = 0;
+	intervalDrawNs = 0;
+	intervalMaxDrawNs = 0;
+	intervalVertices = 0;
+	intervalArcs = 0;
+	intervalLabels = 0;
+	intervalHits = 0;
+	intervalMisses = 0;
+	lastPublishMs = nowMs;
+}
+
+void MoonAvoidanceStats::setPlanningState(const QVector<MoonAvoidanceStatsSnapshot::ZoneRadius>& radii, double moonAltitude, double moonDaysFromFull)
+{
+	QMutexLocker locker(&mutex);
+	published.zoneRadii = radii;
+	published.moonAltitude = moonAltitude;
+	published.moonDaysFromFull = moonDaysFromFull;
+}
+
+MoonAvoidanceStatsSnapshot MoonAvoidanceStats::snapshot() const
+{
+	QMutexLocker locker(&mutex);
+	MoonAvoidanceStatsSnapshot copy = published;
+	copy.configLoadedMsSinceEpoch = configLoadedMs.load(std::memory_order_relaxed);
+	return copy;
+}
+
+double MoonAvoidanceStatsSnapshot::frameTimePercentileMs(double fraction) const
+{
+	if (recentFrameTimesMs.isEmpty())
+		return 0.0;
+	
+	// Nearest-rank percentile on a sorted copy; at most HistorySize entries
+	QVector<double> sorted = recentFrameTimesMs;
+	std::sort(sorted.begin(), sorted.end());
+	const int rank = static_cast<int>(std::ceil(qBound(0.0, fraction, 1.0) * sorted.size())) - 1;
+	return sorted[qBound(0, rank, static_cast<int>(sorted.size()) - 1)];
+}
@@ -0,0 +1,102 @@
+#ifndef MOONAVOIDANCESTATS_HPP
+#define MOONAVOIDANCESTATS_HPP
+
+#include <QMutex>
+#include <QVector>
+#include <QString>
+#include <QtGlobal>
+#include <atomic>
+
+// Counters gathered while the plugin draws a frame
+struct MoonAvoidanceFrameCounters
+{
+	qint64 drawNs = 0;
+	int verticesProjected = 0;
+	int arcsSubmitted = 0;
+	int cacheHits = 0;
+	int cacheMisses = 0;
+	int labelsPlaced = 0;
+};
+
+// Consistent copy of the published counters, safe to hand to other threads
+struct MoonAvoidanceStatsSnapshot
+{
+	quint64 frames = 0;
+	double totalFrameTimeMs = 0.0;   // draw() time summed over all frames
+	double frameTimeMs = 0.0;        // Mean draw() time over the last publish interval
+	double maxFrameTimeMs = 0.0;     // Worst draw() time over the last publish interval
+	double verticesProjected = 0.0;  // Per frame, averaged over the interval
+	double arcsSubmitted = 0.0;      // Per frame, averaged over the interval
+	double labelsPlaced = 0.0;       // Per frame, averaged over the interval
+	double cacheHitRate = 0.0;       // 0..1 over the interval
+	quint64 totalCacheHits = 0;
+	quint64 totalCacheMisses = 0;
+	QVector<double> recentFrameTimesMs; // Most recent draw() times, oldest first
+	
+	// Planning state at the time of the last publish
+	struct ZoneRadius
+	{
+		QString filter;
+		double radiusDegrees;
+	};
+	QVector<ZoneRadius> zoneRadii;
+	double moonAltitude = 0.0;
+	double moonDaysFromFull = 0.0;
+	qint64 configLoadedMsSinceEpoch = 0;
+	
+	// Frame-time percentile (0..1) over recentFrameTimesMs
+	double frameTimePercentileMs(double fraction) const;
+};
+
+// Accumulates per-frame counters on the render thread and publishes an
+// averaged snapshot at a fixed interval. Only publish() and snapshot() take
+// the lock, so the per-frame cost is a handful of integer additions.
+class MoonAvoidanceStats
+{
+public:
+	static constexpr int HistorySize = 512;
+
+	MoonAvoidanceStats();
+
+	// Render thread: counters of the frame being drawn
+	MoonAvoidanceFrameCounters& frame() { return current; }
+
+	// Render thread: close the current frame. Returns true when a new snapshot
+	// was published (at most once per publishIntervalMs).
+	bool endFrame(qint64 nowMs, qint64 publishIntervalMs = 500);
+
+	// Render thread: planning state attached to the next snapshots
+	void setPlanningState(const QVector<MoonAvoidanceStatsSnapshot::ZoneRadius>& radii, double moonAltitude, double moonDaysFromFull);
+	
+	// Any thread
+	MoonAvoidanceStatsSnapshot snapshot() const;
+	void setConfigLoaded(qint64 msSinceEpoch) { configLoadedMs.store(msSinceEpoch, std::memory_order_relaxed); }
+
+private:
+	void publish(qint64 nowMs);
+
+	MoonAvoidanceFrameCounters current;
+
+	// Interval accumulators (render thread only)
+	quint64 intervalFrames;
+	qint64 intervalDrawNs;
+	qint64 intervalMaxDrawNs;
+	qint64 intervalVertices;
+	qint64 intervalArcs;
+	qint64 intervalLabels;
+	qint64 intervalHits;
+	qint64 intervalMisses;
+	qint64 lastPublishMs;
+
+	// Frame-time history ring (render thread writes, copied under lock)
+	QVector<double> history;
+	int historyHead;
+	int historyCount;
+
+	std::atomic<qint64> configLoadedMs;
+	
+	mutable QMutex mutex;
+	MoonAvoidanceStatsSnapshot published;
+};
+
+#endif // MOONAVOIDANCESTATS_HPP
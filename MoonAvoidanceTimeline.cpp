@@ -0,0 +1,271 @@
+#include "MoonAvoidanceTimeline.hpp"
+#include "MoonAvoidanceKernel.hpp"
+#include "MoonAvoidancePlanner.hpp"
+#include "MoonAvoidanceTrace.hpp"
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+
+bool MoonAvoidanceTimelineData::sample(double jd, MoonAvoidanceTimelineSample& out) const
+{
+	if (!covers(jd))
+		return false;
+
+	const double position = (jd - key.windowStartJD) / stepDays;
+	const int i0 = qMin(static_cast<int>(position), sampleCount - 2);
+	const int i1 = i0 + 1;
+	const double f = position - i0;
+	const double g = 1.0 - f;
+
+	out.moonDir = MoonAvoidanceGeometry::normalized(moonDir[i0] * g + moonDir[i1] * f);
+	out.moonAltitude = moonAltitude[i0] * g + moonAltitude[i1] * f;
+	out.moonDaysFromFull = moonDaysFromFull[i0] * g + moonDaysFromFull[i1] * f;
+
+	out.radiiDegrees.resize(filterCount);
+	const double* r0 = radiiDegrees.constData() + i0 * filterCount;
+	const double* r1 = r0 + filterCount;
+	for (int k = 0; k < filterCount; ++k)
+	{
+		// Keep "off" exact instead of fading a zone in over one minute
+		if (r0[k] <= 0.0 || r1[k] <= 0.0)
+			out.radiiDegrees[k] = f < 0.5 ? r0[k] : r1[k];
+		else
+			out.radiiDegrees[k] = r0[k] * g + r1[k] * f;
+	}
+	return true;
+}
+
+QVector<MoonAvoidanceZoneCrossing> MoonAvoidanceTimelineData::crossings(const MoonAvoidanceGeometry::Vector3& target, double fromJD,
+                                                                       double toJD, double toleranceDays) const
+{
+	QVector<MoonAvoidanceZoneCrossing> found;
+	fromJD = qMax(fromJD, key.windowStartJD);
+	toJD = qMin(toJD, endJD());
+	if (sampleCount < 2 || filterCount == 0 || !(toJD > fromJD))
+		return found;
+
+	// Outside the zone is positive; a zone that is off is never entered
+	const double OffMargin = 360.0;
+	const auto margin = [](double separation, double radius) { return radius > 0.0 ? separation - radius : OffMargin; };
+	const auto separationAt = [&target](const MoonAvoidanceGeometry::Vector3& moon) {
+		return std::acos(qBound(-1.0, MoonAvoidanceGeometry::dot(moon, target), 1.0)) * 180.0 / M_PI;
+	};
+
+	// Brackets: the interpolated start, then every sample up to toJD and toJD itself
+	QVector<double> times { fromJD };
+	const int first = static_cast<int>(std::floor((fromJD - key.windowStartJD) / stepDays)) + 1;
+	for (int i = first; i < sampleCount && key.windowStartJD + i * stepDays < toJD; ++i)
+		times.append(key.windowStartJD + i * stepDays);
+	times.append(toJD);
+
+	MoonAvoidanceTimelineSample state;
+	QVector<double> previous(filterCount);
+	QVector<double> current(filterCount);
+	sample(times[0], state);
+	double separation = separationAt(state.moonDir);
+	for (int k = 0; k < filterCount; ++k)
+		previous[k] = margin(separation, state.radiiDegrees[k]);
+
+	for (int t = 1; t < times.size(); ++t)
+	{
+		sample(times[t], state);
+		separation = separationAt(state.moonDir);
+		for (int k = 0; k < filterCount; ++k)
+		{
+			current[k] = margin(separation, state.radiiDegrees[k]);
+			if ((previous[k] > 0.0) == (current[k] > 0.0))
+				continue;
+
+			// Illinois false position: the margin is smooth within a bracket except
+			// where the zone switches off, where it still converges to the jump
+			double a = times[t - 1];
+			double b = times[t];
+			double fa = previous[k];
+			double fb = current[k];
+			int side = 0;
+			MoonAvoidanceTimelineSample probe;
+			for (int iteration = 0; iteration < 64 && b - a > toleranceDays; ++iteration)
+			{
+				double c = (a * fb - b * fa) / (fb - fa);
+				if (!(c > a && c < b))
+					c = 0.5 * (a + b);
+				sample(c, probe);
+				const double fc = margin(separationAt(probe.moonDir), probe.radiiDegrees[k]);
+				if ((fc > 0.0) == (fb > 0.0))
+				{
+					b = c;
+					fb = fc;
+					if (side == 1)
+						fa *= 0.5;
+					side = 1;
+				}
+				else
+				{
+					a = c;
+					fa = fc;
+					if (side == -1)
+						fb *= 0.5;
+					side = -1;
+				}
+			}
+			MoonAvoidanceZoneCrossing crossing;
+			crossing.jd = 0.5 * (a + b);
+			crossing.filter = k;
+			crossing.entering = previous[k] > 0.0;
+			found.append(crossing);
+		}
+		std::swap(previous, current);
+	}
+
+	std::stable_sort(found.begin(), found.end(), [](const MoonAvoidanceZoneCrossing& x, const MoonAvoidanceZoneCrossing& y) {
+		return x.jd < y.jd;
+	});
+	return found;
+}
+
+MoonAvoidanceTimeline::MoonAvoidanceTimeline(QObject* parent)
+	: QThread(parent)
+	, pendingDeltaT(0.0)
+	, hasPending(false)
+	, stopping(false)
+	, hasRequested(false)
+{
+	setObjectName("MoonAvoidanceTimeline");
+}
+
+MoonAvoidanceTimeline::~MoonAvoidanceTimeline()
+{
+	stop();
+}
+
+double MoonAvoidanceTimeline::windowStartFor(double jd, double longitude)
+{
+	return MoonAvoidancePlanner::windowStartFor(jd, longitude);
+}
+
+void MoonAvoidanceTimeline::request(const MoonAvoidanceTimelineKey& key, const QList<FilterConfig>& filters, double deltaTDays)
+{
+	QMutexLocker locker(&mutex);
+	if (hasRequested && key == requestedKey)
+		return; // Built or being built
+	requestedKey = key;
+	hasRequested = true;
+	pendingKey = key;
+	pendingFilters = filters;
+	pendingDeltaT = deltaTDays;
+	hasPending = true;
+	requestReady.wakeOne();
+}
+
+QSharedPointer<const MoonAvoidanceTimelineData> MoonAvoidanceTimeline::current() const
+{
+	QMutexLocker locker(&mutex);
+	return published;
+}
+
+void MoonAvoidanceTimeline::stop()
+{
+	{
+		QMutexLocker locker(&mutex);
+		stopping = true;
+		requestReady.wakeAll();
+	}
+	wait();
+}
+
+void MoonAvoidanceTimeline::run()
+{
+	for (;;)
+	{
+		MoonAvoidanceTimelineKey key;
+		QList<FilterConfig> filters;
+		double deltaT;
+		{
+			QMutexLocker locker(&mutex);
+			while (!hasPending && !stopping)
+				requestReady.wait(&mutex);
+			if (stopping)
+				return;
+			key = pendingKey;
+			filters = pendingFilters;
+			deltaT = pendingDeltaT;
+			hasPending = false;
+		}
+
+		QElapsedTimer timer;
+		timer.start();
+		QSharedPointer<MoonAvoidanceTimelineData> data = build(key, filters, deltaT);
+		if (!data)
+			continue; // Superseded; pick up the newer request
+
+		QMutexLocker locker(&mutex);
+		published = data;
+		qDebug() << "MoonAvoidanceTimeline: Built night from JD" << key.windowStartJD
+		         << "in" << timer.nsecsElapsed() / 1000 << "us";
+	}
+}
+
+bool MoonAvoidanceTimeline::superseded()
+{
+	QMutexLocker locker(&mutex);
+	return hasPending || stopping;
+}
+
+QSharedPointer<MoonAvoidanceTimelineData> MoonAvoidanceTimeline::build(const MoonAvoidanceTimelineKey& key, const QList<FilterConfig>& filters, double deltaTDays)
+{
+	MA_TRACE_ZONE("timeline");
+
+	QSharedPointer<MoonAvoidanceTimelineData> data(new MoonAvoidanceTimelineData());
+	data->key = key;
+	data->stepDays = StepDays;
+	data->sampleCount = SamplesPerNight;
+	data->filterCount = filters.size();
+	data->moonDir.resize(SamplesPerNight);
+	data->moonAltitude.resize(SamplesPerNight);
+	data->moonDaysFromFull.resize(SamplesPerNight);
+	data->sunAltitude.resize(SamplesPerNight);
+	data->radiiDegrees.resize(SamplesPerNight * filters.size());
+
+	const MoonAvoidanceEphemeris::Site site { key.latitude, key.longitude };
+	for (int i = 0; i < SamplesPerNight; ++i)
+	{
+		// Check for a newer request once per simulated hour
+		if (i % 60 == 0 && superseded())
+			return QSharedPointer<MoonAvoidanceTimelineData>();
+
+		const double jd = key.windowStartJD + i * StepDays;
+		const MoonAvoidanceEphemeris::MoonPosition moon = MoonAvoidanceEphemeris::moonPosition(jd, deltaTDays, site);
+		const double daysFromFull = MoonAvoidanceKernel::moonAge(jd).daysFromFull;
+
+		data->moonDir[i] = moon.j2000Dir;
+		data->moonAltitude[i] = moon.altitude;
+		data->moonDaysFromFull[i] = daysFromFull;
+		data->sunAltitude[i] = MoonAvoidanceEphemeris::sunAltitude(jd, deltaTDays, site);
+		double* radii = data->radiiDegrees.data() + i * data->filterCount;
+		for (int k = 0; k < data->filterCount; ++k)
+		{
+			radii[k] = MoonAvoidanceKernel::zoneRadiusDegrees(filters[k], moon.altitude, daysFromFull);
+		}
+	}
+	data->dawnJD = findDawn(*data);
+	return data;
+}
+
+double MoonAvoidanceTimeline::findDawn(const MoonAvoidanceTimelineData& data)
+{
+	// First upward crossing of astronomical twilight, else of sunrise
+	const double thresholds[] = { -18.0, -0.833 };
+	for (double threshold : thresholds)
+	{
+		for (int i = 1; i < data.sampleCount; ++i)
+		{
+			if (data.sunAltitude[i - 1] < threshold && data.sunAltitude[i] >= threshold)
+				return data.key.windowStartJD + i * data.stepDays;
+		}
+	}
+
+	// No sunrise in the window: polar night runs to the end, midnight sun has no night
+	return data.sunAltitude[0] < 0.0 ? data.endJD() : data.key.windowStartJD;
+}
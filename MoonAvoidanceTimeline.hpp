@@ -0,0 +1,129 @@
+#ifndef MOONAVOIDANCETIMELINE_HPP
+#define MOONAVOIDANCETIMELINE_HPP
+
+#include "MoonAvoidanceConfig.hpp"
+#include "MoonAvoidanceEphemeris.hpp"
+#include "MoonAvoidanceGeometry.hpp"
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+// What a timeline was built for. Any change means a rebuild.
+struct MoonAvoidanceTimelineKey
+{
+	double latitude = 0.0;       // Degrees
+	double longitude = 0.0;      // Degrees, east positive
+	double windowStartJD = 0.0;  // Local mean noon that starts the night
+	quint64 filtersRevision = 0; // MoonAvoidanceConfig::getRevision()
+
+	bool operator==(const MoonAvoidanceTimelineKey& other) const
+	{
+		return latitude == other.latitude && longitude == other.longitude
+		    && windowStartJD == other.windowStartJD && filtersRevision == other.filtersRevision;
+	}
+	bool operator!=(const MoonAvoidanceTimelineKey& other) const { return !(*this == other); }
+};
+
+// Interpolated planning state at one instant
+struct MoonAvoidanceTimelineSample
+{
+	MoonAvoidanceGeometry::Vector3 moonDir { 0.0, 0.0, 1.0 }; // J2000, normalized
+	double moonAltitude = 0.0;      // Degrees
+	double moonDaysFromFull = 0.0;  // Lorentzian AGE
+	QVector<double> radiiDegrees;   // One per filter, 0 = avoidance off
+};
+
+// A target entering or leaving one filter's zone
+struct MoonAvoidanceZoneCrossing
+{
+	double jd = 0.0;
+	int filter = 0;
+	bool entering = false; // Else leaving, including the zone switching off
+};
+
+// Moon direction, altitude, age and per-filter radii for one night, sampled
+// every minute from local noon to the next local noon. Built off the render
+// thread from the analytic ephemeris, then read-only.
+struct MoonAvoidanceTimelineData
+{
+	MoonAvoidanceTimelineKey key;
+	double stepDays = 0.0;
+	int sampleCount = 0;
+	int filterCount = 0;
+	double dawnJD = 0.0; // Morning astronomical twilight (sunrise if the sky never gets dark)
+
+	// Structure of arrays, indexed by sample (radii: sample * filterCount + filter)
+	QVector<MoonAvoidanceGeometry::Vector3> moonDir;
+	QVector<double> moonAltitude;
+	QVector<double> moonDaysFromFull;
+	QVector<double> sunAltitude;
+	QVector<double> radiiDegrees;
+
+	double endJD() const { return key.windowStartJD + (sampleCount - 1) * stepDays; }
+	bool covers(double jd) const { return sampleCount > 1 && jd >= key.windowStartJD && jd <= endJD(); }
+	int nearestIndex(double jd) const { return qBound(0, qRound((jd - key.windowStartJD) / stepDays), sampleCount - 1); }
+	QVector<double> radiiAt(int index) const { return radiiDegrees.mid(index * filterCount, filterCount); }
+
+	// Linear interpolation between the two neighbouring samples; false outside the window
+	bool sample(double jd, MoonAvoidanceTimelineSample& out) const;
+
+	// Times in (fromJD, toJD] at which a fixed J2000 direction crosses a zone
+	// edge, in time order. Sign changes of separation minus radius are bracketed
+	// at the one-minute samples and refined on the interpolated timeline to
+	// toleranceDays.
+	QVector<MoonAvoidanceZoneCrossing> crossings(const MoonAvoidanceGeometry::Vector3& target, double fromJD, double toJD,
+	                                             double toleranceDays = 1.0 / 86400.0) const;
+};
+
+// Precomputes the night timeline on a background thread.
+//
+// The render thread calls request() every frame with the current key; only a
+// key change starts a rebuild, and while one is running newer requests replace
+// the pending one. current() hands out the last finished timeline, which stays
+// valid for as long as the caller holds the pointer.
+class MoonAvoidanceTimeline : public QThread
+{
+	Q_OBJECT
+
+public:
+	static constexpr double StepDays = 1.0 / 1440.0; // One minute
+	static constexpr int SamplesPerNight = 1441;      // Noon to noon, both ends included
+
+	MoonAvoidanceTimeline(QObject* parent = nullptr);
+	~MoonAvoidanceTimeline() override;
+
+	// Local mean noon at or before jd (to the minute) for an east longitude in degrees
+	static double windowStartFor(double jd, double longitude);
+
+	// Render thread
+	void request(const MoonAvoidanceTimelineKey& key, const QList<FilterConfig>& filters, double deltaTDays);
+	QSharedPointer<const MoonAvoidanceTimelineData> current() const;
+
+	// Any thread; blocks until the worker has exited
+	void stop();
+
+protected:
+	void run() override;
+
+private:
+	// Returns nullptr if a newer request or stop() arrived while building
+	QSharedPointer<MoonAvoidanceTimelineData> build(const MoonAvoidanceTimelineKey& key, const QList<FilterConfig>& filters, double deltaTDays);
+	bool superseded();
+	static double findDawn(const MoonAvoidanceTimelineData& data);
+
+	mutable QMutex mutex;
+	QWaitCondition requestReady;
+	MoonAvoidanceTimelineKey pendingKey;
+	QList<FilterConfig> pendingFilters;
+	double pendingDeltaT;
+	bool hasPending;
+	bool stopping;
+	MoonAvoidanceTimelineKey requestedKey; // Last key accepted by request()
+	bool hasRequested;
+	QSharedPointer<const MoonAvoidanceTimelineData> published;
+};
+
+#endif // MOONAVOIDANCETIMELINE_HPP
@@ -0,0 +1,121 @@
+#include "MoonAvoidanceTrace.hpp"
+
+#ifdef MOONAVOIDANCE_TRACING
+
+#include <QFile>
+#include <QTextStream>
+#include <QCoreApplication>
+#include <QDebug>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+namespace
+{
+	std::uint32_t currentThreadId()
+	{
+		// Hash once per thread; Chrome only needs a stable small integer
+		thread_local const std::uint32_t id = static_cast<std::uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id()) & 0x7fffffff);
+		return id;
+	}
+}
+
+MoonAvoidanceTrace::MoonAvoidanceTrace()
+	: ring(new Slot[Capacity])
+	, head(0)
+{
+	for (std::uint64_t i = 0; i < Capacity; ++i)
+	{
+		ring[i].sequence.store(0, std::memory_order_relaxed);
+	}
+}
+
+MoonAvoidanceTrace& MoonAvoidanceTrace::instance()
+{
+	// Intentionally leaked so zones running during shutdown never touch a destroyed buffer
+	static MoonAvoidanceTrace* trace = new MoonAvoidanceTrace();
+	return *trace;
+}
+
+std::int64_t MoonAvoidanceTrace::nowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void MoonAvoidanceTrace::record(const char* name, std::int64_t startNs, std::int64_t durationNs)
+{
+	// Claim a slot; writers never wait for each other or for the reader
+	const std::uint64_t index = head.fetch_add(1, std::memory_order_relaxed);
+	Slot& slot = ring[index & (Capacity - 1)];
+
+	// Odd sequence marks the slot as being written
+	slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.name.store(name, std::memory_order_relaxed);
+	slot.startNs.store(startNs, std::memory_order_relaxed);
+	slot.durationNs.store(durationNs, std::memory_order_relaxed);
+	slot.threadId.store(currentThreadId(), std::memory_order_relaxed);
+	slot.sequence.store(2 * index + 2, std::memory_order_release);
+}
+
+void MoonAvoidanceTrace::clear()
+{
+	for (std::uint64_t i = 0; i < Capacity; ++i)
+	{
+		ring[i].sequence.store(0, std::memory_order_release);
+	}
+}
+
+bool MoonAvoidanceTrace::dumpChromeTrace(const QString& path) const
+{
+	QFile file(path);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+	{
+		qWarning() << "MoonAvoidanceTrace: Cannot open" << path << "for writing";
+		return false;
+	}
+
+	const std::uint64_t end = head.load(std::memory_order_acquire);
+	const std::uint64_t begin = end > Capacity ? end - Capacity : 0;
+	const qint64 pid = QCoreApplication::applicationPid();
+
+	QTextStream out(&file);
+	out << "{\"traceEvents\":[\n";
+	bool first = true;
+	int written = 0;
+	for (std::uint64_t index = begin; index < end; ++index)
+	{
+		const Slot& slot = ring[index & (Capacity - 1)];
+
+		// Read the slot seqlock-style and skip it if a writer touched it meanwhile
+		const std::uint64_t expected = 2 * index + 2;
+		if (slot.sequence.load(std::memory_order_acquire) != expected)
+			continue;
+		const char* name = slot.name.load(std::memory_order_relaxed);
+		const std::int64_t startNs = slot.startNs.load(std::memory_order_relaxed);
+		const std::int64_t durationNs = slot.durationNs.load(std::memory_order_relaxed);
+		const std::uint32_t threadId = slot.threadId.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.sequence.load(std::memory_order_relaxed) != expected || !name)
+			continue;
+
+		if (!first)
+			out << ",\n";
+		first = false;
+
+		// Chrome expects microseconds; keep sub-microsecond precision as decimals
+		out << "{\"name\":\"" << name << "\",\"cat\":\"MoonAvoidance\",\"ph\":\"X\""
+		    << ",\"ts\":" << QString::number(startNs / 1000.0, 'f', 3)
+		    << ",\"dur\":" << QString::number(durationNs / 1000.0, 'f', 3)
+		    << ",\"pid\":" << pid << ",\"tid\":" << threadId << "}";
+		++written;
+	}
+	out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+	out.flush();
+
+	qDebug() << "MoonAvoidanceTrace: Wrote" << written << "events to" << path;
+	return file.error() == QFile::NoError;
+}
+
+#endif // MOONAVOIDANCE_TRACING
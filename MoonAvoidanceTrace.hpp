@@ -0,0 +1,92 @@
+#ifndef MOONAVOIDANCETRACE_HPP
+#define MOONAVOIDANCETRACE_HPP
+
+#include <QString>
+
+// Hot-path tracing for the render loop.
+//
+// Zones are opened with MA_TRACE_ZONE("name") and close at the end of the
+// enclosing scope. When the plugin is built without MOONAVOIDANCE_TRACING
+// (the default) the macro expands to nothing, so draw() and friends carry no
+// timing, logging or formatting code at all.
+//
+// With tracing compiled in, each zone writes one fixed-size event into a
+// lock-free ring buffer. The buffer keeps the most recent events and can be
+// written out as Chrome trace_event JSON (chrome://tracing, Perfetto) with
+// MoonAvoidanceTrace::dumpChromeTrace() or the MoonAvoidance.dumpTrace()
+// script slot.
+
+#ifdef MOONAVOIDANCE_TRACING
+
+#include <atomic>
+#include <cstdint>
+
+class MoonAvoidanceTrace
+{
+public:
+	static MoonAvoidanceTrace& instance();
+
+	// Current time on the trace clock, in nanoseconds
+	static std::int64_t nowNs();
+
+	// Record a completed zone. name must point to a string literal.
+	void record(const char* name, std::int64_t startNs, std::int64_t durationNs);
+
+	// Write the buffered events as Chrome trace_event JSON
+	bool dumpChromeTrace(const QString& path) const;
+
+	// Drop all buffered events
+	void clear();
+
+private:
+	MoonAvoidanceTrace();
+
+	static constexpr std::uint64_t Capacity = 1u << 16; // Must be a power of two
+
+	// Each slot is published with a sequence number so the reader can skip
+	// slots that are being overwritten while it dumps
+	struct Slot
+	{
+		std::atomic<std::uint64_t> sequence;
+		std::atomic<const char*> name;
+		std::atomic<std::int64_t> startNs;
+		std::atomic<std::int64_t> durationNs;
+		std::atomic<std::uint32_t> threadId;
+	};
+
+	Slot* ring;
+	std::atomic<std::uint64_t> head;
+};
+
+class MoonAvoidanceTraceZone
+{
+public:
+	explicit MoonAvoidanceTraceZone(const char* zoneName)
+		: name(zoneName)
+		, startNs(MoonAvoidanceTrace::nowNs())
+	{}
+
+	~MoonAvoidanceTraceZone()
+	{
+		MoonAvoidanceTrace::instance().record(name, startNs, MoonAvoidanceTrace::nowNs() - startNs);
+	}
+
+	MoonAvoidanceTraceZone(const MoonAvoidanceTraceZone&) = delete;
+	MoonAvoidanceTraceZone& operator=(const MoonAvoidanceTraceZone&) = delete;
+
+private:
+	const char* name;
+	std::int64_t startNs;
+};
+
+#define MA_TRACE_CONCAT_INNER(a, b) a##b
+#define MA_TRACE_CONCAT(a, b) MA_TRACE_CONCAT_INNER(a, b)
+#define MA_TRACE_ZONE(name) MoonAvoidanceTraceZone MA_TRACE_CONCAT(maTraceZone, __LINE__)(name)
+
+#else
+
+#define MA_TRACE_ZONE(name) do {} while (false)
+
+#endif // MOONAVOIDANCE_TRACING
+
+#endif // MOONAVOIDANCETRACE_HPP
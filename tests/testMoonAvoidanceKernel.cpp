@@ -0,0 +1,619 @@
+#include <QtTest/QtTest>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QBuffer>
+#include <QDate>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#include <cmath>
+#include <numeric>
+#include "../MoonAvoidanceKernel.hpp"
+#include "../MoonAvoidanceBatch.hpp"
+#include "../MoonAvoidanceEphemeris.hpp"
+#include "../MoonAvoidanceEphemerisCache.hpp"
+#include "../MoonAvoidanceGeometry.hpp"
+#include "../MoonAvoidanceHorizon.hpp"
+#include "../MoonAvoidancePlanner.hpp"
+#include "../MoonAvoidanceSkyIndex.hpp"
+#include "../MoonAvoidanceTimeline.hpp"
+
+class TestMoonAvoidanceKernel : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void testMoonAge();
+	void testRelaxationOnlyInsideAltitudeRange();
+	void testRadiusAtFullAndNewMoon();
+	void testAvoidanceOff();
+	void testRadiusCurve();
+	void testEphemeris();
+	void testArrows();
+	void testSmallCircleGenerator();
+	void testHorizonClipping();
+	void testPlanner();
+	void testCalendarYear();
+	void testBatchStreaming();
+	void testCatalog();
+	void testEphemerisCache();
+	void testZoneCrossings();
+	void testSkyIndex();
+};
+
+void TestMoonAvoidanceKernel::testMoonAge()
+{
+	using namespace MoonAvoidanceKernel;
+
+	// At the reference new moon
+	MoonAge age = moonAge(ReferenceNewMoonJD);
+	QVERIFY(std::fabs(age.daysSinceNew) < 1e-9);
+	QVERIFY(std::fabs(age.daysFromFull - HalfSynodicPeriodDays) < 1e-9);
+
+	// Half a period later is full moon, also many cycles away from the reference
+	age = moonAge(ReferenceNewMoonJD + 300 * SynodicPeriodDays + HalfSynodicPeriodDays);
+	QVERIFY(std::fabs(age.daysFromFull) < 1e-6);
+
+	// Before the reference the age still lands in [0, period)
+	age = moonAge(ReferenceNewMoonJD - 1.0);
+	QVERIFY(age.daysSinceNew >= 0.0 && age.daysSinceNew < SynodicPeriodDays);
+	QVERIFY(std::fabs(age.daysSinceNew - (SynodicPeriodDays - 1.0)) < 1e-6);
+}
+
+void TestMoonAvoidanceKernel::testRelaxationOnlyInsideAltitudeRange()
+{
+	FilterConfig filter("Test", 100.0, 10.0, 2.0, -15.0, 5.0, Qt::white);
+
+	// Inside [MinAlt, MaxAlt]: 100 + 2 * (0 - 5) = 90, width scaled by (0 + 15) / 20
+	QCOMPARE(MoonAvoidanceKernel::relaxedSeparation(filter, 0.0), 90.0);
+	QCOMPARE(MoonAvoidanceKernel::relaxedWidth(filter, 0.0), 7.5);
+
+	// Outside: traditional avoidance
+	QCOMPARE(MoonAvoidanceKernel::relaxedSeparation(filter, 30.0), 100.0);
+	QCOMPARE(MoonAvoidanceKernel::relaxedWidth(filter, 30.0), 10.0);
+	QCOMPARE(MoonAvoidanceKernel::relaxedSeparation(filter, -40.0), 100.0);
+}
+
+void TestMoonAvoidanceKernel::testRadiusAtFullAndNewMoon()
+{
+	FilterConfig filter("Test", 100.0, 10.0, 2.0, -15.0, 5.0, Qt::white);
+
+	// Full moon (AGE = 0): full separation
+	QCOMPARE(MoonAvoidanceKernel::zoneRadiusDegrees(filter, 30.0, 0.0), 100.0);
+
+	// AGE = WIDTH: half the separation
+	QCOMPARE(MoonAvoidanceKernel::zoneRadiusDegrees(filter, 30.0, 10.0), 50.0);
+
+	// Never below 1 degree while avoidance is on
+	FilterConfig narrow("Narrow", 2.0, 0.5, 0.0, -15.0, 5.0, Qt::red);
+	QCOMPARE(MoonAvoidanceKernel::zoneRadiusDegrees(narrow, 30.0, 14.0), 1.0);
+}
+
+void TestMoonAvoidanceKernel::testAvoidanceOff()
+{
+	// Relaxation pushes the separation below zero near MinAlt: avoidance is off
+	FilterConfig filter("Test", 10.0, 10.0, 1.0, -15.0, 5.0, Qt::white);
+	QCOMPARE(MoonAvoidanceKernel::relaxedSeparation(filter, -10.0), -5.0);
+	QCOMPARE(MoonAvoidanceKernel::zoneRadiusDegrees(filter, -10.0, 0.0), 0.0);
+}
+
+void TestMoonAvoidanceKernel::testRadiusCurve()
+{
+	using namespace MoonAvoidanceKernel;
+
+	// Batch evaluation agrees with the per-call form
+	FilterConfig filter("Test", 140.0, 14.0, 2.0, -15.0, 5.0, Qt::white);
+	const double ages[] = { 0.0, 3.5, 7.0, 14.0 };
+	double radii[4];
+	lorentzianRadiiDegrees(filter.separation, filter.width, ages, 4, radii);
+	for (int i = 0; i < 4; ++i)
+		QCOMPARE(radii[i], zoneRadiusDegrees(filter, 30.0, ages[i]));
+
+	// Adaptive curve: sorted, both ends included, within tolerance between samples,
+	// and denser for a narrower (more sharply peaked) Lorentzian
+	QVector<double> curveAges, curveRadii;
+	radiusCurve(140.0, 14.0, HalfSynodicPeriodDays, 0.05, curveAges, curveRadii);
+	QCOMPARE(curveAges.first(), 0.0);
+	QCOMPARE(curveAges.last(), HalfSynodicPeriodDays);
+	for (int i = 0; i + 1 < curveAges.size(); ++i)
+	{
+		QVERIFY(curveAges[i] < curveAges[i + 1]);
+		const double middle = 0.5 * (curveAges[i] + curveAges[i + 1]);
+		double exact;
+		lorentzianRadiiDegrees(140.0, 14.0, &middle, 1, &exact);
+		QVERIFY(std::fabs(exact - 0.5 * (curveRadii[i] + curveRadii[i + 1])) <= 0.05);
+	}
+	const int wideCount = curveAges.size();
+	radiusCurve(140.0, 2.0, HalfSynodicPeriodDays, 0.05, curveAges, curveRadii);
+	QVERIFY(curveAges.size() > wideCount);
+}
+
+void TestMoonAvoidanceKernel::testEphemeris()
+{
+	using namespace MoonAvoidanceEphemeris;
+
+	// Meeus example 12.b: 1987 April 10, 19:21 UT
+	QVERIFY(std::fabs(greenwichMeanSiderealTime(2446896.30625) - 128.7378734) < 1e-6);
+
+	// Meeus example 47.a: 1992 April 12, 0h TD, distance 368409.7 km, declination +13.77 (of date)
+	const MoonPosition moon = moonPosition(2448724.5, 0.0, Site { 0.0, 0.0 });
+	QVERIFY(std::fabs(moon.distanceKm - 368409.7) < 100.0);
+	QVERIFY(std::fabs(std::asin(moon.j2000Dir.z) * 180.0 / M_PI - 13.77) < 1.5); // Parallax is up to ~1 degree
+
+	// An observer with the moon on the meridian at their latitude sees it at the zenith
+	const double ra = std::atan2(moon.j2000Dir.y, moon.j2000Dir.x) * 180.0 / M_PI;
+	const double dec = std::asin(moon.j2000Dir.z) * 180.0 / M_PI;
+	const Site underMoon { dec, ra - greenwichMeanSiderealTime(2448724.5) };
+	QVERIFY(moonPosition(2448724.5, 0.0, underMoon).altitude > 88.0);
+}
+
+void TestMoonAvoidanceKernel::testArrows()
+{
+	using namespace MoonAvoidanceGeometry;
+
+	// No arrows on rings too small to read, then one per ~250 px, capped
+	QCOMPARE(arrowCountForCircumference(100.0), 0);
+	QCOMPARE(arrowCountForCircumference(300.0), 3);
+	QCOMPARE(arrowCountForCircumference(1000.0), 4);
+	QCOMPARE(arrowCountForCircumference(1e6), 24);
+
+	// Every shaft starts on the ring and ends further from the center
+	const LocalFrame frame = makeLocalFrame(Vector3 { 0.3, 0.5, 0.8 });
+	const double radius = 0.7;
+	QVector<Vector3> lines;
+	appendArrows(frame, radius, 1, 5, lines);
+	QCOMPARE(lines.size(), 5 * 8);
+	for (int i = 0; i < lines.size(); i += 8)
+	{
+		QVERIFY(std::fabs(std::acos(dot(lines[i], frame.center)) - radius) < 1e-9);
+		QVERIFY(std::acos(dot(lines[i + 1], frame.center)) > radius);
+	}
+}
+
+void TestMoonAvoidanceKernel::testSmallCircleGenerator()
+{
+	using namespace MoonAvoidanceGeometry;
+
+	// The recurrence-based generators agree with the direct formula
+	const LocalFrame frame = makeLocalFrame(Vector3 { 0.3, 0.5, 0.8 });
+	QVector<Vector3> ring;
+	tessellateRing(frame, 1.2, 1024, ring);
+	QCOMPARE(ring.size(), 1025);
+	for (int i = 0; i < ring.size(); ++i)
+	{
+		const Vector3 expected = pointOnSmallCircle(frame, 1.2, i * 2.0 * M_PI / 1024);
+		QVERIFY(norm(ring[i] - expected) < 1e-12);
+	}
+	QVERIFY(ring.first().x == ring.last().x && ring.first().y == ring.last().y && ring.first().z == ring.last().z);
+
+	SmallCirclePoints arc;
+	smallCircle(frame, 0.4, 0.3, 2.0, 100, arc);
+	QCOMPARE(arc.size(), 100);
+	for (int i = 0; i < arc.size(); ++i)
+	{
+		const Vector3 expected = pointOnSmallCircle(frame, 0.4, 0.3 + i * 1.7 / 99);
+		QVERIFY(norm(Vector3 { arc.x[i], arc.y[i], arc.z[i] } - expected) < 1e-12);
+	}
+}
+
+void TestMoonAvoidanceKernel::testHorizonClipping()
+{
+	using namespace MoonAvoidanceGeometry;
+	const MoonAvoidanceHorizon::Axes axes; // Zenith along z
+	QVector<Vector3> points;
+	QVector<int> starts;
+
+	// Flat horizon: a ring centered on the horizon keeps exactly its upper half
+	const MoonAvoidanceHorizon flat(0.0);
+	flat.clipRing(makeLocalFrame({ 1.0, 0.0, 0.0 }), 30.0 * M_PI / 180.0, 256, axes, points, starts);
+	QCOMPARE(starts.size(), 1);
+	double highest = -1.0;
+	for (const Vector3& p : points)
+	{
+		QVERIFY(p.z > -1e-12);
+		highest = qMax(highest, p.z);
+	}
+	QVERIFY(std::fabs(points.first().z) < 1e-12 && std::fabs(points.last().z) < 1e-12);
+	QVERIFY(std::fabs(highest - 0.5) < 1e-9);
+
+	// Entirely below, entirely above
+	flat.clipRing(makeLocalFrame({ 0.0, 0.0, -1.0 }), 0.5, 256, axes, points, starts);
+	QVERIFY(points.isEmpty() && starts.isEmpty());
+	flat.clipRing(makeLocalFrame({ 0.0, 0.0, 1.0 }), 0.5, 256, axes, points, starts);
+	QCOMPARE(points.size(), 257);
+
+	// A 20 degree wall between azimuths -30 and 30 cuts the bottom of a ring above it
+	const MoonAvoidanceHorizon wall = MoonAvoidanceHorizon::fromSampler([](double azimuth, double altitude) {
+		const double a = azimuth > M_PI ? azimuth - 2.0 * M_PI : azimuth;
+		return altitude < (std::fabs(a) < M_PI / 6.0 ? 20.0 * M_PI / 180.0 : 0.0);
+	}, 0.0);
+	QVERIFY(std::fabs(wall.altitudeAt(0.0) - 20.0 * M_PI / 180.0) < 0.001);
+	QVERIFY(std::fabs(wall.altitudeAt(M_PI)) < 1e-12);
+	wall.clipRing(makeLocalFrame(normalized({ 0.9, 0.0, 0.44 })), 15.0 * M_PI / 180.0, 256, axes, points, starts);
+	QVERIFY(starts.size() >= 1 && points.size() < 257);
+	for (const Vector3& p : points)
+		QVERIFY(wall.margin(axes, p) > -1e-4);
+}
+
+void TestMoonAvoidanceKernel::testPlanner()
+{
+	using namespace MoonAvoidancePlanner;
+	using MoonAvoidanceGeometry::Vector3;
+
+	// Sexagesimal RA is in hours, decimal in degrees; names may contain spaces
+	Target target;
+	QString error;
+	QVERIFY(parseTarget("M31, 00:42:44.3, +41:16:09", target, &error));
+	QCOMPARE(target.name, QString("M31"));
+	QVERIFY(std::fabs(target.raDegrees - 10.684583) < 1e-5);
+	QVERIFY(std::fabs(target.decDegrees - 41.269167) < 1e-5);
+	QVERIFY(parseTarget("NGC 7000 314.75 -44.3", target, &error));
+	QCOMPARE(target.name, QString("NGC 7000"));
+	QCOMPARE(target.decDegrees, -44.3);
+	QVERIFY(!parseTarget("# comment", target, &error) && error.isEmpty());
+	QVERIFY(!parseTarget("M42, 25:00:00, 10", target, &error) && !error.isEmpty());
+
+	// Near full moon (2024-09-18) at 48N: a target next to the moon at local midnight
+	// is never usable with a wide zone; with avoidance off it gets every dark hour it is up
+	const MoonAvoidanceEphemeris::Site site { 48.0, 11.0 };
+	const Night night = buildNight(2460571.0 - 11.0 / 360.0, site, 0.0008);
+	QCOMPARE(night.sampleCount, SamplesPerNight);
+	const Vector3 moonAtMidnight = night.moonDir[SamplesPerNight / 2];
+	const Vector3 nearMoon = MoonAvoidanceGeometry::normalized(moonAtMidnight + Vector3 { 0.0, 0.0, 0.05 });
+
+	QList<FilterConfig> filters;
+	filters << FilterConfig("Wide", 140.0, 14.0, 0.0, -15.0, 5.0, Qt::white)
+	        << FilterConfig("Off", 0.0, 14.0, 0.0, -15.0, 5.0, Qt::red);
+	QVector<Target> targets(1);
+	targets[0].dir = nearMoon;
+	const QVector<Usage> usage = evaluateNight(night, targets, filters, 10.0);
+	QCOMPARE(usage.size(), 2);
+	QCOMPARE(usage[0].hours, 0.0);
+	QVERIFY(usage[0].windows.isEmpty());
+	QVERIFY(usage[1].hours > 3.0 && usage[1].hours <= darkHours(night));
+
+	// Windows add up to the hours and lie in the dark part of the night
+	double total = 0.0;
+	for (const Window& window : usage[1].windows)
+	{
+		QVERIFY(window.endJD > window.startJD);
+		total += (window.endJD - window.startJD) * 24.0;
+		const int first = qRound((window.startJD - night.windowStartJD) / night.stepDays);
+		QVERIFY(night.isDark(first));
+	}
+	QVERIFY(std::fabs(total - usage[1].hours) < 1e-9);
+}
+
+void TestMoonAvoidanceKernel::testCalendarYear()
+{
+	using namespace MoonAvoidancePlanner;
+	using MoonAvoidanceEphemerisCache::NightPointer;
+
+	// The Calendar tab's run: a year of nights built once and shared, then the
+	// tab's task per night (dark hours, one target against every filter) mapped
+	// over the global pool. Each target must take well under a second.
+	const qint64 BudgetMs = 1000;
+	const MoonAvoidanceEphemeris::Site site { 48.2, 16.4, 170.0 };
+	const double deltaT = 69.0 / 86400.0;
+	const int nightCount = QDate(2026, 1, 1).daysInYear();
+	const double firstNight = windowStartFor(QDate(2026, 1, 1).toJulianDay() - site.longitude / 360.0 + 0.001, site.longitude);
+
+	QVector<int> indices(nightCount);
+	std::iota(indices.begin(), indices.end(), 0);
+	const QVector<NightPointer> nights = QtConcurrent::blockingMapped<QVector<NightPointer>>(indices, [&](int night) {
+		return NightPointer::create(buildNight(firstNight + night, site, deltaT));
+	});
+	QCOMPARE(nights.size(), nightCount);
+
+	QList<FilterConfig> filters;
+	for (int i = 0; i < 8; ++i)
+		filters << FilterConfig(QString("F%1").arg(i), 30.0 + 15.0 * i, 14.0, 2.0, -15.0, 5.0, Qt::white);
+
+	for (const QString& line : { QString("M31, 00:42:44.3, +41:16:09"), QString("M42, 05:35:17.3, -05:23:28"), QString("M101, 14:03:12.6, +54:20:57") })
+	{
+		QVector<Target> targets(1);
+		QVERIFY(parseTarget(line, targets[0]));
+
+		QElapsedTimer timer;
+		timer.start();
+		const QVector<QVector<double>> hours = QtConcurrent::blockingMapped<QVector<QVector<double>>>(nights, [&](const NightPointer& night) {
+			QVector<double> perFilter { darkHours(*night) };
+			for (const Usage& usage : evaluateNight(*night, targets, filters, 20.0))
+				perFilter.append(usage.hours);
+			return perFilter;
+		});
+		const qint64 elapsedMs = timer.elapsed();
+		QVERIFY2(elapsedMs < BudgetMs, qPrintable(QString("%1: %2 nights x %3 filters took %4 ms")
+			.arg(targets[0].name).arg(nightCount).arg(filters.size()).arg(elapsedMs)));
+
+		QCOMPARE(hours.size(), nightCount);
+		for (const QVector<double>& night : hours)
+		{
+			QCOMPARE(night.size(), filters.size() + 1);
+			for (int filter = 1; filter < night.size(); ++filter)
+				QVERIFY(night[filter] >= 0.0 && night[filter] <= night[0] + 1e-9);
+		}
+	}
+}
+
+void TestMoonAvoidanceKernel::testBatchStreaming()
+{
+	QThreadPool pool;
+	pool.setMaxThreadCount(2);
+	const QList<FilterConfig> filters = MoonAvoidanceConfig::getDefaultFilters();
+	const MoonAvoidanceBatch::Plan plan = MoonAvoidanceBatch::makePlan(
+		QDate(2024, 9, 17), 2, { 48.2, 16.4 }, 69.0 / 86400.0, filters, 30.0, MoonAvoidanceBatch::Output::Hours, &pool);
+	QCOMPARE(plan.nights.size(), 2);
+	QCOMPARE(plan.zones.size(), 2);
+
+	// Chunks of one target, so the output order depends on the writer keeping input order
+	QString input = "# comment\nVega, 18:36:56.3, +38:47:01\nbad line\n\nBarnard \"E\"; 19:41:00; +10:57:00\nPolaris 37.95 89.26\n";
+	QTextStream in(&input);
+	QBuffer out;
+	out.open(QIODevice::WriteOnly);
+	MoonAvoidanceBatch::Stats stats;
+	QList<qint64> errorLines;
+	QVERIFY(MoonAvoidanceBatch::run(plan, in, out, &pool, 1, stats, [&errorLines](qint64 line, const QString&) { errorLines.append(line); }));
+	QCOMPARE(stats.lines, qint64(6));
+	QCOMPARE(stats.targets, qint64(3));
+	QCOMPARE(stats.rejected, qint64(1));
+	QCOMPARE(errorLines, QList<qint64>({ 3 }));
+
+	const QList<QByteArray> rows = out.data().split('\n');
+	QCOMPARE(rows.size(), 1 + 3 * 2 * filters.size() + 1); // Header, rows, empty after the last newline
+	QCOMPARE(rows[0], QByteArray("target,date,filter,hours"));
+	QVERIFY(rows[1].startsWith("Vega,2024-09-17,LRGB,"));
+	QVERIFY(rows[1 + 2 * filters.size()].startsWith("\"Barnard \"\"E\"\"\",2024-09-17,"));
+	QVERIFY(rows[1 + 4 * filters.size()].startsWith("Polaris,2024-09-17,"));
+	QVERIFY(rows[1 + 5 * filters.size()].startsWith("Polaris,2024-09-18,"));
+
+	// Same hours as the planner for the same night
+	MoonAvoidancePlanner::Target vega;
+	QVERIFY(MoonAvoidancePlanner::parseTarget("Vega, 18:36:56.3, +38:47:01", vega));
+	const QVector<MoonAvoidancePlanner::Usage> usage = MoonAvoidancePlanner::evaluateNight(plan.nights[0], { vega }, filters, 30.0);
+	QCOMPARE(rows[1], "Vega,2024-09-17,LRGB," + QByteArray::number(usage[0].hours, 'f', 2));
+
+	QCOMPARE(MoonAvoidanceBatch::csvField("M 31"), QString("M 31"));
+	QCOMPARE(MoonAvoidanceBatch::csvField("a,\"b\""), QString("\"a,\"\"b\"\"\""));
+}
+
+void TestMoonAvoidanceKernel::testCatalog()
+{
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	const QString csvPath = dir.filePath("targets.csv");
+	const QString catalogPath = dir.filePath("targets.mac");
+	const QByteArray csv = "Vega, 18:36:56.3, +38:47:01\r\nbad line\nBarnard \"E\"; 19:41:00; +10:57:00\nPolaris 37.95 89.26";
+	QFile csvFile(csvPath);
+	QVERIFY(csvFile.open(QIODevice::WriteOnly));
+	csvFile.write(csv);
+	csvFile.close();
+
+	// Converted as moonavoid-cli does, in double precision so the screening matches the CSV path exactly
+	QVERIFY(csvFile.open(QIODevice::ReadOnly));
+	MoonAvoidanceCatalogWriter writer(true);
+	QVERIFY(writer.begin());
+	MoonAvoidanceBatch::Stats stats;
+	MoonAvoidanceCatalogFormat::Source source = MoonAvoidanceCatalogFormat::sourceOf(csvPath);
+	MoonAvoidanceBatch::convert(csvFile, writer, stats, source.checksum, nullptr);
+	csvFile.close();
+	QCOMPARE(stats.targets, qint64(3));
+	QCOMPARE(stats.rejected, qint64(1));
+	QCOMPARE(source.checksum, MoonAvoidanceCatalogFormat::checksum(csv.constData(), csv.size()));
+	QVERIFY(writer.finish(catalogPath, source));
+
+	MoonAvoidanceCatalog catalog;
+	QString error;
+	QVERIFY2(catalog.open(catalogPath, true, &error), qPrintable(error));
+	QCOMPARE(catalog.count(), qint64(3));
+	QVERIFY(catalog.isDoublePrecision());
+	QCOMPARE(catalog.name(0), QString("Vega"));
+	QCOMPARE(catalog.name(1), QString("Barnard \"E\""));
+	QCOMPARE(catalog.name(3), QString());
+	const MoonAvoidanceGeometry::Vector3 polaris = MoonAvoidancePlanner::directionFromRaDec(37.95, 89.26);
+	QCOMPARE(catalog.direction(2).z, polaris.z);
+	QVERIFY(catalog.isBuiltFrom(csvPath));
+
+	// Screening the catalog writes what streaming the CSV writes
+	QThreadPool pool;
+	pool.setMaxThreadCount(2);
+	const MoonAvoidanceBatch::Plan plan = MoonAvoidanceBatch::makePlan(QDate(2024, 9, 17), 1, { 48.2, 16.4 }, 69.0 / 86400.0,
+		MoonAvoidanceConfig::getDefaultFilters(), 30.0, MoonAvoidanceBatch::Output::Windows, &pool);
+	QBuffer fromCatalog;
+	fromCatalog.open(QIODevice::WriteOnly);
+	QVERIFY(MoonAvoidanceBatch::run(plan, catalog, fromCatalog, &pool, 2, stats));
+	QString text = QString::fromUtf8(csv);
+	QTextStream in(&text);
+	QBuffer fromCsv;
+	fromCsv.open(QIODevice::WriteOnly);
+	QVERIFY(MoonAvoidanceBatch::run(plan, in, fromCsv, &pool, 2, stats, nullptr));
+	QCOMPARE(fromCatalog.data(), fromCsv.data());
+	catalog.close();
+
+	// Float vectors: half the size, same names
+	MoonAvoidanceCatalogWriter floatWriter(false);
+	QVERIFY(floatWriter.begin());
+	floatWriter.add("M 31", MoonAvoidancePlanner::directionFromRaDec(10.6847, 41.2690));
+	QVERIFY(floatWriter.finish(dir.filePath("float.mac"), MoonAvoidanceCatalogFormat::Source()));
+	MoonAvoidanceCatalog floatCatalog;
+	QVERIFY(floatCatalog.open(dir.filePath("float.mac"), true));
+	QVERIFY(!floatCatalog.isDoublePrecision());
+	QCOMPARE(floatCatalog.name(0), QString("M 31"));
+	QVERIFY(std::fabs(floatCatalog.direction(0).x - MoonAvoidancePlanner::directionFromRaDec(10.6847, 41.2690).x) < 1e-7);
+	floatCatalog.close();
+
+	// A changed source makes the catalog stale
+	QVERIFY(csvFile.open(QIODevice::Append));
+	csvFile.write("\nDeneb, 20:41:25.9, +45:16:49");
+	csvFile.close();
+	QVERIFY(catalog.open(catalogPath, true));
+	QVERIFY(!catalog.isBuiltFrom(csvPath));
+	catalog.close();
+
+	// A damaged payload fails the checksum, unless verification is skipped
+	QFile damaged(catalogPath);
+	QVERIFY(damaged.open(QIODevice::ReadWrite));
+	damaged.seek(damaged.size() - 1);
+	damaged.write("x");
+	damaged.close();
+	QVERIFY(!catalog.open(catalogPath, true, &error));
+	QVERIFY(error.contains("checksum"));
+	QVERIFY(catalog.open(catalogPath, false));
+
+	// A file that is not a catalog
+	QVERIFY(!catalog.open(csvPath, false, &error));
+}
+
+void TestMoonAvoidanceKernel::testEphemerisCache()
+{
+	using MoonAvoidanceEphemerisCache::NightPointer;
+
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	MoonAvoidanceEphemerisCache::Key key;
+	key.site = { 48.2, 16.4, 170.0 };
+	key.deltaTDays = 69.0 / 86400.0;
+	const double first = MoonAvoidancePlanner::windowStartFor(2460571.0, key.site.longitude);
+
+	QVector<NightPointer> nights;
+	for (int i = 0; i < 3; ++i)
+		nights.append(NightPointer::create(MoonAvoidancePlanner::buildNight(first + i, key.site, key.deltaTDays)));
+	QString error;
+	QVERIFY2(MoonAvoidanceEphemerisCache::save(dir.path(), key, first, nights, &error), qPrintable(error));
+
+	// The last two nights and one more: two come from the file, the third stays null
+	QVector<NightPointer> loaded(3);
+	QCOMPARE(MoonAvoidanceEphemerisCache::load(dir.path(), key, first + 1, loaded), 2);
+	QVERIFY(loaded[0] && loaded[1] && !loaded[2]);
+	QCOMPARE(loaded[0]->windowStartJD, first + 1);
+	QCOMPARE(loaded[1]->sampleCount, nights[2]->sampleCount);
+	QCOMPARE(loaded[1]->moonDir, nights[2]->moonDir);
+	QCOMPARE(loaded[1]->sunAltitude, nights[2]->sunAltitude);
+
+	// Another elevation is another site
+	MoonAvoidanceEphemerisCache::Key other = key;
+	other.site.elevation = 0.0;
+	QVector<NightPointer> none(3);
+	QCOMPARE(MoonAvoidanceEphemerisCache::load(dir.path(), other, first, none), 0);
+
+	// A damaged file is ignored
+	const QStringList files = QDir(dir.path()).entryList({ "ephemeris-*.bin" }, QDir::Files);
+	QCOMPARE(files.size(), 1);
+	QFile damaged(QDir(dir.path()).filePath(files[0]));
+	QVERIFY(damaged.open(QIODevice::ReadWrite));
+	damaged.seek(damaged.size() - 1);
+	damaged.write("x");
+	damaged.close();
+	QVector<NightPointer> again(1);
+	QCOMPARE(MoonAvoidanceEphemerisCache::load(dir.path(), key, first, again), 0);
+}
+
+void TestMoonAvoidanceKernel::testZoneCrossings()
+{
+	// A still moon on +x; filter 0 grows from 10 to 50 degrees over the night,
+	// filter 1 is 20 degrees until it switches off halfway
+	MoonAvoidanceTimelineData data;
+	data.key.windowStartJD = 2460571.0;
+	data.stepDays = MoonAvoidanceTimeline::StepDays;
+	data.sampleCount = MoonAvoidanceTimeline::SamplesPerNight;
+	data.filterCount = 2;
+	const int half = data.sampleCount / 2;
+	for (int i = 0; i < data.sampleCount; ++i)
+	{
+		data.moonDir.append({ 1.0, 0.0, 0.0 });
+		data.moonAltitude.append(30.0);
+		data.moonDaysFromFull.append(0.0);
+		data.sunAltitude.append(-30.0);
+		data.radiiDegrees.append(10.0 + 40.0 * i / (data.sampleCount - 1));
+		data.radiiDegrees.append(i <= half ? 20.0 : 0.0);
+	}
+
+	// 15 degrees from the moon: inside filter 1 until it switches off, entering
+	// filter 0 once its radius passes 15
+	const double angle = 15.0 * M_PI / 180.0;
+	const MoonAvoidanceGeometry::Vector3 target { std::cos(angle), std::sin(angle), 0.0 };
+	const QVector<MoonAvoidanceZoneCrossing> crossings = data.crossings(target, data.key.windowStartJD, data.endJD());
+	QCOMPARE(crossings.size(), 2);
+
+	const double tolerance = 2.0 / 86400.0;
+	QCOMPARE(crossings[0].filter, 0);
+	QVERIFY(crossings[0].entering);
+	const double expectedEntry = data.key.windowStartJD + (15.0 - 10.0) / 40.0 * (data.endJD() - data.key.windowStartJD);
+	QVERIFY(std::fabs(crossings[0].jd - expectedEntry) < tolerance);
+	QCOMPARE(crossings[1].filter, 1);
+	QVERIFY(!crossings[1].entering);
+	QVERIFY(std::fabs(crossings[1].jd - (data.key.windowStartJD + (half + 0.5) * data.stepDays)) < tolerance);
+
+	// Nothing before the start of the range is reported
+	QVERIFY(data.crossings(target, expectedEntry + 0.01, crossings[1].jd - 0.01).isEmpty());
+}
+
+void TestMoonAvoidanceKernel::testSkyIndex()
+{
+	// Uniform over the sphere, from a fixed seed
+	QRandomGenerator random(47);
+	QVector<MoonAvoidanceGeometry::Vector3> dirs;
+	for (int i = 0; i < 20000; ++i)
+	{
+		const double z = random.generateDouble() * 2.0 - 1.0;
+		const double a = random.generateDouble() * 2.0 * M_PI;
+		const double r = std::sqrt(1.0 - z * z);
+		dirs.append({ r * std::cos(a), r * std::sin(a), z });
+	}
+	const MoonAvoidanceSkyIndex index(dirs);
+	QCOMPARE(index.size(), dirs.size());
+
+	const MoonAvoidanceGeometry::Vector3 moon = MoonAvoidancePlanner::directionFromRaDec(40.0, 15.0);
+	const QVector<double> radii { 0.0, 20.0 * M_PI / 180.0, 35.0 * M_PI / 180.0, 120.0 * M_PI / 180.0 };
+	const auto angle = [](const MoonAvoidanceGeometry::Vector3& a, const MoonAvoidanceGeometry::Vector3& b) {
+		return std::acos(qBound(-1.0, MoonAvoidanceGeometry::dot(a, b), 1.0));
+	};
+
+	// A narrow view across the rings, a wide one, and the whole sky
+	const QVector<QPair<MoonAvoidanceGeometry::Vector3, double>> views {
+		{ MoonAvoidancePlanner::directionFromRaDec(65.0, 20.0), 10.0 * M_PI / 180.0 },
+		{ MoonAvoidancePlanner::directionFromRaDec(10.0, -20.0), 60.0 * M_PI / 180.0 },
+		{ { 0.0, 0.0, 1.0 }, M_PI },
+	};
+	for (const auto& view : views)
+	{
+		QMap<int, int> expected;
+		for (int i = 0; i < dirs.size(); ++i)
+		{
+			if (angle(view.first, dirs[i]) > view.second)
+				continue;
+			const double separation = angle(moon, dirs[i]);
+			for (int zone = 1; zone < radii.size(); ++zone)
+			{
+				if (separation <= radii[zone])
+				{
+					expected.insert(i, zone);
+					break;
+				}
+			}
+		}
+
+		QVector<MoonAvoidanceSkyIndex::Hit> hits;
+		MoonAvoidanceSkyIndex::Counters counters;
+		index.zoneHits(view.first, view.second, moon, radii, hits, &counters);
+		QMap<int, int> found;
+		for (const MoonAvoidanceSkyIndex::Hit& hit : hits)
+			found.insert(hit.entry, hit.zone);
+		QCOMPARE(found, expected);
+		QVERIFY(counters.entriesTested + counters.entriesAccepted >= hits.size());
+
+		// Only the cells on a ring or the edge of the view are tested one by one
+		if (view.second < M_PI / 2.0)
+			QVERIFY(counters.entriesTested < dirs.size() / 4);
+		else
+			QVERIFY(counters.entriesAccepted > counters.entriesTested);
+	}
+
+	// Every zone off: nothing
+	QVector<MoonAvoidanceSkyIndex::Hit> hits;
+	index.zoneHits(moon, M_PI, moon, { 0.0, 0.0 }, hits);
+	QVERIFY(hits.isEmpty());
+}
+
+QTEST_MAIN(TestMoonAvoidanceKernel)
+#include "testMoonAvoidanceKernel.moc"
@@ -0,0 +1,227 @@
+#include <QtTest/QtTest>
+#include <QLocalSocket>
+#include <QThread>
+#include <cmath>
+#include "../MoonAvoidanceConfig.hpp"
+#include "../MoonAvoidanceEphemeris.hpp"
+#include "../MoonAvoidanceQuery.hpp"
+
+using namespace MoonAvoidanceQueryProtocol;
+
+// The query service as a sequencer sees it: the server on its own thread, as
+// in the plugin, and MoonAvoidanceQueryClient on the test thread.
+class TestMoonAvoidanceQuery : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void init();
+	void cleanup();
+	void testNoSiteYet();
+	void testQueries();
+	void testMalformedRequest();
+	void testAnswerGrid();
+	void benchmarkBatch();
+
+private:
+	static MoonAvoidanceQueryEngine::Context makeContext();
+	static MoonAvoidanceQueryProtocol::Query queryAt(double jd, const MoonAvoidanceGeometry::Vector3& dir, int filter);
+
+	QString socketName;
+	QThread thread;
+	MoonAvoidanceQueryServer* server = nullptr;
+};
+
+namespace
+{
+	const double JD = 2460571.4; // 2024-09-17 21:36 UT, the night before a full moon
+}
+
+MoonAvoidanceQueryEngine::Context TestMoonAvoidanceQuery::makeContext()
+{
+	MoonAvoidanceQueryEngine::Context context;
+	context.site = { 48.2, 16.4, 170.0 };
+	context.deltaTDays = 69.0 / 86400.0;
+	context.filters = MoonAvoidanceConfig::getDefaultFilters();
+	return context;
+}
+
+MoonAvoidanceQueryProtocol::Query TestMoonAvoidanceQuery::queryAt(double jd, const MoonAvoidanceGeometry::Vector3& dir, int filter)
+{
+	MoonAvoidanceQueryProtocol::Query query;
+	query.jd = jd;
+	query.raDegrees = std::atan2(dir.y, dir.x) * 180.0 / M_PI;
+	query.decDegrees = std::asin(qBound(-1.0, dir.z, 1.0)) * 180.0 / M_PI;
+	query.filter = filter;
+	query.reserved = 0;
+	return query;
+}
+
+void TestMoonAvoidanceQuery::init()
+{
+	socketName = QString("moonavoidance-test-%1").arg(QCoreApplication::applicationPid());
+	server = new MoonAvoidanceQueryServer(socketName, QString());
+	server->moveToThread(&thread);
+	thread.start();
+	bool started = false;
+	QMetaObject::invokeMethod(server, "start", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, started));
+	QVERIFY(started);
+}
+
+void TestMoonAvoidanceQuery::cleanup()
+{
+	QMetaObject::invokeMethod(server, "stop", Qt::BlockingQueuedConnection);
+	thread.quit();
+	thread.wait();
+	delete server;
+	server = nullptr;
+}
+
+void TestMoonAvoidanceQuery::testNoSiteYet()
+{
+	MoonAvoidanceQueryClient client;
+	QVERIFY2(client.connectToServer(socketName), qPrintable(client.errorString()));
+	QStringList names;
+	QVERIFY(!client.filterNames(names));
+	QVERIFY(client.errorString().contains("observer"));
+}
+
+void TestMoonAvoidanceQuery::testQueries()
+{
+	const MoonAvoidanceQueryEngine::Context context = makeContext();
+	server->setContext(context, JD);
+
+	MoonAvoidanceQueryClient client;
+	QVERIFY2(client.connectToServer(socketName), qPrintable(client.errorString()));
+	QStringList names;
+	QVERIFY2(client.filterNames(names), qPrintable(client.errorString()));
+	QCOMPARE(names.size(), context.filters.size());
+	QCOMPARE(names.first(), context.filters.first().name);
+
+	// On the moon, opposite the moon, every filter, and a filter that does not exist
+	const MoonAvoidanceGeometry::Vector3 moon = MoonAvoidanceEphemeris::moonPosition(JD, context.deltaTDays, context.site).j2000Dir;
+	const QVector<MoonAvoidanceQueryProtocol::Query> queries {
+		queryAt(JD, moon, 0),
+		queryAt(JD, moon * -1.0, 0),
+		queryAt(JD, moon, -1),
+		queryAt(JD, moon, context.filters.size()),
+	};
+	QVector<Answer> answers;
+	QVERIFY2(client.query(queries, answers), qPrintable(client.errorString()));
+	QCOMPARE(answers.size(), 3 + context.filters.size());
+
+	// Five-minute samples, interpolated: well within a hundredth of a degree
+	QVERIFY(answers[0].separationDegrees < 0.01);
+	QVERIFY((answers[0].flags & AvoidanceOff) || !(answers[0].flags & Allowed));
+	QVERIFY(answers[1].separationDegrees > 179.99);
+	QVERIFY(answers[1].flags & Allowed);
+	for (int filter = 0; filter < context.filters.size(); ++filter)
+	{
+		const Answer& answer = answers[2 + filter];
+		QCOMPARE(answer.filter, filter);
+		QVERIFY((answer.flags & AvoidanceOff) || !(answer.flags & Allowed));
+	}
+	QCOMPARE(answers.last().flags, static_cast<quint32>(InvalidQuery));
+
+	// A changed filter set applies to the next request on the same connection
+	MoonAvoidanceQueryEngine::Context single = context;
+	single.filters = { context.filters.first() };
+	server->setContext(single, JD);
+	QVERIFY(client.query({ queryAt(JD + 3.0, moon, -1) }, answers));
+	QCOMPARE(answers.size(), 1);
+}
+
+void TestMoonAvoidanceQuery::testMalformedRequest()
+{
+	server->setContext(makeContext(), JD);
+
+	QLocalSocket socket;
+	socket.connectToServer(socketName);
+	QVERIFY(socket.waitForConnected(1000));
+	const quint32 length = sizeof(RequestHeader);
+	const RequestHeader header { 0x12345678, Version, QueryRequest, 0, 0 };
+	socket.write(reinterpret_cast<const char*>(&length), sizeof(length));
+	socket.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	QVERIFY(socket.waitForBytesWritten(1000));
+
+	while (socket.bytesAvailable() < static_cast<qint64>(sizeof(quint32) + sizeof(ReplyHeader)))
+		QVERIFY(socket.waitForReadyRead(1000));
+	socket.skip(sizeof(quint32));
+	ReplyHeader reply;
+	socket.read(reinterpret_cast<char*>(&reply), sizeof(reply));
+	QCOMPARE(reply.status, static_cast<quint32>(Malformed));
+	QVERIFY(socket.state() == QLocalSocket::UnconnectedState || socket.waitForDisconnected(1000));
+}
+
+void TestMoonAvoidanceQuery::testAnswerGrid()
+{
+	// The engine alone, as evaluateTargets() uses it for scripts
+	const MoonAvoidanceQueryEngine::Context context = makeContext();
+	const int filterCount = context.filters.size();
+	MoonAvoidanceQueryEngine engine;
+	QVector<Answer> grid;
+	QVERIFY(!engine.answerGrid({ JD }, {}, grid));
+	engine.setContext(context);
+
+	// Out of order, a night apart, and a time and a target that are not numbers
+	const QVector<double> jds { JD + 1.0, JD, std::nan("") };
+	QVector<MoonAvoidancePlanner::Target> targets(3);
+	targets[0].raDegrees = 83.8;
+	targets[0].decDegrees = -5.4;
+	targets[1].raDegrees = 10.7;
+	targets[1].decDegrees = 41.3;
+	targets[2].raDegrees = std::nan("");
+	QVERIFY(engine.answerGrid(jds, targets, grid));
+	QCOMPARE(grid.size(), jds.size() * targets.size() * filterCount);
+
+	for (int time = 0; time < jds.size(); ++time)
+	{
+		for (int t = 0; t < targets.size(); ++t)
+		{
+			const MoonAvoidanceQueryProtocol::Query query { jds[time], targets[t].raDegrees, targets[t].decDegrees, -1, 0 };
+			QVector<Answer> single;
+			QVERIFY(engine.answer(&query, 1, single));
+			for (int filter = 0; filter < filterCount; ++filter)
+			{
+				const Answer& cell = grid[(time * targets.size() + t) * filterCount + filter];
+				QCOMPARE(cell.filter, filter);
+				if (time == 2 || t == 2)
+				{
+					QCOMPARE(cell.flags, static_cast<quint32>(InvalidQuery));
+					continue;
+				}
+				QCOMPARE(cell.flags, single[filter].flags);
+				QCOMPARE(cell.separationDegrees, single[filter].separationDegrees);
+				QCOMPARE(cell.radiusDegrees, single[filter].radiusDegrees);
+			}
+		}
+	}
+}
+
+void TestMoonAvoidanceQuery::benchmarkBatch()
+{
+	const MoonAvoidanceQueryEngine::Context context = makeContext();
+	server->setContext(context, JD);
+
+	// One exposure's worth of targets for every filter, an hour into the night
+	QVector<MoonAvoidanceQueryProtocol::Query> queries;
+	for (int i = 0; i < 100; ++i)
+	{
+		const double ra = i * 3.6 * M_PI / 180.0;
+		const double dec = (i % 9 - 4) * 20.0 * M_PI / 180.0;
+		queries.append(queryAt(JD + 1.0 / 24.0, { std::cos(dec) * std::cos(ra), std::cos(dec) * std::sin(ra), std::sin(dec) }, -1));
+	}
+
+	MoonAvoidanceQueryClient client;
+	QVERIFY(client.connectToServer(socketName));
+	QVector<Answer> answers;
+	QVERIFY(client.query(queries, answers)); // Loads the night
+	QBENCHMARK
+	{
+		client.query(queries, answers);
+	}
+	QCOMPARE(answers.size(), queries.size() * context.filters.size());
+}
+
+QTEST_MAIN(TestMoonAvoidanceQuery)
+#include "testMoonAvoidanceQuery.moc"
@@ -0,0 +1,191 @@
+#include <QtTest/QtTest>
+#include <QFontMetricsF>
+#include <cmath>
+#include "../MoonAvoidanceConfig.hpp"
+#include "../MoonAvoidanceKernel.hpp"
+#include "../MoonAvoidanceFrameWorker.hpp"
+#include "../MoonAvoidanceLabelLayout.hpp"
+#include "../MoonAvoidanceLineBatch.hpp"
+#include "StelProjectorClasses.hpp"
+
+// Cost of the per-frame zone work as the number of filters grows. Run with
+// -tickcounter or -callgrind for stable numbers; the time per zone should stay
+// roughly flat from 4 to 500 zones.
+class TestMoonAvoidanceScaling : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void testLabelsDoNotOverlap();
+	void benchmarkZones_data();
+	void benchmarkZones();
+
+private:
+	static QList<FilterConfig> makeFilters(int count);
+	static QVector<MoonAvoidanceLabelLayout::Request> makeLabelRequests(const QList<FilterConfig>& filters, const QRectF& viewport);
+};
+
+namespace
+{
+	// Stereographic view of J2000 as it is (no rotation), centered on -Z; the
+	// projector's setup is protected, as only StelCore makes them
+	class BenchmarkProjector : public StelProjectorStereographic
+	{
+	public:
+		BenchmarkProjector(int width, int height, double fovDegrees)
+			: StelProjectorStereographic(ModelViewTranformP(new Mat4dTransform(Mat4d::identity(), Mat4d::identity())))
+		{
+			StelProjectorParams params;
+			params.viewportXywh.set(0, 0, width, height);
+			params.viewportCenter.set(0.5 * width, 0.5 * height);
+			params.viewportFovDiameter = qMin(width, height);
+			params.fov = static_cast<float>(fovDegrees);
+			init(params);
+		}
+	};
+
+	// Near the center of the view, angle radians along it
+	Vec3d moonDirection(double angle)
+	{
+		Vec3d dir(std::sin(angle), 0.1, -std::cos(angle));
+		dir.normalize();
+		return dir;
+	}
+}
+
+QList<FilterConfig> TestMoonAvoidanceScaling::makeFilters(int count)
+{
+	QList<FilterConfig> filters;
+	for (int i = 0; i < count; ++i)
+	{
+		// Separations spread over 10..170 degrees so rings of every size are present
+		const double separation = 10.0 + 160.0 * i / qMax(1, count - 1);
+		filters.append(FilterConfig(QString("Zone %1").arg(i), separation, 10.0, 2.0, -15.0, 5.0, QColor::fromHsv((i * 37) % 360, 255, 255)));
+	}
+	return filters;
+}
+
+QVector<MoonAvoidanceLabelLayout::Request> TestMoonAvoidanceScaling::makeLabelRequests(const QList<FilterConfig>& filters, const QRectF& viewport)
+{
+	QVector<MoonAvoidanceLabelLayout::Request> requests;
+	for (int i = 0; i < filters.size(); ++i)
+	{
+		// Every third circle off screen, the rest spread across the viewport
+		const bool visible = i % 3 != 0;
+		const double center = viewport.left() + viewport.width() * ((i * 7919) % 1000) / 1000.0;
+		requests.append({ filters[i].name, filters[i].color, filters[i].separation, visible, center - 50.0, center + 50.0 });
+	}
+	return requests;
+}
+
+void TestMoonAvoidanceScaling::testLabelsDoNotOverlap()
+{
+	const QRectF viewport(0.0, 0.0, 1920.0, 1080.0);
+	const QFont font;
+	const QFontMetricsF metrics(font);
+	const QList<FilterConfig> filters = makeFilters(300);
+	const QVector<MoonAvoidanceLabelLayout::Request> requests = makeLabelRequests(filters, viewport);
+
+	MoonAvoidanceLabelLayout layout;
+	layout.setFont(font);
+	QVector<MoonAvoidanceLabel> labels;
+	layout.layout(viewport, requests, false, labels);
+	QVERIFY(!labels.isEmpty());
+	QCOMPARE(layout.formattedLastLayout(), requests.size());
+
+	QVector<QRectF> rects;
+	for (const MoonAvoidanceLabel& label : labels)
+	{
+		const QRectF rect(label.x, label.y - metrics.height(), metrics.horizontalAdvance(label.text), metrics.height());
+		QVERIFY(viewport.contains(rect));
+		for (const QRectF& other : rects)
+			QVERIFY(!rect.intersects(other));
+		rects.append(rect);
+	}
+
+	// Nothing moved: same positions, no text formatted again
+	QVector<MoonAvoidanceLabel> again;
+	layout.layout(viewport, requests, false, again);
+	QCOMPARE(layout.formattedLastLayout(), 0);
+	QCOMPARE(again.size(), labels.size());
+	for (int i = 0; i < labels.size(); ++i)
+	{
+		QCOMPARE(again[i].x, labels[i].x);
+		QCOMPARE(again[i].y, labels[i].y);
+	}
+}
+
+void TestMoonAvoidanceScaling::benchmarkZones_data()
+{
+	QTest::addColumn<int>("zoneCount");
+	QTest::newRow("4 zones") << 4;
+	QTest::newRow("50 zones") << 50;
+	QTest::newRow("100 zones") << 100;
+	QTest::newRow("300 zones") << 300;
+	QTest::newRow("500 zones") << 500;
+}
+
+void TestMoonAvoidanceScaling::benchmarkZones()
+{
+	QFETCH(int, zoneCount);
+
+	// A whole worker pass (radii, rings, arrows, ghosts, label probes and
+	// layout) and the line batches the render thread builds from it. The moon
+	// moves every frame, as during playback, so the caches never serve a zone.
+	MoonAvoidanceFrameRequest request;
+	request.filters = makeFilters(zoneCount);
+	request.moonAltitude = 20.0;
+	request.moonDaysFromFull = 3.0;
+	request.renderMode = MoonAvoidanceFrameWorker::RenderRings;
+	request.projector = StelProjectorP(new BenchmarkProjector(1920, 1080, 60.0));
+	for (int hour = 1; hour <= 3; ++hour)
+	{
+		MoonAvoidanceGhostEpoch epoch;
+		epoch.opacity = 1.0f - 0.25f * hour;
+		for (const FilterConfig& filter : request.filters)
+			epoch.radiiDegrees.append(MoonAvoidanceKernel::zoneRadiusDegrees(filter, 20.0 + hour, 3.0 + hour / 24.0));
+		request.ghosts.append(epoch);
+	}
+
+	MoonAvoidanceFrameWorker worker; // Never started: compute() runs on this thread
+	MoonAvoidanceFrameState state;
+	MoonAvoidanceLineBatch ghostBatch;
+	MoonAvoidanceLineBatch ringBatch;
+	MoonAvoidanceLineBatch arrowBatch;
+	int segments = 0;
+
+	QBENCHMARK
+	{
+		// Half an arcminute per frame, about the moon's motion in a minute
+		++request.serial;
+		request.jd = 2460571.0 + request.serial / 1440.0;
+		request.moonDir = moonDirection(request.serial * 1.5e-4);
+		for (int hour = 0; hour < request.ghosts.size(); ++hour)
+		{
+			request.ghosts[hour].jd = request.jd + (hour + 1) / 24.0;
+			request.ghosts[hour].moonDir = moonDirection(request.serial * 1.5e-4 + (hour + 1) * 0.0091);
+		}
+		worker.compute(request, state);
+
+		ghostBatch.clear();
+		ringBatch.clear();
+		arrowBatch.clear();
+		for (const MoonAvoidanceZoneGeometry& zone : state.ghostZones)
+			ghostBatch.addStrip(*request.projector, zone.ring, Vec4f(zone.color.redF(), zone.color.greenF(), zone.color.blueF(), zone.opacity));
+		for (const MoonAvoidanceZoneGeometry& zone : state.zones)
+		{
+			const Vec4f color(zone.color.redF(), zone.color.greenF(), zone.color.blueF(), 1.0f);
+			ringBatch.addStrips(*request.projector, zone.ring, zone.ringStarts, color);
+			arrowBatch.addSegments(*request.projector, zone.arrowLines, color);
+		}
+		segments = ghostBatch.segmentCount() + ringBatch.segmentCount() + arrowBatch.segmentCount();
+	}
+
+	QCOMPARE(static_cast<int>(state.zones.size()), zoneCount);
+	QCOMPARE(state.cacheHits, 0);
+	QVERIFY(!state.labels.isEmpty());
+	QVERIFY(segments > 0);
+}
+
+QTEST_MAIN(TestMoonAvoidanceScaling)
+#include "testMoonAvoidanceScaling.moc"
@@ -0,0 +1,220 @@
+#include <QtTest/QtTest>
+#include <QAtomicInt>
+#include <QThread>
+#include <memory>
+#include "../MoonAvoidanceSharedState.hpp"
+
+using namespace MoonAvoidanceSharedStateFormat;
+
+// The shared-memory segment between a publisher and readers in the same
+// process, which exercises the same mapping and seqlock as separate processes.
+class TestMoonAvoidanceSharedState : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void init();
+	void cleanup();
+	void testRoundTrip();
+	void testNotASegment();
+	void testSingleWriter();
+	void stressTornReads();
+
+private:
+	QString name;
+	MoonAvoidanceSharedStatePublisher* publisher = nullptr;
+};
+
+namespace
+{
+	// Every field of frame k is derived from k, so a mix of two frames shows
+	void publishFrame(MoonAvoidanceSharedStatePublisher& publisher, quint64 k, int filterCount)
+	{
+		QVector<double> radii;
+		for (int i = 0; i < filterCount; ++i)
+			radii.append(static_cast<double>(k) + i);
+		const double value = static_cast<double>(k);
+		publisher.publish(2460000.0 + value, { value, -value, 2.0 * value }, value, -value, radii);
+	}
+
+	bool consistent(const Snapshot& snapshot)
+	{
+		if (snapshot.frame == 0)
+			return snapshot.jd == 0.0 && snapshot.filterCount == 0; // Zeroed by create()
+		const double k = static_cast<double>(snapshot.frame);
+		if (snapshot.jd != 2460000.0 + k || snapshot.moonDir[0] != k || snapshot.moonDir[1] != -k || snapshot.moonDir[2] != 2.0 * k
+		    || snapshot.moonAltitude != k || snapshot.moonDaysFromFull != -k || snapshot.filterCount > static_cast<quint32>(MaxFilters))
+			return false;
+		for (quint32 i = 0; i < snapshot.filterCount; ++i)
+			if (snapshot.radiiDegrees[i] != k + i)
+				return false;
+		return true;
+	}
+}
+
+void TestMoonAvoidanceSharedState::init()
+{
+	name = QString("moonavoidance-test-%1").arg(QCoreApplication::applicationPid());
+	publisher = new MoonAvoidanceSharedStatePublisher(name);
+	QString error;
+	QVERIFY2(publisher->create(&error), qPrintable(error));
+}
+
+void TestMoonAvoidanceSharedState::cleanup()
+{
+	delete publisher;
+	publisher = nullptr;
+}
+
+void TestMoonAvoidanceSharedState::testRoundTrip()
+{
+	MoonAvoidanceSharedStateReader reader;
+	QString error;
+	QVERIFY2(reader.attach(name, &error), qPrintable(error));
+
+	// Nothing published yet
+	Snapshot snapshot;
+	QVERIFY(reader.read(snapshot));
+	QCOMPARE(snapshot.frame, quint64(0));
+
+	const QString longName = QString("Ha ") + QString(40, QChar(0x3b1)); // Two UTF-8 bytes per alpha
+	publisher->publishFilterNames({ "LRGB", longName });
+	publishFrame(*publisher, 1, 2);
+	QVERIFY(reader.read(snapshot));
+	QCOMPARE(snapshot.frame, quint64(1));
+	QVERIFY(consistent(snapshot));
+	QCOMPARE(snapshot.filterCount, 2u);
+	QVERIFY(snapshot.publishedMs > 0);
+
+	QStringList names;
+	quint32 revision = 0;
+	QVERIFY(reader.readFilterNames(names, &revision));
+	QCOMPARE(revision, snapshot.namesRevision);
+	QCOMPARE(names.size(), 2);
+	QCOMPARE(names[0], QString("LRGB"));
+	QVERIFY(longName.startsWith(names[1]));
+	QVERIFY(names[1].toUtf8().size() < NameBytes);
+
+	// The same names are not rewritten; more filters than fit are cut off
+	publisher->publishFilterNames({ "LRGB", longName });
+	QVERIFY(reader.readFilterNames(names, &revision));
+	QCOMPARE(revision, snapshot.namesRevision);
+	publishFrame(*publisher, 2, MaxFilters + 5);
+	QVERIFY(reader.read(snapshot));
+	QCOMPARE(snapshot.filterCount, static_cast<quint32>(MaxFilters));
+}
+
+void TestMoonAvoidanceSharedState::testNotASegment()
+{
+	MoonAvoidanceSharedStateReader reader;
+	QVERIFY(!reader.attach(name + "-missing"));
+	QVERIFY(!reader.isAttached());
+	Snapshot snapshot;
+	QVERIFY(!reader.read(snapshot));
+}
+
+void TestMoonAvoidanceSharedState::testSingleWriter()
+{
+	// A second publisher under a live owner's name is refused and leaves the segment alone
+	publishFrame(*publisher, 1, 2);
+	MoonAvoidanceSharedStatePublisher second(name);
+	QString error;
+	QVERIFY(!second.create(&error));
+	QVERIFY(!error.isEmpty());
+	QVERIFY(!second.isOpen());
+
+	MoonAvoidanceSharedStateReader reader;
+	QVERIFY2(reader.attach(name, &error), qPrintable(error));
+	Snapshot snapshot;
+	QVERIFY(reader.read(snapshot));
+	QCOMPARE(snapshot.frame, quint64(1));
+	QCOMPARE(snapshot.filterCount, 2u);
+
+	// Once the owner has closed, the name is free again
+	publisher->close();
+	QVERIFY2(second.create(&error), qPrintable(error));
+	publishFrame(second, 1, 3);
+	QVERIFY(reader.read(snapshot));
+	QVERIFY(consistent(snapshot));
+}
+
+void TestMoonAvoidanceSharedState::stressTornReads()
+{
+	// The writer publishes as fast as it can while readers copy continuously;
+	// every copy a reader accepts must be one whole frame, and frames never go back
+	const int Readers = qBound(2, QThread::idealThreadCount() - 1, 4);
+	const quint64 Frames = 200000;
+	QAtomicInt done(0);
+	QAtomicInt torn(0);
+	QAtomicInt backwards(0);
+	QAtomicInt tornNames(0);
+	QAtomicInt failedReads(0);
+	QVector<quint64> framesSeen(Readers, 0);
+
+	publisher->publishFilterNames({ "N0" });
+	std::vector<std::unique_ptr<QThread>> readers;
+	for (int r = 0; r < Readers; ++r)
+	{
+		readers.emplace_back(QThread::create([&, r]() {
+			MoonAvoidanceSharedStateReader reader;
+			if (!reader.attach(name))
+			{
+				failedReads.fetchAndAddRelaxed(1);
+				return;
+			}
+			quint64 last = 0;
+			Snapshot snapshot;
+			QStringList names;
+			quint32 revision = 0;
+			for (quint64 n = 0; !done.loadAcquire() || n == 0; ++n)
+			{
+				if (!reader.read(snapshot, 1000000))
+				{
+					failedReads.fetchAndAddRelaxed(1);
+					continue;
+				}
+				if (!consistent(snapshot))
+					torn.fetchAndAddRelaxed(1);
+				if (snapshot.frame < last)
+					backwards.fetchAndAddRelaxed(1);
+				if (snapshot.frame != last)
+					++framesSeen[r];
+				last = snapshot.frame;
+
+				// Names N<revision-1>, one per revision modulo 5
+				if (n % 16 == 0 && reader.readFilterNames(names, &revision, 1000000))
+				{
+					bool ok = names.size() == static_cast<int>((revision - 1) % 5) + 1;
+					for (const QString& filterName : names)
+						ok = ok && filterName == QString("N%1").arg(revision - 1);
+					if (!ok)
+						tornNames.fetchAndAddRelaxed(1);
+				}
+			}
+		}));
+		readers.back()->start();
+	}
+
+	for (quint64 k = 1; k <= Frames; ++k)
+	{
+		publishFrame(*publisher, k, static_cast<int>(k % MaxFilters) + 1);
+		if (k % 1000 == 0)
+		{
+			const quint32 next = static_cast<quint32>(k / 1000); // Revision next + 1
+			publisher->publishFilterNames(QStringList(static_cast<int>(next % 5) + 1, QString("N%1").arg(next)));
+		}
+	}
+	done.storeRelease(1);
+	for (const std::unique_ptr<QThread>& thread : readers)
+		QVERIFY(thread->wait(30000));
+
+	QCOMPARE(failedReads.loadRelaxed(), 0);
+	QCOMPARE(torn.loadRelaxed(), 0);
+	QCOMPARE(backwards.loadRelaxed(), 0);
+	QCOMPARE(tornNames.loadRelaxed(), 0);
+	for (quint64 seen : framesSeen)
+		QVERIFY(seen > 0);
+}
+
+QTEST_MAIN(TestMoonAvoidanceSharedState)
+#include "testMoonAvoidanceSharedState.moc"